@@ -0,0 +1,499 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "RecordCodec.h"
+#include "LzCodec.h"
+
+/**
+ * @file ColumnCodec.h
+ * @brief Records as columns, and the packed batch encoding (protocol capability "lz")
+ *
+ * A batch of records is mostly repetition: a few hundred flows at most,
+ * timestamps microseconds apart, seq counting up by one, packets and
+ * sample_rate almost always 1. Stored as columns (one array per field) each
+ * of those becomes a tight loop over one array, and the encoding can give
+ * every field the representation that suits it:
+ *
+ * | Field                  | Encoding                                             |
+ * |------------------------|------------------------------------------------------|
+ * | src/dst address        | per-batch address dictionary, indexes bit-packed     |
+ * | ports, protocol        | per-batch flow dictionary, bit-packed per flow       |
+ * | flow of each record    | bit-packed flow index                                |
+ * | ts_ns                  | first value, first delta, then delta-of-delta varints|
+ * | seq                    | first value, then bit-packed deltas                  |
+ * | length                 | varint                                               |
+ * | flags, packets, sample_rate | bit-packed                                      |
+ *
+ * "Bit-packed" is frame-of-reference packing: the column's minimum as a
+ * varint, one byte of bit width, then every value minus the minimum in that
+ * many bits (LSB first). A column with a single value (seq deltas of 1,
+ * packets of 1) costs two or three bytes however many records there are.
+ *
+ * Decoding writes straight into a RecordColumns; no per-record object is
+ * built unless the caller asks for one with row(). The unpack loop has no
+ * dependency between iterations (each value is one unaligned load, a shift
+ * and a mask), so the compiler can vectorize it; only the timestamp and seq
+ * prefix sums are inherently serial.
+ *
+ * packBatch() puts an optional LZ pass (LzCodec.h) on top and keeps it only
+ * when it pays off, which it does when lengths or flows repeat in runs.
+ *
+ * Header-only: shared by the sniffer, the server and both GUI clients.
+ */
+
+/**
+ * @struct RecordColumns
+ * @brief WireRecord fields as parallel arrays (structure of arrays)
+ */
+struct RecordColumns {
+    std::vector<uint64_t> ts_ns;
+    std::vector<uint64_t> seq;
+    std::vector<uint32_t> src_ip;       ///< Network byte order
+    std::vector<uint32_t> dst_ip;
+    std::vector<uint32_t> length;
+    std::vector<uint32_t> packets;
+    std::vector<uint32_t> sample_rate;
+    std::vector<uint16_t> src_port;
+    std::vector<uint16_t> dst_port;
+    std::vector<uint8_t> protocol;
+    std::vector<uint8_t> flags;
+
+    size_t size() const { return ts_ns.size(); }
+    bool empty() const { return ts_ns.empty(); }
+
+    void resize(size_t n) {
+        ts_ns.resize(n);
+        seq.resize(n);
+        src_ip.resize(n);
+        dst_ip.resize(n);
+        length.resize(n);
+        packets.resize(n);
+        sample_rate.resize(n);
+        src_port.resize(n);
+        dst_port.resize(n);
+        protocol.resize(n);
+        flags.resize(n);
+    }
+
+    void clear() { resize(0); }
+
+    void push_back(const WireRecord& r) {
+        ts_ns.push_back(r.ts_ns);
+        seq.push_back(r.seq);
+        src_ip.push_back(r.src_ip);
+        dst_ip.push_back(r.dst_ip);
+        length.push_back(r.length);
+        packets.push_back(r.packets);
+        sample_rate.push_back(r.sample_rate);
+        src_port.push_back(r.src_port);
+        dst_port.push_back(r.dst_port);
+        protocol.push_back(r.protocol);
+        flags.push_back(r.flags);
+    }
+
+    /// Record i as a WireRecord (for code that still works row by row)
+    WireRecord row(size_t i) const {
+        WireRecord r;
+        r.ts_ns = ts_ns[i];
+        r.seq = seq[i];
+        r.src_ip = src_ip[i];
+        r.dst_ip = dst_ip[i];
+        r.length = length[i];
+        r.packets = packets[i];
+        r.sample_rate = sample_rate[i];
+        r.src_port = src_port[i];
+        r.dst_port = dst_port[i];
+        r.protocol = protocol[i];
+        r.flags = flags[i];
+        return r;
+    }
+};
+
+namespace ColumnCodec {
+
+    /// Largest decompressed batch unpackBatch() accepts (bounds the allocation a peer can cause)
+    constexpr size_t MAX_RAW = 1u << 22;
+
+    /// First byte of a packed batch
+    enum Mode : uint8_t {
+        MODE_COLUMNS = 0,   ///< Columns follow as they are
+        MODE_LZ = 1         ///< [raw_len:4][Lz block that decompresses to the columns]
+    };
+
+    // ========================================================================
+    // Scalar helpers
+    // ========================================================================
+
+    inline void putVarint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    /// Read a varint from [p, end); false if truncated or longer than 10 bytes
+    inline bool getVarint(const char*& p, const char* end, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) return false;
+            uint8_t b = static_cast<uint8_t>(*p++);
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    inline uint64_t zigzag(uint64_t delta) {
+        return (delta << 1) ^ static_cast<uint64_t>(-static_cast<int64_t>(delta >> 63));
+    }
+
+    inline uint64_t unzigzag(uint64_t v) {
+        return (v >> 1) ^ (~(v & 1) + 1);
+    }
+
+    /// Bits needed for v (0 for 0)
+    inline unsigned bitWidth(uint64_t v) {
+        return v ? 64u - static_cast<unsigned>(__builtin_clzll(v)) : 0u;
+    }
+
+    // ========================================================================
+    // Bit packing kernels
+    // ========================================================================
+
+    /// Little-endian 8-byte load that may not run past limit
+    inline uint64_t loadLE64(const uint8_t* p, const uint8_t* limit) {
+        uint64_t v = 0;
+        size_t n = limit - p < 8 ? static_cast<size_t>(limit - p) : 8;
+        for (size_t i = 0; i < n; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+        return v;
+    }
+
+    /// Little-endian 8-byte load; the caller guarantees 8 readable bytes
+    inline uint64_t loadLE64(const uint8_t* p) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+        return v;
+    }
+
+    /**
+     * @brief Append values[0, n) frame-of-reference bit-packed
+     *
+     * [min:varint][width:1][ceil(n * width / 8) bytes]
+     */
+    template <typename T>
+    inline void packBits(const T* values, size_t n, std::string& out) {
+        uint64_t lo = n ? values[0] : 0, hi = lo;
+        for (size_t i = 0; i < n; ++i) {
+            lo = values[i] < lo ? values[i] : lo;
+            hi = values[i] > hi ? values[i] : hi;
+        }
+        unsigned width = bitWidth(hi - lo);
+        putVarint(out, lo);
+        out.push_back(static_cast<char>(width));
+        if (width == 0) return;
+
+        size_t start = out.size();
+        out.resize(start + (n * width + 7) / 8);
+        uint8_t* p = reinterpret_cast<uint8_t*>(&out[start]);
+
+        uint64_t acc = 0;
+        unsigned bits = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t v = static_cast<uint64_t>(values[i]) - lo;
+            acc |= v << bits;
+            bits += width;
+            if (bits >= 64) {
+                for (int k = 0; k < 8; ++k) *p++ = static_cast<uint8_t>(acc >> (8 * k));
+                bits -= 64;
+                acc = bits ? v >> (width - bits) : 0;
+            }
+        }
+        for (unsigned k = 0; k * 8 < bits; ++k) *p++ = static_cast<uint8_t>(acc >> (8 * k));
+    }
+
+    /**
+     * @brief Read n bit-packed values written by packBits() into out
+     *
+     * Values wider than T are truncated; callers that index with them check
+     * the range afterwards.
+     *
+     * @return false if the input is truncated or the width is invalid
+     */
+    template <typename T>
+    inline bool unpackBits(const char*& p, const char* end, size_t n, T* out) {
+        uint64_t lo;
+        if (!getVarint(p, end, lo) || p >= end) return false;
+        unsigned width = static_cast<uint8_t>(*p++);
+        if (width > 64) return false;
+        if (width == 0) {
+            for (size_t i = 0; i < n; ++i) out[i] = static_cast<T>(lo);
+            return true;
+        }
+
+        size_t bytes = (n * width + 7) / 8;
+        if (static_cast<size_t>(end - p) < bytes) return false;
+        const uint8_t* base = reinterpret_cast<const uint8_t*>(p);
+        const uint8_t* limit = base + bytes;
+        const uint64_t mask = width == 64 ? ~uint64_t{0} : (uint64_t{1} << width) - 1;
+
+        // Values whose 9-byte window lies inside the section need no bounds
+        // checks; iterations are independent, so this loop vectorizes
+        size_t fast = bytes >= 9 ? std::min(n, (bytes - 9) * 8 / width + 1) : 0;
+        for (size_t i = 0; i < fast; ++i) {
+            size_t bit = i * width;
+            const uint8_t* q = base + (bit >> 3);
+            unsigned shift = bit & 7;
+            uint64_t v = loadLE64(q) >> shift;
+            if (shift + width > 64) v |= static_cast<uint64_t>(q[8]) << (64 - shift);
+            out[i] = static_cast<T>((v & mask) + lo);
+        }
+        for (size_t i = fast; i < n; ++i) {
+            size_t bit = i * width;
+            const uint8_t* q = base + (bit >> 3);
+            unsigned shift = bit & 7;
+            uint64_t v = loadLE64(q, limit) >> shift;
+            if (shift + width > 64 && q + 8 < limit) v |= static_cast<uint64_t>(q[8]) << (64 - shift);
+            out[i] = static_cast<T>((v & mask) + lo);
+        }
+        p += bytes;
+        return true;
+    }
+
+    // ========================================================================
+    // Columns
+    // ========================================================================
+
+    /**
+     * @brief Append the column encoding of rows [first, first + count) to out
+     */
+    inline void encode(const RecordColumns& c, size_t first, size_t count, std::string& out) {
+        // Flow and address dictionaries: open addressing over at least 2x the
+        // slots they can ever need; slot values are 1-based indexes, 0 = empty
+        size_t table_size = 64;
+        while (table_size < count * 4) table_size <<= 1;
+        const size_t mask = table_size - 1;
+        thread_local std::vector<uint32_t> flow_slots;
+        thread_local std::vector<uint32_t> addr_slots;
+        flow_slots.assign(table_size, 0);
+        addr_slots.assign(table_size, 0);
+
+        std::vector<uint32_t> addrs;
+        std::vector<uint32_t> flow_row;                 // First row of each flow
+        std::vector<uint32_t> flow_src, flow_dst;       // Address indexes per flow
+        std::vector<uint32_t> flow_of(count);
+
+        auto addrIndex = [&](uint32_t addr) {
+            size_t slot = (addr * 2654435761u) & mask;
+            for (; addr_slots[slot] != 0; slot = (slot + 1) & mask) {
+                if (addrs[addr_slots[slot] - 1] == addr) return addr_slots[slot] - 1;
+            }
+            addrs.push_back(addr);
+            addr_slots[slot] = static_cast<uint32_t>(addrs.size());
+            return addr_slots[slot] - 1;
+        };
+
+        for (size_t i = first; i < first + count; ++i) {
+            uint64_t ports = (static_cast<uint64_t>(c.src_port[i]) << 24) |
+                             (static_cast<uint64_t>(c.dst_port[i]) << 8) | c.protocol[i];
+            uint64_t h = ((static_cast<uint64_t>(c.src_ip[i]) << 32) | c.dst_ip[i]) * 0x9E3779B97F4A7C15ull ^
+                         ports * 0xC2B2AE3D27D4EB4Full;
+            size_t slot = static_cast<size_t>(h >> 40) & mask;
+            for (; flow_slots[slot] != 0; slot = (slot + 1) & mask) {
+                uint32_t f = flow_row[flow_slots[slot] - 1];
+                if (c.src_ip[f] == c.src_ip[i] && c.dst_ip[f] == c.dst_ip[i] && c.src_port[f] == c.src_port[i] &&
+                    c.dst_port[f] == c.dst_port[i] && c.protocol[f] == c.protocol[i]) {
+                    break;
+                }
+            }
+            if (flow_slots[slot] == 0) {
+                flow_row.push_back(static_cast<uint32_t>(i));
+                flow_src.push_back(addrIndex(c.src_ip[i]));
+                flow_dst.push_back(addrIndex(c.dst_ip[i]));
+                flow_slots[slot] = static_cast<uint32_t>(flow_row.size());
+            }
+            flow_of[i - first] = flow_slots[slot] - 1;
+        }
+
+        // Dictionaries
+        putVarint(out, addrs.size());
+        for (uint32_t addr : addrs) {
+            out.append(reinterpret_cast<const char*>(&addr), 4);   // Network order as is
+        }
+        size_t flows = flow_row.size();
+        std::vector<uint16_t> ports(flows);
+        std::vector<uint8_t> protocols(flows);
+        putVarint(out, flows);
+        packBits(flow_src.data(), flows, out);
+        packBits(flow_dst.data(), flows, out);
+        for (size_t f = 0; f < flows; ++f) ports[f] = c.src_port[flow_row[f]];
+        packBits(ports.data(), flows, out);
+        for (size_t f = 0; f < flows; ++f) ports[f] = c.dst_port[flow_row[f]];
+        packBits(ports.data(), flows, out);
+        for (size_t f = 0; f < flows; ++f) protocols[f] = c.protocol[flow_row[f]];
+        packBits(protocols.data(), flows, out);
+
+        // Per-record columns
+        packBits(flow_of.data(), count, out);
+
+        const uint64_t* ts = c.ts_ns.data() + first;
+        uint64_t prev_delta = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t delta = i ? ts[i] - ts[i - 1] : ts[0];
+            putVarint(out, i < 2 ? (i ? zigzag(delta) : delta) : zigzag(delta - prev_delta));
+            prev_delta = delta;
+        }
+
+        const uint64_t* seq = c.seq.data() + first;
+        std::vector<uint64_t> deltas(count > 1 ? count - 1 : 0);
+        for (size_t i = 1; i < count; ++i) deltas[i - 1] = zigzag(seq[i] - seq[i - 1]);
+        putVarint(out, count ? seq[0] : 0);
+        packBits(deltas.data(), deltas.size(), out);
+
+        packBits(c.flags.data() + first, count, out);
+        for (size_t i = first; i < first + count; ++i) putVarint(out, c.length[i]);
+        packBits(c.packets.data() + first, count, out);
+        packBits(c.sample_rate.data() + first, count, out);
+    }
+
+    /**
+     * @brief Decode count records from [p, end) into out (replacing its contents)
+     * @return false if the data is corrupt or does not hold exactly count records
+     */
+    inline bool decode(const char* p, const char* end, size_t count, RecordColumns& out) {
+        uint64_t v;
+
+        // Address dictionary; the size check bounds the allocation
+        if (!getVarint(p, end, v) || v > static_cast<uint64_t>(end - p) / 4) return false;
+        std::vector<uint32_t> addrs(v);
+        if (!addrs.empty()) memcpy(addrs.data(), p, addrs.size() * 4);
+        p += addrs.size() * 4;
+
+        // Flow dictionary; every flow takes at least one bit per record that uses it
+        uint64_t flows;
+        if (!getVarint(p, end, flows) || flows > count) return false;
+        std::vector<uint32_t> flow_src(flows), flow_dst(flows);
+        std::vector<uint16_t> flow_sport(flows), flow_dport(flows);
+        std::vector<uint8_t> flow_proto(flows);
+        if (!unpackBits(p, end, flows, flow_src.data()) || !unpackBits(p, end, flows, flow_dst.data()) ||
+            !unpackBits(p, end, flows, flow_sport.data()) || !unpackBits(p, end, flows, flow_dport.data()) ||
+            !unpackBits(p, end, flows, flow_proto.data())) {
+            return false;
+        }
+        uint32_t max_index = 0;
+        for (size_t f = 0; f < flows; ++f) {
+            max_index = std::max(max_index, std::max(flow_src[f], flow_dst[f]));
+        }
+        if (flows && max_index >= addrs.size()) return false;
+        for (size_t f = 0; f < flows; ++f) {
+            flow_src[f] = addrs[flow_src[f]];
+            flow_dst[f] = addrs[flow_dst[f]];
+        }
+
+        out.resize(count);
+
+        // Flow of each record, then gather the flow fields into the columns
+        std::vector<uint32_t> flow_of(count);
+        if (!unpackBits(p, end, count, flow_of.data())) return false;
+        uint32_t max_flow = 0;
+        for (size_t i = 0; i < count; ++i) max_flow = std::max(max_flow, flow_of[i]);
+        if (count && max_flow >= flows) return false;
+        for (size_t i = 0; i < count; ++i) out.src_ip[i] = flow_src[flow_of[i]];
+        for (size_t i = 0; i < count; ++i) out.dst_ip[i] = flow_dst[flow_of[i]];
+        for (size_t i = 0; i < count; ++i) out.src_port[i] = flow_sport[flow_of[i]];
+        for (size_t i = 0; i < count; ++i) out.dst_port[i] = flow_dport[flow_of[i]];
+        for (size_t i = 0; i < count; ++i) out.protocol[i] = flow_proto[flow_of[i]];
+
+        // Timestamps: first value, first delta, then delta-of-delta
+        uint64_t delta = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!getVarint(p, end, v)) return false;
+            if (i == 0) {
+                out.ts_ns[0] = v;
+                continue;
+            }
+            delta = (i == 1) ? unzigzag(v) : delta + unzigzag(v);
+            out.ts_ns[i] = out.ts_ns[i - 1] + delta;
+        }
+
+        uint64_t first_seq;
+        if (!getVarint(p, end, first_seq)) return false;
+        if (count) {
+            out.seq[0] = first_seq;
+            if (!unpackBits(p, end, count - 1, out.seq.data() + 1)) return false;
+            for (size_t i = 1; i < count; ++i) out.seq[i] = out.seq[i - 1] + unzigzag(out.seq[i]);
+        } else if (!unpackBits(p, end, 0, out.seq.data())) {
+            return false;
+        }
+
+        if (!unpackBits(p, end, count, out.flags.data())) return false;
+        for (size_t i = 0; i < count; ++i) {
+            if (!getVarint(p, end, v)) return false;
+            out.length[i] = static_cast<uint32_t>(v);
+        }
+        if (!unpackBits(p, end, count, out.packets.data()) ||
+            !unpackBits(p, end, count, out.sample_rate.data())) {
+            return false;
+        }
+        return p == end;
+    }
+
+    // ========================================================================
+    // Packed batches (RECORD_BATCH_LZ / FORWARD_BATCH_LZ payloads)
+    // ========================================================================
+
+    /**
+     * @brief Append the packed form of rows [first, first + count) to out
+     *
+     * [mode:1] followed by the columns, LZ-compressed if that saves at least
+     * an eighth; otherwise the decoder would spend time for next to nothing.
+     *
+     * @param scratch Reused buffer for the uncompressed columns
+     * @return Bytes appended
+     */
+    inline size_t packBatch(const RecordColumns& c, size_t first, size_t count,
+                            std::string& out, std::string& scratch) {
+        scratch.clear();
+        encode(c, first, count, scratch);
+
+        size_t start = out.size();
+        out.push_back(static_cast<char>(MODE_LZ));
+        out.resize(start + 5);
+        RecordCodec::put32(&out[start + 1], static_cast<uint32_t>(scratch.size()));
+        size_t compressed = Lz::compress(scratch.data(), scratch.size(), out);
+        if (4 + compressed > scratch.size() - scratch.size() / 8) {
+            out.resize(start);
+            out.push_back(static_cast<char>(MODE_COLUMNS));
+            out.append(scratch);
+        }
+        return out.size() - start;
+    }
+
+    /**
+     * @brief Decode a packed batch of count records into out
+     *
+     * @param scratch Reused buffer for decompression
+     * @return false if the data is corrupt or holds a different number of records
+     */
+    inline bool unpackBatch(const char* data, size_t len, size_t count,
+                            RecordColumns& out, std::string& scratch) {
+        if (len < 1) return false;
+        const char* end = data + len;
+        if (static_cast<uint8_t>(data[0]) == MODE_COLUMNS) {
+            return decode(data + 1, end, count, out);
+        }
+        if (static_cast<uint8_t>(data[0]) != MODE_LZ || len < 5) return false;
+
+        size_t raw_len = RecordCodec::get32(data + 1);
+        if (raw_len > MAX_RAW) return false;
+        scratch.resize(raw_len);
+        if (!Lz::decompress(data + 5, len - 5, &scratch[0], raw_len)) return false;
+        return decode(scratch.data(), scratch.data() + raw_len, count, out);
+    }
+
+} // namespace ColumnCodec
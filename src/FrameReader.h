@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+#include "Protocol.h"
+
+/**
+ * @file FrameReader.h
+ * @brief Buffered frame parser shared by the sniffer, server and headless client
+ *
+ * Reading a frame byte-exactly costs three read() calls (header, payload,
+ * terminator) plus a copy of the payload. FrameReader instead pulls up to
+ * READ_CHUNK bytes per read() into one buffer and cuts out as many whole
+ * frames as that read delivered:
+ *
+ * ```
+ * [consumed ......][frame][frame][frame][partial fr][free .............]
+ *  ^ begin_         ^ next() walks forward          ^ end_
+ * ```
+ *
+ * Payloads are returned as views into the buffer, so parsing copies
+ * nothing. A view stays valid until the next fill() or feed(), which is
+ * when the buffer may be compacted (only the partial frame at the tail
+ * moves, at most one frame's worth of bytes).
+ *
+ * Two ways to get bytes in:
+ * - fill(fd): one read() from a socket the caller owns (sniffer, threaded
+ *   server, headless client)
+ * - feed(data, len): bytes an event loop has already received (epoll and
+ *   io_uring server backends)
+ *
+ * VERSION_2 frames are refused until allowLargeFrames() is called, which
+ * the owner does once CAP_LARGE_FRAMES has been negotiated.
+ *
+ * Not thread-safe; each connection has its own reader.
+ */
+
+/**
+ * @struct FrameView
+ * @brief A parsed frame whose payload points into a FrameReader's buffer
+ */
+struct FrameView {
+    uint8_t type = 0;               ///< Message type (Protocol::MessageType)
+    std::string_view payload;       ///< Valid until the reader's next fill() or feed()
+};
+
+/**
+ * @class FrameReader
+ * @brief Pulls large chunks from a stream and parses every whole frame in them
+ */
+class FrameReader {
+public:
+    /// Outcome of next()
+    enum class Status {
+        FRAME,      ///< frame was filled in
+        NEED_MORE,  ///< No complete frame buffered; fill() or feed() more
+        BAD_FRAME   ///< Stream is corrupt (version, length or terminator); see error()
+    };
+
+    /// Header (version, type, 2-byte length) plus the terminator
+    static constexpr size_t FRAME_OVERHEAD = 5;
+
+    /// Largest version-1 frame; VERSION_2 frames grow the buffer when needed
+    static constexpr size_t MAX_FRAME = Protocol::MAX_PAYLOAD_SIZE + FRAME_OVERHEAD;
+
+    /// Most bytes one fill() asks the kernel for
+    static constexpr size_t READ_CHUNK = 64u << 10;
+
+    FrameReader() : buffer_(READ_CHUNK + MAX_FRAME) {}
+
+    /**
+     * @brief Make one read() from fd into the free space
+     * @return Bytes read, 0 on EOF, -1 on error (errno is set; EINTR is retried)
+     */
+    ssize_t fill(int fd) {
+        reserve(READ_CHUNK);
+        ssize_t n;
+        do {
+            n = ::read(fd, buffer_.data() + end_, buffer_.size() - end_);
+        } while (n < 0 && errno == EINTR);
+        if (n > 0) end_ += static_cast<size_t>(n);
+        return n;
+    }
+
+    /**
+     * @brief Append bytes received elsewhere (an event loop's read buffer)
+     */
+    void feed(const char* data, size_t len) {
+        reserve(len);
+        std::memcpy(buffer_.data() + end_, data, len);
+        end_ += len;
+    }
+
+    /**
+     * @brief Parse the next buffered frame
+     *
+     * After BAD_FRAME the stream cannot be resynchronized; the caller should
+     * drop the connection.
+     */
+    Status next(FrameView& frame) {
+        size_t available = end_ - begin_;
+        if (available < 4) return Status::NEED_MORE;
+
+        const uint8_t* header = reinterpret_cast<const uint8_t*>(buffer_.data() + begin_);
+        if (header[0] != Protocol::VERSION && header[0] != Protocol::VERSION_2) {
+            error_ = "invalid protocol version " + std::to_string(header[0]);
+            return Status::BAD_FRAME;
+        }
+        if (header[0] == Protocol::VERSION_2 && !large_frames_) {
+            error_ = "large frame without the large_frames capability";
+            return Status::BAD_FRAME;
+        }
+        // VERSION_2 frames may use the whole 16-bit length
+        size_t length = (static_cast<size_t>(header[2]) << 8) | header[3];
+        if (header[0] == Protocol::VERSION && length > Protocol::MAX_PAYLOAD_SIZE) {
+            error_ = "payload too large (" + std::to_string(length) + " bytes)";
+            return Status::BAD_FRAME;
+        }
+        if (available < length + FRAME_OVERHEAD) return Status::NEED_MORE;
+
+        uint8_t term = header[4 + length];
+        if (term != Protocol::TERM_BYTE) {
+            error_ = "invalid terminator byte " + std::to_string(term);
+            return Status::BAD_FRAME;
+        }
+
+        frame.type = header[1];
+        frame.payload = std::string_view(buffer_.data() + begin_ + 4, length);
+        begin_ += length + FRAME_OVERHEAD;
+        if (begin_ == end_) {
+            begin_ = end_ = 0;      // Cheap reset: the common case after a burst
+        }
+        return Status::FRAME;
+    }
+
+    /**
+     * @brief Blocking read of one frame from fd
+     *
+     * Returns a frame that is already buffered without touching the socket;
+     * otherwise reads (in READ_CHUNK pieces) until one is complete.
+     *
+     * @return false on EOF, socket error or a corrupt frame
+     */
+    bool readFrame(int fd, FrameView& frame) {
+        while (true) {
+            Status status = next(frame);
+            if (status == Status::FRAME) return true;
+            if (status == Status::BAD_FRAME) return false;
+            if (fill(fd) <= 0) {
+                error_ = end_ > begin_ ? "connection closed mid-frame" : "connection closed";
+                return false;
+            }
+        }
+    }
+
+    /// Accept VERSION_2 frames from now on (CAP_LARGE_FRAMES was negotiated)
+    void allowLargeFrames(bool allow) { large_frames_ = allow; }
+
+    /// Bytes received but not yet returned as frames
+    size_t buffered() const { return end_ - begin_; }
+
+    /// Why the last BAD_FRAME or failed readFrame() happened
+    const std::string& error() const { return error_; }
+
+private:
+    /**
+     * @brief Make room for len more bytes at the end
+     *
+     * Moves the unparsed tail to the front when the free space runs short.
+     * Parsed frames are gone by then, so only the partial frame moves.
+     */
+    void reserve(size_t len) {
+        if (buffer_.size() - end_ >= len) return;
+        if (begin_ > 0) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (buffer_.size() - end_ < len) {
+            buffer_.resize(end_ + len);
+        }
+    }
+
+    std::vector<char> buffer_;
+    size_t begin_ = 0;      ///< First unparsed byte
+    size_t end_ = 0;        ///< One past the last received byte
+    bool large_frames_ = false;
+    std::string error_;
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * @file LzCodec.h
+ * @brief Small LZ77 block codec for record batches (protocol capability "lz")
+ *
+ * A byte-oriented LZ in the LZ4 family: no entropy coding, one hash probe
+ * per position, so both directions run at several hundred MB/s on one
+ * core. A block is a series of sequences:
+ *
+ * ```
+ * [token][literal len ext...][literals][offset:2 LE][match len ext...]
+ *  token = (literal length << 4) | (match length - MIN_MATCH), each nibble 0..15;
+ *  a nibble of 15 continues in bytes of 255 until a byte < 255.
+ * ```
+ *
+ * The last sequence has literals only and no offset. Offsets point back into
+ * the output (1..65535) and matches may overlap their own output, which is
+ * how runs of one repeated byte compress.
+ *
+ * The decoder checks every length and offset against both buffers, so a
+ * corrupt or hostile block fails cleanly instead of reading or writing out of
+ * bounds. Blocks carry no size; callers frame them with the decompressed
+ * length (see ColumnCodec::packBatch()).
+ *
+ * Header-only: shared by the sniffer, the server and SnifferCLI.
+ */
+namespace Lz {
+
+    /// Shortest match worth a 3-byte (token + offset) reference
+    constexpr size_t MIN_MATCH = 4;
+
+    /// Farthest back a match may reach
+    constexpr size_t MAX_OFFSET = 65535;
+
+    /// Worst-case compressed size of n input bytes (all literals)
+    inline size_t bound(size_t n) {
+        return n + n / 255 + 16;
+    }
+
+    namespace detail {
+
+        constexpr int HASH_BITS = 13;
+
+        inline uint32_t read32(const uint8_t* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint32_t hash(uint32_t v) {
+            return (v * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        /// Length nibble plus continuation bytes
+        inline uint8_t* putLength(uint8_t* op, size_t len) {
+            for (; len >= 255; len -= 255) *op++ = 255;
+            *op++ = static_cast<uint8_t>(len);
+            return op;
+        }
+
+        inline uint8_t* putSequence(uint8_t* op, const uint8_t* literals, size_t literal_len,
+                                    size_t offset, size_t match_len) {
+            uint8_t* token = op++;
+            uint8_t lit_nibble = literal_len >= 15 ? 15 : static_cast<uint8_t>(literal_len);
+            if (literal_len >= 15) op = putLength(op, literal_len - 15);
+            std::memcpy(op, literals, literal_len);
+            op += literal_len;
+
+            if (match_len == 0) {
+                // Final literal-only sequence
+                *token = static_cast<uint8_t>(lit_nibble << 4);
+                return op;
+            }
+
+            *op++ = static_cast<uint8_t>(offset);
+            *op++ = static_cast<uint8_t>(offset >> 8);
+            size_t code = match_len - MIN_MATCH;
+            uint8_t match_nibble = code >= 15 ? 15 : static_cast<uint8_t>(code);
+            if (code >= 15) op = putLength(op, code - 15);
+            *token = static_cast<uint8_t>((lit_nibble << 4) | match_nibble);
+            return op;
+        }
+
+        /// Read a continued length; false if it runs past end
+        inline bool getLength(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+            uint8_t b;
+            do {
+                if (ip >= end) return false;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+            return true;
+        }
+
+    } // namespace detail
+
+    /**
+     * @brief Append the compressed form of src[0, n) to out
+     *
+     * Greedy parse with a single-entry hash table. When no match turns up the
+     * scan speeds up (the step grows every 32 misses), so incompressible input
+     * costs little more than a copy.
+     *
+     * @return Bytes appended
+     */
+    inline size_t compress(const char* src, size_t n, std::string& out) {
+        size_t start = out.size();
+        out.resize(start + bound(n));
+        uint8_t* const out_begin = reinterpret_cast<uint8_t*>(&out[start]);
+        uint8_t* op = out_begin;
+
+        const uint8_t* const base = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* const end = base + n;
+        const uint8_t* anchor = base;      // First byte not yet emitted
+
+        if (n > MIN_MATCH + 8) {
+            // Positions + 1, so 0 means "empty"; reused per thread to skip the allocation
+            thread_local std::vector<uint32_t> table;
+            table.assign(size_t{1} << detail::HASH_BITS, 0);
+
+            // Leave room at the end so 4-byte reads and match extension stay in bounds
+            const uint8_t* const match_limit = end - MIN_MATCH;
+            const uint8_t* ip = base;
+            uint32_t misses = 0;
+
+            while (ip < match_limit) {
+                uint32_t h = detail::hash(detail::read32(ip));
+                uint32_t candidate_pos = table[h];
+                table[h] = static_cast<uint32_t>(ip - base) + 1;
+
+                const uint8_t* candidate = candidate_pos ? base + candidate_pos - 1 : nullptr;
+                if (!candidate || static_cast<size_t>(ip - candidate) > MAX_OFFSET ||
+                    detail::read32(candidate) != detail::read32(ip)) {
+                    ip += 1 + (misses++ >> 5);
+                    continue;
+                }
+                misses = 0;
+
+                // Extend backwards over pending literals, then forwards
+                while (ip > anchor && candidate > base && ip[-1] == candidate[-1]) {
+                    --ip;
+                    --candidate;
+                }
+                size_t match_len = MIN_MATCH;
+                while (ip + match_len < end && ip[match_len] == candidate[match_len]) {
+                    ++match_len;
+                }
+
+                op = detail::putSequence(op, anchor, static_cast<size_t>(ip - anchor),
+                                         static_cast<size_t>(ip - candidate), match_len);
+                ip += match_len;
+                anchor = ip;
+
+                // Index one position inside the match so the next record's
+                // copy of the same bytes is found
+                if (ip - 2 > base && ip < match_limit) {
+                    table[detail::hash(detail::read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - base) + 1;
+                }
+            }
+        }
+
+        op = detail::putSequence(op, anchor, static_cast<size_t>(end - anchor), 0, 0);
+
+        size_t written = static_cast<size_t>(op - out_begin);
+        out.resize(start + written);
+        return written;
+    }
+
+    /**
+     * @brief Decompress a block into exactly dst_len bytes at dst
+     * @return false if the block is corrupt or does not decode to dst_len bytes
+     */
+    inline bool decompress(const char* src, size_t n, char* dst, size_t dst_len) {
+        const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* const end = ip + n;
+        uint8_t* const out_begin = reinterpret_cast<uint8_t*>(dst);
+        uint8_t* op = out_begin;
+        uint8_t* const out_end = out_begin + dst_len;
+
+        while (ip < end) {
+            uint8_t token = *ip++;
+
+            size_t literal_len = token >> 4;
+            if (literal_len == 15 && !detail::getLength(ip, end, literal_len)) return false;
+            if (literal_len > static_cast<size_t>(end - ip) ||
+                literal_len > static_cast<size_t>(out_end - op)) {
+                return false;
+            }
+            std::memcpy(op, ip, literal_len);
+            ip += literal_len;
+            op += literal_len;
+
+            if (ip == end) break;           // Final sequence has no match
+
+            if (end - ip < 2) return false;
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            if (offset == 0 || offset > static_cast<size_t>(op - out_begin)) return false;
+
+            size_t match_len = token & 0x0F;
+            if (match_len == 15 && !detail::getLength(ip, end, match_len)) return false;
+            match_len += MIN_MATCH;
+            if (match_len > static_cast<size_t>(out_end - op)) return false;
+
+            const uint8_t* match = op - offset;
+            if (offset >= match_len) {
+                std::memcpy(op, match, match_len);
+                op += match_len;
+            } else {
+                // Overlapping copy repeats the last offset bytes
+                for (size_t i = 0; i < match_len; ++i) *op++ = match[i];
+            }
+        }
+        return op == out_end;
+    }
+
+} // namespace Lz
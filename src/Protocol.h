@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 /**
  * @namespace Protocol
@@ -76,7 +77,7 @@
  *
  * ### Robustness
  * The design handles common network failures:
- * - Partial reads: readExact() loops until frame complete
+ * - Partial reads: FrameReader buffers bytes until a frame is complete
  * - Corruption: version, length, and terminator checks
  * - Alignment: binary format avoids struct packing issues
  * - Endianness: explicit big-endian avoids architecture differences
@@ -101,6 +102,93 @@
  * - **ERROR (0x05)**: Error notification
  *   - `{"error":"description"}`
  *
+ * - **STATS (0x06)**: Loss accounting report
+ *   - Sniffer -> Server: `{"seq":N, "kernel_recv":N, "kernel_drop":N, "ring_drop":N, "send_drop":N}`
+ *   - Server -> GUI: `{"ssid":1, "sniffer":{...}, "server":{"seq_gap":N, "decode_drop":N, "fanout_drop":N}}`
+ *
+ * - **CREDIT (0x07)**: Flow-control grant (server -> sniffer)
+ *   - `{"credits":128}`
+ *   - Each TRAFFIC_LOG consumes one credit; control frames are free
+ *
+ * - **QUERY (0x08)**: Historical query over the server's record store (GUI -> server)
+ *   - `{"id":7, "ssid":3, "from_ns":T1, "to_ns":T2, "group_by":"dst_port"}`
+ *   - `{"id":8, "dst":"10.1.2.3", "limit":500}`
+ *
+ * - **QUERY_RESULT (0x09)**: One batch of results (server -> GUI)
+ *   - `{"id":7, "groups":[{"key":"443","packets":N,"bytes":N,"records":N}, ...]}`
+ *   - `{"id":8, "rows":[{"ssid":1,"ts_ns":N,"src":"...","dst":"...",...}, ...]}`
+ *   - The last frame of a query has `"done":true` plus totals, or `"error"`
+ *
+ * - **RECORD_BATCH (0x0A)**: Binary TRAFFIC_LOG records (sniffer -> server, `binary` only)
+ *   - `[count:2][record x count]`, records encoded by RecordCodec
+ *
+ * - **FORWARD_BATCH (0x0B)**: Binary FORWARD_LOG records (server -> GUI, `binary` only)
+ *   - `[ssid:4][first seq:8][count:2][record x count]`; the records carry
+ *     GUI sequence numbers first_seq, first_seq + 1, ...
+ *
+ * - **RECORD_BATCH_LZ (0x0C)** / **FORWARD_BATCH_LZ (0x0D)**: the same, packed (`lz` only)
+ *   - Same header as the uncompressed frame, then ColumnCodec::packBatch()
+ *     output instead of count x 42 bytes. A sender may still use the plain
+ *     frame for any batch that does not get smaller when packed.
+ *
+ * ## Flow Control
+ *
+ * SERVER_HELLO to a sniffer carries an initial `"credits"` window. The
+ * server returns credits in CREDIT frames as it finishes fanning records
+ * out, so the window tracks what the server can actually absorb. When the
+ * window runs low the sniffer degrades instead of blocking in write():
+ * - FULL: every record is sent
+ * - SAMPLED: 1 in N records is sent, tagged with `"sample_rate":N`
+ * - SUMMARY: records are folded into per-flow summaries
+ *   (`"kind":"flow_summary"`, `"packets"`, `"bytes"`) that are sent once
+ *   credits return
+ *
+ * Sniffers that never see `"credits"` in SERVER_HELLO (old servers) send
+ * every record without flow control.
+ *
+ * ## Sequence Numbers
+ *
+ * Every record stream carries its own monotonically increasing sequence
+ * number starting at 1:
+ * - TRAFFIC_LOG: `"seq"` inside the log, counted per sniffer connection
+ * - FORWARD_LOG: `"seq"` in the wrapper, counted per GUI connection
+ *
+ * A receiver that sees seq jump from 41 to 45 knows exactly 3 records were
+ * lost between it and the previous hop. Combined with the STATS counters,
+ * operators can tell which stage (kernel, BPF buffer, sniffer send path,
+ * server fan-out, GUI decode) dropped data under overload.
+ *
+ * ## Protocol Revision 2: Capabilities
+ *
+ * CLIENT_HELLO and SERVER_HELLO stay JSON in version-1 frames, so every
+ * peer can read them. A revision-2 client adds what it supports:
+ * ```json
+ * {"hostname":"...","interface":"en0","proto":2,"caps":["seq","credits","binary","batch","large_frames"]}
+ * ```
+ * and the server answers with the common subset, which is what both sides
+ * use from then on:
+ * ```json
+ * {"ssid":1,"ip":"...","registered":true,"credits":256,"proto":2,"caps":["seq","credits","binary","batch"]}
+ * ```
+ * A CLIENT_HELLO without "caps" (revision 1) gets LEGACY_CAPS: JSON records,
+ * one per frame. A SERVER_HELLO without "caps" (old server) means the same,
+ * so new sniffers and GUIs fall back to JSON on their own. Old and new peers
+ * share one server: the server converts between the encodings on fan-out.
+ *
+ * | Capability     | Meaning once negotiated                                        |
+ * |----------------|----------------------------------------------------------------|
+ * | `seq`          | Records carry per-stream sequence numbers                      |
+ * | `credits`      | Server grants CREDIT windows, sniffer degrades instead of blocking |
+ * | `binary`       | Records travel as RECORD_BATCH / FORWARD_BATCH (see RecordCodec.h) |
+ * | `batch`        | A binary frame may hold more than one record                   |
+ * | `large_frames` | Frames up to MAX_LARGE_PAYLOAD_SIZE, sent with version byte 0x02 |
+ * | `lz`           | Batches may be sent packed (RECORD_BATCH_LZ / FORWARD_BATCH_LZ) |
+ * | `relay`        | The client is a server passing on many streams as FORWARD_BATCH(_LZ) |
+ *
+ * `batch`, `large_frames`, `lz` and `relay` only apply to binary records and
+ * are dropped from the result without `binary`; `lz` also needs `batch`, since
+ * one record per frame leaves nothing to compress.
+ *
  * ## Example Frame
  *
  * ```
@@ -133,6 +221,11 @@ namespace Protocol {
     /// increment to 0x02, 0x03, etc. for forward compatibility.
     constexpr uint8_t VERSION = 0x01;
 
+    /// Version byte of frames longer than MAX_PAYLOAD_SIZE. Only sent to peers
+    /// that negotiated CAP_LARGE_FRAMES; smaller frames keep VERSION, so the
+    /// byte says which length limit applies, not which revision the peer runs.
+    constexpr uint8_t VERSION_2 = 0x02;
+
     /// Frame terminator byte (0x0A = ASCII line feed '\n')
     /// Marks end of frame for defense-in-depth validation.
     /// Provides redundancy alongside the Length field.
@@ -159,6 +252,9 @@ namespace Protocol {
     /// 3. Update all frame parsing code
     constexpr size_t MAX_PAYLOAD_SIZE = 1024;
 
+    /// Largest payload of a VERSION_2 frame (what the 16-bit Length can hold)
+    constexpr size_t MAX_LARGE_PAYLOAD_SIZE = 65535;
+
     // ========================================================================
     // Message Types
     // ========================================================================
@@ -178,9 +274,139 @@ namespace Protocol {
         FORWARD_LOG = 0x04,
 
         /// Error notification
-        ERROR = 0x05
+        ERROR = 0x05,
+
+        /// Drop/loss counters (sniffer -> server, server -> GUI)
+        STATS = 0x06,
+
+        /// Flow-control credit grant (server -> sniffer)
+        CREDIT = 0x07,
+
+        /// Historical query over stored records (GUI -> server)
+        QUERY = 0x08,
+
+        /// Batch of query results; the final batch has "done":true (server -> GUI)
+        QUERY_RESULT = 0x09,
+
+        /// Binary records (sniffer -> server, needs CAP_BINARY):
+        /// [count:2 BE][count x RecordCodec::WIRE_SIZE]
+        RECORD_BATCH = 0x0A,
+
+        /// Binary records of one sniffer (server -> GUI, needs CAP_BINARY;
+        /// also relay -> parent server, needs CAP_RELAY):
+        /// [ssid:4 BE][first seq:8 BE][count:2 BE][count x RecordCodec::WIRE_SIZE]
+        FORWARD_BATCH = 0x0B,
+
+        /// RECORD_BATCH with packed records (needs CAP_COMPRESS):
+        /// [count:2 BE][ColumnCodec::packBatch()]
+        RECORD_BATCH_LZ = 0x0C,
+
+        /// FORWARD_BATCH with packed records (needs CAP_COMPRESS):
+        /// [ssid:4 BE][first seq:8 BE][count:2 BE][ColumnCodec::packBatch()]
+        FORWARD_BATCH_LZ = 0x0D
     };
 
+    // ========================================================================
+    // Capability Negotiation
+    // ========================================================================
+
+    /// Revision advertised as "proto" in CLIENT_HELLO / SERVER_HELLO
+    constexpr uint32_t PROTOCOL_REVISION = 2;
+
+    /// Capability bits; on the wire they are the names in capabilityName()
+    enum Capability : uint32_t {
+        CAP_SEQ = 1u << 0,
+        CAP_CREDITS = 1u << 1,
+        CAP_BINARY = 1u << 2,
+        CAP_BATCH = 1u << 3,
+        CAP_LARGE_FRAMES = 1u << 4,
+        CAP_COMPRESS = 1u << 5,
+        CAP_RELAY = 1u << 6
+    };
+
+    /// What a revision-1 peer (no "caps" in its hello) does
+    constexpr uint32_t LEGACY_CAPS = CAP_SEQ | CAP_CREDITS;
+
+    /// Capabilities only meaningful with CAP_BINARY
+    constexpr uint32_t BINARY_ONLY_CAPS = CAP_BATCH | CAP_LARGE_FRAMES | CAP_COMPRESS | CAP_RELAY;
+
+    /// Wire name of one capability bit ("" for unknown bits)
+    inline const char* capabilityName(uint32_t cap) {
+        switch (cap) {
+            case CAP_SEQ: return "seq";
+            case CAP_CREDITS: return "credits";
+            case CAP_BINARY: return "binary";
+            case CAP_BATCH: return "batch";
+            case CAP_LARGE_FRAMES: return "large_frames";
+            case CAP_COMPRESS: return "lz";
+            case CAP_RELAY: return "relay";
+            default: return "";
+        }
+    }
+
+    /// Names of every bit set in caps, for the "caps" array of a hello
+    inline std::vector<std::string> capabilityNames(uint32_t caps) {
+        std::vector<std::string> names;
+        for (uint32_t cap = 1; cap != 0 && cap <= caps; cap <<= 1) {
+            if ((caps & cap) && *capabilityName(cap)) names.push_back(capabilityName(cap));
+        }
+        return names;
+    }
+
+    /// Bits for a "caps" array; names this build does not know are ignored
+    inline uint32_t parseCapabilities(const std::vector<std::string>& names) {
+        uint32_t caps = 0;
+        for (const auto& name : names) {
+            for (uint32_t cap = 1; cap != 0; cap <<= 1) {
+                if (name == capabilityName(cap)) caps |= cap;
+            }
+        }
+        return caps;
+    }
+
+    /**
+     * @brief The mode both sides use: the common capabilities
+     * @param offered What the client sent (LEGACY_CAPS if it sent none)
+     * @param supported What the server implements
+     */
+    inline uint32_t negotiate(uint32_t offered, uint32_t supported) {
+        uint32_t common = offered & supported;
+        if (!(common & CAP_BINARY)) common &= ~BINARY_ONLY_CAPS;
+        if (!(common & CAP_BATCH)) common &= ~CAP_COMPRESS;
+        return common;
+    }
+
+    /// Largest payload a peer with these capabilities accepts
+    inline size_t maxPayload(uint32_t caps) {
+        return (caps & CAP_LARGE_FRAMES) ? MAX_LARGE_PAYLOAD_SIZE : MAX_PAYLOAD_SIZE;
+    }
+
+    /// Version byte for a frame with this payload length
+    inline uint8_t frameVersion(size_t payload_len) {
+        return payload_len > MAX_PAYLOAD_SIZE ? VERSION_2 : VERSION;
+    }
+
+    // ========================================================================
+    // Flow Control
+    // ========================================================================
+
+    /// Smallest credit window granted to a sniffer in SERVER_HELLO, the one
+    /// for JSON records. 256 records x ~300 bytes of JSON = ~75 KB in flight,
+    /// which fits in a default TCP send buffer, so a sniffer that respects its
+    /// credits never blocks in write().
+    constexpr uint32_t CREDIT_WINDOW = 256;
+
+    /// Batching sniffers get room for this many full RECORD_BATCH frames, so
+    /// a batch never waits for the credits of the one before it
+    constexpr uint32_t CREDIT_FRAMES = 4;
+
+    /// Records per second a window also covers for one round trip of the
+    /// link, the time credits take to come back
+    constexpr uint64_t CREDIT_RATE = 100000;
+
+    /// Largest window the server grants
+    constexpr uint32_t MAX_CREDIT_WINDOW = 65536;
+
     // ========================================================================
     // Frame Structure
     // ========================================================================
@@ -208,4 +434,92 @@ namespace Protocol {
     /// Special SSID value indicating unassigned client
     constexpr uint32_t SSID_UNASSIGNED = 0;
 
+    /**
+     * SSIDs with this bit set are derived from the sniffer's identity (see
+     * stableSsid()): the same sniffer gets the same SSID on every server of
+     * a pool, after a reconnect, and after a server restart. SSIDs without
+     * it come from a per-server counter (GUIs, and the rare sniffer whose
+     * stable SSID is already taken).
+     */
+    constexpr uint32_t SSID_STABLE_BIT = 0x80000000u;
+
+    /**
+     * @brief 64-bit FNV-1a with a final avalanche step
+     *
+     * FNV-1a alone mixes the last bytes poorly, and identities often differ
+     * only there ("en0" vs "en1"); the finalizer spreads every input bit.
+     * Also places servers and sniffers on the shard ring (ShardRing.h), so
+     * the value must never change.
+     */
+    inline uint64_t identityHash(const std::string& text) {
+        uint64_t h = 0xCBF29CE484222325ull;
+        for (unsigned char c: text) {
+            h ^= c;
+            h *= 0x100000001B3ull;
+        }
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /// Who a sniffer is, from its CLIENT_HELLO: "hostname/interface"
+    inline std::string snifferIdentity(const std::string& hostname, const std::string& interface) {
+        return hostname + "/" + interface;
+    }
+
+    /// SSID of a sniffer, from its identity (always has SSID_STABLE_BIT set)
+    inline uint32_t stableSsid(const std::string& identity) {
+        return SSID_STABLE_BIT | static_cast<uint32_t>(identityHash(identity) & 0x7FFFFFFFu);
+    }
+
+    inline bool isStableSsid(uint32_t ssid) {
+        return (ssid & SSID_STABLE_BIT) != 0;
+    }
+
+    // ========================================================================
+    // Sequence Tracking
+    // ========================================================================
+
+    /**
+     * @struct SequenceTracker
+     * @brief Detects gaps in a per-stream sequence number series
+     *
+     * Used by the server (per sniffer connection) and the GUI (per server
+     * connection). Sequence numbers start at 1; a value of 0 means "sender
+     * does not number its records" and is ignored.
+     *
+     * A value that goes backwards (seq < expected) is counted as a restart
+     * and starts a new series at seq + 1 - TCP preserves order, so this
+     * only happens after the sender restarts its numbering.
+     */
+    struct SequenceTracker {
+        uint64_t expected = 1;   ///< Next sequence number we expect to see
+        uint64_t lost = 0;       ///< Total records missing (sum of gap sizes)
+        uint64_t gaps = 0;       ///< Number of distinct gap events
+        uint64_t restarts = 0;   ///< Times the series went backwards
+
+        /**
+         * @brief Record an observed sequence number
+         * @param seq Sequence number carried by the received record
+         * @return Number of records missing immediately before this one
+         */
+        uint64_t observe(uint64_t seq) {
+            if (seq == 0) return 0;
+
+            uint64_t missing = 0;
+            if (seq > expected) {
+                missing = seq - expected;
+                lost += missing;
+                gaps++;
+            } else if (seq < expected) {
+                restarts++;
+            }
+            expected = seq + 1;
+            return missing;
+        }
+    };
+
 } // namespace Protocol
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <arpa/inet.h>
+#include <nlohmann/json.hpp>
+
+/**
+ * @file RecordCodec.h
+ * @brief Binary encoding of traffic records (protocol capability "binary")
+ *
+ * A JSON TRAFFIC_LOG is ~200 bytes and costs a serialize on the sniffer and
+ * a parse on the server. Peers that negotiated CAP_BINARY send the same
+ * information as fixed 42-byte records instead (big-endian):
+ *
+ * | Offset | Size | Field       |
+ * |--------|------|-------------|
+ * | 0      | 8    | ts_ns       |
+ * | 8      | 8    | seq         |
+ * | 16     | 4    | src_ip (network order, as captured) |
+ * | 20     | 4    | dst_ip      |
+ * | 24     | 4    | length      |
+ * | 28     | 4    | packets     |
+ * | 32     | 4    | sample_rate |
+ * | 36     | 2    | src_port    |
+ * | 38     | 2    | dst_port    |
+ * | 40     | 1    | protocol (IPPROTO_* number) |
+ * | 41     | 1    | flags (FLAG_*) |
+ *
+ * A DNS transaction record (FLAG_DNS) reuses the fields: the 5-tuple is the
+ * query's (client to server), ts_ns is when the query was seen, length is
+ * the latency in microseconds (DNS_NO_RESPONSE if none came), packets is 2
+ * (1 without a response), and the response code is in the upper four bits
+ * of flags. The query name and type only travel in the JSON form.
+ *
+ * An HTTP summary record (FLAG_HTTP_SUMMARY) stands for the requests to
+ * one host that got one status during a summary interval: dst_port is the
+ * status, packets the number of requests and length their mean latency in
+ * microseconds. Addresses and src_port are zero. Host, maximum and
+ * histogram only travel in the JSON form.
+ *
+ * The fields are those of the server's StoredRecord, so a received record
+ * goes to disk without passing through JSON. toJson() and fromJson() convert
+ * for peers that still speak JSON; they use the field names PacketParser
+ * produces, so a JSON GUI cannot tell which encoding the sniffer used.
+ *
+ * Peers that also negotiated CAP_COMPRESS may send whole batches packed
+ * column by column instead; see ColumnCodec.h.
+ *
+ * Header-only: shared by the sniffer, the server and SnifferCLI.
+ */
+
+/**
+ * @struct WireRecord
+ * @brief One decoded binary record
+ */
+struct WireRecord {
+    uint64_t ts_ns = 0;         ///< Capture time, ns since the epoch (0 = unknown)
+    uint64_t seq = 0;           ///< Sender's sequence number (0 = not numbered)
+    uint32_t src_ip = 0;        ///< IPv4, network byte order
+    uint32_t dst_ip = 0;
+    uint32_t length = 0;        ///< Bytes (flow summaries: total bytes)
+    uint32_t packets = 1;       ///< Packets this record stands for
+    uint32_t sample_rate = 1;   ///< Sampling rate the record was kept at
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    uint8_t protocol = 0;       ///< IPPROTO_* (0 if unknown)
+    uint8_t flags = 0;          ///< FLAG_* bits
+
+    static constexpr uint8_t FLAG_FLOW_SUMMARY = 0x01;
+    static constexpr uint8_t FLAG_REPLAYED = 0x02;      ///< Captured while the server was away
+    static constexpr uint8_t FLAG_DNS = 0x04;           ///< DNS transaction, see the file comment
+    static constexpr uint8_t FLAG_HTTP_SUMMARY = 0x08;  ///< HTTP latency summary, see the file comment
+
+    /// DNS records: rcode = flags >> DNS_RCODE_SHIFT
+    static constexpr unsigned DNS_RCODE_SHIFT = 4;
+
+    /// DNS records: length of a query that got no response
+    static constexpr uint32_t DNS_NO_RESPONSE = UINT32_MAX;
+};
+
+namespace RecordCodec {
+
+    using json = nlohmann::json;
+
+    /// Encoded size of one WireRecord
+    constexpr size_t WIRE_SIZE = 42;
+
+    // ========================================================================
+    // Big-endian helpers
+    // ========================================================================
+
+    inline void put16(char* p, uint16_t v) {
+        p[0] = static_cast<char>(v >> 8);
+        p[1] = static_cast<char>(v);
+    }
+
+    inline void put32(char* p, uint32_t v) {
+        put16(p, static_cast<uint16_t>(v >> 16));
+        put16(p + 2, static_cast<uint16_t>(v));
+    }
+
+    inline void put64(char* p, uint64_t v) {
+        put32(p, static_cast<uint32_t>(v >> 32));
+        put32(p + 4, static_cast<uint32_t>(v));
+    }
+
+    inline uint16_t get16(const char* p) {
+        const auto* u = reinterpret_cast<const uint8_t*>(p);
+        return static_cast<uint16_t>((u[0] << 8) | u[1]);
+    }
+
+    inline uint32_t get32(const char* p) {
+        return (static_cast<uint32_t>(get16(p)) << 16) | get16(p + 2);
+    }
+
+    inline uint64_t get64(const char* p) {
+        return (static_cast<uint64_t>(get32(p)) << 32) | get32(p + 4);
+    }
+
+    // ========================================================================
+    // Binary form
+    // ========================================================================
+
+    /// Write record as WIRE_SIZE bytes at out
+    inline void encode(const WireRecord& r, char* out) {
+        put64(out, r.ts_ns);
+        put64(out + 8, r.seq);
+        memcpy(out + 16, &r.src_ip, 4);     // Already network order
+        memcpy(out + 20, &r.dst_ip, 4);
+        put32(out + 24, r.length);
+        put32(out + 28, r.packets);
+        put32(out + 32, r.sample_rate);
+        put16(out + 36, r.src_port);
+        put16(out + 38, r.dst_port);
+        out[40] = static_cast<char>(r.protocol);
+        out[41] = static_cast<char>(r.flags);
+    }
+
+    /// Read one record from WIRE_SIZE bytes at in
+    inline WireRecord decode(const char* in) {
+        WireRecord r;
+        r.ts_ns = get64(in);
+        r.seq = get64(in + 8);
+        memcpy(&r.src_ip, in + 16, 4);
+        memcpy(&r.dst_ip, in + 20, 4);
+        r.length = get32(in + 24);
+        r.packets = get32(in + 28);
+        r.sample_rate = get32(in + 32);
+        r.src_port = get16(in + 36);
+        r.dst_port = get16(in + 38);
+        r.protocol = static_cast<uint8_t>(in[40]);
+        r.flags = static_cast<uint8_t>(in[41]);
+        return r;
+    }
+
+    // ========================================================================
+    // Field conversions
+    // ========================================================================
+
+    inline uint8_t protocolNumber(const std::string& name) {
+        if (name == "TCP") return 6;
+        if (name == "UDP") return 17;
+        if (name == "ICMP") return 1;
+        return 0;
+    }
+
+    inline const char* protocolName(uint8_t protocol) {
+        switch (protocol) {
+            case 1: return "ICMP";
+            case 6: return "TCP";
+            case 17: return "UDP";
+            default: return "OTHER";
+        }
+    }
+
+    /// DNS response code (RFC 1035, RFC 6895) as written in records
+    inline const char* dnsRcodeName(uint8_t rcode) {
+        static const char* const names[16] = {
+            "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET",
+            "NXRRSET", "NOTAUTH", "NOTZONE", "DSOTYPENI", "RCODE12", "RCODE13", "RCODE14", "RCODE15"};
+        return names[rcode & 0x0F];
+    }
+
+    inline uint8_t dnsRcodeNumber(const std::string& name) {
+        for (uint8_t rcode = 0; rcode < 16; ++rcode) {
+            if (name == dnsRcodeName(rcode)) return rcode;
+        }
+        return 0;
+    }
+
+    /// Largest formatIpv4() output, terminator included
+    constexpr size_t IPV4_TEXT_SIZE = 16;
+
+    /// Decimal digits of one octet, left-aligned, and how many are used
+    struct OctetText {
+        char digits[3];
+        uint8_t length;
+    };
+
+    constexpr std::array<OctetText, 256> makeOctetTable() {
+        std::array<OctetText, 256> table{};
+        for (int v = 0; v < 256; ++v) {
+            OctetText& t = table[v];
+            if (v >= 100) {
+                t = {{char('0' + v / 100), char('0' + v / 10 % 10), char('0' + v % 10)}, 3};
+            } else if (v >= 10) {
+                t = {{char('0' + v / 10), char('0' + v % 10), '\0'}, 2};
+            } else {
+                t = {{char('0' + v), '\0', '\0'}, 1};
+            }
+        }
+        return table;
+    }
+
+    inline constexpr std::array<OctetText, 256> OCTET_TEXT = makeOctetTable();
+
+    /**
+     * @brief Write the dotted quad of a network-order address to out
+     *
+     * One table lookup per octet. Each octet copies all three digit bytes
+     * and then advances by its length, so there is no branch on the value
+     * and no locale or errno handling as in inet_ntop().
+     *
+     * @param out At least IPV4_TEXT_SIZE bytes; NUL-terminated
+     * @return Characters written, without the terminator
+     */
+    inline size_t formatIpv4(uint32_t addr, char* out) {
+        const uint8_t* octets = reinterpret_cast<const uint8_t*>(&addr);  // Network order: first octet first
+        size_t n = 0;
+        for (int i = 0; i < 4; ++i) {
+            const OctetText& octet = OCTET_TEXT[octets[i]];
+            memcpy(out + n, octet.digits, 3);
+            n += octet.length;
+            out[n++] = '.';
+        }
+        out[--n] = '\0';
+        return n;
+    }
+
+    /// Dotted quad of a network-order address (fits std::string's inline buffer)
+    inline std::string ipText(uint32_t addr) {
+        char buf[IPV4_TEXT_SIZE];
+        return std::string(buf, formatIpv4(addr, buf));
+    }
+
+    /// Network-order address of log[key], 0 if absent or not IPv4
+    inline uint32_t ipv4Address(const json& log, const char* key) {
+        auto it = log.find(key);
+        if (it == log.end() || !it->is_string()) return 0;
+        uint32_t addr = 0;
+        if (inet_pton(AF_INET, it->get_ref<const std::string&>().c_str(), &addr) != 1) return 0;
+        return addr;
+    }
+
+    /**
+     * @brief Parse "YYYY-MM-DD HH:MM:SS.UUUUUU" (local time) into ns since the epoch
+     *
+     * mktime() is slow and takes the timezone lock, so the seconds part is cached
+     * per thread: consecutive records almost always share the same second.
+     *
+     * @return 0 if the string does not have the expected shape
+     */
+    inline uint64_t parseTimestamp(const std::string& text) {
+        thread_local char cached_prefix[20] = {0};
+        thread_local time_t cached_secs = 0;
+
+        if (text.size() < 19) return 0;
+
+        if (memcmp(cached_prefix, text.data(), 19) != 0) {
+            struct tm tm_info;
+            memset(&tm_info, 0, sizeof(tm_info));
+            if (sscanf(text.c_str(), "%4d-%2d-%2d %2d:%2d:%2d",
+                       &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday,
+                       &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec) != 6) {
+                return 0;
+            }
+            tm_info.tm_year -= 1900;
+            tm_info.tm_mon -= 1;
+            tm_info.tm_isdst = -1;
+            time_t secs = mktime(&tm_info);
+            if (secs == static_cast<time_t>(-1)) return 0;
+
+            memcpy(cached_prefix, text.data(), 19);
+            cached_secs = secs;
+        }
+
+        uint64_t usec = 0;
+        if (text.size() > 20 && text[19] == '.') {
+            for (size_t i = 20; i < text.size() && i < 26; ++i) {
+                if (text[i] < '0' || text[i] > '9') break;
+                usec = usec * 10 + static_cast<uint64_t>(text[i] - '0');
+            }
+        }
+        return static_cast<uint64_t>(cached_secs) * 1000000000ull + usec * 1000ull;
+    }
+
+    /// Largest formatTimestamp() output, terminator included
+    constexpr size_t TIMESTAMP_TEXT_SIZE = 30;
+
+    /**
+     * @brief Write ts_ns as "YYYY-MM-DD HH:MM:SS.UUUUUU" (local time) to out
+     *
+     * The inverse of parseTimestamp(), with the same trick: localtime_r()
+     * and strftime() run once per second per thread, and every other call
+     * only copies the cached prefix and renders the fraction. No allocation,
+     * no shared state, so parser threads can call it freely.
+     *
+     * @param out At least TIMESTAMP_TEXT_SIZE bytes; NUL-terminated
+     * @param fraction_digits 6 (microseconds) or 9 (nanoseconds)
+     * @return Characters written, without the terminator
+     */
+    inline size_t formatTimestamp(uint64_t ts_ns, char* out, int fraction_digits = 6) {
+        thread_local char cached_prefix[20] = {0};
+        thread_local time_t cached_secs = -1;
+
+        time_t secs = static_cast<time_t>(ts_ns / 1000000000ull);
+        if (secs != cached_secs) {
+            struct tm tm_info;
+            localtime_r(&secs, &tm_info);
+            if (strftime(cached_prefix, sizeof(cached_prefix), "%Y-%m-%d %H:%M:%S", &tm_info) != 19) {
+                memset(cached_prefix, '0', 19);     // Year past 9999: not worth a slow path
+            }
+            cached_secs = secs;
+        }
+
+        memcpy(out, cached_prefix, 19);
+        out[19] = '.';
+        uint32_t fraction = static_cast<uint32_t>(ts_ns % 1000000000ull);
+        if (fraction_digits != 9) {
+            fraction_digits = 6;
+            fraction /= 1000;
+        }
+        for (int i = fraction_digits; i > 0; --i) {
+            out[19 + i] = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+        }
+        out[20 + fraction_digits] = '\0';
+        return static_cast<size_t>(20 + fraction_digits);
+    }
+
+    /// formatTimestamp() as a string, for display code
+    inline std::string formatTimestamp(uint64_t ts_ns) {
+        char buf[TIMESTAMP_TEXT_SIZE];
+        size_t n = formatTimestamp(ts_ns, buf);
+        return std::string(buf, n);
+    }
+
+    // ========================================================================
+    // JSON form
+    // ========================================================================
+
+    /**
+     * @brief Binary form of a TRAFFIC_LOG JSON object
+     *
+     * Uses "ts_ns" when present, otherwise parses "timestamp". ts_ns stays 0
+     * if neither is usable; the receiver decides what to substitute.
+     * Likewise the parser's raw "src_ip"/"dst_ip" numbers are preferred over
+     * the "src"/"dst" text that JSON peers send.
+     */
+    inline WireRecord fromJson(const json& log) {
+        WireRecord r;
+        if (log.contains("ts_ns")) {
+            r.ts_ns = log["ts_ns"].get<uint64_t>();
+        } else if (log.contains("timestamp") && log["timestamp"].is_string()) {
+            r.ts_ns = parseTimestamp(log["timestamp"].get_ref<const std::string&>());
+        }
+        r.seq = log.value("seq", uint64_t{0});
+        r.src_ip = log.contains("src_ip") ? log["src_ip"].get<uint32_t>() : ipv4Address(log, "src");
+        r.dst_ip = log.contains("dst_ip") ? log["dst_ip"].get<uint32_t>() : ipv4Address(log, "dst");
+        r.length = log.value("length", uint32_t{0});
+        r.packets = log.value("packets", uint32_t{1});
+        r.sample_rate = log.value("sample_rate", uint32_t{1});
+        r.src_port = log.value("src_port", uint16_t{0});
+        r.dst_port = log.value("dst_port", uint16_t{0});
+        r.protocol = protocolNumber(log.value("protocol", std::string()));
+        if (log.value("kind", std::string()) == "flow_summary") {
+            r.flags |= WireRecord::FLAG_FLOW_SUMMARY;
+        }
+        if (log.value("replayed", false)) {
+            r.flags |= WireRecord::FLAG_REPLAYED;
+        }
+        if (log.value("kind", std::string()) == "dns") {
+            bool answered = log.contains("latency_us");
+            r.flags |= WireRecord::FLAG_DNS;
+            r.flags |= dnsRcodeNumber(log.value("rcode", std::string())) << WireRecord::DNS_RCODE_SHIFT;
+            r.length = answered ? log["latency_us"].get<uint32_t>() : WireRecord::DNS_NO_RESPONSE;
+            r.packets = answered ? 2 : 1;
+        }
+        if (log.value("kind", std::string()) == "http_summary") {
+            constexpr uint64_t LIMIT = UINT32_MAX;
+            r.flags |= WireRecord::FLAG_HTTP_SUMMARY;
+            r.dst_port = log.value("status", uint16_t{0});
+            r.packets = static_cast<uint32_t>(std::min(LIMIT, log.value("requests", uint64_t{0})));
+            r.length = static_cast<uint32_t>(std::min(LIMIT, log.value("latency_us", uint64_t{0})));
+        }
+        return r;
+    }
+
+    /**
+     * @brief JSON fields of a DNS transaction record ("kind":"dns")
+     *
+     * "latency_us" and "rcode" if the query was answered, "timeout":true if
+     * not. Takes the record's flags and length (see the file comment).
+     */
+    inline void dnsFields(json& log, uint8_t flags, uint32_t length) {
+        log["kind"] = "dns";
+        if (length == WireRecord::DNS_NO_RESPONSE) {
+            log["timeout"] = true;
+        } else {
+            log["latency_us"] = length;
+            log["rcode"] = dnsRcodeName(static_cast<uint8_t>(flags >> WireRecord::DNS_RCODE_SHIFT));
+        }
+    }
+
+    /**
+     * @brief TRAFFIC_LOG JSON object for a binary record
+     *
+     * Same field names and optional fields as the sniffer's own JSON, plus
+     * "ts_ns" so no precision is lost.
+     */
+    inline json toJson(const WireRecord& r) {
+        json log;
+        log["timestamp"] = formatTimestamp(r.ts_ns);
+        log["ts_ns"] = r.ts_ns;
+        log["src"] = ipText(r.src_ip);
+        log["dst"] = ipText(r.dst_ip);
+        log["protocol"] = protocolName(r.protocol);
+        if (r.protocol == 6 || r.protocol == 17) {
+            log["src_port"] = r.src_port;
+            log["dst_port"] = r.dst_port;
+        }
+        if (r.seq) log["seq"] = r.seq;
+        if (r.sample_rate > 1) log["sample_rate"] = r.sample_rate;
+        if (r.flags & WireRecord::FLAG_DNS) {
+            dnsFields(log, r.flags, r.length);
+        } else if (r.flags & WireRecord::FLAG_HTTP_SUMMARY) {
+            log["kind"] = "http_summary";
+            log["status"] = r.dst_port;
+            log["requests"] = r.packets;
+            log["latency_us"] = r.length;
+        } else if (r.flags & WireRecord::FLAG_FLOW_SUMMARY) {
+            log["length"] = r.length;
+            log["kind"] = "flow_summary";
+            log["packets"] = r.packets;
+            log["bytes"] = r.length;
+        } else {
+            log["length"] = r.length;
+            if (r.packets > 1) log["packets"] = r.packets;
+        }
+        if (r.flags & WireRecord::FLAG_REPLAYED) log["replayed"] = true;
+        return log;
+    }
+
+} // namespace RecordCodec
@@ -0,0 +1,713 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "Protocol.h"
+#include "FrameReader.h"
+
+/**
+ * @file ShmTransport.h
+ * @brief Shared-memory transport between a sniffer and a server on the same host
+ *
+ * Over loopback TCP every frame costs a write() in the sniffer, a read() in
+ * the server and two copies through the kernel. When both run on one host
+ * the sniffer can instead hand frames over in shared memory:
+ *
+ * ```
+ *  sniffer                      shared file                       server
+ *  sendFrame() --memcpy--> [ up ring:   TRAFFIC_LOG, RECORD_BATCH, STATS ] --> handleFrame() in place
+ *  pollServerFrames() <--- [ down ring: SERVER_HELLO, CREDIT             ] <-- sendToPeer()
+ *              \___________ Unix socket: setup, doorbells, hang-up ______/
+ * ```
+ *
+ * The frames in the rings are byte-for-byte the TCP frames, so the protocol
+ * (hello, capabilities, credits) is unchanged and the server handles them
+ * with the same handleFrame(). A record is copied once, by the sniffer into
+ * the ring; the server decodes it where it lies and only then releases the
+ * space.
+ *
+ * ## Setup
+ *
+ * The server listens on a Unix socket (`--shm PATH`). The sniffer creates the
+ * shared file (memfd on Linux, an immediately unlinked POSIX shm object
+ * elsewhere), connects, and passes the file descriptor with SCM_RIGHTS. The
+ * socket then stays open: it carries doorbells, and its hang-up tells either
+ * side that the other one is gone.
+ *
+ * ## Rings and wakeups
+ *
+ * Each ring has one producer and one consumer. head and tail count bytes
+ * ever written and consumed, on separate cache lines. A frame never wraps:
+ * if it does not fit before the end, a 0x00 byte (an impossible version)
+ * marks the rest of the ring as padding. Frames are limited to half a ring,
+ * so one always fits eventually.
+ *
+ * A side that finds nothing to do spins for SPIN_BEFORE_SLEEP, then sets its
+ * "sleeping" flag, checks the ring once more and blocks in poll() on the
+ * socket. The other side writes a one-byte doorbell only when it sees that
+ * flag, so while data keeps flowing neither side makes a syscall. The
+ * doorbell is a socket byte rather than an eventfd or futex because those
+ * are Linux-only and the sniffer also runs on the BSDs and macOS; as with an
+ * eventfd, the cost is one write() per sleep, not per frame.
+ *
+ * ## Trust
+ *
+ * The server checks every frame header against the ring bounds and the
+ * decoders check every payload, so a broken sniffer cannot make the server
+ * read outside the mapping. Access is controlled by the socket file's
+ * permissions; only local sniffers may use it, and only sniffers.
+ *
+ * On Linux the memfd is sealed against shrinking and growing before it is
+ * passed, and the server refuses a file without those seals, so the sniffer
+ * cannot truncate the file under the server's mapping (which would fault the
+ * server with SIGBUS). POSIX shm has no seals: elsewhere the server trusts
+ * the local sniffer not to truncate the file it sent.
+ *
+ * Header-only: shared by the sniffer and the server.
+ */
+namespace Shm {
+
+    /// First word of the shared file and of the setup message ("SHM1")
+    constexpr uint32_t MAGIC = 0x53484d31;
+
+    /// Layout revision; bumped if Layout or the ring format changes
+    constexpr uint32_t LAYOUT_VERSION = 1;
+
+    /// Sniffer -> server ring: ~4 credit windows of full-size batches
+    constexpr size_t DEFAULT_UP_BYTES = 4u << 20;
+
+    /// Server -> sniffer ring: SERVER_HELLO and CREDIT frames only
+    constexpr size_t DEFAULT_DOWN_BYTES = 256u << 10;
+
+    /// Smallest ring: must hold two of the largest (VERSION_2) frames
+    constexpr size_t MIN_RING_BYTES = 256u << 10;
+
+    /// Largest ring the server agrees to map
+    constexpr size_t MAX_RING_BYTES = 256u << 20;
+
+    /// How long a side polls an empty (or full) ring before sleeping
+    constexpr std::chrono::microseconds SPIN_BEFORE_SLEEP{50};
+
+    /// Marks the rest of the ring as padding (no frame starts with version 0)
+    constexpr uint8_t PAD_BYTE = 0x00;
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "ring counters must be lock-free to be shared between processes");
+
+    /**
+     * @struct RingControl
+     * @brief Counters of one ring; producer and consumer fields on separate cache lines
+     */
+    struct RingControl {
+        alignas(64) std::atomic<uint64_t> head{0};          ///< Bytes ever written (producer)
+        std::atomic<uint32_t> consumer_sleeping{0};         ///< Consumer is (about to be) in poll()
+        alignas(64) std::atomic<uint64_t> tail{0};          ///< Bytes ever consumed (consumer)
+        std::atomic<uint32_t> producer_sleeping{0};         ///< Producer is waiting for room
+    };
+
+    /**
+     * @struct Layout
+     * @brief Start of the shared file; the ring data follows at dataOffset()
+     */
+    struct Layout {
+        uint32_t magic = MAGIC;
+        uint32_t version = LAYOUT_VERSION;
+        uint64_t up_bytes = 0;          ///< Capacity of the sniffer -> server ring
+        uint64_t down_bytes = 0;        ///< Capacity of the server -> sniffer ring
+        RingControl up;
+        RingControl down;
+    };
+
+    /// Ring data starts on its own page
+    inline size_t dataOffset() {
+        return (sizeof(Layout) + 4095) & ~size_t{4095};
+    }
+
+    inline bool validRingSize(uint64_t bytes) {
+        return bytes >= MIN_RING_BYTES && bytes <= MAX_RING_BYTES && (bytes & (bytes - 1)) == 0;
+    }
+
+    /// Tell the CPU we are busy-waiting (cheaper for the sibling hyperthread)
+    inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /**
+     * @class Ring
+     * @brief One direction of a channel: a byte ring of whole frames
+     *
+     * Does not own its memory. Each process uses a Ring either as producer
+     * (tryWrite) or as consumer (next/consume), never both.
+     */
+    class Ring {
+    public:
+        Ring() = default;
+
+        /// @param capacity Power of two (see validRingSize())
+        Ring(RingControl* control, char* data, size_t capacity)
+            : control_(control), data_(data), capacity_(capacity) {}
+
+        /// Largest frame (header + payload + terminator) tryWrite() accepts
+        size_t maxFrame() const { return capacity_ / 2; }
+
+        RingControl& control() const { return *control_; }
+
+        // ====================================================================
+        // Producer
+        // ====================================================================
+
+        /// Whether a frame with a payload of len bytes would fit now
+        bool hasRoom(size_t len) const {
+            uint64_t head = control_->head.load(std::memory_order_relaxed);
+            uint64_t tail = control_->tail.load(std::memory_order_acquire);
+            return head + spaceNeeded(head, len + FrameReader::FRAME_OVERHEAD) - tail <= capacity_;
+        }
+
+        /**
+         * @brief Append one frame, or return false if the ring is too full
+         *
+         * The frame becomes visible to the consumer with one release store,
+         * after its last byte is written.
+         */
+        bool tryWrite(uint8_t type, const char* payload, size_t len) {
+            size_t frame = len + FrameReader::FRAME_OVERHEAD;
+            if (frame > maxFrame() || len > Protocol::MAX_LARGE_PAYLOAD_SIZE) return false;
+
+            uint64_t head = control_->head.load(std::memory_order_relaxed);
+            uint64_t tail = control_->tail.load(std::memory_order_acquire);
+            size_t need = spaceNeeded(head, frame);
+            if (head + need - tail > capacity_) return false;
+
+            size_t pos = static_cast<size_t>(head) & (capacity_ - 1);
+            if (need > frame) {
+                data_[pos] = static_cast<char>(PAD_BYTE);
+                head += capacity_ - pos;
+                pos = 0;
+            }
+
+            char* out = data_ + pos;
+            out[0] = static_cast<char>(Protocol::frameVersion(len));
+            out[1] = static_cast<char>(type);
+            out[2] = static_cast<char>((len >> 8) & 0xFF);
+            out[3] = static_cast<char>(len & 0xFF);
+            if (len > 0) std::memcpy(out + 4, payload, len);
+            out[4 + len] = static_cast<char>(Protocol::TERM_BYTE);
+
+            control_->head.store(head + frame, std::memory_order_release);
+            return true;
+        }
+
+        // ====================================================================
+        // Consumer
+        // ====================================================================
+
+        /// Whether the producer has published anything not yet consumed
+        bool readable() const {
+            return control_->head.load(std::memory_order_acquire) !=
+                   control_->tail.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Parse the oldest unconsumed frame in place
+         *
+         * The payload points into the ring and stays valid until consume().
+         * Calling next() again without consume() returns the same frame.
+         *
+         * @return FRAME, NEED_MORE (ring empty) or BAD_FRAME (see error())
+         */
+        FrameReader::Status next(FrameView& frame) {
+            uint64_t tail = control_->tail.load(std::memory_order_relaxed);
+            uint64_t head = control_->head.load(std::memory_order_acquire);
+            if (head == tail) return FrameReader::Status::NEED_MORE;
+            if (head - tail > capacity_) return bad("ring counters out of range");
+
+            size_t pos = static_cast<size_t>(tail) & (capacity_ - 1);
+            if (static_cast<uint8_t>(data_[pos]) == PAD_BYTE) {
+                // Padding runs to the end of the ring; the frame is at 0
+                uint64_t skip = capacity_ - pos;
+                if (head - tail < skip) return bad("truncated padding");
+                tail += skip;
+                control_->tail.store(tail, std::memory_order_release);
+                if (head == tail) return FrameReader::Status::NEED_MORE;
+                pos = 0;
+            }
+
+            // The producer wrote the whole frame contiguously before publishing
+            size_t available = std::min<uint64_t>(head - tail, capacity_ - pos);
+            if (available < FrameReader::FRAME_OVERHEAD) return bad("truncated frame header");
+
+            const uint8_t* header = reinterpret_cast<const uint8_t*>(data_ + pos);
+            uint8_t version = header[0];
+            size_t length = (static_cast<size_t>(header[2]) << 8) | header[3];
+            if (version != Protocol::VERSION && version != Protocol::VERSION_2) {
+                return bad("invalid protocol version " + std::to_string(version));
+            }
+            if (version == Protocol::VERSION_2 && !large_frames_) {
+                return bad("large frame without the large_frames capability");
+            }
+            if (version == Protocol::VERSION && length > Protocol::MAX_PAYLOAD_SIZE) {
+                return bad("payload too large (" + std::to_string(length) + " bytes)");
+            }
+            if (length + FrameReader::FRAME_OVERHEAD > available) return bad("frame overruns the ring");
+            if (header[4 + length] != Protocol::TERM_BYTE) {
+                return bad("invalid terminator byte " + std::to_string(header[4 + length]));
+            }
+
+            frame.type = header[1];
+            frame.payload = std::string_view(data_ + pos + 4, length);
+            pending_ = length + FrameReader::FRAME_OVERHEAD;
+            return FrameReader::Status::FRAME;
+        }
+
+        /// Release the frame returned by next() to the producer
+        void consume() {
+            uint64_t tail = control_->tail.load(std::memory_order_relaxed);
+            control_->tail.store(tail + pending_, std::memory_order_release);
+            pending_ = 0;
+        }
+
+        const std::string& error() const { return error_; }
+
+        /// Accept VERSION_2 frames from now on (CAP_LARGE_FRAMES was negotiated)
+        void allowLargeFrames(bool allow) { large_frames_ = allow; }
+
+    private:
+        /// Bytes a frame takes at head, including padding to skip the ring's end
+        size_t spaceNeeded(uint64_t head, size_t frame) const {
+            size_t to_end = capacity_ - (static_cast<size_t>(head) & (capacity_ - 1));
+            return frame <= to_end ? frame : to_end + frame;
+        }
+
+        FrameReader::Status bad(const std::string& why) {
+            error_ = why;
+            return FrameReader::Status::BAD_FRAME;
+        }
+
+        RingControl* control_ = nullptr;
+        char* data_ = nullptr;
+        size_t capacity_ = 0;
+        size_t pending_ = 0;        ///< Size of the frame next() returned
+        bool large_frames_ = false;
+        std::string error_;
+    };
+
+    /**
+     * @class Channel
+     * @brief Both rings of one sniffer connection, plus the socket that backs them
+     *
+     * The sniffer creates one with connect(), the server with accept(). The
+     * sniffer produces on the up ring and consumes the down ring; the server
+     * the other way round. Not thread-safe: each side drives its channel from
+     * one thread.
+     */
+    class Channel {
+    public:
+        /**
+         * @brief Sniffer side: create the shared file and hand it to the server at path
+         * @throws std::runtime_error if the socket or the shared memory cannot be set up
+         */
+        static std::unique_ptr<Channel> connect(const std::string& path,
+                                                size_t up_bytes = DEFAULT_UP_BYTES,
+                                                size_t down_bytes = DEFAULT_DOWN_BYTES) {
+            if (!validRingSize(up_bytes) || !validRingSize(down_bytes)) {
+                throw std::runtime_error("shared-memory ring sizes must be powers of two between " +
+                                         std::to_string(MIN_RING_BYTES) + " and " +
+                                         std::to_string(MAX_RING_BYTES) + " bytes");
+            }
+
+            int fd = connectUnix(path);
+            size_t map_len = dataOffset() + up_bytes + down_bytes;
+            int mem = createSharedFile(map_len);
+            if (mem < 0) {
+                int err = errno;
+                ::close(fd);
+                throw std::runtime_error(std::string("shared memory: ") + strerror(err));
+            }
+
+            void* map = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, mem, 0);
+            if (map == MAP_FAILED) {
+                int err = errno;
+                ::close(mem);
+                ::close(fd);
+                throw std::runtime_error(std::string("mmap: ") + strerror(err));
+            }
+            Layout* layout = new (map) Layout();
+            layout->up_bytes = up_bytes;
+            layout->down_bytes = down_bytes;
+
+            bool sent = sendDescriptor(fd, mem);
+            int err = errno;
+            ::close(mem);       // The mapping and the server's copy keep it alive
+            if (!sent) {
+                munmap(map, map_len);
+                ::close(fd);
+                throw std::runtime_error(std::string("passing shared memory to the server: ") + strerror(err));
+            }
+            return std::unique_ptr<Channel>(new Channel(fd, map, map_len, up_bytes, down_bytes, true));
+        }
+
+        /**
+         * @brief Server side: receive and map the shared file a sniffer sent on fd
+         *
+         * Takes ownership of fd (closed on failure too). The ring sizes are
+         * validated once and kept locally, so the sniffer cannot change them
+         * afterwards. The header is read through a mapping rather than
+         * pread(), which POSIX shm objects do not support on every system
+         * (macOS fails it with ENXIO).
+         *
+         * @throws std::runtime_error if the setup message or the file is invalid
+         */
+        static std::unique_ptr<Channel> accept(int fd) {
+            int mem = receiveDescriptor(fd);
+            if (mem < 0) {
+                ::close(fd);
+                throw std::runtime_error("no shared-memory descriptor in setup message");
+            }
+
+#ifdef __linux__
+            // A file the sniffer could still resize would let it fault us
+            int seals = fcntl(mem, F_GET_SEALS);
+            if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+                ::close(mem);
+                ::close(fd);
+                throw std::runtime_error("shared-memory file is not sealed against resizing");
+            }
+#endif
+
+            struct stat st;
+            void* head = MAP_FAILED;
+            if (fstat(mem, &st) == 0 && static_cast<size_t>(st.st_size) >= dataOffset()) {
+                head = mmap(nullptr, dataOffset(), PROT_READ, MAP_SHARED, mem, 0);
+            }
+            bool readable = head != MAP_FAILED;
+            uint32_t magic = 0, version = 0;
+            size_t up_bytes = 0, down_bytes = 0;
+            if (readable) {
+                const Layout* header = static_cast<const Layout*>(head);
+                magic = header->magic;
+                version = header->version;
+                up_bytes = header->up_bytes;
+                down_bytes = header->down_bytes;
+                munmap(head, dataOffset());
+            }
+            if (!readable || magic != MAGIC || version != LAYOUT_VERSION ||
+                !validRingSize(up_bytes) || !validRingSize(down_bytes) ||
+                static_cast<size_t>(st.st_size) < dataOffset() + up_bytes + down_bytes) {
+                ::close(mem);
+                ::close(fd);
+                throw std::runtime_error("shared-memory file has an unexpected layout");
+            }
+
+            size_t map_len = dataOffset() + up_bytes + down_bytes;
+            void* map = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, mem, 0);
+            int err = errno;
+            ::close(mem);
+            if (map == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error(std::string("mmap: ") + strerror(err));
+            }
+            return std::unique_ptr<Channel>(new Channel(fd, map, map_len, up_bytes, down_bytes, false));
+        }
+
+        /**
+         * @brief Server side: bind and listen on a Unix socket at path
+         *
+         * A stale socket file from an earlier run is removed first.
+         *
+         * @return The listening socket
+         * @throws std::runtime_error if the path is too long or bind/listen fails
+         */
+        static int listen(const std::string& path) {
+            struct sockaddr_un addr = unixAddress(path);
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+            ::unlink(path.c_str());
+            if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+                ::listen(fd, 16) < 0) {
+                int err = errno;
+                ::close(fd);
+                throw std::runtime_error("cannot listen on " + path + ": " + strerror(err));
+            }
+            return fd;
+        }
+
+        ~Channel() {
+            munmap(map_, map_len_);
+            ::close(fd_);
+        }
+
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+
+        /// The Unix socket (doorbells and hang-up detection)
+        int fd() const { return fd_; }
+
+        /// The peer hung up
+        bool closed() const { return closed_; }
+
+        /// Doorbells this side has written: its syscalls in the steady state
+        uint64_t doorbells() const { return doorbells_; }
+
+        /// Why next() returned BAD_FRAME
+        const std::string& error() const { return rx_.error(); }
+
+        /**
+         * @brief Send one frame to the peer
+         *
+         * @param wait Block while the ring is full (the sniffer, like a
+         *             blocking socket) instead of failing (the server, like
+         *             its capped send queues)
+         * @return false if the frame is too large, the ring is full and wait
+         *         is false, or the peer hung up
+         */
+        bool send(uint8_t type, const char* payload, size_t len, bool wait) {
+            while (!tx_.tryWrite(type, payload, len)) {
+                if (!wait || closed_ || len + FrameReader::FRAME_OVERHEAD > tx_.maxFrame()) return false;
+                RingControl& control = tx_.control();
+                park(control.producer_sleeping, [&] { return tx_.hasRoom(len); }, 1000);
+            }
+            wakeIfSleeping(tx_.control().consumer_sleeping);
+            return true;
+        }
+
+        /// Accept VERSION_2 frames from the peer (CAP_LARGE_FRAMES was negotiated)
+        void allowLargeFrames(bool allow) { rx_.allowLargeFrames(allow); }
+
+        /// Parse the next received frame in place (see Ring::next())
+        FrameReader::Status next(FrameView& frame) { return rx_.next(frame); }
+
+        /// Release the frame returned by next(), waking a producer waiting for room
+        void consume() {
+            rx_.consume();
+            wakeIfSleeping(rx_.control().producer_sleeping);
+        }
+
+        /**
+         * @brief Wait until a frame can be received
+         * @return false on timeout or if the peer hung up (see closed())
+         */
+        bool waitReadable(int timeout_ms) {
+            return park(rx_.control().consumer_sleeping, [&] { return rx_.readable(); }, timeout_ms);
+        }
+
+        /**
+         * @brief Blocking receive of one frame; consume() it when done
+         * @return false on timeout, hang-up or a corrupt frame
+         */
+        bool readFrame(FrameView& frame, int timeout_ms) {
+            while (true) {
+                FrameReader::Status status = next(frame);
+                if (status == FrameReader::Status::FRAME) return true;
+                if (status == FrameReader::Status::BAD_FRAME) return false;
+                if (!waitReadable(timeout_ms)) return false;
+            }
+        }
+
+    private:
+        Channel(int fd, void* map, size_t map_len, size_t up_bytes, size_t down_bytes, bool sniffer_side)
+            : fd_(fd), map_(map), map_len_(map_len) {
+            Layout* layout = static_cast<Layout*>(map);
+            char* data = static_cast<char*>(map) + dataOffset();
+            Ring up(&layout->up, data, up_bytes);
+            Ring down(&layout->down, data + up_bytes, down_bytes);
+            tx_ = sniffer_side ? up : down;
+            rx_ = sniffer_side ? down : up;
+        }
+
+        /**
+         * @brief Spin, then sleep on the socket until ready() or timeout
+         *
+         * Announces the sleep in flag and re-checks ready() afterwards, so a
+         * peer that published in between either sees the flag (and rings) or
+         * its data is seen here. The fences order each side's store before
+         * its load of the other side's variable.
+         */
+        template <typename Ready>
+        bool park(std::atomic<uint32_t>& flag, Ready ready, int timeout_ms) {
+            auto spin_until = std::chrono::steady_clock::now() + SPIN_BEFORE_SLEEP;
+            for (uint32_t i = 1; !ready(); ++i) {
+                if ((i & 63) == 0 && std::chrono::steady_clock::now() >= spin_until) break;
+                cpuRelax();
+            }
+            if (ready()) return true;
+
+            flag.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready()) {
+                sleepOnSocket(timeout_ms);
+            }
+            flag.store(0, std::memory_order_relaxed);
+            return ready();
+        }
+
+        /// After publishing: ring the doorbell if the peer said it sleeps
+        void wakeIfSleeping(std::atomic<uint32_t>& flag) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (flag.load(std::memory_order_relaxed) && flag.exchange(0, std::memory_order_relaxed)) {
+                char bell = 1;
+                int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+                flags |= MSG_NOSIGNAL;
+#endif
+                // EAGAIN: the socket is full of doorbells, the peer wakes anyway
+                if (::send(fd_, &bell, 1, flags) == 1) doorbells_++;
+            }
+        }
+
+        /// poll() the socket, then drain whatever doorbells arrived
+        void sleepOnSocket(int timeout_ms) {
+            struct pollfd pfd;
+            pfd.fd = fd_;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, timeout_ms) <= 0) return;
+
+            char bells[64];
+            while (true) {
+                ssize_t n = recv(fd_, bells, sizeof(bells), MSG_DONTWAIT);
+                if (n == 0) closed_ = true;
+                if (n <= 0) {
+                    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closed_ = true;
+                    return;
+                }
+            }
+        }
+
+        static struct sockaddr_un unixAddress(const std::string& path) {
+            struct sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+                throw std::runtime_error("invalid Unix socket path '" + path + "'");
+            }
+            std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+            return addr;
+        }
+
+        static int connectUnix(const std::string& path) {
+            struct sockaddr_un addr = unixAddress(path);
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+                int err = errno;
+                ::close(fd);
+                throw std::runtime_error("cannot connect to " + path + ": " + strerror(err));
+            }
+            return fd;
+        }
+
+        /// Anonymous shared file of len bytes, zero-filled (and sealed at that size on Linux)
+        static int createSharedFile(size_t len) {
+#ifdef __linux__
+            int mem = memfd_create("sniffer-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+            // No memfd: create a uniquely named object and unlink it at once
+            static std::atomic<uint32_t> counter{0};
+            std::string name = "/sniffer-shm-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+            int mem = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (mem >= 0) shm_unlink(name.c_str());
+#endif
+            if (mem < 0) return -1;
+            bool sized = ftruncate(mem, static_cast<off_t>(len)) == 0;
+#ifdef __linux__
+            // The server refuses a file it could see shrink (see accept())
+            sized = sized && fcntl(mem, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0;
+#endif
+            if (!sized) {
+                int err = errno;
+                ::close(mem);
+                errno = err;
+                return -1;
+            }
+            return mem;
+        }
+
+        /// Setup message: MAGIC plus the descriptor as SCM_RIGHTS
+        static bool sendDescriptor(int fd, int mem) {
+            uint32_t magic = MAGIC;
+            struct iovec iov;
+            iov.iov_base = &magic;
+            iov.iov_len = sizeof(magic);
+
+            alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &mem, sizeof(int));
+
+            return sendmsg(fd, &msg, 0) == static_cast<ssize_t>(sizeof(magic));
+        }
+
+        /// @return The received descriptor, or -1
+        static int receiveDescriptor(int fd) {
+            uint32_t magic = 0;
+            struct iovec iov;
+            iov.iov_base = &magic;
+            iov.iov_len = sizeof(magic);
+
+            alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t n;
+            do {
+                n = recvmsg(fd, &msg, 0);
+            } while (n < 0 && errno == EINTR);
+
+            int mem = -1;
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            if (n > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+                std::memcpy(&mem, CMSG_DATA(cmsg), sizeof(int));
+            }
+            if (mem >= 0 && (n != static_cast<ssize_t>(sizeof(magic)) || magic != MAGIC ||
+                             (msg.msg_flags & MSG_CTRUNC))) {
+                ::close(mem);
+                mem = -1;
+            }
+            return mem;
+        }
+
+        int fd_;
+        void* map_;
+        size_t map_len_;
+        Ring tx_;                   ///< Ring this side produces on
+        Ring rx_;                   ///< Ring this side consumes
+        bool closed_ = false;
+        uint64_t doorbells_ = 0;
+    };
+
+} // namespace Shm
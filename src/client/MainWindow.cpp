@@ -18,6 +18,53 @@
 #include <QSplitter>
 #include <QApplication>
 
+namespace {
+
+/// Protocol column of a "kind":"dns" record: "DNS A example.com NOERROR 1.234 ms"
+QString dnsLabel(const json& record) {
+    QString label = "DNS";
+    if (record.contains("qtype")) label += " " + QString::fromStdString(record["qtype"].get<std::string>());
+    if (record.contains("qname")) label += " " + QString::fromStdString(record["qname"].get<std::string>());
+    if (record.contains("latency_us")) {
+        label += QString(" %1 %2 ms").arg(QString::fromStdString(record.value("rcode", std::string())))
+                                     .arg(record["latency_us"].get<uint64_t>() / 1000.0, 0, 'f', 3);
+    } else {
+        label += " no response";
+    }
+    return label;
+}
+
+/// Appended to the protocol of a record that carries a ClientHello: " TLS 1.3 example.com h2,http/1.1"
+QString tlsSuffix(const json& record) {
+    QString suffix = " TLS " + QString::fromStdString(record["tls_version"].get<std::string>());
+    if (record.contains("sni")) suffix += " " + QString::fromStdString(record["sni"].get<std::string>());
+    if (record.contains("alpn")) suffix += " " + QString::fromStdString(record["alpn"].get<std::string>());
+    return suffix;
+}
+
+/// Appended to the protocol of a packet taken out of a tunnel: " in vxlan 42 192.0.2.1>192.0.2.2"
+QString tunnelSuffix(const json& record) {
+    QString suffix = " in " + QString::fromStdString(record["tunnel"].get<std::string>());
+    if (record.contains("vni")) suffix += QString(" %1").arg(record["vni"].get<uint32_t>());
+    if (record.contains("tunnel_src")) {
+        suffix += " " + QString::fromStdString(record["tunnel_src"].get<std::string>()) + ">" +
+                  QString::fromStdString(record.value("tunnel_dst", std::string()));
+    }
+    return suffix;
+}
+
+/// Protocol column of a "kind":"http_summary" record: "HTTP example.com 200 x42 12.345 ms"
+QString httpLabel(const json& record) {
+    QString label = "HTTP";
+    if (record.contains("host")) label += " " + QString::fromStdString(record["host"].get<std::string>());
+    label += QString(" %1 x%2 %3 ms").arg(record.value("status", 0u))
+                                     .arg(record.value("requests", uint64_t{0}))
+                                     .arg(record.value("latency_us", uint64_t{0}) / 1000.0, 0, 'f', 3);
+    return label;
+}
+
+} // namespace
+
 /**
  * @brief Construct main window and set up UI
  *
@@ -38,6 +85,10 @@ MainWindow::MainWindow(QWidget* parent)
     connect(client_, &SnifferClient::disconnected, this, &MainWindow::onClientDisconnected);
     connect(client_, &SnifferClient::connectionError, this, &MainWindow::onConnectionError);
     connect(client_, &SnifferClient::forwardLogReceived, this, &MainWindow::onForwardLogReceived);
+    connect(client_, &SnifferClient::forwardBatchReceived, this, &MainWindow::onForwardBatchReceived);
+    connect(client_, &SnifferClient::lossStatsReceived, this, &MainWindow::onLossStatsReceived);
+    connect(client_, &SnifferClient::queryResultReceived, this, &MainWindow::onQueryResultReceived);
+    connect(client_, &SnifferClient::queryFinished, this, &MainWindow::onQueryFinished);
 }
 
 /**
@@ -50,8 +101,10 @@ MainWindow::~MainWindow() = default;
  *
  * Creates:
  * 1. Connection panel with host/port input and status indicator
- * 2. Tab widget container for per-SSID tables
- * 3. Status bar at bottom
+ * 2. Filter panel (also used by history queries)
+ * 3. History query panel
+ * 4. Tab widget container for per-SSID tables
+ * 5. Status bar at bottom
  */
 void MainWindow::setupUI() {
     setWindowTitle("Network Sniffer Monitor");
@@ -128,6 +181,53 @@ void MainWindow::setupUI() {
 
     mainLayout->addWidget(filterGroup);
 
+    // ====================================================================
+    // HISTORY QUERY PANEL
+    // ====================================================================
+    // Runs on the server over its stored records, so it is not limited to
+    // the MAX_ROWS rows the live tables keep. Protocol / Source IP / Dest IP
+    // from the filter panel above are applied as exact matches.
+    QGroupBox* queryGroup = new QGroupBox("History Query", this);
+    QHBoxLayout* queryLayout = new QHBoxLayout(queryGroup);
+
+    queryLayout->addWidget(new QLabel("SSID:", this));
+    querySsid_ = new QSpinBox(this);
+    querySsid_->setRange(0, 1000000);
+    querySsid_->setToolTip("0 = all sniffers");
+    querySsid_->setFixedWidth(80);
+    queryLayout->addWidget(querySsid_);
+
+    queryLayout->addWidget(new QLabel("Last (min):", this));
+    queryMinutes_ = new QSpinBox(this);
+    queryMinutes_->setRange(0, 525600);
+    queryMinutes_->setValue(60);
+    queryMinutes_->setToolTip("0 = all stored history");
+    queryMinutes_->setFixedWidth(80);
+    queryLayout->addWidget(queryMinutes_);
+
+    queryLayout->addWidget(new QLabel("Port:", this));
+    queryPort_ = new QSpinBox(this);
+    queryPort_->setRange(0, 65535);
+    queryPort_->setToolTip("Source or destination port, 0 = any");
+    queryPort_->setFixedWidth(80);
+    queryLayout->addWidget(queryPort_);
+
+    queryLayout->addWidget(new QLabel("Show:", this));
+    queryGroupBy_ = new QComboBox(this);
+    QStringList groupings;
+    groupings << "Records" << "dst_port" << "src_port" << "dst" << "src" << "protocol";
+    queryGroupBy_->addItems(groupings);
+    queryLayout->addWidget(queryGroupBy_);
+
+    queryButton_ = new QPushButton("Run Query", this);
+    queryButton_->setEnabled(false);
+    connect(queryButton_, &QPushButton::clicked, this, &MainWindow::onRunQueryClicked);
+    queryLayout->addWidget(queryButton_);
+
+    queryLayout->addStretch();
+
+    mainLayout->addWidget(queryGroup);
+
     // ====================================================================
     // TAB WIDGET FOR SNIFFER TABLES
     // ====================================================================
@@ -180,6 +280,7 @@ void MainWindow::onClientConnected() {
     disconnectButton_->setEnabled(true);
     hostEdit_->setEnabled(false);
     portSpinBox_->setEnabled(false);
+    queryButton_->setEnabled(true);
     updateConnectionStatus("Connected");
     statusBar()->showMessage("Connected to server");
 }
@@ -194,6 +295,8 @@ void MainWindow::onClientDisconnected() {
     disconnectButton_->setEnabled(false);
     hostEdit_->setEnabled(true);
     portSpinBox_->setEnabled(true);
+    queryButton_->setEnabled(false);
+    activeQuery_ = 0;
     updateConnectionStatus("Disconnected");
     statusBar()->showMessage("Disconnected from server");
 }
@@ -238,24 +341,255 @@ void MainWindow::onForwardLogReceived(uint32_t ssid, const json& log) {
 
     SSIDStats& stats = ssidStatsData_[ssid];
 
+    // A flow summary (sent while the sniffer is out of credits) stands for
+    // many packets, and a sampled record for sample_rate packets; scale
+    // both back up so the totals estimate the real traffic
+    uint32_t rate = log.value("sample_rate", 1u);
+    uint32_t packets = log.value("packets", 1u) * rate;
+
     // Count packet
-    stats.totalPackets++;
+    stats.totalPackets += packets;
 
     // Add to protocol count
     QString protocol = log.contains("protocol") ?
         QString::fromStdString(log["protocol"].get<std::string>()) : "OTHER";
-    stats.protocolCounts[protocol]++;
+    stats.protocolCounts[protocol] += packets;
 
     // Add to byte count
-    int length = log.contains("length") ? log["length"].get<int>() : 0;
-    stats.totalBytes += length;
+    uint64_t length = log.value("length", uint64_t{0});
+    stats.totalBytes += length * rate;
+
+    refreshStatsWidget(ssid);
+}
+
+/**
+ * @brief [Qt Slot] Handle a batch of forwarded records from a sniffer
+ *
+ * Statistics are summed column by column: packets x sample_rate, length x
+ * sample_rate and a per-protocol-number count, with no per-record JSON or
+ * string work. Only the newest MAX_ROWS records can survive in the table,
+ * so only those are turned into rows.
+ *
+ * @param ssid Sniffer Session ID identifying the source sniffer
+ * @param records Decoded batch, oldest first
+ */
+void MainWindow::onForwardBatchReceived(uint32_t ssid, const RecordColumns& records) {
+    QTableWidget* table = getOrCreateTabForSSID(ssid);
+
+    size_t count = records.size();
+    size_t first = count > static_cast<size_t>(MAX_ROWS) ? count - MAX_ROWS : 0;
+    table->setUpdatesEnabled(false);
+    for (size_t i = first; i < count; ++i) {
+        addRecordRowToTable(table, records, i);
+    }
+    table->setUpdatesEnabled(true);
+
+    // ====================================================================
+    // UPDATE STATISTICS
+    // ====================================================================
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t byProtocol[256] = {0};
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t scaled = static_cast<uint64_t>(records.packets[i]) * records.sample_rate[i];
+        packets += scaled;
+        bytes += static_cast<uint64_t>(records.length[i]) * records.sample_rate[i];
+        byProtocol[records.protocol[i]] += scaled;
+    }
 
-    // Update stats widget if visible
+    SSIDStats& stats = ssidStatsData_[ssid];
+    stats.totalPackets += static_cast<uint32_t>(packets);
+    stats.totalBytes += bytes;
+    for (int protocol = 0; protocol < 256; ++protocol) {
+        if (byProtocol[protocol]) {
+            stats.protocolCounts[RecordCodec::protocolName(static_cast<uint8_t>(protocol))] +=
+                static_cast<uint32_t>(byProtocol[protocol]);
+        }
+    }
+
+    refreshStatsWidget(ssid);
+}
+
+/**
+ * @brief Update an SSID's stats widget, if it has one, from ssidStatsData_
+ */
+void MainWindow::refreshStatsWidget(uint32_t ssid) {
     if (ssidStats_.contains(ssid)) {
+        const SSIDStats& stats = ssidStatsData_[ssid];
         ssidStats_[ssid]->updateStats(stats.totalPackets, stats.protocolCounts, stats.totalBytes);
     }
 }
 
+/**
+ * @brief [Qt Slot] Handle loss counters for a sniffer
+ *
+ * Flattens the sniffer/server/gui sections of a STATS frame into the
+ * per-stage counters shown by that SSID's StatsWidget.
+ *
+ * @param ssid Sniffer Session ID the counters belong to
+ * @param stats Combined STATS object (see SnifferClient::lossStatsReceived)
+ */
+void MainWindow::onLossStatsReceived(uint32_t ssid, const json& stats) {
+    getOrCreateTabForSSID(ssid);
+
+    auto counter = [&stats](const char* section, const char* key) -> quint64 {
+        if (!stats.contains(section)) return 0;
+        return stats[section].value(key, uint64_t{0});
+    };
+
+    StatsWidget::LossCounters loss;
+    loss.kernelDrops = counter("sniffer", "kernel_drop");
+    loss.ringDrops = counter("sniffer", "ring_drop");
+    loss.sendDrops = counter("sniffer", "send_drop");
+    loss.serverGaps = counter("server", "seq_gap");
+    loss.serverDecode = counter("server", "decode_drop");
+    loss.fanoutDrops = counter("server", "fanout_drop");
+    loss.guiGaps = counter("gui", "seq_gap");
+    loss.guiDecode = counter("gui", "decode_error");
+
+    ssidStats_[ssid]->updateLoss(loss);
+    ssidStats_[ssid]->updateSampling(static_cast<uint32_t>(counter("sniffer", "sample_rate")));
+}
+
+// ============================================================================
+// HISTORY QUERIES
+// ============================================================================
+
+/**
+ * @brief [Qt Slot] Build a QUERY from the filter and query panels and send it
+ *
+ * Replaces any query still in flight: results for an older id are ignored.
+ */
+void MainWindow::onRunQueryClicked() {
+    json query;
+    if (querySsid_->value() > 0) query["ssid"] = querySsid_->value();
+    if (queryMinutes_->value() > 0) {
+        qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+        query["from_ns"] = static_cast<uint64_t>(nowMs - qint64(queryMinutes_->value()) * 60000) * 1000000ull;
+    }
+    if (queryPort_->value() > 0) query["port"] = queryPort_->value();
+    if (!filterProtocol_->text().isEmpty()) query["protocol"] = filterProtocol_->text().toUpper().toStdString();
+    if (!filterSource_->text().isEmpty()) query["src"] = filterSource_->text().toStdString();
+    if (!filterDest_->text().isEmpty()) query["dst"] = filterDest_->text().toStdString();
+    if (queryGroupBy_->currentIndex() > 0) query["group_by"] = queryGroupBy_->currentText().toStdString();
+
+    QTableWidget* table = getOrCreateQueryTab();
+    table->setSortingEnabled(false);   // Re-enabled once all batches are in
+    table->setRowCount(0);
+
+    QStringList headers;
+    if (query.contains("group_by")) {
+        headers << queryGroupBy_->currentText() << "Packets" << "Bytes" << "Records";
+    } else {
+        headers << "Timestamp" << "Protocol" << "Source" << "Dest" << "Src Port" << "Dst Port" << "Length" << "SSID";
+    }
+    table->setColumnCount(headers.size());
+    table->setHorizontalHeaderLabels(headers);
+
+    activeQuery_ = client_->sendQuery(query);
+    statusBar()->showMessage(activeQuery_ ? "Query running..." : "Query could not be sent");
+}
+
+/**
+ * @brief [Qt Slot] Append one batch of query results to the query table
+ *
+ * @param id Query id; batches of superseded queries are dropped
+ * @param batch QUERY_RESULT payload with "rows" or "groups"
+ */
+void MainWindow::onQueryResultReceived(quint32 id, const json& batch) {
+    if (id != activeQuery_ || !queryTable_) return;
+    QTableWidget* table = queryTable_;
+
+    auto text = [](const json& obj, const char* key) -> QString {
+        if (!obj.contains(key)) return "";
+        const json& value = obj[key];
+        return value.is_string() ? QString::fromStdString(value.get<std::string>())
+                                 : QString::fromStdString(value.dump());
+    };
+
+    if (batch.contains("groups")) {
+        for (const auto& group : batch["groups"]) {
+            int row = table->rowCount();
+            table->insertRow(row);
+            table->setItem(row, 0, new QTableWidgetItem(text(group, "key")));
+            table->setItem(row, 1, new QTableWidgetItem(text(group, "packets")));
+            table->setItem(row, 2, new QTableWidgetItem(text(group, "bytes")));
+            table->setItem(row, 3, new QTableWidgetItem(text(group, "records")));
+        }
+    } else if (batch.contains("rows")) {
+        for (const auto& record : batch["rows"]) {
+            // Rows arrive newest first; append to keep that order
+            int row = table->rowCount();
+            table->insertRow(row);
+
+            qint64 ms = static_cast<qint64>(record.value("ts_ns", uint64_t{0}) / 1000000);
+            QString protocol = text(record, "protocol");
+            if (record.value("kind", "") == "flow_summary") {
+                protocol += QString(" (flow x%1)").arg(record.value("packets", 1u));
+            } else if (record.value("kind", "") == "dns") {
+                protocol = dnsLabel(record);
+            }
+
+            table->setItem(row, 0, new QTableWidgetItem(
+                QDateTime::fromMSecsSinceEpoch(ms).toString("yyyy-MM-dd HH:mm:ss.zzz")));
+            table->setItem(row, 1, new QTableWidgetItem(protocol));
+            table->setItem(row, 2, new QTableWidgetItem(text(record, "src")));
+            table->setItem(row, 3, new QTableWidgetItem(text(record, "dst")));
+            table->setItem(row, 4, new QTableWidgetItem(text(record, "src_port")));
+            table->setItem(row, 5, new QTableWidgetItem(text(record, "dst_port")));
+            table->setItem(row, 6, new QTableWidgetItem(text(record, "length")));
+            table->setItem(row, 7, new QTableWidgetItem(text(record, "ssid")));
+        }
+    }
+}
+
+/**
+ * @brief [Qt Slot] Show the outcome of a query in the status bar
+ *
+ * @param id Query id
+ * @param summary Final QUERY_RESULT payload (totals or "error")
+ */
+void MainWindow::onQueryFinished(quint32 id, const json& summary) {
+    if (id != activeQuery_) return;
+    activeQuery_ = 0;
+    if (queryTable_) queryTable_->setSortingEnabled(true);
+
+    if (summary.contains("error")) {
+        statusBar()->showMessage("Query failed: " + QString::fromStdString(summary["error"].get<std::string>()));
+        return;
+    }
+
+    QString message = QString("Query: %1 of %2 stored records matched (%3 segments, %4 ms)")
+        .arg(summary.value("matched", uint64_t{0}))
+        .arg(summary.value("scanned", uint64_t{0}))
+        .arg(summary.value("segments", uint64_t{0}))
+        .arg(summary.value("elapsed_ms", uint64_t{0}));
+    if (summary.value("truncated", false)) {
+        message += " - truncated, narrow the query to see everything";
+    }
+    statusBar()->showMessage(message);
+}
+
+/**
+ * @brief Get the query results table, creating its tab on first use
+ * @return Table that shows the latest query's results
+ */
+QTableWidget* MainWindow::getOrCreateQueryTab() {
+    if (queryTable_) {
+        tabWidget_->setCurrentIndex(tabWidget_->indexOf(queryTable_));
+        return queryTable_;
+    }
+
+    queryTable_ = new QTableWidget(this);
+    queryTable_->setSelectionBehavior(QAbstractItemView::SelectRows);
+    queryTable_->setSelectionMode(QAbstractItemView::SingleSelection);
+    queryTable_->setAlternatingRowColors(true);
+
+    int index = tabWidget_->addTab(queryTable_, "History Query");
+    tabWidget_->setCurrentIndex(index);
+    return queryTable_;
+}
+
 /**
  * @brief Get or create a table for the given SSID
  *
@@ -344,12 +678,28 @@ void MainWindow::addLogRowToTable(QTableWidget* table, const json& log) {
         // ================================================================
         // EXTRACT FIELDS FROM JSON LOG
         // ================================================================
+        // Formatted here, at display time, when the record only has ts_ns
         QString timestamp = log.contains("timestamp") ?
             QString::fromStdString(log["timestamp"].get<std::string>()) :
+            log.contains("ts_ns") ?
+            QString::fromStdString(RecordCodec::formatTimestamp(log["ts_ns"].get<uint64_t>())) :
             QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss.zzz");
 
         QString protocol = log.contains("protocol") ?
             QString::fromStdString(log["protocol"].get<std::string>()) : "UNKNOWN";
+        if (log.value("kind", "") == "flow_summary") {
+            protocol += QString(" (flow x%1)").arg(log.value("packets", 1u));
+        } else if (log.value("kind", "") == "dns") {
+            protocol = dnsLabel(log);
+        } else if (log.value("kind", "") == "http_summary") {
+            protocol = httpLabel(log);
+        }
+        if (log.contains("tls_version")) {
+            protocol += tlsSuffix(log);
+        }
+        if (log.contains("tunnel")) {
+            protocol += tunnelSuffix(log);
+        }
 
         QString src = log.contains("src") ?
             QString::fromStdString(log["src"].get<std::string>()) : "?";
@@ -365,46 +715,103 @@ void MainWindow::addLogRowToTable(QTableWidget* table, const json& log) {
 
         int length = log.contains("length") ? log["length"].get<int>() : 0;
 
-        // ================================================================
-        // TRIM TABLE IF NECESSARY
-        // ================================================================
-        if (table->rowCount() >= MAX_ROWS) {
-            for (int i = 0; i < TRIM_ROWS; ++i) {
-                table->removeRow(0);  // Remove oldest entries from top
-            }
-        }
+        insertRowAtTop(table, timestamp, protocol, src, dst, srcPort, dstPort, length);
 
-        // ================================================================
-        // INSERT NEW ROW AT TOP
-        // ================================================================
-        table->insertRow(0);
+    } catch (const std::exception& e) {
+        qWarning() << "Error adding row to table:" << e.what();
+    }
+}
 
-        // Column 0: Timestamp
-        table->setItem(0, 0, new QTableWidgetItem(timestamp));
+/**
+ * @brief Add record i of a decoded batch as a new row at the top of table
+ *
+ * Same cell texts as addLogRowToTable() produces for the JSON form of the
+ * record (see RecordCodec::toJson()), read straight from the columns.
+ *
+ * @param table Target table widget
+ * @param records Batch in column form
+ * @param i Index of the record within the batch
+ */
+void MainWindow::addRecordRowToTable(QTableWidget* table, const RecordColumns& records, size_t i) {
+    uint8_t proto = records.protocol[i];
+    QString protocol = RecordCodec::protocolName(proto);
+    if (records.flags[i] & WireRecord::FLAG_FLOW_SUMMARY) {
+        protocol += QString(" (flow x%1)").arg(records.packets[i]);
+    } else if (records.flags[i] & WireRecord::FLAG_DNS) {
+        json fields;
+        RecordCodec::dnsFields(fields, records.flags[i], records.length[i]);
+        protocol = dnsLabel(fields);
+    } else if (records.flags[i] & WireRecord::FLAG_HTTP_SUMMARY) {
+        protocol = httpLabel(RecordCodec::toJson(records.row(i)));
+    }
 
-        // Column 1: Protocol
-        table->setItem(0, 1, new QTableWidgetItem(protocol));
+    bool hasPorts = proto == 6 || proto == 17;
+    insertRowAtTop(table,
+                   QString::fromStdString(RecordCodec::formatTimestamp(records.ts_ns[i])),
+                   protocol,
+                   addressText(records.src_ip[i]),
+                   addressText(records.dst_ip[i]),
+                   hasPorts ? QString::number(records.src_port[i]) : QString(),
+                   hasPorts ? QString::number(records.dst_port[i]) : QString(),
+                   (records.flags[i] & (WireRecord::FLAG_DNS | WireRecord::FLAG_HTTP_SUMMARY)) ? 0 : records.length[i]);
+}
 
-        // Column 2: Source IP
-        table->setItem(0, 2, new QTableWidgetItem(src));
+QString MainWindow::addressText(quint32 addr) {
+    // Fibonacci hash: spreads addresses that differ only in the last octet
+    AddressSlot& slot = addressCache_[(addr * 2654435761u) >> 24];
+    if (slot.addr != addr || slot.text.isNull()) {
+        char buf[RecordCodec::IPV4_TEXT_SIZE];
+        slot.text = QString::fromLatin1(buf, static_cast<int>(RecordCodec::formatIpv4(addr, buf)));
+        slot.addr = addr;
+    }
+    return slot.text;
+}
 
-        // Column 3: Destination IP
-        table->setItem(0, 3, new QTableWidgetItem(dst));
+/**
+ * @brief Insert one row of cell texts at the top of table
+ *
+ * When table reaches MAX_ROWS, oldest TRIM_ROWS entries are removed to
+ * prevent memory exhaustion.
+ */
+void MainWindow::insertRowAtTop(QTableWidget* table, const QString& timestamp, const QString& protocol,
+                                const QString& src, const QString& dst, const QString& srcPort,
+                                const QString& dstPort, qint64 length) {
+    // ================================================================
+    // TRIM TABLE IF NECESSARY
+    // ================================================================
+    if (table->rowCount() >= MAX_ROWS) {
+        for (int i = 0; i < TRIM_ROWS; ++i) {
+            table->removeRow(0);  // Remove oldest entries from top
+        }
+    }
 
-        // Column 4: Source Port
-        table->setItem(0, 4, new QTableWidgetItem(srcPort));
+    // ================================================================
+    // INSERT NEW ROW AT TOP
+    // ================================================================
+    table->insertRow(0);
 
-        // Column 5: Destination Port
-        table->setItem(0, 5, new QTableWidgetItem(dstPort));
+    // Column 0: Timestamp
+    table->setItem(0, 0, new QTableWidgetItem(timestamp));
 
-        // Column 6: Length
-        QTableWidgetItem* lengthItem = new QTableWidgetItem(QString::number(length));
-        lengthItem->setTextAlignment(Qt::AlignRight);
-        table->setItem(0, 6, lengthItem);
+    // Column 1: Protocol
+    table->setItem(0, 1, new QTableWidgetItem(protocol));
 
-    } catch (const std::exception& e) {
-        qWarning() << "Error adding row to table:" << e.what();
-    }
+    // Column 2: Source IP
+    table->setItem(0, 2, new QTableWidgetItem(src));
+
+    // Column 3: Destination IP
+    table->setItem(0, 3, new QTableWidgetItem(dst));
+
+    // Column 4: Source Port
+    table->setItem(0, 4, new QTableWidgetItem(srcPort));
+
+    // Column 5: Destination Port
+    table->setItem(0, 5, new QTableWidgetItem(dstPort));
+
+    // Column 6: Length
+    QTableWidgetItem* lengthItem = new QTableWidgetItem(QString::number(length));
+    lengthItem->setTextAlignment(Qt::AlignRight);
+    table->setItem(0, 6, lengthItem);
 }
 
 /**
@@ -15,6 +15,7 @@
 #include <QLineEdit>
 #include <QPushButton>
 #include <QSpinBox>
+#include <QComboBox>
 #include <QStatusBar>
 #include <QLabel>
 #include <QMap>
@@ -35,6 +36,7 @@ using json = nlohmann::json;
  * - Structured table view with sortable columns
  * - Real-time traffic log updates
  * - Connection status indicator
+ * - History queries against the server's record store, shown in their own tab
  */
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -54,6 +56,11 @@ private slots:
     void onClientDisconnected();
     void onConnectionError(const QString& error);
     void onForwardLogReceived(uint32_t ssid, const json& log);
+    void onForwardBatchReceived(uint32_t ssid, const RecordColumns& records);
+    void onLossStatsReceived(uint32_t ssid, const json& stats);
+    void onRunQueryClicked();
+    void onQueryResultReceived(quint32 id, const json& batch);
+    void onQueryFinished(quint32 id, const json& summary);
 
 private:
     void setupUI();
@@ -72,8 +79,45 @@ private:
      */
     void addLogRowToTable(QTableWidget* table, const json& log);
 
+    /**
+     * @brief Add one record of a decoded batch as a row in the table
+     * @param table Target table widget
+     * @param records Batch in column form
+     * @param i Index of the record within the batch
+     */
+    void addRecordRowToTable(QTableWidget* table, const RecordColumns& records, size_t i);
+
+    /**
+     * @brief Insert a row at the top, trimming the oldest rows at MAX_ROWS
+     *
+     * Shared by the JSON and the batch path, which only differ in where
+     * the cell texts come from.
+     */
+    void insertRowAtTop(QTableWidget* table, const QString& timestamp, const QString& protocol,
+                        const QString& src, const QString& dst, const QString& srcPort,
+                        const QString& dstPort, qint64 length);
+
+    /**
+     * @brief Dotted quad of a network-order address, from addressCache_
+     *
+     * Rows repeat the same few addresses, and a cached QString is shared
+     * by reference, so a hit neither formats nor allocates.
+     */
+    QString addressText(quint32 addr);
+
+    /**
+     * @brief Push an SSID's accumulated statistics to its stats widget
+     */
+    void refreshStatsWidget(uint32_t ssid);
+
     void updateConnectionStatus(const QString& status);
 
+    /**
+     * @brief Get the query results table, creating its tab on first use
+     * @return QTableWidget that shows the results of the latest query
+     */
+    QTableWidget* getOrCreateQueryTab();
+
     // Network
     SnifferClient* client_;
 
@@ -94,6 +138,22 @@ private:
     QLineEdit* filterSource_;
     QLineEdit* filterDest_;
 
+    // History query components (filters above are reused as query filters)
+    QSpinBox* querySsid_;                ///< 0 = all sniffers
+    QSpinBox* queryMinutes_;             ///< Look-back window, 0 = all stored history
+    QSpinBox* queryPort_;                ///< 0 = any port
+    QComboBox* queryGroupBy_;            ///< "Records" or an aggregation key
+    QPushButton* queryButton_;
+    QTableWidget* queryTable_ = nullptr; ///< Created on the first query
+    quint32 activeQuery_ = 0;            ///< Results for other ids are stale and ignored
+
+    /// Direct-mapped address text cache (GUI thread only), see addressText()
+    struct AddressSlot {
+        quint32 addr = 0;
+        QString text;                    ///< Null = empty slot
+    };
+    AddressSlot addressCache_[256];
+
     /**
      * @brief Apply filter to current table
      *
@@ -7,6 +7,7 @@
  * - Binary frame parsing and validation
  * - Protocol handshake (CLIENT_HELLO/SERVER_HELLO)
  * - Reception and processing of FORWARD_LOG frames containing traffic data
+ * - Columnar decoding of FORWARD_BATCH / FORWARD_BATCH_LZ record batches
  */
 
 #include "SnifferClient.h"
@@ -99,6 +100,27 @@ bool SnifferClient::isConnected() const {
     return socket_->state() == QAbstractSocket::ConnectedState;
 }
 
+/**
+ * @brief Send a historical query to the server
+ *
+ * @param query Query JSON (e.g. {"ssid":3,"group_by":"dst_port"})
+ * @return Assigned query id, or 0 if not connected or the query is too large
+ *
+ * @see queryResultReceived(), queryFinished()
+ */
+quint32 SnifferClient::sendQuery(json query) {
+    if (!isConnected()) return 0;
+
+    quint32 id = next_query_id_++;
+    query["id"] = id;
+    if (!sendFrame(Protocol::QUERY, query.dump())) {
+        qWarning() << "[GUI] Failed to send query" << id;
+        return 0;
+    }
+    qDebug() << "[GUI] Sent query" << id;
+    return id;
+}
+
 // ============================================================================
 // QT SLOTS (Signal Handlers)
 // ============================================================================
@@ -109,7 +131,8 @@ bool SnifferClient::isConnected() const {
  * Called automatically by Qt when TCP socket reaches ConnectedState.
  * Performs the CLIENT_HELLO handshake:
  *
- * 1. Construct CLIENT_HELLO JSON with type="gui" and hostname="Qt GUI Client"
+ * 1. Construct CLIENT_HELLO JSON with type="gui", hostname="Qt GUI Client" and
+ *    the capabilities for binary record batches
  * 2. Encode into binary frame: [Protocol::VERSION][Protocol::CLIENT_HELLO][Length][Payload][Protocol::TERM_BYTE]
  * 3. Write frame to socket
  * 4. Flush socket to ensure data is sent
@@ -123,12 +146,19 @@ bool SnifferClient::isConnected() const {
 void SnifferClient::onConnected() {
     qDebug() << "[GUI] Connected to server";
 
+    // New connection = new FORWARD_LOG stream, numbered from 1 again
+    rx_seq_ = Protocol::SequenceTracker();
+
     // ================================================================
     // STEP 1: Construct CLIENT_HELLO payload
     // ================================================================
     json hello;
     hello["type"] = "gui";
     hello["hostname"] = "Qt GUI Client";
+    hello["proto"] = Protocol::PROTOCOL_REVISION;
+    hello["caps"] = Protocol::capabilityNames(Protocol::LEGACY_CAPS | Protocol::CAP_BINARY |
+                                              Protocol::CAP_BATCH | Protocol::CAP_LARGE_FRAMES |
+                                              Protocol::CAP_COMPRESS);
     std::string payload = hello.dump();
 
     // ================================================================
@@ -223,88 +253,107 @@ void SnifferClient::onError(QAbstractSocket::SocketError error) {
  *
  * Returns false if:
  * - Buffer has fewer than HEADER_SIZE (4) bytes (incomplete frame)
- * - Protocol version doesn't match Protocol::VERSION (protocol mismatch)
- * - Payload length > 1024 (invalid/corrupted)
  * - Buffer has fewer bytes than needed for complete frame (still incomplete)
- * - Terminator byte doesn't match Protocol::TERM_BYTE (corrupted)
+ *
+ * VERSION_2 frames (sent because we offered large_frames) may use the whole
+ * 16-bit length; VERSION frames are still limited to MAX_PAYLOAD_SIZE.
+ *
+ * Corruption (bad version, oversized length, bad terminator) is handled by
+ * resync(): the bad start byte is skipped and parsing continues at the next
+ * plausible frame header. Only the corrupted bytes are lost, not every frame
+ * that happened to be queued behind them.
  *
  * On success:
  * - Parses frame.type and frame.payload
  * - Removes parsed frame from read_buffer_
  * - Returns true
  *
- * On failure:
- * - If malformed (bad version, too large, bad terminator), clears buffer
- * - If incomplete, leaves buffer intact for more data
- * - Returns false
- *
  * @param[out] frame Parsed frame (populated on success)
- * @return true if a valid complete frame was parsed, false if incomplete/invalid
+ * @return true if a valid complete frame was parsed, false if more data is needed
  */
 bool SnifferClient::readFrame(Frame& frame) {
     const int HEADER_SIZE = 4;
 
-    // ================================================================
-    // STEP 1: Check if we have enough data for header
-    // ================================================================
-    if (read_buffer_.size() < HEADER_SIZE) {
-        return false;  // Incomplete - wait for more data
-    }
+    while (true) {
+        // ================================================================
+        // STEP 1: Check if we have enough data for header
+        // ================================================================
+        if (read_buffer_.size() < HEADER_SIZE) {
+            return false;  // Incomplete - wait for more data
+        }
 
-    // ================================================================
-    // STEP 2: Validate protocol version
-    // ================================================================
-    uint8_t version = static_cast<uint8_t>(read_buffer_[0]);
-    if (version != Protocol::VERSION) {
-        qWarning() << "Invalid protocol version:" << version;
-        read_buffer_.clear();  // Corrupted - discard everything
-        return false;
-    }
+        // ================================================================
+        // STEP 2: Validate protocol version
+        // ================================================================
+        uint8_t version = static_cast<uint8_t>(read_buffer_[0]);
+        if (version != Protocol::VERSION && version != Protocol::VERSION_2) {
+            qWarning() << "Invalid protocol version:" << version;
+            resync();
+            continue;
+        }
 
-    // ================================================================
-    // STEP 3: Extract frame type and payload length
-    // ================================================================
-    frame.type = static_cast<uint8_t>(read_buffer_[1]);
-    uint16_t length = (static_cast<uint8_t>(read_buffer_[2]) << 8) |
-                      static_cast<uint8_t>(read_buffer_[3]);
+        // ================================================================
+        // STEP 3: Extract frame type and payload length
+        // ================================================================
+        frame.type = static_cast<uint8_t>(read_buffer_[1]);
+        uint16_t length = (static_cast<uint8_t>(read_buffer_[2]) << 8) |
+                          static_cast<uint8_t>(read_buffer_[3]);
+
+        // ================================================================
+        // STEP 4: Validate payload length
+        // ================================================================
+        if (version == Protocol::VERSION && length > Protocol::MAX_PAYLOAD_SIZE) {
+            qWarning() << "Payload too large:" << length;
+            resync();
+            continue;
+        }
 
-    // ================================================================
-    // STEP 4: Validate payload length
-    // ================================================================
-    if (length > 1024) {
-        qWarning() << "Payload too large:" << length;
-        read_buffer_.clear();  // Corrupted - discard everything
-        return false;
-    }
+        // ================================================================
+        // STEP 5: Check if we have the complete frame (header + payload + terminator)
+        // ================================================================
+        int total_size = HEADER_SIZE + length + 1;  // +1 for Protocol::TERM_BYTE
+        if (read_buffer_.size() < total_size) {
+            return false;  // Incomplete - wait for more data
+        }
 
-    // ================================================================
-    // STEP 5: Check if we have the complete frame (header + payload + terminator)
-    // ================================================================
-    int total_size = HEADER_SIZE + length + 1;  // +1 for Protocol::TERM_BYTE
-    if (read_buffer_.size() < total_size) {
-        return false;  // Incomplete - wait for more data
-    }
+        // ================================================================
+        // STEP 6: Validate terminator byte
+        // ================================================================
+        uint8_t term = static_cast<uint8_t>(read_buffer_[HEADER_SIZE + length]);
+        if (term != Protocol::TERM_BYTE) {
+            qWarning() << "Invalid terminator byte:" << term;
+            resync();
+            continue;
+        }
 
-    // ================================================================
-    // STEP 6: Extract payload
-    // ================================================================
-    frame.payload = read_buffer_.mid(HEADER_SIZE, length);
+        // ================================================================
+        // STEP 7: Extract payload, remove frame from buffer, return success
+        // ================================================================
+        frame.payload = read_buffer_.mid(HEADER_SIZE, length);
+        read_buffer_.remove(0, total_size);
+        return true;
+    }
+}
 
-    // ================================================================
-    // STEP 7: Validate terminator byte
-    // ================================================================
-    uint8_t term = static_cast<uint8_t>(read_buffer_[HEADER_SIZE + length]);
-    if (term != Protocol::TERM_BYTE) {
-        qWarning() << "Invalid terminator byte:" << term;
-        read_buffer_.clear();  // Corrupted - discard everything
-        return false;
+/**
+ * @brief Skip to the next candidate frame header after a corrupted one
+ *
+ * The byte at position 0 is known to be a bad frame start, so it is always
+ * dropped. Everything up to the next Protocol::VERSION or VERSION_2 byte is
+ * dropped too; if there is none, the whole buffer is garbage.
+ */
+void SnifferClient::resync() {
+    decode_errors_++;
+
+    int skip = 1;
+    while (skip < read_buffer_.size()) {
+        uint8_t byte = static_cast<uint8_t>(read_buffer_[skip]);
+        if (byte == Protocol::VERSION || byte == Protocol::VERSION_2) break;
+        skip++;
     }
 
-    // ================================================================
-    // STEP 8: Remove parsed frame from buffer and return success
-    // ================================================================
-    read_buffer_.remove(0, total_size);
-    return true;
+    bytes_discarded_ += skip;
+    read_buffer_.remove(0, skip);
 }
 
 /**
@@ -316,10 +365,22 @@ bool SnifferClient::readFrame(Frame& frame) {
  *   - Emits forwardLogReceived() signal
  *   - GUI will organize logs by ssid in tabs
  *
+ * - Protocol::FORWARD_BATCH (0x0B) / FORWARD_BATCH_LZ (0x0D): Record batch
+ *   - [ssid:4][first seq:8][count:2][count x 42 bytes, or ColumnCodec::packBatch()]
+ *   - Decoded into batch_records_ (plain records are transposed on the way)
+ *   - Emits forwardBatchReceived() once for the whole batch
+ *
  * - Protocol::SERVER_HELLO (0x02): Server acknowledgment (usually handled by server)
  *   - Contains assigned SSID for this connection
  *   - Logged but not used by GUI
  *
+ * - Protocol::STATS (0x06): Loss counters for one sniffer
+ *   - GUI-side counters are added under "gui"
+ *   - Emits lossStatsReceived() signal
+ *
+ * - Protocol::QUERY_RESULT (0x09): Query results
+ *   - Emits queryResultReceived() per batch, queryFinished() for the last frame
+ *
  * - Protocol::ERROR (0x05): Error message from server
  *   - Logged as warning
  *   - Payload contains error description
@@ -345,11 +406,76 @@ void SnifferClient::processFrame(const Frame& frame) {
                 uint32_t ssid = payload["ssid"];
                 json log = payload["log"];
 
+                uint64_t missing = rx_seq_.observe(payload.value("seq", uint64_t{0}));
+                if (missing > 0) {
+                    qWarning() << "[GUI] FORWARD_LOG sequence gap:" << missing << "record(s) lost";
+                }
+
                 qDebug() << "Emitting log for SSID:" << ssid;
                 emit forwardLogReceived(ssid, log);
             } else {
                 qDebug() << "Frame missing ssid or log fields";
             }
+        } else if (frame.type == Protocol::FORWARD_BATCH || frame.type == Protocol::FORWARD_BATCH_LZ) {
+            // ================================================================
+            // FORWARD_BATCH(_LZ): Records from one sniffer, decoded into columns
+            // ================================================================
+            const char* data = frame.payload.constData();
+            size_t size = static_cast<size_t>(frame.payload.size());
+            size_t count = size >= 14 ? RecordCodec::get16(data + 12) : 0;
+
+            bool valid;
+            if (frame.type == Protocol::FORWARD_BATCH_LZ) {
+                valid = size >= 14 &&
+                        ColumnCodec::unpackBatch(data + 14, size - 14, count, batch_records_, unpack_scratch_);
+            } else {
+                valid = size == 14 + count * RecordCodec::WIRE_SIZE;
+                if (valid) {
+                    batch_records_.clear();
+                    for (size_t i = 0; i < count; ++i) {
+                        batch_records_.push_back(RecordCodec::decode(data + 14 + i * RecordCodec::WIRE_SIZE));
+                    }
+                }
+            }
+            if (!valid) {
+                decode_errors_++;
+                qWarning() << "[GUI] Undecodable record batch of" << size << "bytes";
+                return;
+            }
+
+            uint64_t first_seq = RecordCodec::get64(data + 4);
+            uint64_t missing = rx_seq_.observe(first_seq);
+            if (missing > 0) {
+                qWarning() << "[GUI] FORWARD_BATCH sequence gap:" << missing << "record(s) lost";
+            }
+            if (count > 0) rx_seq_.expected = first_seq + count;   // The batch is contiguous
+
+            emit forwardBatchReceived(RecordCodec::get32(data), batch_records_);
+        } else if (frame.type == Protocol::STATS) {
+            // ================================================================
+            // STATS: Loss counters for one sniffer, plus our own
+            // ================================================================
+            json stats = json::parse(frame.payload.toStdString());
+            if (stats.contains("ssid")) {
+                stats["gui"] = {
+                    {"rx_seq", rx_seq_.expected - 1},
+                    {"seq_gap", rx_seq_.lost},
+                    {"decode_error", decode_errors_},
+                    {"bytes_discarded", bytes_discarded_}
+                };
+                emit lossStatsReceived(stats["ssid"].get<uint32_t>(), stats);
+            }
+        } else if (frame.type == Protocol::QUERY_RESULT) {
+            // ================================================================
+            // QUERY_RESULT: One batch of a query, or its final summary
+            // ================================================================
+            json batch = json::parse(frame.payload.toStdString());
+            quint32 id = batch.value("id", 0u);
+            if (batch.value("done", false)) {
+                emit queryFinished(id, batch);
+            } else {
+                emit queryResultReceived(id, batch);
+            }
         } else if (frame.type == Protocol::ERROR) {
             // ================================================================
             // ERROR: Error notification from server
@@ -362,6 +488,31 @@ void SnifferClient::processFrame(const Frame& frame) {
             qDebug() << "Received frame type:" << (int)frame.type << "(not FORWARD_LOG)";
         }
     } catch (const std::exception& e) {
+        decode_errors_++;
         qWarning() << "Error processing frame:" << e.what();
     }
 }
+
+/**
+ * @brief Write a complete frame to the server socket
+ *
+ * Frame format: [Version:1][Type:1][Length:2][Payload:N][Terminator:1]
+ *
+ * @param type Message type
+ * @param payload JSON payload (at most Protocol::MAX_PAYLOAD_SIZE bytes)
+ * @return true if the frame was handed to the socket
+ */
+bool SnifferClient::sendFrame(uint8_t type, const std::string& payload) {
+    if (payload.size() > Protocol::MAX_PAYLOAD_SIZE) return false;
+
+    QByteArray frame;
+    frame.reserve(static_cast<int>(payload.size()) + 5);
+    frame.append(static_cast<char>(Protocol::VERSION));
+    frame.append(static_cast<char>(type));
+    frame.append(static_cast<char>((payload.size() >> 8) & 0xFF));
+    frame.append(static_cast<char>(payload.size() & 0xFF));
+    frame.append(payload.data(), static_cast<int>(payload.size()));
+    frame.append(static_cast<char>(Protocol::TERM_BYTE));
+
+    return socket_->write(frame) == frame.size();
+}
@@ -13,8 +13,8 @@
  * 1. Connect to server via connectToServer()
  * 2. On connection, automatically send CLIENT_HELLO to identify as GUI
  * 3. Receive SERVER_HELLO with assigned SSID
- * 4. Continuously receive FORWARD_LOG frames from sniffers
- * 5. Emit forwardLogReceived() signal for each log
+ * 4. Continuously receive FORWARD_LOG or FORWARD_BATCH(_LZ) frames from sniffers
+ * 5. Emit forwardLogReceived() per JSON log, forwardBatchReceived() per batch
  *
  * ## Binary Frame Format
  *
@@ -25,6 +25,27 @@
  * - 0x02 SERVER_HELLO: Server acknowledgment with SSID (received by client)
  * - 0x04 FORWARD_LOG: Traffic log from sniffer (received by client)
  * - 0x05 ERROR: Error notification (received by client)
+ * - 0x06 STATS: Loss counters for one sniffer's stream (received by client)
+ * - 0x08 QUERY: Historical query over the server's store (sent by client)
+ * - 0x09 QUERY_RESULT: Batch of query results (received by client)
+ * - 0x0B FORWARD_BATCH: Binary records from one sniffer (received by client)
+ * - 0x0D FORWARD_BATCH_LZ: Packed columnar records (received by client)
+ *
+ * ## Record Batches
+ *
+ * The client offers the binary, batch, large_frames and lz capabilities, so a
+ * current server sends records in batches of up to a few thousand instead of
+ * one JSON frame each. Batches are decoded straight into a RecordColumns
+ * (ColumnCodec.h) that is reused from frame to frame; nothing is converted to
+ * JSON, and MainWindow sums the columns it needs for its statistics. Older
+ * servers ignore the capabilities and keep sending FORWARD_LOG.
+ *
+ * ## Loss Detection
+ *
+ * FORWARD_LOG frames carry a per-connection "seq" field; gaps are counted in
+ * a Protocol::SequenceTracker. A corrupted frame no longer discards the whole
+ * read buffer: the client skips ahead to the next plausible frame header and
+ * counts the bytes it had to throw away.
  *
  * ## Example Usage
  *
@@ -44,6 +65,7 @@
 #include <QByteArray>
 #include <nlohmann/json.hpp>
 #include "../Protocol.h"
+#include "../ColumnCodec.h"
 
 using json = nlohmann::json;
 
@@ -107,6 +129,19 @@ public:
      */
     bool isConnected() const;
 
+    /**
+     * @brief Ask the server to query its stored record history
+     *
+     * Results arrive asynchronously: zero or more queryResultReceived()
+     * signals followed by exactly one queryFinished(). See Protocol.h for
+     * the query keys (ssid, from_ns, to_ns, src, dst, ip, port, protocol,
+     * group_by, limit).
+     *
+     * @param query Query object; its "id" is assigned here
+     * @return The query id, or 0 if not connected
+     */
+    quint32 sendQuery(json query);
+
 signals:
     /**
      * @brief Emitted when successfully connected to server
@@ -156,6 +191,57 @@ signals:
      */
     void forwardLogReceived(uint32_t ssid, const json& log);
 
+    /**
+     * @brief Emitted when a FORWARD_BATCH or FORWARD_BATCH_LZ frame is received
+     *
+     * The records are in column form, oldest first. The columns are reused
+     * for the next batch, so receivers must copy what they want to keep.
+     *
+     * @param ssid Sniffer Session ID the records came from
+     * @param records Decoded batch (see ColumnCodec.h)
+     */
+    void forwardBatchReceived(uint32_t ssid, const RecordColumns& records);
+
+    /**
+     * @brief Emitted when a STATS frame is received for a sniffer
+     *
+     * The stats object contains the sniffer's own counters under "sniffer",
+     * the server's counters under "server", and this client's counters under
+     * "gui":
+     * ```json
+     * {"ssid":1,
+     *  "sniffer":{"kernel_drop":0,"ring_drop":0,"send_drop":0,...},
+     *  "server":{"seq_gap":0,"decode_drop":0,"fanout_drop":0,...},
+     *  "gui":{"seq_gap":0,"decode_error":0,"bytes_discarded":0}}
+     * ```
+     *
+     * @param ssid Sniffer Session ID the counters belong to
+     * @param stats Combined loss counters for every stage of the pipeline
+     */
+    void lossStatsReceived(uint32_t ssid, const json& stats);
+
+    /**
+     * @brief Emitted for each batch of results of a query
+     *
+     * The batch holds either "rows" (individual records, newest first) or
+     * "groups" (aggregates, largest byte count first):
+     * ```json
+     * {"id":3,"groups":[{"key":"443","packets":1200,"bytes":980000,"records":1200}]}
+     * ```
+     *
+     * @param id Query id returned by sendQuery()
+     * @param batch QUERY_RESULT payload
+     */
+    void queryResultReceived(quint32 id, const json& batch);
+
+    /**
+     * @brief Emitted once when a query completes or fails
+     * @param id Query id returned by sendQuery()
+     * @param summary Totals ("matched", "scanned", "segments", "elapsed_ms",
+     *                "truncated") or "error"
+     */
+    void queryFinished(quint32 id, const json& summary);
+
 private slots:
     /**
      * @brief [Qt Slot] Called when TCP connection is successfully established
@@ -223,8 +309,8 @@ private:
      * [Version:1][Type:1][Length:2][Payload:N][Terminator:1]
      *
      * Validates:
-     * - Protocol version matches PROTOCOL_VERSION
-     * - Payload size is reasonable (< 1024 bytes)
+     * - Protocol version is VERSION or VERSION_2
+     * - Payload size is reasonable (<= 1024 bytes for VERSION frames)
      * - Frame is properly terminated with TERM_BYTE
      *
      * If a valid frame is found, it's removed from read_buffer_ and parsed into frame.
@@ -236,12 +322,24 @@ private:
      */
     bool readFrame(Frame& frame);
 
+    /**
+     * @brief Skip past a corrupted frame start in read_buffer_
+     *
+     * Drops the first byte and everything up to the next byte that could be
+     * the start of a frame (Protocol::VERSION or VERSION_2). Counts the discarded bytes so
+     * decode losses are visible instead of silently clearing the buffer.
+     *
+     * @internal
+     */
+    void resync();
+
     /**
      * @brief Process a parsed frame received from server
      *
      * Dispatches frame based on type:
      * - TYPE_SERVER_HELLO: Acknowledgment of CLIENT_HELLO (not typically used by GUI)
      * - TYPE_FORWARD_LOG: Traffic log from sniffer - parse JSON and emit forwardLogReceived()
+     * - TYPE_FORWARD_BATCH(_LZ): Record batch - decode into columns and emit forwardBatchReceived()
      * - TYPE_ERROR: Error message from server - log to debug output
      * - Others: Log and ignore
      *
@@ -251,8 +349,24 @@ private:
      */
     void processFrame(const Frame& frame);
 
+    /**
+     * @brief Write one frame to the server
+     * @return true if the whole frame was queued on the socket
+     *
+     * @internal
+     */
+    bool sendFrame(uint8_t type, const std::string& payload);
+
     QTcpSocket* socket_;            ///< TCP socket for server communication
     QByteArray read_buffer_;        ///< Accumulator for partial frame data
 
+    Protocol::SequenceTracker rx_seq_;  ///< Gap detection on FORWARD_LOG "seq" and batch first seq
+    RecordColumns batch_records_;       ///< Last decoded batch, reused to keep its capacity
+    std::string unpack_scratch_;        ///< Scratch buffer for ColumnCodec::unpackBatch()
+    quint64 decode_errors_ = 0;         ///< Corrupted frames skipped by resync()
+    quint64 bytes_discarded_ = 0;       ///< Bytes thrown away while resyncing
+
+    quint32 next_query_id_ = 1;         ///< Id for the next sendQuery()
+
     // Protocol constants defined in Protocol.h (shared across all components)
 };
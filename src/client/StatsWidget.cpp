@@ -45,6 +45,16 @@ void StatsWidget::setupUI() {
     bytesBox->addWidget(bytesLabel_);
     overallLayout->addLayout(bytesBox);
 
+    // Sampling
+    QVBoxLayout* samplingBox = new QVBoxLayout();
+    QLabel* samplingTitle = new QLabel("Sampling");
+    samplingTitle->setStyleSheet("color: #00d4ff; font-weight: bold;");
+    samplingLabel_ = new QLabel("Off");
+    samplingLabel_->setStyleSheet("color: #e0e0e0; font-size: 14px; font-weight: bold;");
+    samplingBox->addWidget(samplingTitle);
+    samplingBox->addWidget(samplingLabel_);
+    overallLayout->addLayout(samplingBox);
+
     overallLayout->addStretch();
     mainLayout->addWidget(overallGroup);
 
@@ -88,9 +98,42 @@ void StatsWidget::setupUI() {
     protocolLayout->addStretch();
     mainLayout->addWidget(protocolGroup);
 
+    // ====================================================================
+    // LOSS ACCOUNTING SECTION
+    // ====================================================================
+    // One counter per stage, in pipeline order, so an operator can see
+    // where packets disappear under overload.
+    QGroupBox* lossGroup = new QGroupBox("Loss Accounting", this);
+    QHBoxLayout* lossLayout = new QHBoxLayout(lossGroup);
+    lossLayout->setSpacing(20);
+
+    kernelDropLabel_ = addLossLabel(lossLayout, "Kernel");
+    ringDropLabel_ = addLossLabel(lossLayout, "BPF Buffer");
+    sendDropLabel_ = addLossLabel(lossLayout, "Sniffer Send");
+    serverGapLabel_ = addLossLabel(lossLayout, "Server Gap");
+    serverDecodeLabel_ = addLossLabel(lossLayout, "Server Decode");
+    fanoutDropLabel_ = addLossLabel(lossLayout, "Fan-out");
+    guiGapLabel_ = addLossLabel(lossLayout, "GUI Gap");
+    guiDecodeLabel_ = addLossLabel(lossLayout, "GUI Decode");
+
+    lossLayout->addStretch();
+    mainLayout->addWidget(lossGroup);
+
     mainLayout->addStretch();
 }
 
+QLabel* StatsWidget::addLossLabel(QHBoxLayout* layout, const QString& title) {
+    QVBoxLayout* box = new QVBoxLayout();
+    QLabel* titleLabel = new QLabel(title);
+    titleLabel->setStyleSheet("color: #FF8C42; font-weight: bold;");
+    QLabel* valueLabel = new QLabel("0");
+    valueLabel->setStyleSheet("color: #e0e0e0; font-size: 14px; font-weight: bold;");
+    box->addWidget(titleLabel);
+    box->addWidget(valueLabel);
+    layout->addLayout(box);
+    return valueLabel;
+}
+
 void StatsWidget::updateStats(uint32_t totalPackets, const QMap<QString, uint32_t>& protocolCounts, uint64_t totalBytes) {
     // Update total packets
     packetsLabel_->setText(QString::number(totalPackets));
@@ -104,12 +147,33 @@ void StatsWidget::updateStats(uint32_t totalPackets, const QMap<QString, uint32_
     icmpLabel_->setText(QString::number(protocolCounts.value("ICMP", 0)));
 }
 
+void StatsWidget::updateLoss(const LossCounters& loss) {
+    kernelDropLabel_->setText(QString::number(loss.kernelDrops));
+    ringDropLabel_->setText(QString::number(loss.ringDrops));
+    sendDropLabel_->setText(QString::number(loss.sendDrops));
+    serverGapLabel_->setText(QString::number(loss.serverGaps));
+    serverDecodeLabel_->setText(QString::number(loss.serverDecode));
+    fanoutDropLabel_->setText(QString::number(loss.fanoutDrops));
+    guiGapLabel_->setText(QString::number(loss.guiGaps));
+    guiDecodeLabel_->setText(QString::number(loss.guiDecode));
+}
+
+void StatsWidget::updateSampling(uint32_t rate) {
+    if (rate <= 1) {
+        samplingLabel_->setText("Off");
+    } else {
+        samplingLabel_->setText(QString("1/%1 (scaled)").arg(rate));
+    }
+}
+
 void StatsWidget::reset() {
     packetsLabel_->setText("0");
     bytesLabel_->setText("0 B");
     tcpLabel_->setText("0");
     udpLabel_->setText("0");
     icmpLabel_->setText("0");
+    updateLoss(LossCounters());
+    updateSampling(1);
 }
 
 QString StatsWidget::formatBytes(uint64_t bytes) {
@@ -10,6 +10,7 @@
 #include <cstdint>
 #include <QWidget>
 #include <QLabel>
+#include <QHBoxLayout>
 #include <QMap>
 #include <QString>
 
@@ -17,6 +18,21 @@ class StatsWidget : public QWidget {
     Q_OBJECT
 
 public:
+    /**
+     * @struct LossCounters
+     * @brief Records lost at each stage of the sniffer -> server -> GUI path
+     */
+    struct LossCounters {
+        quint64 kernelDrops = 0;    ///< Dropped by the kernel (BPF buffer full)
+        quint64 ringDrops = 0;      ///< Truncated records discarded by the sniffer
+        quint64 sendDrops = 0;      ///< Sniffer failed to write to the server
+        quint64 serverGaps = 0;     ///< Sequence gaps seen by the server
+        quint64 serverDecode = 0;   ///< Frames the server could not parse
+        quint64 fanoutDrops = 0;    ///< Server failed to write to a GUI
+        quint64 guiGaps = 0;        ///< Sequence gaps seen by this GUI
+        quint64 guiDecode = 0;      ///< Corrupted frames skipped by this GUI
+    };
+
     explicit StatsWidget(QWidget* parent = nullptr);
 
     /**
@@ -27,6 +43,21 @@ public:
      */
     void updateStats(std::uint32_t totalPackets, const QMap<QString, uint32_t>& protocolCounts, uint64_t totalBytes);
 
+    /**
+     * @brief Update the per-stage loss counters
+     * @param loss Latest counters from a STATS frame
+     */
+    void updateLoss(const LossCounters& loss);
+
+    /**
+     * @brief Show the sniffer's current sampling rate
+     * @param rate Sniffer keeps 1 in rate packets (0 or 1 = unsampled)
+     *
+     * Packet and byte totals are already scaled up by the rate; this label
+     * tells the operator they are estimates.
+     */
+    void updateSampling(uint32_t rate);
+
     /**
      * @brief Reset statistics
      */
@@ -35,6 +66,7 @@ public:
 private:
     void setupUI();
     QString formatBytes(uint64_t bytes);
+    QLabel* addLossLabel(QHBoxLayout* layout, const QString& title);
 
     // Stat labels
     QLabel* packetsLabel_;
@@ -42,4 +74,15 @@ private:
     QLabel* udpLabel_;
     QLabel* icmpLabel_;
     QLabel* bytesLabel_;
+    QLabel* samplingLabel_;
+
+    // Loss labels, one per pipeline stage
+    QLabel* kernelDropLabel_;
+    QLabel* ringDropLabel_;
+    QLabel* sendDropLabel_;
+    QLabel* serverGapLabel_;
+    QLabel* serverDecodeLabel_;
+    QLabel* fanoutDropLabel_;
+    QLabel* guiGapLabel_;
+    QLabel* guiDecodeLabel_;
 };
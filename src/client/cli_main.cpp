@@ -0,0 +1,399 @@
+/**
+ * @file cli_main.cpp
+ * @brief Headless GUI client: prints or counts what the server forwards
+ *
+ * Registers with the server exactly like the Qt GUI (CLIENT_HELLO with
+ * "type":"gui") but needs no display, so it can run on a server box, in a
+ * script, or as the receiving end of a throughput test. Frames are read
+ * with the same FrameReader the sniffer and server use.
+ *
+ * Modes:
+ * - default: one line per FORWARD_LOG, STATS and QUERY_RESULT frame
+ * - `--quiet`: one summary line per second (records/s, bytes/s, seq gaps)
+ * - `--query JSON`: send one QUERY, print its results, exit after "done"
+ * - `--merged`: if the server is one shard of a pool (its SERVER_HELLO lists
+ *   the "pool"), also register with every other shard and show the records
+ *   of all of them. Sniffer SSIDs are the same on every shard, so the
+ *   streams merge without renumbering.
+ *
+ * Records arrive as packed or plain binary batches if the server agrees (see
+ * Protocol.h), otherwise as JSON; `--json` forces JSON and `--no-lz` plain
+ * binary, which is handy for checking that every path delivers the same
+ * records and for comparing their payload rates.
+ *
+ * @usage ./SnifferCLI <server_ip> <port> [--quiet] [--json] [--no-lz] [--merged] [--records N] [--query JSON]
+ * @example ./SnifferCLI 127.0.0.1 9090 --quiet --records 1000000
+ * @example ./SnifferCLI 127.0.0.1 9090 --query '{"id":1,"group_by":"dst_port"}'
+ * @example ./SnifferCLI 127.0.0.1 9090 --merged --quiet
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <nlohmann/json.hpp>
+#include "../Protocol.h"
+#include "../FrameReader.h"
+#include "../RecordCodec.h"
+#include "../ColumnCodec.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+/**
+ * @brief Send one frame on a blocking socket
+ * @return false if the payload is too large or the write failed
+ */
+bool sendFrame(int fd, uint8_t type, const std::string& payload) {
+    if (payload.size() > Protocol::MAX_PAYLOAD_SIZE) return false;
+
+    uint8_t header[4] = {Protocol::VERSION, type,
+                         static_cast<uint8_t>(payload.size() >> 8),
+                         static_cast<uint8_t>(payload.size() & 0xFF)};
+    uint8_t term = Protocol::TERM_BYTE;
+
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char*>(payload.data());
+    iov[1].iov_len = payload.size();
+    iov[2].iov_base = &term;
+    iov[2].iov_len = 1;
+
+    // Frames are at most ~1 KB, so a short write only happens on error
+    ssize_t total = static_cast<ssize_t>(sizeof(header) + payload.size() + 1);
+    return writev(fd, iov, 3) == total;
+}
+
+int connectTo(const std::string& ip, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0 ||
+        connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    // Queries and CREDIT-less hellos are single short frames: send them now
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " <server_ip> <port> [--quiet] [--json] [--no-lz] [--merged] [--records N]"
+              << " [--query JSON]\n"
+              << "\n"
+              << "  --quiet        Print one summary line per second instead of every record\n"
+              << "  --json         Ask for JSON records instead of binary batches\n"
+              << "  --no-lz        Ask for binary batches, but not packed ones\n"
+              << "  --merged       Also receive from every other server of the server's pool\n"
+              << "  --records N    Exit after N FORWARD_LOG records\n"
+              << "  --query JSON   Send one QUERY frame, print the results and exit\n";
+}
+
+/**
+ * @struct Totals
+ * @brief What this client received, for the summary lines
+ */
+struct Totals {
+    uint64_t records = 0;       ///< FORWARD_LOG frames
+    uint64_t frames = 0;        ///< All frames
+    uint64_t bytes = 0;         ///< Payload bytes
+    uint64_t decode_drop = 0;   ///< Frames whose JSON did not parse
+    uint64_t seq_gap = 0;       ///< Records missing, summed over all servers
+};
+
+/**
+ * @struct Link
+ * @brief One registered server connection; --merged keeps one per shard
+ */
+struct Link {
+    std::string address;                ///< "HOST:PORT", for messages
+    int fd = -1;                        ///< -1 once the server has gone
+    FrameReader reader;
+    Protocol::SequenceTracker rx_seq;   ///< FORWARD_* numbering is per server
+};
+
+/**
+ * @brief Connect to a server, send CLIENT_HELLO and wait for SERVER_HELLO
+ *
+ * @param[out] response The server's SERVER_HELLO
+ * @return false (after printing why) if any step failed
+ */
+bool registerWith(Link& link, const std::string& ip, int port, uint32_t offered, json& response) {
+    link.address = ip + ":" + std::to_string(port);
+    link.fd = connectTo(ip, port);
+    if (link.fd < 0) {
+        std::cerr << "[CLI] Cannot connect to " << link.address << std::endl;
+        return false;
+    }
+
+    json hello;
+    hello["type"] = "gui";
+    hello["hostname"] = "Headless CLI Client";
+    hello["proto"] = Protocol::PROTOCOL_REVISION;
+    hello["caps"] = Protocol::capabilityNames(offered);
+    if (!sendFrame(link.fd, Protocol::CLIENT_HELLO, hello.dump())) {
+        std::cerr << "[CLI] Failed to send CLIENT_HELLO to " << link.address << std::endl;
+        return false;
+    }
+
+    FrameView frame;
+    if (!link.reader.readFrame(link.fd, frame) || frame.type != Protocol::SERVER_HELLO) {
+        std::cerr << "[CLI] Failed to receive SERVER_HELLO from " << link.address << ": "
+                  << link.reader.error() << std::endl;
+        return false;
+    }
+    std::cout << "[CLI] Registered with " << link.address << ": " << frame.payload << std::endl;
+    try {
+        response = json::parse(frame.payload);
+        uint32_t caps = Protocol::negotiate(
+            Protocol::parseCapabilities(response.value("caps", std::vector<std::string>())), offered);
+        link.reader.allowLargeFrames(caps & Protocol::CAP_LARGE_FRAMES);
+    } catch (const json::exception& e) {
+        std::cerr << "[CLI] Bad SERVER_HELLO from " << link.address << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void printSummary(const Totals& totals, const Totals& previous, double seconds) {
+    double rate = seconds > 0 ? (totals.records - previous.records) / seconds : 0.0;
+    double mbps = seconds > 0 ? (totals.bytes - previous.bytes) / seconds / (1 << 20) : 0.0;
+    std::cout << "[CLI] records=" << totals.records
+              << " rate=" << static_cast<uint64_t>(rate) << "/s"
+              << " payload=" << mbps << " MB/s"
+              << " seq_gap=" << totals.seq_gap
+              << " decode_drop=" << totals.decode_drop << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string server_ip = argv[1];
+    int port = std::atoi(argv[2]);
+    bool quiet = false;
+    bool binary = true;
+    bool compress = true;
+    bool merged = false;
+    uint64_t max_records = 0;
+    std::string query;
+
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quiet") {
+            quiet = true;
+        } else if (arg == "--json") {
+            binary = false;
+        } else if (arg == "--no-lz") {
+            compress = false;
+        } else if (arg == "--merged") {
+            merged = true;
+        } else if (arg == "--records" && i + 1 < argc) {
+            max_records = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--query" && i + 1 < argc) {
+            query = argv[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    uint32_t offered = Protocol::LEGACY_CAPS;
+    if (binary) offered |= Protocol::CAP_BINARY | Protocol::CAP_BATCH | Protocol::CAP_LARGE_FRAMES;
+    if (binary && compress) offered |= Protocol::CAP_COMPRESS;
+
+    // Links never move once registered: FrameReader holds buffered frames
+    std::vector<std::unique_ptr<Link> > links;
+    json response;
+    links.emplace_back(new Link());
+    if (!registerWith(*links[0], server_ip, port, offered, response)) {
+        return 1;
+    }
+
+    if (merged) {
+        // Every other shard of the pool; without a pool there is nothing to merge
+        std::vector<std::string> pool = response.value("pool", std::vector<std::string>());
+        std::string shard = response.value("shard", "");
+        for (const std::string& member: pool) {
+            size_t colon = member.rfind(':');
+            if (member == shard || colon == std::string::npos) continue;
+            std::unique_ptr<Link> link(new Link());
+            json shard_response;
+            if (!registerWith(*link, member.substr(0, colon), std::atoi(member.c_str() + colon + 1), offered,
+                              shard_response)) {
+                return 1;
+            }
+            links.push_back(std::move(link));
+        }
+        std::cout << "[CLI] Receiving from " << links.size() << " server(s)" << std::endl;
+    }
+
+    for (auto& link: links) {
+        if (!query.empty() && !sendFrame(link->fd, Protocol::QUERY, query)) {
+            std::cerr << "[CLI] Failed to send QUERY (is it longer than "
+                      << Protocol::MAX_PAYLOAD_SIZE << " bytes?)" << std::endl;
+            return 1;
+        }
+    }
+
+    Totals totals;
+    Totals previous;
+    RecordColumns unpacked;
+    std::string scratch;
+    auto started = std::chrono::steady_clock::now();
+    auto last_summary = started;
+    auto secondsSince = [](std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    };
+
+    std::vector<struct pollfd> pfds(links.size());
+    size_t open_links = links.size();
+    size_t queries_done = 0;
+    bool done = false;
+    FrameView frame;
+
+    auto closeLink = [&open_links](Link& link) {
+        close(link.fd);
+        link.fd = -1;
+        open_links--;
+    };
+
+    while (!done && open_links > 0) {
+        // One frame per server per round, so a busy shard cannot starve the others
+        bool idle = true;
+        for (size_t l = 0; l < links.size() && !done; ++l) {
+            Link& link = *links[l];
+            if (link.fd < 0) continue;
+
+            FrameReader::Status status = link.reader.next(frame);
+            if (status == FrameReader::Status::BAD_FRAME) {
+                std::cerr << "[CLI] " << link.address << ": " << link.reader.error() << std::endl;
+                closeLink(link);
+                continue;
+            }
+            if (status == FrameReader::Status::NEED_MORE) continue;
+            idle = false;
+
+            totals.frames++;
+            totals.bytes += frame.payload.size();
+
+            if (frame.type == Protocol::FORWARD_LOG) {
+                totals.records++;
+                try {
+                    json forward = json::parse(frame.payload);
+                    uint64_t missing = link.rx_seq.observe(forward.value("seq", uint64_t{0}));
+                    totals.seq_gap += missing;
+                    if (missing > 0 && !quiet) {
+                        std::cout << "[CLI] " << missing << " record(s) lost before seq " << forward["seq"] << std::endl;
+                    }
+                    if (!quiet) {
+                        std::cout << "[SSID " << forward.value("ssid", 0u) << "] " << forward["log"].dump() << std::endl;
+                    }
+                } catch (const json::exception&) {
+                    totals.decode_drop++;
+                }
+                if (max_records > 0 && totals.records >= max_records) done = true;
+            } else if (frame.type == Protocol::FORWARD_BATCH || frame.type == Protocol::FORWARD_BATCH_LZ) {
+                // [ssid:4][first seq:8][count:2][records, plain or packed]
+                const char* data = frame.payload.data();
+                size_t count = frame.payload.size() >= 14 ? RecordCodec::get16(data + 12) : 0;
+                bool packed = frame.type == Protocol::FORWARD_BATCH_LZ;
+                bool valid = packed
+                        ? frame.payload.size() >= 14 &&
+                          ColumnCodec::unpackBatch(data + 14, frame.payload.size() - 14, count, unpacked, scratch)
+                        : frame.payload.size() == 14 + count * RecordCodec::WIRE_SIZE;
+                if (!valid) {
+                    totals.decode_drop++;
+                    continue;
+                }
+                uint32_t ssid = RecordCodec::get32(data);
+                uint64_t first_seq = RecordCodec::get64(data + 4);
+                uint64_t missing = link.rx_seq.observe(first_seq);
+                totals.seq_gap += missing;
+                if (missing > 0 && !quiet) {
+                    std::cout << "[CLI] " << missing << " record(s) lost before seq " << first_seq << std::endl;
+                }
+                if (count > 0) link.rx_seq.expected = first_seq + count;   // The batch is contiguous
+
+                totals.records += count;
+                if (!quiet) {
+                    for (size_t i = 0; i < count; ++i) {
+                        WireRecord record = packed ? unpacked.row(i)
+                                                   : RecordCodec::decode(data + 14 + i * RecordCodec::WIRE_SIZE);
+                        std::cout << "[SSID " << ssid << "] " << RecordCodec::toJson(record).dump() << std::endl;
+                    }
+                }
+                if (max_records > 0 && totals.records >= max_records) done = true;
+            } else if (frame.type == Protocol::QUERY_RESULT) {
+                std::cout << "[QUERY] " << frame.payload << std::endl;
+                try {
+                    // Each shard answers from its own store
+                    if (json::parse(frame.payload).value("done", false) && ++queries_done == links.size()) {
+                        done = true;
+                    }
+                } catch (const json::exception&) {
+                    totals.decode_drop++;
+                }
+            } else if (frame.type == Protocol::STATS) {
+                if (!quiet) std::cout << "[STATS] " << frame.payload << std::endl;
+            } else if (frame.type == Protocol::ERROR) {
+                std::cerr << "[ERROR] " << frame.payload << std::endl;
+            }
+        }
+        if (!idle || done) continue;
+
+        // Wake up at least once a second so --quiet keeps reporting while
+        // the servers are idle
+        if (quiet && secondsSince(last_summary) >= 1.0) {
+            printSummary(totals, previous, secondsSince(last_summary));
+            previous = totals;
+            last_summary = std::chrono::steady_clock::now();
+        }
+        for (size_t l = 0; l < links.size(); ++l) {
+            pfds[l].fd = links[l]->fd;     // Negative fds are ignored by poll()
+            pfds[l].events = POLLIN;
+            pfds[l].revents = 0;
+        }
+        int ready = poll(pfds.data(), pfds.size(), quiet ? 1000 : -1);
+        if (ready < 0 && errno != EINTR) break;
+        for (size_t l = 0; ready > 0 && l < links.size(); ++l) {
+            if (pfds[l].revents == 0 || links[l]->fd < 0) continue;
+            if (links[l]->reader.fill(links[l]->fd) <= 0) {
+                std::cout << "[CLI] Server " << links[l]->address << " closed the connection" << std::endl;
+                closeLink(*links[l]);
+            }
+        }
+    }
+
+    Totals none;
+    printSummary(totals, none, secondsSince(started));
+    for (auto& link: links) {
+        if (link->fd >= 0) close(link->fd);
+    }
+    return 0;
+}
@@ -13,8 +13,12 @@
  * be run with sudo. It captures packets from a specified network interface
  * and displays them in real-time with detailed protocol information.
  * 
- * Usage: sudo ./sniffer <interface>
+ * Usage: sudo ./sniffer <interface> [server_ip server_port] [options]
  * Example: sudo ./sniffer en0
+ * Example: sudo ./sniffer en0 127.0.0.1 9090 --sample flow:16 --budget 512
+ * Example: sudo ./sniffer en0 --pcap /var/capture/en0 --pcap-rotate-mb 512
+ * Example: sudo ./sniffer en0 --shm /run/sniffer.sock
+ * Example: sudo ./sniffer en0 127.0.0.1 9090 --spill /var/tmp/en0.spill --spill-mb 512
  */
 
 #include "sniffer/Sniffer.h"   // Main packet capture and BPF management class
@@ -22,50 +26,50 @@
 #include <iostream>    // Standard I/O for user interaction
 #include <csignal>     // POSIX signal handling (SIGINT, SIGTERM)
 #include <cstdlib>     // Standard library utilities (exit)
+#include <string>      // Option parsing
+#include <vector>      // Port lists
+#include <algorithm>   // std::min
 
 // === Global State for Signal Handling ===
 
 /**
- * @brief Global flag to control application lifecycle
- * 
- * This static variable is used by the signal handler to indicate when
- * the application should terminate. It's set to false when SIGINT (Ctrl+C)
- * or SIGTERM is received.
- * 
- * @note Static ensures it's only visible within this compilation unit
- * @note Must be volatile in multi-threaded contexts (not needed here)
+ * @brief Signal that ended the capture, or 0 while it runs
+ *
+ * Written by the signal handler, read by main() once the sniffer has
+ * returned, hence volatile sig_atomic_t.
  */
-static bool running = true;
+static volatile sig_atomic_t received_signal = 0;
+
+/**
+ * @brief The running sniffer, so the signal handler can ask it to stop
+ */
+static Sniffer* volatile active_sniffer = nullptr;
 
 /**
  * @brief Signal handler for graceful application shutdown
  * 
  * This function is called when the application receives SIGINT (Ctrl+C)
- * or SIGTERM signals. It provides a clean way to terminate the packet
- * capture loop and exit the application.
+ * or SIGTERM signals. It only records the signal and asks the capture loop
+ * to return; main() then finishes the pcapng file and the rest of the
+ * shutdown (Sniffer::stop()) outside the handler.
  * 
  * Signal Handling Strategy:
  * - SIGINT (2): User pressed Ctrl+C - most common shutdown method
  * - SIGTERM (15): System requesting termination (e.g., during shutdown)
+ * - A second signal while shutting down kills the process as usual
  * 
  * @param signum Signal number received (SIGINT=2, SIGTERM=15, etc.)
  * 
- * @note This handler uses async-signal-safe functions only
- * @see signal(7) for signal safety information
+ * @note Only stores to volatile sig_atomic_t objects and calls signal(),
+ *       which are async-signal-safe
+ * @see signal-safety(7)
  */
 void signalHandler(int signum) {
-    // Print termination message to inform user
-    // Note: std::cout is not technically async-signal-safe, but works in practice
-    std::cout << "\nReceived signal " << signum << ", stopping..." << std::endl;
-    
-    // Set global flag to indicate shutdown requested
-    // In this simple implementation, we exit immediately
-    running = false;
-    
-    // Terminate the application immediately
-    // In a more complex implementation, we might set a flag and allow
-    // the main loop to clean up resources before exiting
-    exit(0);
+    received_signal = signum;
+    if (active_sniffer) {
+        active_sniffer->requestStop();
+    }
+    signal(signum, SIG_DFL);
 }
 
 /**
@@ -82,12 +86,160 @@ void signalHandler(int signum) {
  * @param program_name Name of the executable (from argv[0])
  */
 void printUsage(const char* program_name) {
-    std::cout << "Usage: " << program_name << " <interface> [server_ip] [server_port]" << std::endl;
+    std::cout << "Usage: " << program_name << " <interface> [server_ip server_port] [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --sample <det|prob|flow>:<N>  Keep 1 in N packets (counter, random, or per flow)" << std::endl;
+    std::cout << "  --budget <KB/s>               Adapt the sampling rate to stay under this upstream bandwidth" << std::endl;
+    std::cout << "  --pcap <prefix>               Record every packet to <prefix>_NNNNN_<time>.pcapng" << std::endl;
+    std::cout << "  --snaplen <bytes>             Bytes kept per packet in the pcapng files (default: all)" << std::endl;
+    std::cout << "  --pcap-rotate-mb <MB>         Start a new pcapng file after this size (default: 1024, 0 = never)" << std::endl;
+    std::cout << "  --pcap-rotate-sec <seconds>   Start a new pcapng file after this age (default: never)" << std::endl;
+    std::cout << "  --wire <lz|binary|json>       Record encoding to offer the server (default: lz)" << std::endl;
+    std::cout << "  --shm <path>                  Send to a server on this host through shared memory" << std::endl;
+    std::cout << "                                (its --shm socket) instead of server_ip server_port" << std::endl;
+    std::cout << "  --spill-records <N>           Records kept in memory while the server is away (default: 262144)" << std::endl;
+    std::cout << "  --spill <path>                Then spill records to this file (default: memory only)" << std::endl;
+    std::cout << "  --spill-mb <MB>               Largest spill file (default: 1024)" << std::endl;
+    std::cout << "  --replay-rate <N>             Spilled records resent per second after reconnecting (default: 20000)" << std::endl;
+    std::cout << "  --tcp-memory-mb <MB>          Out-of-order TCP data buffered for dissectors (default: 64)" << std::endl;
+    std::cout << "  --tcp-overlap <first|last>    Which copy of overlapping TCP data to keep (default: first)" << std::endl;
+    std::cout << "  --frag-memory-mb <MB>         IPv4 fragments held for reassembly, 0 = off (default: 16)" << std::endl;
+    std::cout << "  --dns-pending <N>             DNS queries awaiting a response, 0 = no DNS latency (default: 16384)" << std::endl;
+    std::cout << "  --dns-timeout-sec <seconds>   Report a DNS query as unanswered after this long (default: 5)" << std::endl;
+    std::cout << "  --tls-ports <port,...>        Read SNI and ALPN from ClientHellos to these ports, 0 = off (default: 443)" << std::endl;
+    std::cout << "  --http-ports <port,...>       Time HTTP/1.x requests to these ports, 0 = off (default: 80,8080)" << std::endl;
+    std::cout << "  --http-groups <N>             (host, status) latency histograms per summary, 1-65536 (default: 256)" << std::endl;
+    std::cout << "  --http-interval-sec <seconds> Send HTTP latency summaries this often (default: 10)" << std::endl;
+    std::cout << "  --tunnel-depth <N>            Tunnel layers taken off to reach the inner packet, 0 = off (default: 4)" << std::endl;
     std::cout << "Example: " << program_name << " en0" << std::endl;
     std::cout << "Example: " << program_name << " en0 127.0.0.1 9090" << std::endl;
+    std::cout << "Example: " << program_name << " en0 127.0.0.1 9090 --sample flow:16 --budget 512" << std::endl;
+    std::cout << "Example: " << program_name << " en0 --pcap /var/capture/en0 --pcap-rotate-sec 3600" << std::endl;
+    std::cout << "Example: " << program_name << " en0 --shm /run/sniffer.sock" << std::endl;
+    std::cout << "Example: " << program_name << " en0 127.0.0.1 9090 --spill /var/tmp/en0.spill --spill-mb 512" << std::endl;
     std::cout << "Note: Requires root privileges (run with sudo)" << std::endl;
 }
 
+/**
+ * @brief Parse a comma-separated port list such as "443,8443"
+ *
+ * Port 0 is skipped, so "0" alone yields an empty list (dissector off).
+ *
+ * @throws std::invalid_argument If an entry is not a number or above 65535
+ */
+std::vector<uint16_t> parsePorts(const std::string& value) {
+    std::vector<uint16_t> ports;
+    for (size_t start = 0; start <= value.size();) {
+        size_t comma = std::min(value.find(',', start), value.size());
+        unsigned long port = std::stoul(value.substr(start, comma - start));
+        if (port > 65535) {
+            throw std::invalid_argument("port out of range");
+        }
+        if (port != 0) {
+            ports.push_back(static_cast<uint16_t>(port));
+        }
+        start = comma + 1;
+    }
+    return ports;
+}
+
+/**
+ * @brief Parse optional "--flag value" arguments into CaptureOptions
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @param first Index of the first optional argument
+ * @param options[out] Parsed capture options
+ * @return true on success, false if an option is unknown or malformed
+ */
+bool parseOptions(int argc, char* argv[], int first, CaptureOptions& options) {
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        try {
+            if (arg == "--sample") {
+                // Format: mode:N, e.g. "flow:16"
+                size_t colon = value.find(':');
+                options.sample_mode = Sampler::parseMode(value.substr(0, colon));
+                if (colon != std::string::npos) {
+                    options.sample_rate = static_cast<uint32_t>(std::stoul(value.substr(colon + 1)));
+                }
+            } else if (arg == "--budget") {
+                options.upstream_budget = std::stoull(value) * 1024;
+            } else if (arg == "--pcap") {
+                options.pcap.prefix = value;
+            } else if (arg == "--snaplen") {
+                options.pcap.snaplen = static_cast<uint32_t>(std::stoul(value));
+            } else if (arg == "--pcap-rotate-mb") {
+                options.pcap.rotate_bytes = std::stoull(value) << 20;
+            } else if (arg == "--pcap-rotate-sec") {
+                options.pcap.rotate_seconds = static_cast<uint32_t>(std::stoul(value));
+            } else if (arg == "--wire") {
+                if (value != "lz" && value != "binary" && value != "json") {
+                    throw std::invalid_argument("expected lz, binary or json");
+                }
+                options.binary_records = value != "json";
+                options.compress_records = value == "lz";
+            } else if (arg == "--shm") {
+                options.shm_path = value;
+            } else if (arg == "--spill-records") {
+                options.spill.memory_records = std::stoull(value);
+            } else if (arg == "--spill") {
+                options.spill.path = value;
+            } else if (arg == "--spill-mb") {
+                options.spill.disk_bytes = std::stoull(value) << 20;
+            } else if (arg == "--tcp-memory-mb") {
+                options.tcp.memory_bytes = std::stoull(value) << 20;
+            } else if (arg == "--tcp-overlap") {
+                if (value != "first" && value != "last") {
+                    throw std::invalid_argument("expected first or last");
+                }
+                options.tcp.overlap = value == "first" ? ReassemblyOptions::Overlap::FIRST
+                                                       : ReassemblyOptions::Overlap::LAST;
+            } else if (arg == "--frag-memory-mb") {
+                options.fragments.memory_bytes = std::stoull(value) << 20;
+            } else if (arg == "--dns-pending") {
+                options.dns.max_pending = std::stoull(value);
+            } else if (arg == "--dns-timeout-sec") {
+                options.dns.timeout_sec = static_cast<uint32_t>(std::stoul(value));
+            } else if (arg == "--tls-ports") {
+                options.tls.ports = parsePorts(value);
+            } else if (arg == "--http-ports") {
+                options.http.ports = parsePorts(value);
+            } else if (arg == "--http-groups") {
+                options.http.max_groups = std::stoull(value);
+                if (options.http.max_groups == 0 || options.http.max_groups > HttpSummaryTable::MAX_GROUPS) {
+                    throw std::invalid_argument("must be between 1 and " + std::to_string(HttpSummaryTable::MAX_GROUPS));
+                }
+            } else if (arg == "--http-interval-sec") {
+                options.http.interval_sec = static_cast<uint32_t>(std::stoul(value));
+                if (options.http.interval_sec == 0) {
+                    throw std::invalid_argument("must be at least 1");
+                }
+            } else if (arg == "--tunnel-depth") {
+                options.tunnel_depth = static_cast<unsigned>(std::stoul(value));
+            } else if (arg == "--replay-rate") {
+                options.spill.replay_rate = static_cast<uint32_t>(std::stoul(value));
+                if (options.spill.replay_rate == 0) {
+                    throw std::invalid_argument("must be at least 1");
+                }
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid value for " << arg << ": " << e.what() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Main application entry point
  * 
@@ -105,7 +257,19 @@ void printUsage(const char* program_name) {
 int main(int argc, char* argv[]) {
     // === Command-Line Argument Validation ===
 
-    if (argc != 2 && argc != 4) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Positional arguments: <interface> [server_ip server_port], then options
+    int first_option = 2;
+    if (argc >= 4 && argv[2][0] != '-') {
+        first_option = 4;
+    }
+
+    CaptureOptions options;
+    if (!parseOptions(argc, argv, first_option, options)) {
         printUsage(argv[0]);
         return 1;
     }
@@ -115,13 +279,17 @@ int main(int argc, char* argv[]) {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
 
+    // A server that goes away must fail write() with EPIPE, which the
+    // sniffer answers by reconnecting, instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+
     // === Extract Arguments ===
 
     std::string interface = argv[1];
     std::string server_ip;
     int server_port = 0;
 
-    if (argc == 4) {
+    if (first_option == 4) {
         server_ip = argv[2];
         server_port = std::atoi(argv[3]);
     }
@@ -129,8 +297,18 @@ int main(int argc, char* argv[]) {
     // === Initialize and Run Packet Sniffer ===
 
     try {
-        Sniffer sniffer(interface, server_ip, server_port);
+        Sniffer sniffer(interface, server_ip, server_port, options);
+        active_sniffer = &sniffer;
+        if (received_signal) sniffer.requestStop();     // Arrived while starting up
         sniffer.run();
+        active_sniffer = nullptr;
+
+        if (received_signal) {
+            std::cout << "\nReceived signal " << received_signal << ", stopping..." << std::endl;
+        }
+        // Outside the signal handler: flush console output and the pcapng
+        // recording, and drop the spill buffer and its file
+        sniffer.stop();
 
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -139,8 +317,7 @@ int main(int argc, char* argv[]) {
     
     // === Normal Termination ===
     
-    // If we reach here, the sniffer terminated normally
-    // (though in practice, signal handlers usually call exit() directly)
+    // If we reach here, the sniffer was stopped by a signal and shut down
     return 0;  // Success
     
     /*
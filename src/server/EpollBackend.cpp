@@ -0,0 +1,178 @@
+/**
+ * @file EpollBackend.cpp
+ * @brief epoll implementation of IoBackend
+ */
+
+#include "EpollBackend.h"
+
+#ifdef __linux__
+
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+EpollBackend::EpollBackend() : rx_buffer_(RECV_CHUNK) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+    }
+}
+
+EpollBackend::~EpollBackend() {
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+    }
+}
+
+void EpollBackend::run(int listen_fd, const IoCallbacks& callbacks) {
+    setLoopThread();
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    std::vector<struct epoll_event> events(256);
+    std::vector<int> dirty;
+
+    while (true) {
+        int n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("epoll_wait: ") + strerror(errno));
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t what = events[i].events;
+
+            if (fd == listen_fd) {
+                acceptAll(listen_fd, callbacks);
+                continue;
+            }
+            if (fd == wake_fd_) {
+                uint64_t count;
+                clearWake();
+                if (read(wake_fd_, &count, sizeof(count)) < 0) {
+                    // EAGAIN: already drained
+                }
+                syscalls_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            auto it = connections_.find(fd);
+            if (it == connections_.end()) continue;   // Closed earlier in this batch
+
+            if ((what & EPOLLOUT) && !flush(fd, it->second)) {
+                closeConnection(fd, callbacks);
+                continue;
+            }
+            if ((what & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !readOnce(fd, callbacks)) {
+                closeConnection(fd, callbacks);
+            }
+        }
+
+        // Everything the callbacks (or other threads) queued goes out now,
+        // one write per connection
+        takeDirty(dirty);
+        for (int fd : dirty) {
+            auto it = connections_.find(fd);
+            if (it == connections_.end() || it->second.want_write) continue;
+            if (!flush(fd, it->second)) {
+                closeConnection(fd, callbacks);
+            }
+        }
+    }
+}
+
+void EpollBackend::acceptAll(int listen_fd, const IoCallbacks& callbacks) {
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "Accept failed: " << strerror(errno) << std::endl;
+            }
+            return;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+
+        connections_[fd] = Connection();
+        addConnection(fd);
+        callbacks.on_accept(fd, inet_ntoa(addr.sin_addr));
+    }
+}
+
+bool EpollBackend::readOnce(int fd, const IoCallbacks& callbacks) {
+    // Level-triggered: if more is buffered than fits, epoll reports the fd
+    // again on the next iteration, so there is no read-until-EAGAIN loop
+    ssize_t n = read(fd, rx_buffer_.data(), rx_buffer_.size());
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (n == 0) return false;
+    return callbacks.on_data(fd, rx_buffer_.data(), static_cast<size_t>(n));
+}
+
+bool EpollBackend::flush(int fd, Connection& conn) {
+    while (true) {
+        // Only refill once the previous bytes are out, so a stalled peer's
+        // backlog stays in the capped send queue instead of growing here
+        if (conn.offset == conn.unsent.size()) {
+            conn.unsent.clear();
+            conn.offset = 0;
+            if (!takePending(fd, conn.unsent)) break;
+        }
+        ssize_t n = ::send(fd, conn.unsent.data() + conn.offset, conn.unsent.size() - conn.offset, MSG_NOSIGNAL);
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            break;
+        }
+        conn.offset += static_cast<size_t>(n);
+    }
+
+    // Watch for EPOLLOUT only while something is left over
+    bool want_write = conn.offset < conn.unsent.size();
+    if (want_write != conn.want_write) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        if (want_write) ev.events |= EPOLLOUT;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+        conn.want_write = want_write;
+    }
+    return true;
+}
+
+void EpollBackend::closeConnection(int fd, const IoCallbacks& callbacks) {
+    callbacks.on_close(fd);
+    removeConnection(fd);
+    connections_.erase(fd);
+    // close() also removes fd from the epoll set
+    close(fd);
+}
+
+#endif // __linux__
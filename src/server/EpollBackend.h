@@ -0,0 +1,46 @@
+/**
+ * @file EpollBackend.h
+ * @brief Level-triggered epoll event loop (Linux)
+ *
+ * One read() per readiness event, one write() per connection per loop
+ * iteration. A connection whose socket buffer is full keeps its unsent bytes
+ * and is watched for EPOLLOUT until it drains.
+ */
+
+#pragma once
+
+#ifdef __linux__
+
+#include "IoBackend.h"
+
+/**
+ * @class EpollBackend
+ * @brief IoBackend built on epoll_wait()
+ */
+class EpollBackend : public IoBackend {
+public:
+    /// @throws std::runtime_error if the epoll instance cannot be created
+    EpollBackend();
+    ~EpollBackend() override;
+
+    const char* name() const override { return "epoll"; }
+    void run(int listen_fd, const IoCallbacks& callbacks) override;
+
+private:
+    struct Connection {
+        std::string unsent;         ///< Taken from the send queue, not yet written
+        size_t offset = 0;          ///< Bytes of unsent already written
+        bool want_write = false;    ///< Registered for EPOLLOUT
+    };
+
+    void acceptAll(int listen_fd, const IoCallbacks& callbacks);
+    bool readOnce(int fd, const IoCallbacks& callbacks);
+    bool flush(int fd, Connection& conn);
+    void closeConnection(int fd, const IoCallbacks& callbacks);
+
+    int epoll_fd_ = -1;
+    std::unordered_map<int, Connection> connections_;
+    std::vector<char> rx_buffer_;
+};
+
+#endif // __linux__
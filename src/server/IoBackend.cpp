@@ -0,0 +1,165 @@
+/**
+ * @file IoBackend.cpp
+ * @brief Send queues shared by the event-driven backends, and the factory
+ */
+
+#include "IoBackend.h"
+#include "EpollBackend.h"
+#include "UringBackend.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// ============================================================================
+// FACTORY
+// ============================================================================
+
+IoBackend::Kind IoBackend::parseKind(const std::string& name) {
+    if (name == "auto") return Kind::AUTO;
+    if (name == "threads") return Kind::THREADS;
+    if (name == "epoll") return Kind::EPOLL;
+    if (name == "uring" || name == "io_uring") return Kind::URING;
+    throw std::invalid_argument("unknown I/O backend '" + name + "' (expected auto, threads, epoll or uring)");
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(Kind kind) {
+    if (kind == Kind::THREADS) return nullptr;
+
+#ifdef __linux__
+    if (kind == Kind::URING) return std::unique_ptr<IoBackend>(new UringBackend());
+    if (kind == Kind::EPOLL) return std::unique_ptr<IoBackend>(new EpollBackend());
+
+    // AUTO: io_uring needs a recent kernel and may be disabled by policy
+    // (kernel.io_uring_disabled, seccomp), so fall back quietly
+    try {
+        return std::unique_ptr<IoBackend>(new UringBackend());
+    } catch (const std::exception& e) {
+        std::cout << "[SERVER] io_uring unavailable (" << e.what() << "), using epoll" << std::endl;
+    }
+    try {
+        return std::unique_ptr<IoBackend>(new EpollBackend());
+    } catch (const std::exception& e) {
+        std::cout << "[SERVER] epoll unavailable (" << e.what() << "), using one thread per connection" << std::endl;
+    }
+    return nullptr;
+#else
+    if (kind == Kind::AUTO) return nullptr;
+    throw std::runtime_error("the epoll and io_uring backends require Linux");
+#endif
+}
+
+// ============================================================================
+// SEND QUEUES
+// ============================================================================
+
+IoBackend::IoBackend() {
+#ifdef __linux__
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    }
+#endif
+}
+
+IoBackend::~IoBackend() {
+    if (wake_fd_ >= 0) {
+        close(wake_fd_);
+    }
+}
+
+void IoBackend::addConnection(int fd) {
+    std::lock_guard<std::mutex> lock(out_mutex_);
+    out_[fd] = Outbound();
+}
+
+void IoBackend::removeConnection(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(out_mutex_);
+        out_.erase(fd);
+    }
+    // Senders blocked on this fd's queue must give up
+    out_cv_.notify_all();
+}
+
+bool IoBackend::send(int fd, const struct iovec* iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(out_mutex_);
+        auto it = out_.find(fd);
+        if (it == out_.end()) return false;
+
+        // The loop must never wait on a slow peer, so a full queue refuses
+        Outbound& out = it->second;
+        if (out.pending.size() + len > MAX_QUEUED_BYTES) return false;
+
+        for (int i = 0; i < iovcnt; ++i) {
+            out.pending.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+        if (!out.dirty) {
+            out.dirty = true;
+            dirty_.push_back(fd);
+        }
+    }
+
+    // The loop flushes dirty queues at the end of every iteration; only a
+    // foreign thread has to interrupt its wait
+    if (std::this_thread::get_id() != loop_thread_) {
+        wake();
+    }
+    return true;
+}
+
+bool IoBackend::waitForRoom(int fd, size_t len) {
+    std::unique_lock<std::mutex> lock(out_mutex_);
+    bool open = false;
+    out_cv_.wait(lock, [&] {
+        auto it = out_.find(fd);
+        open = it != out_.end();
+        return !open || it->second.pending.size() + len <= MAX_QUEUED_BYTES;
+    });
+    return open;
+}
+
+void IoBackend::takeDirty(std::vector<int>& fds) {
+    fds.clear();
+    std::lock_guard<std::mutex> lock(out_mutex_);
+    fds.swap(dirty_);
+    for (int fd : fds) {
+        auto it = out_.find(fd);
+        if (it != out_.end()) it->second.dirty = false;
+    }
+}
+
+bool IoBackend::takePending(int fd, std::string& out) {
+    {
+        std::lock_guard<std::mutex> lock(out_mutex_);
+        auto it = out_.find(fd);
+        if (it == out_.end() || it->second.pending.empty()) return false;
+        if (out.empty()) {
+            out.swap(it->second.pending);
+        } else {
+            out.append(it->second.pending);
+            it->second.pending.clear();
+        }
+    }
+    out_cv_.notify_all();
+    return true;
+}
+
+void IoBackend::wake() {
+    if (wake_pending_.exchange(true, std::memory_order_acq_rel)) return;
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {
+        // EAGAIN means the counter is already non-zero: the loop will wake anyway
+    }
+}
@@ -0,0 +1,183 @@
+/**
+ * @file IoBackend.h
+ * @brief Event-driven socket I/O for the server (epoll or io_uring)
+ *
+ * By default every connection gets its own thread that blocks in read().
+ * That is simple, but each record costs several syscalls: reading the
+ * header, payload and terminator separately, plus one write per GUI. An
+ * IoBackend instead runs every socket from a single event-loop thread:
+ *
+ * - Reads pull up to RECV_CHUNK bytes at once and hand them to the server,
+ *   which cuts out as many whole frames as are present.
+ * - send() only queues bytes. At the end of each loop iteration, everything
+ *   queued for a connection goes out in one write (epoll) or one SEND
+ *   submission (io_uring), so a burst of records to a GUI costs one syscall
+ *   instead of one per frame.
+ *
+ * ## Backends
+ *
+ * | Name     | Accept              | Receive                         | Send                     |
+ * |----------|---------------------|---------------------------------|--------------------------|
+ * | epoll    | accept4 until EAGAIN| read() per readiness            | write() per flush        |
+ * | io_uring | multishot ACCEPT    | multishot RECV, provided buffers| batched SEND submissions |
+ *
+ * With io_uring the loop makes one io_uring_enter() per iteration, which
+ * submits all queued sends and waits for completions in the same call.
+ *
+ * ## Threading
+ *
+ * Callbacks run on the loop thread only. send() may be called from any
+ * thread and never blocks: if the connection already has MAX_QUEUED_BYTES
+ * queued, the frame is refused. Threads that would rather wait (query
+ * results) call waitForRoom() first, outside any lock the loop needs.
+ *
+ * Both backends are Linux-only; elsewhere create() throws and the server
+ * stays on thread-per-connection.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <sys/uio.h>
+
+/**
+ * @struct IoCallbacks
+ * @brief Server hooks invoked by the event loop
+ */
+struct IoCallbacks {
+    /// New connection (already registered with the backend)
+    std::function<void(int fd, const std::string& remote_ip)> on_accept;
+
+    /// Bytes received; return false to close the connection
+    std::function<bool(int fd, const char* data, size_t len)> on_data;
+
+    /// Connection is closing; no further send() to fd will be delivered
+    std::function<void(int fd)> on_close;
+};
+
+/**
+ * @class IoBackend
+ * @brief Base class: per-connection send queues plus the backend factory
+ */
+class IoBackend {
+public:
+    /// I/O model requested on the command line (--io)
+    enum class Kind {
+        AUTO,       ///< io_uring, else epoll, else threads
+        THREADS,    ///< Thread per connection (no IoBackend)
+        EPOLL,
+        URING
+    };
+
+    /// Most bytes queued for one connection before send() refuses more
+    static constexpr size_t MAX_QUEUED_BYTES = 4u << 20;
+
+    /// Largest single read from a socket
+    static constexpr size_t RECV_CHUNK = 64u << 10;
+
+    /**
+     * @brief Parse an --io argument ("auto", "threads", "epoll", "uring")
+     * @throws std::invalid_argument for unknown names
+     */
+    static Kind parseKind(const std::string& name);
+
+    /**
+     * @brief Create the backend for kind
+     *
+     * AUTO falls back from io_uring to epoll to nullptr (threads) and only
+     * logs why. An explicitly requested backend that cannot start throws.
+     *
+     * @return The backend, or nullptr for thread-per-connection
+     * @throws std::runtime_error if an explicitly requested backend is unavailable
+     */
+    static std::unique_ptr<IoBackend> create(Kind kind);
+
+    virtual ~IoBackend();
+
+    IoBackend(const IoBackend&) = delete;
+    IoBackend& operator=(const IoBackend&) = delete;
+
+    /// Backend name for logs ("epoll", "io_uring")
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Run the event loop on the calling thread (does not return)
+     * @param listen_fd Bound, listening socket
+     * @param callbacks Server hooks
+     */
+    virtual void run(int listen_fd, const IoCallbacks& callbacks) = 0;
+
+    /**
+     * @brief Queue the gathered buffers for fd (thread-safe, never blocks)
+     * @return false if fd is not an open connection or its queue is full
+     */
+    bool send(int fd, const struct iovec* iov, int iovcnt);
+
+    /**
+     * @brief Wait until len more bytes fit in fd's send queue
+     *
+     * Must not be called on the loop thread, which is the one draining it.
+     *
+     * @return false if fd was closed while waiting
+     */
+    bool waitForRoom(int fd, size_t len);
+
+    /// Syscalls the event loop has made (for syscalls-per-record figures)
+    uint64_t syscalls() const { return syscalls_.load(std::memory_order_relaxed); }
+
+protected:
+    /// @throws std::runtime_error if the wakeup eventfd cannot be created
+    IoBackend();
+
+    /// Start accepting send() for fd
+    void addConnection(int fd);
+
+    /// Stop accepting send() for fd and discard whatever is queued
+    void removeConnection(int fd);
+
+    /**
+     * @brief Fds that had bytes queued since the last call
+     * @param[out] fds Replaced with the dirty list
+     */
+    void takeDirty(std::vector<int>& fds);
+
+    /**
+     * @brief Move fd's queued bytes to the end of out
+     * @return false if nothing was queued
+     */
+    bool takePending(int fd, std::string& out);
+
+    /// Called by the loop after consuming wake_fd_
+    void clearWake() { wake_pending_.store(false, std::memory_order_release); }
+
+    /// Mark the current thread as the loop thread
+    void setLoopThread() { loop_thread_ = std::this_thread::get_id(); }
+
+    int wake_fd_ = -1;                      ///< eventfd; readable when a foreign send() queued bytes
+    std::atomic<uint64_t> syscalls_{0};
+
+private:
+    struct Outbound {
+        std::string pending;                ///< Bytes not yet handed to the kernel
+        bool dirty = false;                 ///< fd is on dirty_
+    };
+
+    void wake();
+
+    std::mutex out_mutex_;
+    std::condition_variable out_cv_;        ///< Signalled when a queue drains or closes
+    std::unordered_map<int, Outbound> out_;
+    std::vector<int> dirty_;
+    std::atomic<bool> wake_pending_{false};
+    std::thread::id loop_thread_;
+};
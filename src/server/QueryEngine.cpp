@@ -0,0 +1,366 @@
+/**
+ * @file QueryEngine.cpp
+ * @brief Implementation of mmap-based scans over stored segments
+ */
+
+#include "QueryEngine.h"
+#include "../Protocol.h"
+#include "../RecordCodec.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+namespace {
+
+uint32_t parseIPv4(const json& request, const char* key) {
+    if (!request.contains(key)) return 0;
+    std::string text = request[key].get<std::string>();
+    uint32_t addr = 0;
+    if (inet_pton(AF_INET, text.c_str(), &addr) != 1) {
+        throw std::invalid_argument(std::string("Invalid IPv4 address for \"") + key + "\": " + text);
+    }
+    return addr;
+}
+
+int32_t parsePort(const json& request, const char* key) {
+    if (!request.contains(key)) return -1;
+    int port = request[key].get<int>();
+    if (port < 0 || port > 65535) {
+        throw std::invalid_argument(std::string("Port out of range for \"") + key + "\"");
+    }
+    return port;
+}
+
+/// Read-only mapping of a segment file, unmapped on scope exit
+struct MappedSegment {
+    void* base = MAP_FAILED;
+    size_t size = 0;
+
+    explicit MappedSegment(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(SegmentHeader)) {
+            size = static_cast<size_t>(st.st_size);
+            base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base != MAP_FAILED) {
+                madvise(base, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);   // The mapping stays valid
+    }
+
+    ~MappedSegment() {
+        if (base != MAP_FAILED) munmap(base, size);
+    }
+
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+};
+
+std::vector<IndexEntry> loadIndex(const std::string& path) {
+    std::vector<IndexEntry> index;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return index;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        index.resize(static_cast<size_t>(st.st_size) / sizeof(IndexEntry));
+        ssize_t want = static_cast<ssize_t>(index.size() * sizeof(IndexEntry));
+        if (pread(fd, index.data(), static_cast<size_t>(want), 0) != want) {
+            index.clear();
+        }
+    }
+    close(fd);
+    return index;
+}
+
+} // namespace
+
+// ============================================================================
+// QUERY PARSING
+// ============================================================================
+
+Query Query::fromJson(const json& request) {
+    Query q;
+    q.id = request.value("id", 0u);
+    q.ssid = request.value("ssid", static_cast<uint32_t>(Protocol::SSID_UNASSIGNED));
+    q.from_ns = request.value("from_ns", uint64_t{0});
+    q.to_ns = request.value("to_ns", UINT64_MAX);
+    q.src_ip = parseIPv4(request, "src");
+    q.dst_ip = parseIPv4(request, "dst");
+    q.any_ip = parseIPv4(request, "ip");
+    q.src_port = parsePort(request, "src_port");
+    q.dst_port = parsePort(request, "dst_port");
+    q.any_port = parsePort(request, "port");
+
+    if (request.contains("protocol")) {
+        const json& proto = request["protocol"];
+        if (proto.is_number()) {
+            q.protocol = proto.get<int>() & 0xFF;
+        } else {
+            std::string name = proto.get<std::string>();
+            if (name == "TCP") q.protocol = 6;
+            else if (name == "UDP") q.protocol = 17;
+            else if (name == "ICMP") q.protocol = 1;
+            else throw std::invalid_argument("Unknown protocol: " + name);
+        }
+    }
+
+    std::string kind = request.value("kind", std::string("traffic"));
+    if (kind == "traffic") q.kind = Kind::TRAFFIC;
+    else if (kind == "dns") q.kind = Kind::DNS;
+    else throw std::invalid_argument("Unknown kind: " + kind);
+
+    std::string group = request.value("group_by", std::string());
+    if (group.empty()) q.group_by = GroupBy::NONE;
+    else if (group == "src") q.group_by = GroupBy::SRC_IP;
+    else if (group == "dst") q.group_by = GroupBy::DST_IP;
+    else if (group == "src_port") q.group_by = GroupBy::SRC_PORT;
+    else if (group == "dst_port") q.group_by = GroupBy::DST_PORT;
+    else if (group == "protocol") q.group_by = GroupBy::PROTOCOL;
+    else throw std::invalid_argument("Unknown group_by: " + group);
+
+    q.limit = std::min(std::max(request.value("limit", 1000u), 1u), MAX_LIMIT);
+    return q;
+}
+
+// ============================================================================
+// EXECUTION
+// ============================================================================
+
+QueryResult QueryEngine::run(const Query& query) const {
+    QueryResult result;
+
+    // One task per segment; remember which sniffer each task belongs to
+    std::vector<std::pair<uint32_t, std::future<Partial>>> tasks;
+    for (const SegmentInfo& segment : store_.listSegments(query.ssid)) {
+        if (segment.records == 0) continue;
+        tasks.emplace_back(segment.ssid,
+                           pool_.submit([segment, query] { return scanSegment(segment, query); }));
+    }
+
+    std::unordered_map<uint64_t, GroupAggregate> groups;
+    std::vector<std::pair<uint32_t, StoredRecord>> rows;
+
+    for (auto& task : tasks) {
+        Partial partial = task.second.get();
+        result.segments++;
+        result.scanned += partial.scanned;
+        result.matched += partial.matched;
+        for (const auto& row : partial.rows) {
+            rows.emplace_back(task.first, row);
+        }
+        for (const auto& group : partial.groups) {
+            GroupAggregate& agg = groups[group.first];
+            agg.packets += group.second.packets;
+            agg.bytes += group.second.bytes;
+            agg.records += group.second.records;
+            agg.latency_us += group.second.latency_us;
+            agg.answered += group.second.answered;
+            agg.errors += group.second.errors;
+        }
+    }
+
+    if (query.group_by == Query::GroupBy::NONE) {
+        std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+            return a.second.ts_ns > b.second.ts_ns;
+        });
+        result.truncated = result.matched > query.limit;
+        if (rows.size() > query.limit) rows.resize(query.limit);
+        result.rows = std::move(rows);
+    } else {
+        result.groups.assign(groups.begin(), groups.end());
+        std::sort(result.groups.begin(), result.groups.end(), [](const auto& a, const auto& b) {
+            if (a.second.bytes != b.second.bytes) return a.second.bytes > b.second.bytes;
+            if (a.second.records != b.second.records) return a.second.records > b.second.records;
+            return a.first < b.first;
+        });
+        result.truncated = result.groups.size() > query.limit;
+        if (result.groups.size() > query.limit) result.groups.resize(query.limit);
+    }
+    return result;
+}
+
+QueryEngine::Partial QueryEngine::scanSegment(const SegmentInfo& segment, const Query& q) {
+    Partial partial;
+
+    MappedSegment map(segment.path);
+    if (map.base == MAP_FAILED) return partial;
+
+    const auto* header = static_cast<const SegmentHeader*>(map.base);
+    if (memcmp(header->magic, "SNFSEG01", sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(StoredRecord)) {
+        return partial;
+    }
+
+    const auto* records = reinterpret_cast<const StoredRecord*>(
+        static_cast<const char*>(map.base) + sizeof(SegmentHeader));
+    const uint64_t count = (map.size - sizeof(SegmentHeader)) / sizeof(StoredRecord);
+
+    // Index entries cover blocks of INDEX_STRIDE records; max_ts_ns is a
+    // running maximum, so every block before the first entry reaching
+    // from_ns is entirely older than the range
+    std::vector<IndexEntry> index = loadIndex(segment.index_path);
+    auto first = std::partition_point(index.begin(), index.end(),
+                                      [&q](const IndexEntry& e) { return e.max_ts_ns < q.from_ns; });
+    uint64_t start = first != index.end() ? first->first_record
+                     : (index.empty() ? 0 : index.back().first_record + RecordStore::INDEX_STRIDE);
+
+    constexpr uint64_t STRIDE = RecordStore::INDEX_STRIDE;
+    uint8_t sel[STRIDE];
+
+    const uint8_t want_dns = q.kind == Query::Kind::DNS ? StoredRecord::FLAG_DNS : 0;
+
+    // Row queries keep the newest matches by ts_ns in a min-heap of at most
+    // q.limit rows. Not file order: replayed and flow-summary records are
+    // appended after newer ones.
+    auto newer = [](const StoredRecord& a, const StoredRecord& b) { return a.ts_ns > b.ts_ns; };
+    std::unordered_map<uint64_t, GroupAggregate> groups;
+
+    for (uint64_t base = start; base < count; base += STRIDE) {
+        uint64_t block = base / STRIDE;
+        if (block < index.size() && index[block].min_ts_ns > q.to_ns) continue;
+
+        const StoredRecord* r = records + base;
+        const size_t len = static_cast<size_t>(std::min<uint64_t>(STRIDE, count - base));
+        partial.scanned += len;
+
+        // ---- Column-wise predicate passes --------------------------------
+        for (size_t i = 0; i < len; ++i) {
+            sel[i] = (r[i].ts_ns >= q.from_ns) & (r[i].ts_ns <= q.to_ns) &
+                     ((r[i].flags & StoredRecord::FLAG_DNS) == want_dns);
+        }
+        if (q.src_ip) {
+            for (size_t i = 0; i < len; ++i) sel[i] &= r[i].src_ip == q.src_ip;
+        }
+        if (q.dst_ip) {
+            for (size_t i = 0; i < len; ++i) sel[i] &= r[i].dst_ip == q.dst_ip;
+        }
+        if (q.any_ip) {
+            for (size_t i = 0; i < len; ++i) sel[i] &= (r[i].src_ip == q.any_ip) | (r[i].dst_ip == q.any_ip);
+        }
+        if (q.src_port >= 0) {
+            for (size_t i = 0; i < len; ++i) sel[i] &= r[i].src_port == q.src_port;
+        }
+        if (q.dst_port >= 0) {
+            for (size_t i = 0; i < len; ++i) sel[i] &= r[i].dst_port == q.dst_port;
+        }
+        if (q.any_port >= 0) {
+            for (size_t i = 0; i < len; ++i) {
+                sel[i] &= (r[i].src_port == q.any_port) | (r[i].dst_port == q.any_port);
+            }
+        }
+        if (q.protocol >= 0) {
+            for (size_t i = 0; i < len; ++i) sel[i] &= r[i].protocol == q.protocol;
+        }
+
+        // ---- Collect / aggregate the survivors ---------------------------
+        for (size_t i = 0; i < len; ++i) {
+            if (!sel[i]) continue;
+            partial.matched++;
+
+            if (q.group_by == Query::GroupBy::NONE) {
+                if (partial.rows.size() < q.limit) {
+                    partial.rows.push_back(r[i]);
+                    std::push_heap(partial.rows.begin(), partial.rows.end(), newer);
+                } else if (r[i].ts_ns >= partial.rows.front().ts_ns) {
+                    // Ties go to the later record
+                    std::pop_heap(partial.rows.begin(), partial.rows.end(), newer);
+                    partial.rows.back() = r[i];
+                    std::push_heap(partial.rows.begin(), partial.rows.end(), newer);
+                }
+                continue;
+            }
+
+            uint64_t key;
+            switch (q.group_by) {
+                case Query::GroupBy::SRC_IP: key = r[i].src_ip; break;
+                case Query::GroupBy::DST_IP: key = r[i].dst_ip; break;
+                case Query::GroupBy::SRC_PORT: key = r[i].src_port; break;
+                case Query::GroupBy::DST_PORT: key = r[i].dst_port; break;
+                case Query::GroupBy::PROTOCOL:
+                default: key = r[i].protocol; break;
+            }
+            GroupAggregate& agg = groups[key];
+            if (want_dns) {
+                agg.records++;
+                if (r[i].length != WireRecord::DNS_NO_RESPONSE) {
+                    agg.answered++;
+                    agg.latency_us += r[i].length;
+                    agg.errors += (r[i].flags >> WireRecord::DNS_RCODE_SHIFT) != 0;
+                }
+                continue;
+            }
+            uint64_t rate = r[i].sample_rate ? r[i].sample_rate : 1;
+            agg.packets += static_cast<uint64_t>(r[i].packets) * rate;
+            agg.bytes += static_cast<uint64_t>(r[i].length) * rate;
+            agg.records++;
+        }
+    }
+
+    partial.groups.assign(groups.begin(), groups.end());
+    return partial;
+}
+
+// ============================================================================
+// SERIALIZATION
+// ============================================================================
+
+json QueryEngine::rowToJson(uint32_t ssid, const StoredRecord& record) {
+    json row;
+    row["ssid"] = ssid;
+    row["ts_ns"] = record.ts_ns;
+    row["src"] = RecordCodec::ipText(record.src_ip);
+    row["dst"] = RecordCodec::ipText(record.dst_ip);
+    row["protocol"] = RecordCodec::protocolName(record.protocol);
+    if (record.protocol == 6 || record.protocol == 17) {
+        row["src_port"] = record.src_port;
+        row["dst_port"] = record.dst_port;
+    }
+    if (record.flags & StoredRecord::FLAG_DNS) {
+        RecordCodec::dnsFields(row, record.flags, record.length);
+        if (record.flags & StoredRecord::FLAG_REPLAYED) row["replayed"] = true;
+        return row;
+    }
+    row["length"] = record.length;
+    if (record.packets > 1) row["packets"] = record.packets;
+    if (record.sample_rate > 1) row["sample_rate"] = record.sample_rate;
+    if (record.flags & StoredRecord::FLAG_FLOW_SUMMARY) row["kind"] = "flow_summary";
+    if (record.flags & StoredRecord::FLAG_REPLAYED) row["replayed"] = true;
+    return row;
+}
+
+json QueryEngine::groupToJson(const Query& query, uint64_t key, const GroupAggregate& agg) {
+    json group;
+    switch (query.group_by) {
+        case Query::GroupBy::SRC_IP:
+        case Query::GroupBy::DST_IP:
+            group["key"] = RecordCodec::ipText(static_cast<uint32_t>(key));
+            break;
+        case Query::GroupBy::PROTOCOL:
+            group["key"] = RecordCodec::protocolName(static_cast<uint8_t>(key));
+            break;
+        default:
+            group["key"] = std::to_string(key);
+            break;
+    }
+    group["records"] = agg.records;
+    if (query.kind == Query::Kind::DNS) {
+        // Mean latency of the answered queries; unanswered ones are timeouts
+        group["answered"] = agg.answered;
+        group["timeouts"] = agg.records - agg.answered;
+        group["errors"] = agg.errors;
+        if (agg.answered) group["latency_us"] = agg.latency_us / agg.answered;
+        return group;
+    }
+    group["packets"] = agg.packets;
+    group["bytes"] = agg.bytes;
+    return group;
+}
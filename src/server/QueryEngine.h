@@ -0,0 +1,150 @@
+/**
+ * @file QueryEngine.h
+ * @brief Filters and aggregations over records in a RecordStore
+ *
+ * Answers questions about stored history that the GUI tables (capped at
+ * MainWindow::MAX_ROWS) cannot, for example:
+ * - "bytes by dst_port for SSID 3 between T1 and T2"
+ *   `{"ssid":3,"from_ns":T1,"to_ns":T2,"group_by":"dst_port"}`
+ * - "all packets to 10.1.2.3"
+ *   `{"dst":"10.1.2.3"}`
+ * - "DNS latency and errors by resolver"
+ *   `{"kind":"dns","group_by":"dst"}`
+ *
+ * ## Execution
+ *
+ * - Each matching segment is one task on a ThreadPool, so a query spreads
+ *   across cores.
+ * - A task mmaps its segment and starts at the block found through the
+ *   sparse time index. Index blocks whose minimum timestamp is after the end
+ *   of the range are skipped without being touched.
+ * - Each block of INDEX_STRIDE records is filtered column by column: one
+ *   tight loop per active predicate refines a byte mask, with no branches or
+ *   parsing inside the loops. A final loop over the mask aggregates, or
+ *   keeps the newest rows by timestamp in a heap of at most limit rows
+ *   (segments are not in timestamp order: replayed records come late).
+ * - Per-segment partial results are merged at the end: group sums are added,
+ *   and row lists are merged newest first and cut to the limit.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <nlohmann/json.hpp>
+#include "RecordStore.h"
+#include "ThreadPool.h"
+
+using json = nlohmann::json;
+
+/**
+ * @struct Query
+ * @brief A parsed QUERY request
+ *
+ * All filters are optional and AND'd together. IPv4 addresses are in network
+ * byte order, as stored; 0 / -1 mean "any".
+ */
+struct Query {
+    /// Aggregation key; NONE returns individual records
+    enum class GroupBy { NONE, SRC_IP, DST_IP, SRC_PORT, DST_PORT, PROTOCOL };
+
+    /// Packets and flow summaries, or DNS transactions; never both, so
+    /// latencies are not added up as bytes
+    enum class Kind { TRAFFIC, DNS };
+
+    /// Hard cap on rows or groups returned, whatever the client asks for
+    static constexpr uint32_t MAX_LIMIT = 100000;
+
+    uint32_t id = 0;                   ///< Client-chosen id echoed in every result frame
+    uint32_t ssid = 0;                 ///< Protocol::SSID_UNASSIGNED = all sniffers
+    uint64_t from_ns = 0;              ///< Inclusive
+    uint64_t to_ns = UINT64_MAX;       ///< Inclusive
+    uint32_t src_ip = 0;
+    uint32_t dst_ip = 0;
+    uint32_t any_ip = 0;               ///< Matches source or destination
+    int32_t src_port = -1;
+    int32_t dst_port = -1;
+    int32_t any_port = -1;             ///< Matches source or destination port
+    int32_t protocol = -1;             ///< IPPROTO_* number
+    Kind kind = Kind::TRAFFIC;
+    GroupBy group_by = GroupBy::NONE;
+    uint32_t limit = 1000;             ///< Rows (newest first) or groups (largest bytes first)
+
+    /**
+     * @brief Parse a QUERY payload
+     *
+     * Keys: id, ssid, from_ns, to_ns, src, dst, ip, src_port, dst_port, port,
+     * protocol ("TCP"/"UDP"/"ICMP" or a number), kind ("traffic", the
+     * default, or "dns"), group_by ("src", "dst", "src_port", "dst_port",
+     * "protocol"), limit.
+     *
+     * @throws std::invalid_argument for malformed addresses or unknown names
+     */
+    static Query fromJson(const json& request);
+};
+
+/**
+ * @struct GroupAggregate
+ * @brief Sums for one group key; packets and bytes scaled by sample rate
+ *
+ * DNS groups count transactions in records and leave packets and bytes 0.
+ */
+struct GroupAggregate {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t records = 0;
+    uint64_t latency_us = 0;    ///< DNS: sum over answered queries
+    uint64_t answered = 0;      ///< DNS: queries with a response
+    uint64_t errors = 0;        ///< DNS: responses with an rcode other than NOERROR
+};
+
+/**
+ * @struct QueryResult
+ * @brief Merged result of a query across all segments
+ */
+struct QueryResult {
+    std::vector<std::pair<uint32_t, StoredRecord>> rows;       ///< (ssid, record), newest first
+    std::vector<std::pair<uint64_t, GroupAggregate>> groups;   ///< Largest bytes first
+    uint64_t segments = 0;   ///< Segments scanned
+    uint64_t scanned = 0;    ///< Records examined
+    uint64_t matched = 0;    ///< Records that passed every filter
+    bool truncated = false;  ///< More rows or groups matched than limit
+};
+
+/**
+ * @class QueryEngine
+ * @brief Runs Query objects against a RecordStore on a ThreadPool
+ *
+ * Stateless apart from its references; run() may be called concurrently.
+ */
+class QueryEngine {
+public:
+    QueryEngine(const RecordStore& store, ThreadPool& pool) : store_(store), pool_(pool) {}
+
+    /**
+     * @brief Execute a query, blocking until every segment task finishes
+     */
+    QueryResult run(const Query& query) const;
+
+    /// Serialize one result row for a QUERY_RESULT frame
+    static json rowToJson(uint32_t ssid, const StoredRecord& record);
+
+    /// Serialize one group for a QUERY_RESULT frame (DNS fields for Kind::DNS)
+    static json groupToJson(const Query& query, uint64_t key, const GroupAggregate& agg);
+
+private:
+    /// Result of scanning a single segment
+    struct Partial {
+        std::vector<StoredRecord> rows;    ///< The limit newest matches by ts_ns, in no order
+        std::vector<std::pair<uint64_t, GroupAggregate>> groups;
+        uint64_t scanned = 0;
+        uint64_t matched = 0;
+    };
+
+    static Partial scanSegment(const SegmentInfo& segment, const Query& query);
+
+    const RecordStore& store_;
+    ThreadPool& pool_;
+};
@@ -0,0 +1,490 @@
+/**
+ * @file RecordStore.cpp
+ * @brief Implementation of the segmented on-disk record store
+ */
+
+#include "RecordStore.h"
+#include "../Protocol.h"
+#include "../RecordCodec.h"
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'S', 'N', 'F', 'S', 'E', 'G', '0', '1'};
+
+uint64_t wallClockNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+/// write() the whole buffer, retrying on partial writes and EINTR
+bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+// ============================================================================
+// CONSTRUCTION
+// ============================================================================
+
+RecordStore::RecordStore(const StoreConfig& config) : config_(config) {
+    if (config_.root.empty()) {
+        throw std::runtime_error("RecordStore: no directory given");
+    }
+    if (mkdir(config_.root.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("RecordStore: cannot create " + config_.root + ": " + strerror(errno));
+    }
+
+    std::cout << "[STORE] Writing records to " << config_.root
+              << " (segment " << (config_.segment_max_bytes >> 20) << " MB / "
+              << config_.segment_max_seconds << " s";
+    if (config_.retain_seconds) std::cout << ", keep " << config_.retain_seconds / 3600 << " h";
+    if (config_.retain_bytes) std::cout << ", cap " << (config_.retain_bytes >> 20) << " MB";
+    std::cout << ")" << std::endl;
+
+    writer_ = std::thread(&RecordStore::writerLoop, this);
+}
+
+RecordStore::~RecordStore() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_one();
+    if (writer_.joinable()) writer_.join();
+}
+
+// ============================================================================
+// INGEST
+// ============================================================================
+
+StoredRecord RecordStore::fromJson(const json& log) {
+    return fromWire(RecordCodec::fromJson(log));
+}
+
+StoredRecord RecordStore::fromWire(const WireRecord& wire) {
+    StoredRecord r;
+    memset(&r, 0, sizeof(r));
+
+    r.ts_ns = wire.ts_ns ? wire.ts_ns : wallClockNs();   // Fall back to arrival time
+    r.seq = wire.seq;
+    r.src_ip = wire.src_ip;
+    r.dst_ip = wire.dst_ip;
+    r.length = wire.length;
+    r.packets = wire.packets;
+    r.sample_rate = wire.sample_rate;
+    r.src_port = wire.src_port;
+    r.dst_port = wire.dst_port;
+    r.protocol = wire.protocol;
+    if (wire.flags & WireRecord::FLAG_FLOW_SUMMARY) {
+        r.flags |= StoredRecord::FLAG_FLOW_SUMMARY;
+    }
+    if (wire.flags & WireRecord::FLAG_REPLAYED) {
+        r.flags |= StoredRecord::FLAG_REPLAYED;
+    }
+    if (wire.flags & WireRecord::FLAG_DNS) {
+        r.flags |= StoredRecord::FLAG_DNS | (wire.flags & (0x0F << WireRecord::DNS_RCODE_SHIFT));
+    }
+    return r;
+}
+
+bool RecordStore::append(uint32_t ssid, const json& log) {
+    return append(ssid, fromJson(log));
+}
+
+bool RecordStore::append(uint32_t ssid, const StoredRecord& record) {
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (queue_.size() >= config_.queue_capacity) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        queue_.push_back({ssid, record});
+        queued = queue_.size();
+    }
+
+    // Waking the writer per record would cost a futex call each; it also
+    // wakes on its own every FLUSH_INTERVAL_MS / 10
+    if (queued == WAKE_BATCH) queue_cv_.notify_one();
+    return true;
+}
+
+// ============================================================================
+// WRITER THREAD
+// ============================================================================
+
+void RecordStore::writerLoop() {
+    std::vector<Pending> batch;
+    auto last_flush = std::chrono::steady_clock::now();
+    auto last_retention = last_flush;
+
+    while (true) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS / 10),
+                               [this] { return stopping_ || queue_.size() >= WAKE_BATCH; });
+            // Swapping hands the producers our (already sized) empty vector
+            batch.swap(queue_);
+            stop = stopping_;
+        }
+
+        uint64_t now_ns = wallClockNs();
+        for (const auto& p : batch) {
+            writeRecord(p.ssid, p.record, now_ns);
+        }
+        batch.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        if (stop || now - last_flush >= std::chrono::milliseconds(FLUSH_INTERVAL_MS)) {
+            flushAll(now_ns);
+            last_flush = now;
+        }
+        if (rotated_ || now - last_retention >= std::chrono::seconds(RETENTION_CHECK_SEC)) {
+            enforceRetention(now_ns);
+            rotated_ = false;
+            last_retention = now;
+        }
+
+        if (stop) break;
+    }
+
+    for (auto& entry : active_) {
+        closeSegment(entry.second);
+    }
+    active_.clear();
+    std::cout << "[STORE] Closed; " << written() << " records written, "
+              << dropped() << " dropped" << std::endl;
+}
+
+void RecordStore::writeRecord(uint32_t ssid, const StoredRecord& record, uint64_t now_ns) {
+    ActiveSegment& seg = activeSegment(ssid, now_ns);
+    if (seg.fd < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    const char* bytes = reinterpret_cast<const char*>(&record);
+    seg.buffer.insert(seg.buffer.end(), bytes, bytes + sizeof(record));
+    seg.buffered++;
+    seg.records++;
+    seg.bytes += sizeof(record);
+    seg.max_ts = std::max(seg.max_ts, record.ts_ns);
+    seg.block_min_ts = std::min(seg.block_min_ts, record.ts_ns);
+
+    // Close the block: one sparse index entry per INDEX_STRIDE records
+    if (seg.records % INDEX_STRIDE == 0) {
+        seg.pending_index.push_back({seg.max_ts, seg.block_min_ts, seg.records - INDEX_STRIDE});
+        seg.block_min_ts = UINT64_MAX;
+    }
+
+    if (seg.buffer.size() >= WRITE_BUFFER_BYTES) {
+        flush(seg);
+    }
+}
+
+RecordStore::ActiveSegment& RecordStore::activeSegment(uint32_t ssid, uint64_t now_ns) {
+    ActiveSegment& seg = active_[ssid];
+
+    if (seg.fd >= 0) {
+        bool too_big = seg.bytes >= config_.segment_max_bytes;
+        bool too_old = config_.segment_max_seconds > 0 &&
+                       now_ns - seg.start_ns >= config_.segment_max_seconds * 1000000000ull;
+        if (too_big || too_old) {
+            closeSegment(seg);
+        }
+    }
+
+    if (seg.fd < 0) {
+        openSegment(ssid, seg, now_ns);
+    }
+    return seg;
+}
+
+void RecordStore::openSegment(uint32_t ssid, ActiveSegment& seg, uint64_t now_ns) {
+    std::string dir = ssidDir(ssid);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "[STORE] Cannot create " << dir << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    // Zero-padded so lexical order of file names is time order
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(now_ns));
+    std::string base = dir + "/" + name;
+
+    seg = ActiveSegment();
+    seg.path = base + ".seg";
+    seg.start_ns = now_ns;
+    seg.fd = open(seg.path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    seg.index_fd = open((base + ".idx").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (seg.fd < 0 || seg.index_fd < 0) {
+        std::cerr << "[STORE] Cannot create segment " << seg.path << ": " << strerror(errno) << std::endl;
+        if (seg.fd >= 0) close(seg.fd);
+        if (seg.index_fd >= 0) close(seg.index_fd);
+        seg.fd = seg.index_fd = -1;
+        return;
+    }
+
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.record_size = sizeof(StoredRecord);
+    header.ssid = ssid;
+    header.created_ns = now_ns;
+
+    seg.buffer.reserve(WRITE_BUFFER_BYTES + sizeof(StoredRecord));
+    const char* bytes = reinterpret_cast<const char*>(&header);
+    seg.buffer.insert(seg.buffer.end(), bytes, bytes + sizeof(header));
+    seg.bytes = sizeof(header);
+
+    std::lock_guard<std::mutex> lock(active_paths_mutex_);
+    active_paths_.insert(seg.path);
+}
+
+void RecordStore::closeSegment(ActiveSegment& seg) {
+    if (seg.fd < 0) return;
+
+    // Index the trailing partial block so closed segments are fully covered
+    if (seg.records % INDEX_STRIDE != 0) {
+        seg.pending_index.push_back({seg.max_ts, seg.block_min_ts,
+                                     seg.records - seg.records % INDEX_STRIDE});
+    }
+    flush(seg);
+    releaseSegment(seg);
+}
+
+void RecordStore::releaseSegment(ActiveSegment& seg) {
+    if (seg.fd < 0) return;
+
+    close(seg.fd);
+    close(seg.index_fd);
+    seg.fd = seg.index_fd = -1;
+    rotated_ = true;
+
+    std::lock_guard<std::mutex> lock(active_paths_mutex_);
+    active_paths_.erase(seg.path);
+}
+
+void RecordStore::flush(ActiveSegment& seg) {
+    if (seg.fd < 0) return;
+
+    if (!seg.buffer.empty()) {
+        if (!writeAll(seg.fd, seg.buffer.data(), seg.buffer.size())) {
+            std::cerr << "[STORE] Write to " << seg.path << " failed: " << strerror(errno)
+                      << "; closing the segment" << std::endl;
+            dropped_.fetch_add(seg.buffered, std::memory_order_relaxed);
+
+            // Part of the buffer may have reached the disk: cut the file back
+            // to its last whole record, and forget the index entries of the
+            // lost records. Later records would sit behind the torn one, so
+            // they go to a new segment.
+            if (seg.written_bytes == 0) {
+                unlink(seg.path.c_str());
+                unlink((seg.path.substr(0, seg.path.size() - 4) + ".idx").c_str());
+            } else if (ftruncate(seg.fd, static_cast<off_t>(seg.written_bytes)) != 0) {
+                std::cerr << "[STORE] Cannot truncate " << seg.path << ": " << strerror(errno) << std::endl;
+            }
+            seg.buffer.clear();
+            seg.buffered = 0;
+            seg.pending_index.clear();
+            releaseSegment(seg);
+            return;
+        }
+        written_.fetch_add(seg.buffered, std::memory_order_relaxed);
+        seg.written_bytes += seg.buffer.size();
+        seg.buffer.clear();
+        seg.buffered = 0;
+    }
+
+    // Index entries only after the records they point at are on disk, so a
+    // reader never follows an entry past the end of the segment
+    if (!seg.pending_index.empty()) {
+        size_t len = seg.pending_index.size() * sizeof(IndexEntry);
+        bool indexed = writeAll(seg.index_fd, reinterpret_cast<const char*>(seg.pending_index.data()), len);
+        seg.pending_index.clear();
+        if (!indexed) {
+            // A torn entry would shift every later one: keep the whole
+            // entries and leave the rest of the records as the unindexed tail
+            std::cerr << "[STORE] Index write for " << seg.path << " failed: " << strerror(errno)
+                      << "; closing the segment" << std::endl;
+            if (ftruncate(seg.index_fd, static_cast<off_t>(seg.index_bytes)) != 0) {
+                std::cerr << "[STORE] Cannot truncate the index of " << seg.path << ": "
+                          << strerror(errno) << std::endl;
+            }
+            releaseSegment(seg);
+            return;
+        }
+        seg.index_bytes += len;
+    }
+}
+
+void RecordStore::flushAll(uint64_t now_ns) {
+    for (auto& entry : active_) {
+        ActiveSegment& seg = entry.second;
+        // An idle sniffer's segment still has to rotate on age
+        if (seg.fd >= 0 && config_.segment_max_seconds > 0 &&
+            now_ns - seg.start_ns >= config_.segment_max_seconds * 1000000000ull) {
+            closeSegment(seg);
+        } else {
+            flush(seg);
+        }
+    }
+}
+
+// ============================================================================
+// RETENTION
+// ============================================================================
+
+void RecordStore::enforceRetention(uint64_t now_ns) {
+    std::vector<SegmentInfo> segments = listSegments(Protocol::SSID_UNASSIGNED);
+
+    // Oldest first across all SSIDs, so the disk cap removes the oldest data
+    std::sort(segments.begin(), segments.end(),
+              [](const SegmentInfo& a, const SegmentInfo& b) { return a.start_ns < b.start_ns; });
+
+    uint64_t total = 0;
+    for (const auto& s : segments) total += s.bytes;
+
+    uint64_t removed = 0;
+    for (const auto& s : segments) {
+        if (s.active) continue;
+
+        bool expired = false;
+        if (config_.retain_seconds > 0) {
+            // A segment expires when its newest data does: use the mtime
+            struct stat st;
+            if (stat(s.path.c_str(), &st) == 0) {
+                uint64_t mtime_ns = static_cast<uint64_t>(st.st_mtime) * 1000000000ull;
+                expired = now_ns > mtime_ns && now_ns - mtime_ns > config_.retain_seconds * 1000000000ull;
+            }
+        }
+        bool over_cap = config_.retain_bytes > 0 && total > config_.retain_bytes;
+        if (!expired && !over_cap) continue;
+
+        unlink(s.path.c_str());
+        unlink(s.index_path.c_str());
+        total -= std::min(total, s.bytes);
+        removed++;
+    }
+
+    if (removed > 0) {
+        std::cout << "[STORE] Retention removed " << removed << " segment(s), "
+                  << (total >> 20) << " MB on disk" << std::endl;
+    }
+}
+
+// ============================================================================
+// SEGMENT LISTING AND LOOKUP
+// ============================================================================
+
+uint64_t RecordStore::seekTime(const SegmentInfo& segment, uint64_t ts_ns) {
+    int fd = open(segment.index_path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;   // No index: scan from the start
+
+    struct stat st;
+    uint64_t entries = fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) / sizeof(IndexEntry) : 0;
+
+    // max_ts_ns is a running maximum, so it never decreases across entries
+    uint64_t lo = 0, hi = entries;
+    IndexEntry entry;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (pread(fd, &entry, sizeof(entry), static_cast<off_t>(mid * sizeof(entry))) != sizeof(entry)) {
+            close(fd);
+            return 0;
+        }
+        if (entry.max_ts_ns >= ts_ns) hi = mid;
+        else lo = mid + 1;
+    }
+
+    uint64_t start = 0;
+    if (lo < entries) {
+        pread(fd, &entry, sizeof(entry), static_cast<off_t>(lo * sizeof(entry)));
+        start = entry.first_record;
+    } else if (entries > 0) {
+        // Every indexed block is older; only the unindexed tail can match
+        pread(fd, &entry, sizeof(entry), static_cast<off_t>((entries - 1) * sizeof(entry)));
+        start = entry.first_record + INDEX_STRIDE;
+    }
+    close(fd);
+    return std::min(start, segment.records);
+}
+
+std::string RecordStore::ssidDir(uint32_t ssid) const {
+    return config_.root + "/ssid-" + std::to_string(ssid);
+}
+
+std::vector<SegmentInfo> RecordStore::listSegments(uint32_t ssid) const {
+    std::vector<SegmentInfo> result;
+
+    DIR* root = opendir(config_.root.c_str());
+    if (!root) return result;
+
+    std::set<std::string> active;
+    {
+        std::lock_guard<std::mutex> lock(active_paths_mutex_);
+        active = active_paths_;
+    }
+
+    while (struct dirent* dir_entry = readdir(root)) {
+        uint32_t dir_ssid = 0;
+        if (sscanf(dir_entry->d_name, "ssid-%u", &dir_ssid) != 1) continue;
+        if (ssid != Protocol::SSID_UNASSIGNED && dir_ssid != ssid) continue;
+
+        std::string dir = ssidDir(dir_ssid);
+        DIR* segs = opendir(dir.c_str());
+        if (!segs) continue;
+
+        while (struct dirent* seg_entry = readdir(segs)) {
+            std::string name = seg_entry->d_name;
+            if (name.size() <= 4 || name.compare(name.size() - 4, 4, ".seg") != 0) continue;
+
+            SegmentInfo info;
+            info.ssid = dir_ssid;
+            info.path = dir + "/" + name;
+            info.index_path = info.path.substr(0, info.path.size() - 4) + ".idx";
+            info.start_ns = std::strtoull(name.c_str(), nullptr, 10);
+
+            struct stat st;
+            if (stat(info.path.c_str(), &st) != 0) continue;
+            info.bytes = static_cast<uint64_t>(st.st_size);
+            info.records = info.bytes > sizeof(SegmentHeader)
+                    ? (info.bytes - sizeof(SegmentHeader)) / sizeof(StoredRecord) : 0;
+            info.active = active.count(info.path) > 0;
+            result.push_back(info);
+        }
+        closedir(segs);
+    }
+    closedir(root);
+
+    std::sort(result.begin(), result.end(), [](const SegmentInfo& a, const SegmentInfo& b) {
+        return a.ssid != b.ssid ? a.ssid < b.ssid : a.start_ns < b.start_ns;
+    });
+    return result;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file RecordStore.h
+ * @brief Append-only on-disk store for the server's record stream
+ *
+ * The server used to forward each TRAFFIC_LOG to the GUIs and then forget it.
+ * RecordStore keeps a copy on disk so history survives beyond what the GUI
+ * tables hold.
+ *
+ * ## Layout
+ *
+ * ```
+ * <root>/ssid-<N>/<start_ns>.seg   segment: SegmentHeader + StoredRecord[]
+ * <root>/ssid-<N>/<start_ns>.idx   sparse index: IndexEntry per INDEX_STRIDE records
+ * ```
+ *
+ * - Records are fixed-size (48 bytes), so record i lives at
+ *   sizeof(SegmentHeader) + i * sizeof(StoredRecord) and can be mmapped and
+ *   scanned without parsing.
+ * - Segments rotate when they reach a size or age limit. Only the newest
+ *   segment of each SSID is ever written to.
+ * - The sparse index holds one entry per INDEX_STRIDE records with the
+ *   running maximum timestamp, which never decreases, so the first block that
+ *   can contain a time T is found by binary search: O(log n) seeks per
+ *   segment instead of a full scan.
+ *
+ * ## Ingest Path
+ *
+ * append() converts the JSON record into a StoredRecord and pushes it onto a
+ * bounded in-memory queue; it never touches the disk and never blocks the
+ * fan-out path. If the queue is full the record is dropped and counted.
+ * A single writer thread drains the queue into per-SSID 1 MB buffers and
+ * issues large sequential write() calls.
+ *
+ * ## Retention
+ *
+ * After each rotation, and at least every RETENTION_CHECK_SEC, closed
+ * segments older than the age limit are deleted. Oldest-first deletion then
+ * continues while the store exceeds its disk usage limit.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <nlohmann/json.hpp>
+#include "../RecordCodec.h"
+
+using json = nlohmann::json;
+
+/**
+ * @struct StoredRecord
+ * @brief Fixed-size on-disk representation of one TRAFFIC_LOG record
+ *
+ * Host byte order except for the IPv4 addresses, which stay in network order
+ * so they compare directly against inet_pton() output.
+ */
+struct StoredRecord {
+    uint64_t ts_ns;        ///< Capture time, nanoseconds since the epoch
+    uint64_t seq;          ///< Sniffer sequence number (0 if not numbered)
+    uint32_t src_ip;       ///< IPv4 source, network byte order (0 if not IPv4)
+    uint32_t dst_ip;       ///< IPv4 destination, network byte order
+    uint32_t length;       ///< Bytes (flow summaries: total bytes; DNS: latency in us)
+    uint32_t packets;      ///< Packets this record stands for (flow summaries > 1)
+    uint32_t sample_rate;  ///< Sampling rate the record was kept at (1 = unsampled)
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;      ///< IPPROTO_* number (0 if unknown)
+    uint8_t flags;         ///< FLAG_* bits
+    uint8_t reserved[6];
+
+    /// Record is a flow summary rather than a single packet
+    static constexpr uint8_t FLAG_FLOW_SUMMARY = 0x01;
+
+    /// Record was spilled by the sniffer during an outage and sent late
+    static constexpr uint8_t FLAG_REPLAYED = 0x02;
+
+    /// Record is a DNS transaction: length is the latency in microseconds
+    /// and the upper four bits of flags the rcode (see RecordCodec.h)
+    static constexpr uint8_t FLAG_DNS = 0x04;
+};
+static_assert(sizeof(StoredRecord) == 48, "StoredRecord layout is part of the on-disk format");
+
+/**
+ * @struct SegmentHeader
+ * @brief First 64 bytes of every segment file
+ */
+struct SegmentHeader {
+    char magic[8];         ///< "SNFSEG01"
+    uint32_t version;      ///< Format version (1)
+    uint32_t record_size;  ///< sizeof(StoredRecord) when written
+    uint32_t ssid;         ///< Sniffer the segment belongs to
+    uint32_t reserved0;
+    uint64_t created_ns;   ///< When the segment was opened
+    uint8_t reserved[32];
+};
+static_assert(sizeof(SegmentHeader) == 64, "SegmentHeader layout is part of the on-disk format");
+
+/**
+ * @struct IndexEntry
+ * @brief One sparse index entry, written every INDEX_STRIDE records
+ */
+struct IndexEntry {
+    uint64_t max_ts_ns;    ///< Largest timestamp in the segment up to the end of this block
+    uint64_t min_ts_ns;    ///< Smallest timestamp within this block
+    uint64_t first_record; ///< Index of the block's first record
+};
+static_assert(sizeof(IndexEntry) == 24, "IndexEntry layout is part of the on-disk format");
+
+/**
+ * @struct SegmentInfo
+ * @brief Metadata about one segment on disk, as seen by queries
+ */
+struct SegmentInfo {
+    uint32_t ssid;
+    std::string path;          ///< .seg file
+    std::string index_path;    ///< .idx file
+    uint64_t start_ns;         ///< From the file name
+    uint64_t records;          ///< Complete records flushed to disk
+    uint64_t bytes;            ///< File size
+    bool active;               ///< Still being appended to
+};
+
+/**
+ * @struct StoreConfig
+ * @brief Rotation and retention limits for a RecordStore
+ */
+struct StoreConfig {
+    std::string root;                                   ///< Directory holding ssid-* subdirectories
+    uint64_t segment_max_bytes = 64ull << 20;           ///< Rotate after this many bytes
+    uint32_t segment_max_seconds = 300;                 ///< Rotate after this age
+    uint64_t retain_seconds = 7 * 24 * 3600;            ///< Delete closed segments older than this (0 = keep)
+    uint64_t retain_bytes = 0;                          ///< Cap on total disk usage (0 = unlimited)
+    size_t queue_capacity = 1 << 20;                    ///< Records buffered before ingest drops
+};
+
+/**
+ * @class RecordStore
+ * @brief Segmented, time-indexed, append-only record store
+ *
+ * Thread-safe: append() may be called from any connection thread.
+ */
+class RecordStore {
+public:
+    /// Sparse index granularity (records per IndexEntry)
+    static constexpr uint64_t INDEX_STRIDE = 1024;
+
+    /// Size of each per-SSID write buffer
+    static constexpr size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+    /// Buffered data is flushed at least this often
+    static constexpr int FLUSH_INTERVAL_MS = 1000;
+
+    /// Retention runs at least this often even without rotations
+    static constexpr int RETENTION_CHECK_SEC = 30;
+
+    /**
+     * @brief Open (or create) a store and start its writer thread
+     * @param config Directory and limits
+     * @throws std::runtime_error if the root directory cannot be created
+     */
+    explicit RecordStore(const StoreConfig& config);
+
+    /// Flushes pending records and stops the writer thread
+    ~RecordStore();
+
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
+
+    /**
+     * @brief Queue a record for storage (non-blocking)
+     *
+     * @param ssid Sniffer that produced the record
+     * @param log TRAFFIC_LOG JSON
+     * @return false if the queue was full and the record was dropped
+     */
+    bool append(uint32_t ssid, const json& log);
+
+    /**
+     * @brief Queue an already converted record (non-blocking)
+     */
+    bool append(uint32_t ssid, const StoredRecord& record);
+
+    /**
+     * @brief List segments on disk, oldest first
+     * @param ssid Restrict to one sniffer, or Protocol::SSID_UNASSIGNED for all
+     */
+    std::vector<SegmentInfo> listSegments(uint32_t ssid) const;
+
+    /**
+     * @brief Find where a time-range scan of a segment should start
+     *
+     * Binary-searches the segment's sparse index on disk (pread per probe, so
+     * O(log n) seeks) for the first block whose running maximum timestamp
+     * reaches ts_ns. Every record before the returned index is older than
+     * ts_ns; records from it onward still have to be filtered by time.
+     *
+     * @param segment Segment from listSegments()
+     * @param ts_ns Start of the time range
+     * @return Record index to start scanning at (segment.records if none qualify)
+     */
+    static uint64_t seekTime(const SegmentInfo& segment, uint64_t ts_ns);
+
+    /// Records dropped because the ingest queue was full
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /// Records written to disk
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+
+    /// Configured root directory
+    const std::string& root() const { return config_.root; }
+
+    /**
+     * @brief Convert a TRAFFIC_LOG JSON object into the on-disk record
+     *
+     * Uses "ts_ns" when present, otherwise parses the "timestamp" string
+     * (local time, as produced by PacketParser) with a per-second cache so
+     * mktime() runs at most once per distinct second.
+     */
+    static StoredRecord fromJson(const json& log);
+
+    /**
+     * @brief Convert a binary (RECORD_BATCH) record into the on-disk record
+     *
+     * A record without a timestamp gets the arrival time.
+     */
+    static StoredRecord fromWire(const WireRecord& wire);
+
+private:
+    /// One queued record
+    struct Pending {
+        uint32_t ssid;
+        StoredRecord record;
+    };
+
+    /// Open segment being appended to for one SSID
+    struct ActiveSegment {
+        int fd = -1;
+        int index_fd = -1;
+        std::string path;
+        uint64_t start_ns = 0;
+        uint64_t records = 0;          ///< Records in the segment (written + buffered)
+        uint64_t bytes = 0;            ///< File size including buffered data
+        uint64_t written_bytes = 0;    ///< File size: data that reached the disk
+        uint64_t index_bytes = 0;      ///< Index file size
+        uint64_t max_ts = 0;           ///< Running max timestamp
+        uint64_t block_min_ts = UINT64_MAX;
+        std::vector<char> buffer;      ///< Pending sequential write
+        size_t buffered = 0;           ///< Records in buffer
+        std::vector<IndexEntry> pending_index; ///< Written after the records they describe
+    };
+
+    void writerLoop();
+    void writeRecord(uint32_t ssid, const StoredRecord& record, uint64_t now_ns);
+    ActiveSegment& activeSegment(uint32_t ssid, uint64_t now_ns);
+    void openSegment(uint32_t ssid, ActiveSegment& seg, uint64_t now_ns);
+    void closeSegment(ActiveSegment& seg);
+    void releaseSegment(ActiveSegment& seg);
+    void flush(ActiveSegment& seg);
+    void flushAll(uint64_t now_ns);
+    void enforceRetention(uint64_t now_ns);
+
+    std::string ssidDir(uint32_t ssid) const;
+
+    StoreConfig config_;
+
+    // Ingest queue (producer: connection threads, consumer: writer thread)
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::vector<Pending> queue_;
+    bool stopping_ = false;
+
+    /// Producers wake the writer once this many records are queued
+    static constexpr size_t WAKE_BATCH = 4096;
+
+    // Writer state (writer thread only, except the active-path set below)
+    std::map<uint32_t, ActiveSegment> active_;
+    bool rotated_ = false;             ///< A segment was closed since the last retention pass
+
+    // Paths of segments currently being written, for listSegments() and retention
+    mutable std::mutex active_paths_mutex_;
+    std::set<std::string> active_paths_;
+
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> written_{0};
+
+    std::thread writer_;
+};
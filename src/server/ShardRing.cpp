@@ -0,0 +1,58 @@
+/**
+ * @file ShardRing.cpp
+ * @brief Implementation of the consistent-hash ring over a server pool
+ */
+
+#include "ShardRing.h"
+#include "../Protocol.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+std::vector<std::string> ShardRing::parsePool(const std::string& list) {
+    std::vector<std::string> members;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        std::string member = list.substr(start, comma - start);
+
+        size_t colon = member.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == member.size() ||
+            member.find_first_not_of("0123456789", colon + 1) != std::string::npos) {
+            throw std::invalid_argument("pool member \"" + member + "\" is not HOST:PORT");
+        }
+        if (std::find(members.begin(), members.end(), member) == members.end()) {
+            members.push_back(member);
+        }
+        start = comma + 1;
+    }
+    return members;
+}
+
+ShardRing::ShardRing(std::vector<std::string> members, std::string self)
+    : members_(std::move(members)), self_(std::move(self)) {
+    if (std::find(members_.begin(), members_.end(), self_) == members_.end()) {
+        throw std::invalid_argument("--self " + self_ + " is not in the pool");
+    }
+
+    points_.reserve(members_.size() * VNODES);
+    for (uint32_t m = 0; m < members_.size(); ++m) {
+        for (int i = 0; i < VNODES; ++i) {
+            points_.emplace_back(Protocol::identityHash(members_[m] + "#" + std::to_string(i)), m);
+        }
+    }
+    // Ties (practically impossible) are broken by member name, not by the
+    // order of the --pool list, so every server builds the same ring
+    std::sort(points_.begin(), points_.end(), [this](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first < b.first : members_[a.second] < members_[b.second];
+    });
+}
+
+const std::string& ShardRing::owner(const std::string& identity) const {
+    uint64_t h = Protocol::identityHash(identity);
+    auto it = std::lower_bound(points_.begin(), points_.end(), h,
+                               [](const std::pair<uint64_t, uint32_t>& p, uint64_t v) { return p.first < v; });
+    if (it == points_.end()) it = points_.begin();   // Wrap around
+    return members_[it->second];
+}
@@ -0,0 +1,70 @@
+/**
+ * @file ShardRing.h
+ * @brief Consistent hashing of sniffers onto a pool of servers
+ *
+ * With `--pool A,B,C --self B` several servers share the sniffers between
+ * them. Every server of the pool builds the same ring from the same member
+ * list, so all of them agree on which server owns a sniffer without talking
+ * to each other. A sniffer that connects to the wrong one is redirected in
+ * SERVER_HELLO.
+ *
+ * ## Ring
+ *
+ * Each member is placed on a 64-bit ring at VNODES points, hashed from
+ * "HOST:PORT#i" with Protocol::identityHash(). A sniffer ("hostname/interface")
+ * is owned by the member of the first point at or after its own hash.
+ *
+ * - Adding or removing a member moves only the sniffers between its points
+ *   and their predecessors, about 1/N of them; the rest keep their server.
+ * - With 128 points per member the busiest of up to ten servers carries
+ *   about 10% more than the average share.
+ *
+ * The member list is configuration, not discovery: every server of a pool
+ * must be started with the same --pool list (in any order).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @class ShardRing
+ * @brief Which server of a pool owns a sniffer
+ *
+ * Immutable after construction, so it may be read from any thread.
+ */
+class ShardRing {
+public:
+    /// Points on the ring per member
+    static constexpr int VNODES = 128;
+
+    /**
+     * @brief Parse "HOST:PORT,HOST:PORT,..."
+     * @throws std::invalid_argument if the list is empty or an entry is not HOST:PORT
+     */
+    static std::vector<std::string> parsePool(const std::string& list);
+
+    /**
+     * @param members Every server of the pool as "HOST:PORT"
+     * @param self This server's entry in members
+     * @throws std::invalid_argument if self is not a member
+     */
+    ShardRing(std::vector<std::string> members, std::string self);
+
+    /// Member ("HOST:PORT") that owns the sniffer with this identity
+    const std::string& owner(const std::string& identity) const;
+
+    /// True if this server owns the sniffer
+    bool owns(const std::string& identity) const { return owner(identity) == self_; }
+
+    const std::vector<std::string>& members() const { return members_; }
+    const std::string& self() const { return self_; }
+
+private:
+    std::vector<std::string> members_;
+    std::string self_;
+    std::vector<std::pair<uint64_t, uint32_t> > points_; ///< (hash, member index), sorted by hash
+};
@@ -0,0 +1,97 @@
+/**
+ * @file ThreadPool.h
+ * @brief Fixed-size worker pool for CPU-bound server tasks
+ *
+ * Connection handling has its own threads or event loop; this pool is for work that
+ * should be spread across cores regardless of which connection asked for it,
+ * such as scanning stored segments for a query.
+ */
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+/**
+ * @class ThreadPool
+ * @brief N worker threads draining a shared FIFO of tasks
+ *
+ * Thread-safe: submit() may be called from any thread.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Start the workers
+     * @param threads Number of worker threads (at least 1)
+     */
+    explicit ThreadPool(size_t threads) {
+        if (threads == 0) threads = 1;
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    /// Finishes queued tasks, then joins the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queue a task
+     * @param task Callable taking no arguments
+     * @return Future for the task's result; exceptions are delivered through it
+     */
+    template <typename F>
+    auto submit(F&& task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        // std::function needs a copyable target; packaged_task is move-only
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace([packaged] { (*packaged)(); });
+        }
+        cv_.notify_one();
+        return future;
+    }
+
+    /// Number of worker threads
+    size_t size() const { return workers_.size(); }
+
+private:
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;   // stopping_ and drained
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
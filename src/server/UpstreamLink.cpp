@@ -0,0 +1,418 @@
+/**
+ * @file UpstreamLink.cpp
+ * @brief Implementation of the relay connection to a parent server
+ */
+
+#include "UpstreamLink.h"
+#include "../Protocol.h"
+#include "../FrameReader.h"
+#include "../RecordCodec.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+
+/// Header of a FORWARD_BATCH payload: ssid, first seq, record count
+constexpr size_t BATCH_HEADER = 4 + 8 + 2;
+
+/// How long the handshake, and any single write, may take
+constexpr int SOCKET_TIMEOUT_SEC = 10;
+
+/// writev() the whole gather list, retrying on partial writes and EINTR
+bool writevAll(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+// ============================================================================
+// CONSTRUCTION
+// ============================================================================
+
+UpstreamConfig UpstreamConfig::parseAddress(const std::string& address) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+        throw std::invalid_argument("upstream address '" + address + "' is not HOST:PORT");
+    }
+    UpstreamConfig config;
+    config.host = address.substr(0, colon);
+    config.port = std::atoi(address.c_str() + colon + 1);
+    return config;
+}
+
+UpstreamLink::UpstreamLink(const UpstreamConfig& config) : config_(config) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, config_.host.c_str(), &addr) != 1) {
+        throw std::invalid_argument("upstream host '" + config_.host + "' is not an IPv4 address");
+    }
+    if (config_.port <= 0 || config_.port > 65535) {
+        throw std::invalid_argument("upstream port " + std::to_string(config_.port) + " is out of range");
+    }
+
+    std::cout << "[RELAY] Forwarding every stream to " << address();
+    if (config_.aggregate_ms) std::cout << " as flow summaries every " << config_.aggregate_ms << " ms";
+    std::cout << std::endl;
+
+    sender_ = std::thread(&UpstreamLink::senderLoop, this);
+}
+
+UpstreamLink::~UpstreamLink() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_one();
+    if (sender_.joinable()) sender_.join();
+}
+
+std::string UpstreamLink::address() const {
+    return config_.host + ":" + std::to_string(config_.port);
+}
+
+// ============================================================================
+// PRODUCERS
+// ============================================================================
+
+bool UpstreamLink::submit(uint32_t ssid, const RecordColumns& records) {
+    if (records.empty()) return true;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (queued_records_ + records.size() <= config_.queue_capacity) {
+            queue_.emplace_back();
+            queue_.back().ssid = ssid;
+            queue_.back().records = records;
+            size_t before = queued_records_;
+            queued_records_ += records.size();
+
+            // Waking the sender per batch would cost a futex call each; it
+            // also wakes on its own every WAKE_INTERVAL_MS
+            if (before < WAKE_RECORDS && queued_records_ >= WAKE_RECORDS) queue_cv_.notify_one();
+            return true;
+        }
+    }
+    countDrop(ssid, records.size());
+    return false;
+}
+
+void UpstreamLink::submitStats(const std::string& stats) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (queued_records_ >= config_.queue_capacity) return;
+    queue_.emplace_back();
+    queue_.back().stats = stats;
+    queued_records_++;
+}
+
+uint64_t UpstreamLink::dropped(uint32_t ssid) const {
+    std::lock_guard<std::mutex> lock(drops_mutex_);
+    auto it = drops_.find(ssid);
+    return it == drops_.end() ? 0 : it->second;
+}
+
+void UpstreamLink::countDrop(uint32_t ssid, uint64_t records) {
+    std::lock_guard<std::mutex> lock(drops_mutex_);
+    drops_[ssid] += records;
+}
+
+// ============================================================================
+// SENDER THREAD
+// ============================================================================
+
+void UpstreamLink::senderLoop() {
+    using Clock = std::chrono::steady_clock;
+    std::vector<Pending> batch;
+    auto backoff = std::chrono::seconds(1);
+    auto next_attempt = Clock::now();
+    auto window_start = Clock::now();
+
+    while (true) {
+        if (fd_ < 0 && Clock::now() >= next_attempt) {
+            if (connectUpstream()) {
+                backoff = std::chrono::seconds(1);
+            } else {
+                if (backoff == std::chrono::seconds(1)) {
+                    std::cerr << "[RELAY] Cannot reach " << address() << ", retrying" << std::endl;
+                }
+                next_attempt = Clock::now() + backoff;
+                backoff = std::min(backoff * 2, std::chrono::seconds(MAX_BACKOFF_SEC));
+            }
+        }
+
+        bool stop;
+        {
+            // While disconnected the queue keeps filling (up to its capacity)
+            // and is sent as a whole once the parent is back
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait_for(lock, std::chrono::milliseconds(WAKE_INTERVAL_MS),
+                               [this] { return stopping_ || (fd_ >= 0 && queued_records_ >= WAKE_RECORDS); });
+            if (fd_ >= 0) {
+                batch.swap(queue_);
+                queued_records_ = 0;
+            }
+            stop = stopping_;
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Pending& p = batch[i];
+            if (fd_ < 0) {
+                // The connection failed earlier in this batch
+                if (p.stats.empty()) countDrop(p.ssid, p.records.size());
+                continue;
+            }
+            if (!p.stats.empty()) {
+                if (!sendFrame(Protocol::STATS, p.stats)) disconnect();
+            } else if (config_.aggregate_ms) {
+                aggregate(p.ssid, p.records);
+            } else if (!sendRecords(p.ssid, p.records)) {
+                countDrop(p.ssid, p.records.size());
+                disconnect();
+            }
+        }
+        batch.clear();
+
+        auto now = Clock::now();
+        if (config_.aggregate_ms && (stop || flows_.size() >= MAX_FLOWS ||
+                                     now - window_start >= std::chrono::milliseconds(config_.aggregate_ms))) {
+            if (!flushFlows()) disconnect();
+            window_start = now;
+        }
+
+        if (stop) break;
+    }
+
+    disconnect();
+    std::cout << "[RELAY] Closed; " << sent() << " records sent to " << address() << std::endl;
+}
+
+bool UpstreamLink::connectUpstream() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(config_.port));
+    inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr);
+
+    // A parent that stops reading must not wedge the sender forever: a
+    // timed-out write is a failed connection, which is retried
+    struct timeval timeout = {SOCKET_TIMEOUT_SEC, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    // Batches are written whole; Nagle would only delay the last one
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    fd_ = fd;
+
+    // Introduce ourselves as a sniffer that speaks for many streams
+    uint32_t offered = Protocol::CAP_SEQ | Protocol::CAP_BINARY | Protocol::CAP_BATCH |
+                       Protocol::CAP_LARGE_FRAMES | Protocol::CAP_RELAY;
+    if (config_.compress) offered |= Protocol::CAP_COMPRESS;
+    char hostname[256] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    json hello;
+    hello["hostname"] = hostname;
+    hello["interface"] = "relay";
+    hello["proto"] = Protocol::PROTOCOL_REVISION;
+    hello["caps"] = Protocol::capabilityNames(offered);
+
+    caps_ = 0;      // Version-1 frames until the parent's answer says otherwise
+    FrameReader reader;
+    FrameView frame;
+    if (!sendFrame(Protocol::CLIENT_HELLO, hello.dump()) || !reader.readFrame(fd_, frame) ||
+        frame.type != Protocol::SERVER_HELLO) {
+        std::cerr << "[RELAY] Handshake with " << address() << " failed" << std::endl;
+        disconnect();
+        return false;
+    }
+
+    try {
+        json response = json::parse(frame.payload);
+        caps_ = Protocol::negotiate(
+            Protocol::parseCapabilities(response.value("caps", std::vector<std::string>())), offered);
+    } catch (const json::exception& e) {
+        std::cerr << "[RELAY] Bad SERVER_HELLO from " << address() << ": " << e.what() << std::endl;
+        disconnect();
+        return false;
+    }
+    if (!(caps_ & Protocol::CAP_RELAY)) {
+        std::cerr << "[RELAY] " << address() << " does not accept relays (no \"relay\" capability)" << std::endl;
+        disconnect();
+        return false;
+    }
+
+    link_seq_ = 0;
+    connected_.store(true, std::memory_order_relaxed);
+    std::cout << "[RELAY] Connected to " << address()
+              << ((caps_ & Protocol::CAP_COMPRESS) ? " (packed batches)" : "") << std::endl;
+    return true;
+}
+
+void UpstreamLink::disconnect() {
+    if (fd_ < 0) return;
+    close(fd_);
+    fd_ = -1;
+    if (connected_.exchange(false, std::memory_order_relaxed)) {
+        std::cerr << "[RELAY] Lost connection to " << address() << ", retrying" << std::endl;
+    }
+}
+
+bool UpstreamLink::sendFrame(uint8_t type, std::string_view head, std::string_view tail) {
+    size_t length = head.size() + tail.size();
+    if (length > Protocol::maxPayload(caps_)) return false;
+
+    uint8_t header[4] = {Protocol::frameVersion(length), type,
+                         static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length & 0xFF)};
+    uint8_t term = Protocol::TERM_BYTE;
+
+    struct iovec iov[4];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char*>(head.data());
+    iov[1].iov_len = head.size();
+    iov[2].iov_base = const_cast<char*>(tail.data());
+    iov[2].iov_len = tail.size();
+    iov[3].iov_base = &term;
+    iov[3].iov_len = 1;
+    return writevAll(fd_, iov, 4);
+}
+
+/**
+ * Same chunking and encoding choice as the server's forwardBinary(): as many
+ * records per frame as the negotiated frame size allows, packed when that is
+ * smaller.
+ */
+bool UpstreamLink::sendRecords(uint32_t ssid, const RecordColumns& records) {
+    size_t per_frame = (Protocol::maxPayload(caps_) - BATCH_HEADER) / RecordCodec::WIRE_SIZE;
+    bool compress = (caps_ & Protocol::CAP_COMPRESS) != 0;
+
+    for (size_t first = 0; first < records.size(); first += per_frame) {
+        size_t count = std::min(per_frame, records.size() - first);
+        char header[BATCH_HEADER];
+        RecordCodec::put32(header, ssid);
+        RecordCodec::put64(header + 4, link_seq_ + 1);
+        RecordCodec::put16(header + 12, static_cast<uint16_t>(count));
+
+        bool ok;
+        packed_.clear();
+        if (compress) ColumnCodec::packBatch(records, first, count, packed_, scratch_);
+        if (compress && packed_.size() < count * RecordCodec::WIRE_SIZE) {
+            ok = sendFrame(Protocol::FORWARD_BATCH_LZ, std::string_view(header, sizeof(header)), packed_);
+        } else {
+            encoded_.resize(count * RecordCodec::WIRE_SIZE);
+            for (size_t i = 0; i < count; ++i) {
+                RecordCodec::encode(records.row(first + i), &encoded_[i * RecordCodec::WIRE_SIZE]);
+            }
+            ok = sendFrame(Protocol::FORWARD_BATCH, std::string_view(header, sizeof(header)), encoded_);
+        }
+        if (!ok) return false;
+
+        link_seq_ += count;
+        sent_.fetch_add(count, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// ============================================================================
+// PRE-AGGREGATION
+// ============================================================================
+
+void UpstreamLink::aggregate(uint32_t ssid, const RecordColumns& records) {
+    constexpr uint64_t LIMIT = std::numeric_limits<uint32_t>::max();
+    RecordColumns events;  // DNS transactions and HTTP summaries are not traffic: forwarded as they are
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (records.flags[i] & (WireRecord::FLAG_DNS | WireRecord::FLAG_HTTP_SUMMARY)) {
+            events.push_back(records.row(i));
+            continue;
+        }
+
+        // Sampled records stand for sample_rate packets; a summary keeps the estimate
+        uint64_t rate = std::max<uint32_t>(records.sample_rate[i], 1);
+        uint64_t packets = static_cast<uint64_t>(records.packets[i]) * rate;
+        uint64_t bytes = static_cast<uint64_t>(records.length[i]) * rate;
+
+        FlowKey key = {ssid, records.src_ip[i], records.dst_ip[i],
+                       records.src_port[i], records.dst_port[i], records.protocol[i]};
+        auto it = flows_.find(key);
+        if (it != flows_.end() && (it->second.packets + packets > LIMIT || it->second.length + bytes > LIMIT)) {
+            // The 32-bit counters would wrap: send this flow's window so far on its own
+            RecordColumns full;
+            full.push_back(it->second);
+            flows_.erase(it);
+            if (fd_ >= 0 && !sendRecords(ssid, full)) disconnect();
+            it = flows_.end();
+        }
+        if (it == flows_.end()) {
+            WireRecord summary = records.row(i);
+            summary.seq = 0;                // Stands for many sniffer records
+            summary.sample_rate = 1;
+            summary.packets = 0;
+            summary.length = 0;
+            summary.flags |= WireRecord::FLAG_FLOW_SUMMARY;
+            it = flows_.emplace(key, summary).first;
+        }
+        WireRecord& summary = it->second;
+        summary.packets = static_cast<uint32_t>(std::min(LIMIT, summary.packets + packets));
+        summary.length = static_cast<uint32_t>(std::min(LIMIT, summary.length + bytes));
+        summary.ts_ns = std::min(summary.ts_ns ? summary.ts_ns : records.ts_ns[i], records.ts_ns[i]);
+    }
+
+    if (!events.empty() && !sendRecords(ssid, events)) {
+        countDrop(ssid, events.size());
+        disconnect();
+    }
+}
+
+bool UpstreamLink::flushFlows() {
+    if (flows_.empty()) return true;
+
+    std::map<uint32_t, RecordColumns> by_stream;
+    for (const auto& flow : flows_) {
+        by_stream[flow.first.ssid].push_back(flow.second);
+    }
+    flows_.clear();
+
+    bool ok = fd_ >= 0;
+    for (const auto& stream : by_stream) {
+        if (ok && sendRecords(stream.first, stream.second)) continue;
+        ok = false;
+        countDrop(stream.first, stream.second.size());
+    }
+    return ok;
+}
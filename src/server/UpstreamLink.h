@@ -0,0 +1,203 @@
+/**
+ * @file UpstreamLink.h
+ * @brief Relay mode: pass this server's record streams on to a parent server
+ *
+ * A single server holds every sniffer and every GUI connection. With
+ * `--upstream HOST:PORT` a server also connects to a parent server, the way
+ * a sniffer would, and passes on every record it receives over that one
+ * connection, for all of its SSIDs. Site servers can then feed a regional
+ * server and regions a global one, with fan-out, storage and aggregation
+ * spread across the tiers.
+ *
+ * ## Wire Format
+ *
+ * The link negotiates the "relay" capability (with binary, batch,
+ * large_frames and lz). Records go up in the frames a binary GUI receives:
+ * ```
+ * FORWARD_BATCH / FORWARD_BATCH_LZ: [ssid:4][first seq:8][count:2][records]
+ * ```
+ * - ssid is this server's SSID for the stream. The parent keeps a stable
+ *   sniffer SSID as it is and maps any other (link, ssid) pair to an SSID
+ *   of its own, so streams from different relays never collide and every
+ *   tier has one SSID namespace.
+ * - first seq numbers records on the link, so the parent can see gaps on it;
+ *   each record keeps the seq its sniffer gave it.
+ * - The STATS this server builds for a stream go up as STATS frames; the
+ *   parent adds its own view and passes them on.
+ *
+ * ## Pre-aggregation
+ *
+ * With aggregate_ms > 0 the link does not send records one by one. It folds
+ * them per stream and 5-tuple into flow summaries (FLAG_FLOW_SUMMARY, packets
+ * and bytes scaled up by sample_rate) and sends each window's summaries when
+ * the window closes. A parent that only needs traffic volumes then receives
+ * one record per flow per window. DNS transaction records and HTTP
+ * summaries are not traffic and are forwarded unchanged.
+ *
+ * ## Delivery
+ *
+ * submit() copies the records onto a bounded queue and never blocks the
+ * connection that produced them. A sender thread encodes and writes. If the
+ * parent is slow or unreachable the queue fills up, and further records are
+ * dropped and counted per SSID (reported as "upstream_drop" in STATS). The
+ * link does not offer "credits": the parent's TCP window is its flow control
+ * and the queue its buffer. After a lost connection the link reconnects with
+ * backoff; counter SSIDs are then assigned anew.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../ColumnCodec.h"
+
+/**
+ * @struct UpstreamConfig
+ * @brief Where and how a relay forwards its streams
+ */
+struct UpstreamConfig {
+    std::string host;                   ///< Parent server (IPv4 address)
+    int port = 0;
+    uint32_t aggregate_ms = 0;          ///< Flow-summary window, 0 = forward every record
+    size_t queue_capacity = 1 << 20;    ///< Records buffered before submit() drops
+    bool compress = true;               ///< Offer "lz" to the parent
+
+    /**
+     * @brief Parse "HOST:PORT"
+     * @throws std::invalid_argument if the address is malformed
+     */
+    static UpstreamConfig parseAddress(const std::string& address);
+};
+
+/**
+ * @class UpstreamLink
+ * @brief Connection from a relay to its parent server, with its sender thread
+ *
+ * Thread-safe: submit() and submitStats() may be called from any connection
+ * thread.
+ */
+class UpstreamLink {
+public:
+    /// The sender wakes at least this often (aggregation windows, reconnects)
+    static constexpr int WAKE_INTERVAL_MS = 100;
+
+    /// Producers wake the sender early once this many records are queued
+    static constexpr size_t WAKE_RECORDS = 4096;
+
+    /// Longest wait between connection attempts
+    static constexpr int MAX_BACKOFF_SEC = 30;
+
+    /// Flows tracked per aggregation window before it is closed early
+    static constexpr size_t MAX_FLOWS = 65536;
+
+    /**
+     * @brief Start the sender thread; it connects in the background
+     * @throws std::invalid_argument if the address or port is invalid
+     */
+    explicit UpstreamLink(const UpstreamConfig& config);
+
+    /// Sends what is queued (if connected) and stops the sender thread
+    ~UpstreamLink();
+
+    UpstreamLink(const UpstreamLink&) = delete;
+    UpstreamLink& operator=(const UpstreamLink&) = delete;
+
+    /**
+     * @brief Queue records of one stream for the parent (non-blocking)
+     * @return false if the queue was full and the records were dropped
+     */
+    bool submit(uint32_t ssid, const RecordColumns& records);
+
+    /**
+     * @brief Queue a STATS payload built for one stream (non-blocking)
+     *
+     * Stats are snapshots: one that finds the queue full is simply dropped.
+     */
+    void submitStats(const std::string& stats);
+
+    /// Records of this stream dropped on the way to the parent
+    uint64_t dropped(uint32_t ssid) const;
+
+    /// Records (or flow summaries) written to the parent
+    uint64_t sent() const { return sent_.load(std::memory_order_relaxed); }
+
+    /// A handshake with the parent succeeded and the connection is up
+    bool connected() const { return connected_.load(std::memory_order_relaxed); }
+
+    /// "HOST:PORT" of the parent, for log lines
+    std::string address() const;
+
+private:
+    /// One queued item: records of a stream, or a STATS payload
+    struct Pending {
+        uint32_t ssid = 0;
+        RecordColumns records;
+        std::string stats;              ///< Non-empty for STATS
+    };
+
+    /// Stream and 5-tuple of a flow being aggregated
+    struct FlowKey {
+        uint32_t ssid;
+        uint32_t src_ip;
+        uint32_t dst_ip;
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint8_t protocol;
+
+        bool operator==(const FlowKey& o) const {
+            return ssid == o.ssid && src_ip == o.src_ip && dst_ip == o.dst_ip &&
+                   src_port == o.src_port && dst_port == o.dst_port && protocol == o.protocol;
+        }
+    };
+
+    struct FlowKeyHash {
+        size_t operator()(const FlowKey& k) const {
+            uint64_t h = (static_cast<uint64_t>(k.src_ip) << 32 | k.dst_ip) * 0x9E3779B97F4A7C15ull;
+            h ^= (static_cast<uint64_t>(k.ssid) << 24 | static_cast<uint64_t>(k.src_port) << 8 | k.protocol) +
+                 (static_cast<uint64_t>(k.dst_port) << 40) + (h >> 29);
+            return static_cast<size_t>(h * 0xBF58476D1CE4E5B9ull);
+        }
+    };
+
+    void senderLoop();
+    bool connectUpstream();
+    void disconnect();
+    bool sendFrame(uint8_t type, std::string_view head, std::string_view tail = {});
+    bool sendRecords(uint32_t ssid, const RecordColumns& records);
+    void aggregate(uint32_t ssid, const RecordColumns& records);
+    bool flushFlows();
+    void countDrop(uint32_t ssid, uint64_t records);
+
+    UpstreamConfig config_;
+
+    // Queue (producers: connection threads, consumer: sender thread)
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::vector<Pending> queue_;
+    size_t queued_records_ = 0;
+    bool stopping_ = false;
+
+    // Sender thread only
+    int fd_ = -1;
+    uint32_t caps_ = 0;                 ///< Negotiated with the parent
+    uint64_t link_seq_ = 0;             ///< Last record number sent on this connection
+    std::unordered_map<FlowKey, WireRecord, FlowKeyHash> flows_;
+    std::string encoded_;
+    std::string packed_;
+    std::string scratch_;
+
+    mutable std::mutex drops_mutex_;
+    std::unordered_map<uint32_t, uint64_t> drops_;
+
+    std::atomic<uint64_t> sent_{0};
+    std::atomic<bool> connected_{false};
+
+    std::thread sender_;
+};
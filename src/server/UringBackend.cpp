@@ -0,0 +1,494 @@
+/**
+ * @file UringBackend.cpp
+ * @brief io_uring implementation of IoBackend
+ */
+
+#include "UringBackend.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+
+int sysSetup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sysEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sysRegister(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+uint64_t userData(int fd, uint8_t op) {
+    return (static_cast<uint64_t>(fd) << 8) | op;
+}
+
+std::runtime_error uringError(const char* what, int err) {
+    return std::runtime_error(std::string("io_uring ") + what + ": " + strerror(err));
+}
+
+} // namespace
+
+// ============================================================================
+// SETUP / TEARDOWN
+// ============================================================================
+
+UringBackend::UringBackend() {
+    // Prefer running completion work only when we ask for it (DEFER_TASKRUN,
+    // Linux 6.1), then cooperative task running (5.19), then plain
+    static const unsigned setup_flags[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_COOP_TASKRUN,
+        0
+    };
+    struct io_uring_params params;
+    for (unsigned flags : setup_flags) {
+        memset(&params, 0, sizeof(params));
+        params.flags = flags;
+        ring_fd_ = sysSetup(RING_ENTRIES, &params);
+        if (ring_fd_ >= 0 || errno != EINVAL) break;
+    }
+    if (ring_fd_ < 0) {
+        throw uringError("setup", errno);
+    }
+    features_ = params.features;
+
+    try {
+        // Map the rings; with SINGLE_MMAP both live in one mapping
+        sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (features_ & IORING_FEAT_SINGLE_MMAP) {
+            sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+        }
+
+        sq_ptr_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            sq_ptr_ = nullptr;
+            throw uringError("mmap", errno);
+        }
+        if (features_ & IORING_FEAT_SINGLE_MMAP) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            cq_ptr_ = mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) {
+                cq_ptr_ = nullptr;
+                throw uringError("mmap", errno);
+            }
+        }
+        sqes_map_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            throw uringError("mmap", errno);
+        }
+        sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_local_tail_ = *sq_tail_;
+        // SQE slot i is always submitted through array entry i
+        for (unsigned i = 0; i <= sq_mask_; ++i) {
+            sq_array_[i] = i;
+        }
+
+        char* cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Provided-buffer ring for multishot RECV (Linux 5.19)
+        buf_ring_size_ = RECV_BUFFERS * sizeof(struct io_uring_buf);
+        void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            throw uringError("mmap", errno);
+        }
+        buf_ring_ = static_cast<struct io_uring_buf_ring*>(ring);
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = RECV_BUFFERS;
+        reg.bgid = 0;
+        if (sysRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            throw uringError("buffer ring registration", errno);
+        }
+
+        buffers_ = static_cast<char*>(std::malloc(static_cast<size_t>(RECV_BUFFERS) * RECV_BUFFER_SIZE));
+        if (!buffers_) {
+            throw std::runtime_error("io_uring: cannot allocate receive buffers");
+        }
+        for (unsigned bid = 0; bid < RECV_BUFFERS; ++bid) {
+            recycleBuffer(bid);
+        }
+
+        probeMultishot();
+    } catch (...) {
+        teardown();
+        throw;
+    }
+
+    // io_uring honours O_NONBLOCK and would complete the eventfd READ with
+    // -EAGAIN instead of waiting for a wakeup
+    fcntl(wake_fd_, F_SETFL, fcntl(wake_fd_, F_GETFL) & ~O_NONBLOCK);
+}
+
+UringBackend::~UringBackend() {
+    teardown();
+}
+
+void UringBackend::teardown() {
+    if (buffers_) std::free(buffers_);
+    if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+    if (sqes_) munmap(sqes_, sqes_map_size_);
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_map_size_);
+    if (sq_ptr_) munmap(sq_ptr_, sq_map_size_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+    buffers_ = nullptr;
+    buf_ring_ = nullptr;
+    sqes_ = nullptr;
+    cq_ptr_ = sq_ptr_ = nullptr;
+    ring_fd_ = -1;
+}
+
+/**
+ * Multishot ACCEPT (Linux 5.19) and RECV (6.0) are flags on older opcodes,
+ * so IORING_REGISTER_PROBE cannot tell whether they work; a kernel without
+ * them fails the request with -EINVAL only once it runs. Run each once on a
+ * local socket here, so a kernel that lacks either fails construction (and
+ * IoBackend::create() falls back to epoll) instead of the event loop.
+ */
+void UringBackend::probeMultishot() {
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int peer = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int pair[2] = {-1, -1};
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    socklen_t addr_len = sizeof(addr.sun_family);
+    // Binding just the family autobinds to a fresh abstract address
+    bool ready = listener >= 0 && peer >= 0 &&
+                 bind(listener, reinterpret_cast<struct sockaddr*>(&addr), addr_len) == 0 &&
+                 listen(listener, 1) == 0 &&
+                 (addr_len = sizeof(addr), getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr), &addr_len)) == 0 &&
+                 connect(peer, reinterpret_cast<struct sockaddr*>(&addr), addr_len) == 0 &&
+                 socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == 0 &&
+                 write(pair[1], "x", 1) == 1;
+    int err = errno;
+
+    int accept_res = 0;
+    int recv_res = 0;
+    if (ready) {
+        armAccept(listener);
+        accept_res = probeCompletion(userData(listener, OP_ACCEPT));
+        if (accept_res >= 0) close(accept_res);
+
+        armRecv(pair[0]);
+        connections_.erase(pair[0]);
+        recv_res = probeCompletion(userData(pair[0], OP_RECV));
+    }
+    for (int fd : {listener, peer, pair[0], pair[1]}) {
+        if (fd >= 0) close(fd);
+    }
+
+    if (!ready) throw uringError("probe sockets", err);
+    if (accept_res == -EINVAL) throw std::runtime_error("io_uring: multishot accept needs Linux 5.19+");
+    if (recv_res == -EINVAL) throw std::runtime_error("io_uring: multishot recv needs Linux 6.0+");
+}
+
+/**
+ * Wait for the first completion of a probe request, then cancel the request
+ * if it stays armed and reap everything it produces
+ *
+ * @return res of the first completion
+ */
+int UringBackend::probeCompletion(uint64_t user_data) {
+    bool have_result = false;
+    bool armed = true;
+    bool cancelled = false;
+    bool cancel_done = false;
+    int result = 0;
+    while (armed || (cancelled && !cancel_done)) {
+        submitAndWait(1);
+        unsigned head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = cqes_[head & cq_mask_];
+            head++;
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            if (cqe.user_data != user_data) {
+                cancel_done = true;     // The only other request is the cancel
+                continue;
+            }
+            if (cqe.flags & IORING_CQE_F_BUFFER) recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (!have_result) {
+                have_result = true;
+                result = cqe.res;
+            } else if (cqe.res >= 0 && (user_data & 0xFF) == OP_ACCEPT) {
+                close(cqe.res);
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) armed = false;
+        }
+        if (armed && have_result && !cancelled) {
+            struct io_uring_sqe* sqe = getSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = user_data;
+            sqe->user_data = 0;
+            cancelled = true;
+        }
+    }
+    return result;
+}
+
+// ============================================================================
+// SUBMISSION HELPERS
+// ============================================================================
+
+struct io_uring_sqe* UringBackend::getSqe() {
+    // The kernel consumes everything we submit, so a full SQ only means we
+    // queued more than RING_ENTRIES since the last io_uring_enter()
+    while (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) > sq_mask_) {
+        submitAndWait(0);
+    }
+    struct io_uring_sqe* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_local_tail_++;
+    to_submit_++;
+    return sqe;
+}
+
+unsigned UringBackend::submitAndWait(unsigned wait_nr) {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    int submitted = sysEnter(ring_fd_, to_submit_, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+    if (submitted < 0) {
+        // EBUSY/EAGAIN: completions must be reaped first; EINTR: a signal
+        if (errno == EINTR || errno == EBUSY || errno == EAGAIN) return 0;
+        throw uringError("enter", errno);
+    }
+    to_submit_ -= static_cast<unsigned>(submitted);
+    return static_cast<unsigned>(submitted);
+}
+
+void UringBackend::armAccept(int listen_fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(listen_fd, OP_ACCEPT);
+}
+
+void UringBackend::armRecv(int fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = userData(fd, OP_RECV);
+    connections_[fd].recv_armed = true;
+}
+
+void UringBackend::armWake() {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_value_);
+    sqe->len = sizeof(wake_value_);
+    sqe->user_data = userData(wake_fd_, OP_WAKE);
+}
+
+void UringBackend::submitSend(int fd, Connection& conn) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(conn.sending.data() + conn.offset);
+    sqe->len = static_cast<uint32_t>(conn.sending.size() - conn.offset);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData(fd, OP_SEND);
+    conn.send_in_flight = true;
+}
+
+void UringBackend::recycleBuffer(unsigned bid) {
+    // Index from the ring's base rather than through ->bufs: the header
+    // declares bufs[] after an empty struct, which is one byte in C++ and
+    // shifts the array by a whole entry. Only addr/len/bid are written, as
+    // entry 0's resv field doubles as the ring's tail.
+    struct io_uring_buf* bufs = reinterpret_cast<struct io_uring_buf*>(buf_ring_);
+    struct io_uring_buf* buf = &bufs[buf_tail_ & (RECV_BUFFERS - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(bid) * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = static_cast<uint16_t>(bid);
+    buf_tail_++;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+// ============================================================================
+// EVENT LOOP
+// ============================================================================
+
+void UringBackend::run(int listen_fd, const IoCallbacks& callbacks) {
+    setLoopThread();
+    armAccept(listen_fd);
+    armWake();
+
+    std::vector<int> dirty;
+    while (true) {
+        // Turn everything queued since the last iteration into SENDs; they
+        // are submitted by the same io_uring_enter() that waits below
+        takeDirty(dirty);
+        for (int fd : dirty) {
+            auto it = connections_.find(fd);
+            if (it != connections_.end()) {
+                startSend(fd, it->second);
+            }
+        }
+
+        submitAndWait(1);
+
+        unsigned head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = cqes_[head & cq_mask_];
+            head++;
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            handleCompletion(cqe, listen_fd, callbacks);
+        }
+    }
+}
+
+void UringBackend::handleCompletion(const struct io_uring_cqe& cqe, int listen_fd, const IoCallbacks& callbacks) {
+    const int fd = static_cast<int>(cqe.user_data >> 8);
+    const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+    switch (static_cast<Op>(cqe.user_data & 0xFF)) {
+    case OP_ACCEPT: {
+        if (cqe.res >= 0) {
+            int client_fd = cqe.res;
+            struct sockaddr_in addr;
+            socklen_t addr_len = sizeof(addr);
+            std::string ip;
+            if (getpeername(client_fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len) == 0) {
+                ip = inet_ntoa(addr.sin_addr);
+            }
+            syscalls_.fetch_add(1, std::memory_order_relaxed);
+
+            connections_[client_fd] = Connection();
+            addConnection(client_fd);
+            callbacks.on_accept(client_fd, ip);
+            armRecv(client_fd);
+        } else {
+            std::cerr << "Accept failed: " << strerror(-cqe.res) << std::endl;
+        }
+        if (!more) {
+            armAccept(listen_fd);
+        }
+        break;
+    }
+
+    case OP_RECV: {
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) break;
+        Connection& conn = it->second;
+        if (!more) conn.recv_armed = false;
+
+        if (cqe.res > 0) {
+            unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            bool keep = conn.closing ||
+                        callbacks.on_data(fd, buffers_ + static_cast<size_t>(bid) * RECV_BUFFER_SIZE,
+                                          static_cast<size_t>(cqe.res));
+            recycleBuffer(bid);
+            if (!keep) {
+                beginClose(fd, conn, callbacks);
+            } else if (!conn.recv_armed && !conn.closing) {
+                armRecv(fd);
+            }
+        } else if (cqe.res == -ENOBUFS) {
+            // Every buffer was in use; they are back in the ring by now
+            if (!conn.recv_armed && !conn.closing) armRecv(fd);
+        } else {
+            // 0 = peer closed, < 0 = error
+            beginClose(fd, conn, callbacks);
+        }
+
+        if (conn.closing && !conn.recv_armed && !conn.send_in_flight) {
+            finishClose(fd);
+        }
+        break;
+    }
+
+    case OP_SEND: {
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) break;
+        Connection& conn = it->second;
+        conn.send_in_flight = false;
+
+        if (cqe.res < 0) {
+            beginClose(fd, conn, callbacks);
+        } else {
+            conn.offset += static_cast<size_t>(cqe.res);
+            startSend(fd, conn);   // Rest of a short send, or the next batch
+        }
+
+        if (conn.closing && !conn.recv_armed && !conn.send_in_flight) {
+            finishClose(fd);
+        }
+        break;
+    }
+
+    case OP_WAKE:
+        clearWake();
+        armWake();
+        break;
+    }
+}
+
+void UringBackend::startSend(int fd, Connection& conn) {
+    if (conn.send_in_flight || conn.closing) return;
+    if (conn.offset == conn.sending.size()) {
+        conn.sending.clear();
+        conn.offset = 0;
+        if (!takePending(fd, conn.sending)) return;
+    }
+    submitSend(fd, conn);
+}
+
+void UringBackend::beginClose(int fd, Connection& conn, const IoCallbacks& callbacks) {
+    if (conn.closing) return;
+    conn.closing = true;
+    callbacks.on_close(fd);
+    removeConnection(fd);
+    // Completes the armed RECV (and fails any SEND) so the fd can be closed
+    // once nothing in the ring refers to it
+    shutdown(fd, SHUT_RDWR);
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void UringBackend::finishClose(int fd) {
+    connections_.erase(fd);
+    close(fd);
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+}
+
+#endif // __linux__
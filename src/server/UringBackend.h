@@ -0,0 +1,110 @@
+/**
+ * @file UringBackend.h
+ * @brief io_uring event loop (Linux 6.0 or newer)
+ *
+ * Talks to the kernel through the raw io_uring_setup/enter/register
+ * syscalls, so there is no liburing dependency.
+ *
+ * - One multishot ACCEPT stays armed on the listening socket.
+ * - Each connection has one multishot RECV that picks its buffer from a
+ *   registered provided-buffer ring. Data arrives without a syscall per read,
+ *   and the buffer goes back to the ring as soon as the server has parsed it.
+ * - Queued sends become SEND submissions (one in flight per connection) and
+ *   are submitted together with the wait for completions: the loop makes one
+ *   io_uring_enter() per iteration.
+ *
+ * A closing connection is shut down first; the fd is closed only after its
+ * RECV and SEND have completed, so no completion can refer to a reused fd.
+ */
+
+#pragma once
+
+#ifdef __linux__
+
+#include "IoBackend.h"
+#include <linux/io_uring.h>
+
+/**
+ * @class UringBackend
+ * @brief IoBackend built on io_uring
+ */
+class UringBackend : public IoBackend {
+public:
+    /// Submission queue entries (completions get twice as many)
+    static constexpr unsigned RING_ENTRIES = 1024;
+
+    /// Provided receive buffers (power of two) and their size
+    static constexpr unsigned RECV_BUFFERS = 256;
+    static constexpr unsigned RECV_BUFFER_SIZE = 16u << 10;
+
+    /**
+     * @brief Set up the ring, register the receive buffers and probe multishot support
+     * @throws std::runtime_error if io_uring is unavailable or too old
+     */
+    UringBackend();
+    ~UringBackend() override;
+
+    const char* name() const override { return "io_uring"; }
+    void run(int listen_fd, const IoCallbacks& callbacks) override;
+
+private:
+    /// Operation tag in the low byte of user_data; the fd is above it
+    enum Op : uint8_t { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_WAKE };
+
+    struct Connection {
+        std::string sending;        ///< Buffer of the SEND in flight
+        size_t offset = 0;          ///< Bytes of sending already sent
+        bool recv_armed = false;
+        bool send_in_flight = false;
+        bool closing = false;
+    };
+
+    void teardown();
+    void probeMultishot();
+    int probeCompletion(uint64_t user_data);
+    struct io_uring_sqe* getSqe();
+    unsigned submitAndWait(unsigned wait_nr);
+    void armAccept(int listen_fd);
+    void armRecv(int fd);
+    void armWake();
+    void submitSend(int fd, Connection& conn);
+    void recycleBuffer(unsigned bid);
+    void handleCompletion(const struct io_uring_cqe& cqe, int listen_fd, const IoCallbacks& callbacks);
+    void startSend(int fd, Connection& conn);
+    void beginClose(int fd, Connection& conn, const IoCallbacks& callbacks);
+    void finishClose(int fd);
+
+    int ring_fd_ = -1;
+    unsigned features_ = 0;
+
+    // Submission queue
+    void* sq_ptr_ = nullptr;
+    size_t sq_map_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_map_size_ = 0;
+    unsigned sq_local_tail_ = 0;
+    unsigned to_submit_ = 0;
+
+    // Completion queue
+    void* cq_ptr_ = nullptr;
+    size_t cq_map_size_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    struct io_uring_cqe* cqes_ = nullptr;
+
+    // Provided receive buffers
+    struct io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    char* buffers_ = nullptr;
+    uint16_t buf_tail_ = 0;
+
+    uint64_t wake_value_ = 0;       ///< Target of the eventfd READ
+    std::unordered_map<int, Connection> connections_;
+};
+
+#endif // __linux__
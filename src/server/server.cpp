@@ -14,7 +14,15 @@
  * - **Sniffer Clients**: Send captured network packets as TRAFFIC_LOG frames
  * - **GUI Clients**: Receive logs via FORWARD_LOG frames for real-time monitoring
  *
- * Each connection is handled in its own thread. The server maintains:
+ * By default all connections run on one event loop (io_uring or epoll, see
+ * IoBackend.h); with `--io threads`, or where neither is available, each
+ * connection is handled in its own thread. Sniffers on the same host may
+ * instead connect through shared memory (`--shm PATH`, see ShmTransport.h);
+ * each such sniffer is served by its own thread. With `--upstream HOST:PORT`
+ * the server also relays every stream to a parent server (see UpstreamLink.h)
+ * and accepts relays of its own the same way. With `--pool` several servers
+ * share the sniffers by consistent hashing and redirect the ones they do not
+ * own (see ShardRing.h). The server maintains:
  * - A client list with connection metadata (fd, IP, SSID, type)
  * - An IP-to-sniffer mapping for identifying sniffer instances
  * - A mutex to protect shared state during concurrent access
@@ -32,6 +40,37 @@
  * - 0x03 TRAFFIC_LOG: Sniffer sends captured packet data
  * - 0x04 FORWARD_LOG: Server broadcasts logs to GUI clients
  * - 0x05 ERROR: Error notification
+ * - 0x06 STATS: Loss counters (sniffer -> server, then server -> GUIs)
+ * - 0x07 CREDIT: Flow-control grant (server -> sniffer)
+ * - 0x08 QUERY: Historical query over the record store (GUI -> server)
+ * - 0x09 QUERY_RESULT: Batched query results (server -> GUI)
+ * - 0x0A RECORD_BATCH: Binary records (sniffer -> server, protocol revision 2)
+ * - 0x0B FORWARD_BATCH: Binary records (server -> GUI, protocol revision 2)
+ * - 0x0C / 0x0D RECORD_BATCH_LZ / FORWARD_BATCH_LZ: The same, packed ("lz")
+ *
+ * CLIENT_HELLO may carry a capability list; the server answers with the
+ * common subset, and JSON and binary peers are served side by side (see
+ * Protocol.h).
+ *
+ * ## Loss Accounting
+ *
+ * TRAFFIC_LOG records carry a per-sniffer "seq" and FORWARD_LOG frames carry
+ * a per-GUI "seq". The server detects gaps in each sniffer's series, counts
+ * undecodable frames and failed GUI writes, and forwards those counters to
+ * the GUIs together with the sniffer's own kernel/ring/send counters.
+ *
+ * ## Persistent Store
+ *
+ * With --store, every TRAFFIC_LOG is also handed to a RecordStore, which
+ * writes it to per-SSID segment files on a background thread. The hand-off is
+ * a bounded queue, so a slow disk drops (and counts) stored records rather
+ * than stalling the fan-out to GUIs.
+ *
+ * GUIs query that history with QUERY frames. A QueryEngine scans the mmapped
+ * segments on a shared ThreadPool and the results stream back as
+ * QUERY_RESULT batches on the asking GUI's connection. With an event
+ * backend the queries themselves run on a small pool of their own, and
+ * beyond MAX_PENDING_QUERIES waiting or running the server answers "busy".
  *
  * ## Client Registration Flow
  *
@@ -46,23 +85,44 @@
  * 2. Server assigns SSID and sends SERVER_HELLO response
  * 3. GUI waits to receive FORWARD_LOG frames from sniffers
  * 4. GUI displays logs organized by sniffer SSID
+ * 5. GUI may send QUERY frames at any time; results come back as QUERY_RESULT
  *
- * @usage ./SnifferServer <port>
- * @example ./SnifferServer 9090
+ * @usage ./SnifferServer <port> [--io auto|threads|epoll|uring] [--shm PATH] [--upstream HOST:PORT] [--pool HOST:PORT,... --self HOST:PORT] [--store DIR]
+ *                       [--retain-hours H] [--retain-mb M] [--segment-mb M] [--segment-sec S]
+ * @example ./SnifferServer 9090 --store /var/lib/sniffer --retain-hours 24
  */
 
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <cerrno>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <map>
+#include <unordered_map>
 #include <cstring>
+#include <csignal>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
 #include <nlohmann/json.hpp>
 #include "../Protocol.h"
+#include "../FrameReader.h"
+#include "../RecordCodec.h"
+#include "../ColumnCodec.h"
+#include "../ShmTransport.h"
+#include "RecordStore.h"
+#include "QueryEngine.h"
+#include "IoBackend.h"
+#include "UpstreamLink.h"
+#include "ShardRing.h"
 
 using json = nlohmann::json;
 
@@ -80,6 +140,26 @@ struct Client {
     std::string remote_ip; ///< Client IP address
     uint32_t ssid; ///< Unique Session ID assigned by server
     bool is_sniffer; ///< True if sniffer, false if GUI client
+    uint32_t caps = Protocol::LEGACY_CAPS; ///< Negotiated capabilities (Protocol::Capability bits)
+    uint64_t tx_seq = 0; ///< Last FORWARD_LOG sequence number sent to this GUI
+};
+
+/**
+ * @struct SnifferLossStats
+ * @brief Server-side loss accounting for one sniffer's record stream
+ *
+ * Combined with the counters the sniffer reports in its STATS frames,
+ * these show where records disappear between capture and the GUI:
+ * - seq_gap: records the sniffer numbered but we never received
+ * - decode_drop: TRAFFIC_LOG frames we received but could not parse
+ * - fanout_drop: (record, GUI) deliveries that failed in sendFrame()
+ */
+struct SnifferLossStats {
+    Protocol::SequenceTracker rx_seq; ///< Gap detection on TRAFFIC_LOG "seq"
+    uint64_t decode_drop = 0;
+    uint64_t fanout_drop = 0;
+    uint64_t records = 0; ///< TRAFFIC_LOG records received
+    uint64_t est_packets = 0; ///< Packets they represent, scaled by "sample_rate" and "packets"
 };
 
 /**
@@ -99,152 +179,447 @@ std::vector<Client> clients; ///< All connected clients
 std::mutex clients_mutex; ///< Protects clients list access
 std::map<std::string, SnifferRecord> ip_to_sniffer; ///< Maps IP to sniffer metadata
 std::map<int, uint32_t> fd_to_ssid; ///< Maps file descriptor to SSID
-uint32_t next_ssid = 1; ///< Counter for assigning SSIDs
+uint32_t next_ssid = 1; ///< Counter for SSIDs without Protocol::SSID_STABLE_BIT
+std::unordered_map<uint32_t, std::string> stable_ssids; ///< Stable SSIDs in use, and who holds them
 int next_sniffer_index = 1; ///< Counter for sniffer indices
 
-/**
- * @struct Frame
- * @brief Parsed binary frame received from socket
- */
-struct Frame {
-    uint8_t type; ///< Message type (CLIENT_HELLO, TRAFFIC_LOG, etc.)
-    std::string payload; ///< JSON payload (varies by message type)
-};
+std::unique_ptr<RecordStore> record_store; ///< On-disk history (--store), null if disabled
+std::unique_ptr<ThreadPool> query_pool; ///< Segment scans for QUERY, created with the store
+std::unique_ptr<QueryEngine> query_engine; ///< Null if the store is disabled
+std::unique_ptr<IoBackend> io_backend; ///< Event loop (--io), null for thread-per-connection
+std::unique_ptr<UpstreamLink> upstream; ///< Relay link to a parent server (--upstream), null at the top tier
+std::unique_ptr<ShardRing> shard_ring; ///< Sniffer placement in a server pool (--pool), null if alone
+
+/// QUERY requests an event-loop server runs at once
+constexpr size_t QUERY_RUNNERS = 2;
+
+/// Queries waiting or running before new ones are refused as busy
+constexpr size_t MAX_PENDING_QUERIES = 16;
+
+/// Streams one relay may carry; records of any further stream are refused
+constexpr size_t MAX_RELAYED_STREAMS = 4096;
+
+/// Runs QUERY requests off the event loop (--io), null for thread-per-connection.
+/// Declared after the store and engine so it is drained before they go.
+std::unique_ptr<ThreadPool> query_runner;
+std::atomic<size_t> pending_queries{0}; ///< Submitted to query_runner and not finished
+
+/// Capabilities this server offers in SERVER_HELLO
+constexpr uint32_t SERVER_CAPS = Protocol::CAP_SEQ | Protocol::CAP_CREDITS | Protocol::CAP_BINARY |
+                                 Protocol::CAP_BATCH | Protocol::CAP_LARGE_FRAMES | Protocol::CAP_COMPRESS |
+                                 Protocol::CAP_RELAY;
 
 // ============================================================================
 // HELPER FUNCTIONS
 // ============================================================================
 
 /**
- * @brief Read exactly N bytes from socket, handling partial reads
+ * @brief Disable Nagle on an accepted connection
  *
- * TCP read() may return fewer bytes than requested. This function loops until
- * the requested number of bytes has been read or an error occurs.
+ * Every frame goes out in one write, so Nagle only holds back the last short
+ * frame of a burst (a CREDIT, a QUERY_DONE) until the peer's delayed ACK.
+ */
+void setNoDelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * @brief Smoothed round-trip time of a TCP connection, in microseconds
  *
- * @param fd Socket file descriptor
- * @param buf Buffer to read into
- * @param len Number of bytes to read
- * @return true if exactly len bytes were read, false on any error or EOF
+ * @return 0 where the kernel does not report it, or for a non-TCP fd
+ */
+uint32_t roundTripUs(int fd) {
+#if defined(__linux__)
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) return info.tcpi_rtt;
+#elif defined(__APPLE__)
+    struct tcp_connection_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_CONNECTION_INFO, &info, &len) == 0) return info.tcpi_srtt * 1000;
+#else
+    (void) fd;
+#endif
+    return 0;
+}
+
+/**
+ * @brief Write a whole gather list to a blocking socket
  *
- * @note This is a blocking call that will wait for data
+ * @return false on any error; partial writes are continued, not failed
  */
-bool readExact(int fd, void *buf, size_t len) {
-    size_t total = 0;
-    while (total < len) {
-        ssize_t n = read(fd, (char *) buf + total, len - total);
-        if (n <= 0) return false;
-        total += n;
+bool writevAll(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        // Skip the buffers (and the part of one) that went out
+        while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
     }
     return true;
 }
 
 /**
- * @brief Read and parse a complete binary frame from socket
+ * @brief Send a complete binary frame to client socket
  *
- * Frame format: [Version:1][Type:1][Length:2][Payload:N][Terminator:1]
+ * Constructs frame with proper header and sends:
+ * [Version:1][Type:1][Length:2][Payload:N][Terminator:1]
  *
- * Validates:
- * - Protocol version matches Protocol::VERSION
- * - Payload length is reasonable (< 1024 bytes)
- * - Frame is properly terminated with TERM_BYTE
+ * Header, payload and terminator are handed over as one gather list: one
+ * writev() with thread-per-connection, one append to the connection's send
+ * queue with an event backend (which then writes many frames per syscall).
  *
- * @param fd Socket file descriptor
- * @param frame[out] Parsed frame (type and payload)
- * @return true if a valid frame was read, false on error or validation failure
+ * The payload may come in two pieces (head + tail) so a per-recipient header
+ * can be put in front of a body shared by many recipients without copying.
+ * Payloads above Protocol::MAX_PAYLOAD_SIZE go out as VERSION_2 frames, and
+ * only to peers whose caps include CAP_LARGE_FRAMES: for any other peer
+ * such a payload is refused.
  *
- * @note Sets frame.type and frame.payload on success
+ * @param fd Socket file descriptor
+ * @param caps The recipient's negotiated capabilities
+ * @param type Message type (Protocol::SERVER_HELLO, Protocol::FORWARD_LOG, etc.)
+ * @param head Payload, or its first part
+ * @param tail Rest of the payload (may be empty)
+ * @return true if frame was sent (or queued) successfully, false on error
  */
-bool readFrame(int fd, Frame &frame) {
-    std::cout << "[DEBUG] readFrame: trying to read 4-byte header" << std::endl;
+bool sendFrame(int fd, uint32_t caps, uint8_t type, std::string_view head, std::string_view tail = {}) {
+    size_t length = head.size() + tail.size();
+    if (length > Protocol::maxPayload(caps)) return false;
+
     uint8_t header[4];
-    if (!readExact(fd, header, 4)) {
-        std::cout << "[DEBUG] Failed to read header" << std::endl;
-        return false;
+    header[0] = Protocol::frameVersion(length);
+    header[1] = type;
+    header[2] = (length >> 8) & 0xFF;
+    header[3] = length & 0xFF;
+    uint8_t term = Protocol::TERM_BYTE;
+
+    struct iovec iov[4];
+    int iovcnt = 0;
+    iov[iovcnt].iov_base = header;
+    iov[iovcnt++].iov_len = sizeof(header);
+    iov[iovcnt].iov_base = const_cast<char *>(head.data());
+    iov[iovcnt++].iov_len = head.size();
+    if (!tail.empty()) {
+        iov[iovcnt].iov_base = const_cast<char *>(tail.data());
+        iov[iovcnt++].iov_len = tail.size();
     }
+    iov[iovcnt].iov_base = &term;
+    iov[iovcnt++].iov_len = 1;
 
-    std::cout << "[DEBUG] Header bytes: " << (int) header[0] << " " << (int) header[1] << " " << (int) header[2] << " "
-            << (int) header[3] << std::endl;
+    if (io_backend) {
+        return io_backend->send(fd, iov, iovcnt);
+    }
+    return writevAll(fd, iov, iovcnt);
+}
 
-    uint8_t version = header[0];
-    if (version != Protocol::VERSION) {
-        std::cerr << "Invalid protocol version: " << (int) version << std::endl;
-        return false;
+/**
+ * @brief Extract the remote IP address from a connected socket
+ *
+ * @param fd Socket file descriptor
+ * @return IP address string (e.g., "192.168.1.1"), or empty string on error
+ */
+std::string getClientIP(int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *) &addr, &len) == -1) {
+        return "";
     }
+    return std::string(inet_ntoa(addr.sin_addr));
+}
 
-    frame.type = header[1];
-    uint16_t length = (header[2] << 8) | header[3];
+/**
+ * @struct ForwardBatch
+ * @brief Records from one sniffer frame on their way to the GUIs
+ *
+ * GUIs may speak JSON (FORWARD_LOG), binary (FORWARD_BATCH) or packed
+ * binary (FORWARD_BATCH_LZ) depending on what they negotiated. Each encoding
+ * is produced at most once per batch, and only if some GUI needs it.
+ */
+struct ForwardBatch {
+    uint32_t ssid = 0;
+    RecordColumns records;              ///< Always filled
+    std::vector<std::string> bodies;    ///< FORWARD_LOG objects without "seq"; built on first use
+    std::string encoded;                ///< records in wire form; built on first use
+    std::vector<std::string> packed;    ///< packBatch() of each chunk; empty string = not smaller
+    size_t packed_per_frame = 0;        ///< Chunk size packed was built for
+};
 
-    std::cout << "[DEBUG] Frame type: " << (int) frame.type << ", payload length: " << length << std::endl;
+/// Header of a FORWARD_BATCH payload: ssid, first GUI seq, record count
+constexpr size_t FORWARD_BATCH_HEADER = 4 + 8 + 2;
 
-    if (length > 1024) {
-        std::cerr << "Payload too large: " << length << std::endl;
-        return false;
+/**
+ * @brief Send a batch to one JSON GUI, one FORWARD_LOG per record
+ *
+ * Each GUI connection is its own stream with its own sequence number, so the
+ * "seq" field is spliced in per recipient instead of re-serializing the whole
+ * JSON object for every GUI:
+ * ```
+ * body:   {"log":{...},"ssid":1}
+ * sent:   {"seq":42,"log":{...},"ssid":1}
+ * ```
+ *
+ * @return Number of records that could not be delivered
+ */
+uint64_t forwardJson(Client &c, ForwardBatch &batch) {
+    if (batch.bodies.empty()) {
+        for (size_t i = 0; i < batch.records.size(); ++i) {
+            json forward;
+            forward["ssid"] = batch.ssid;
+            forward["log"] = RecordCodec::toJson(batch.records.row(i));
+            batch.bodies.push_back(forward.dump());
+        }
     }
 
-    std::vector<char> payload_buf(length);
-    if (!readExact(fd, payload_buf.data(), length)) {
-        std::cout << "[DEBUG] Failed to read payload" << std::endl;
-        return false;
+    uint64_t failed = 0;
+    for (const auto &body: batch.bodies) {
+        std::string framed = "{\"seq\":" + std::to_string(++c.tx_seq) + "," + body.substr(1);
+        if (!sendFrame(c.fd, c.caps, Protocol::FORWARD_LOG, framed)) {
+            failed++;
+        }
     }
-    frame.payload = std::string(payload_buf.begin(), payload_buf.end());
+    return failed;
+}
 
-    uint8_t term;
-    if (!readExact(fd, &term, 1)) {
-        std::cout << "[DEBUG] Failed to read terminator" << std::endl;
-        return false;
+/**
+ * @brief Send a batch to one binary GUI as FORWARD_BATCH frames
+ *
+ * The encoded records are shared by all binary GUIs; only the 14-byte header
+ * (with this GUI's sequence numbers) differs. Without CAP_BATCH every frame
+ * holds one record; otherwise as many as the GUI's frame limit allows.
+ *
+ * GUIs with CAP_COMPRESS get each chunk packed instead, as long as that is
+ * smaller. Chunks are packed once and shared, like the plain encoding.
+ *
+ * @return Number of records that could not be delivered
+ */
+uint64_t forwardBinary(Client &c, ForwardBatch &batch) {
+    if (batch.encoded.empty()) {
+        batch.encoded.resize(batch.records.size() * RecordCodec::WIRE_SIZE);
+        for (size_t i = 0; i < batch.records.size(); ++i) {
+            RecordCodec::encode(batch.records.row(i), &batch.encoded[i * RecordCodec::WIRE_SIZE]);
+        }
     }
 
-    if (term != Protocol::TERM_BYTE) {
-        std::cerr << "Invalid terminator byte: " << (int) term << std::endl;
-        return false;
+    size_t per_frame = 1;
+    if (c.caps & Protocol::CAP_BATCH) {
+        per_frame = (Protocol::maxPayload(c.caps) - FORWARD_BATCH_HEADER) / RecordCodec::WIRE_SIZE;
     }
 
-    std::cout << "[DEBUG] Frame read successfully" << std::endl;
-    return true;
+    bool compress = (c.caps & Protocol::CAP_COMPRESS) != 0;
+    if (compress && batch.packed_per_frame != per_frame) {
+        // Only GUIs with different frame limits make this run twice
+        thread_local std::string scratch;
+        batch.packed.clear();
+        batch.packed_per_frame = per_frame;
+        for (size_t first = 0; first < batch.records.size(); first += per_frame) {
+            size_t count = std::min(per_frame, batch.records.size() - first);
+            std::string chunk;
+            ColumnCodec::packBatch(batch.records, first, count, chunk, scratch);
+            if (chunk.size() >= count * RecordCodec::WIRE_SIZE) chunk.clear();
+            batch.packed.push_back(std::move(chunk));
+        }
+    }
+
+    uint64_t failed = 0;
+    std::string_view encoded(batch.encoded);
+    for (size_t first = 0, chunk = 0; first < batch.records.size(); first += per_frame, ++chunk) {
+        size_t count = std::min(per_frame, batch.records.size() - first);
+        char header[FORWARD_BATCH_HEADER];
+        RecordCodec::put32(header, batch.ssid);
+        RecordCodec::put64(header + 4, c.tx_seq + 1);
+        RecordCodec::put16(header + 12, static_cast<uint16_t>(count));
+        c.tx_seq += count;
+
+        bool sent;
+        if (compress && !batch.packed[chunk].empty()) {
+            sent = sendFrame(c.fd, c.caps, Protocol::FORWARD_BATCH_LZ, std::string_view(header, sizeof(header)),
+                             batch.packed[chunk]);
+        } else {
+            sent = sendFrame(c.fd, c.caps, Protocol::FORWARD_BATCH, std::string_view(header, sizeof(header)),
+                             encoded.substr(first * RecordCodec::WIRE_SIZE, count * RecordCodec::WIRE_SIZE));
+        }
+        if (!sent) failed += count;
+    }
+    return failed;
 }
 
 /**
- * @brief Send a complete binary frame to client socket
+ * @brief Forward sniffer records to every connected GUI client
  *
- * Constructs frame with proper header and sends:
- * [Version:1][Type:1][Length:2][Payload:N][Terminator:1]
+ * @param batch Records to send; encodings are filled in as GUIs need them
+ * @return Number of (record, GUI) deliveries that failed
  *
- * @param fd Socket file descriptor
- * @param type Message type (Protocol::SERVER_HELLO, Protocol::FORWARD_LOG, etc.)
- * @param payload JSON string to send (must be < 1024 bytes)
- * @return true if frame was sent successfully, false on error
+ * @note Holds clients_mutex for the duration of the sends
+ */
+uint64_t forwardToGuis(ForwardBatch &batch) {
+    uint64_t failed = 0;
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    for (auto &c: clients) {
+        if (c.is_sniffer) continue;
+        failed += (c.caps & Protocol::CAP_BINARY) ? forwardBinary(c, batch) : forwardJson(c, batch);
+    }
+    return failed;
+}
+
+/**
+ * @brief Send a frame to every connected GUI client without per-stream numbering
  *
- * @note Does NOT handle partial writes - fails if full frame not sent atomically
+ * Used for STATS frames, which are periodic snapshots rather than records.
+ *
+ * @param type Message type
+ * @param payload Serialized JSON payload
+ * @param compact The same within Protocol::MAX_PAYLOAD_SIZE, for GUIs
+ *                without CAP_LARGE_FRAMES
  */
-bool sendFrame(int fd, uint8_t type, const std::string &payload) {
-    if (payload.length() > 1024) return false;
+void broadcastToGuis(uint8_t type, const std::string &payload, const std::string &compact) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    for (const auto &c: clients) {
+        if (!c.is_sniffer) {
+            sendFrame(c.fd, c.caps, type, (c.caps & Protocol::CAP_LARGE_FRAMES) ? payload : compact);
+        }
+    }
+}
 
-    uint8_t header[4];
-    header[0] = Protocol::VERSION;
-    header[1] = type;
-    header[2] = (payload.length() >> 8) & 0xFF;
-    header[3] = payload.length() & 0xFF;
+/**
+ * @brief Send a frame to one GUI client from a thread other than the sniffers'
+ *
+ * GUI sockets are written by every sniffer through forwardToGuis(), so
+ * frames sent here must not interleave with a FORWARD_LOG mid-frame: with
+ * thread-per-connection that means taking clients_mutex. The ssid check
+ * guards against the GUI having disconnected and its fd being reused by a
+ * newer connection while a long query was running.
+ *
+ * With an event backend a full send queue is waited out here, outside
+ * clients_mutex, since the event loop needs that lock to drain it.
+ *
+ * @param fd GUI socket
+ * @param ssid SSID the GUI had when it asked
+ * @param type Message type
+ * @param payload Serialized JSON payload
+ * @return true if the frame was sent (or queued)
+ */
+bool sendToGui(int fd, uint32_t ssid, uint8_t type, const std::string &payload) {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            auto it = fd_to_ssid.find(fd);
+            if (it == fd_to_ssid.end() || it->second != ssid) return false;
+            auto client = std::find_if(clients.begin(), clients.end(),
+                                       [fd](const Client &c) { return c.fd == fd; });
+            uint32_t caps = client != clients.end() ? client->caps : Protocol::LEGACY_CAPS;
+            if (sendFrame(fd, caps, type, payload)) return true;
+            if (!io_backend) return false;
+        }
+        if (!io_backend->waitForRoom(fd, payload.size() + 5)) return false;
+    }
+}
 
-    if (write(fd, header, 4) != 4) return false;
-    if (write(fd, payload.data(), payload.length()) != (ssize_t) payload.length()) return false;
-    if (write(fd, &Protocol::TERM_BYTE, 1) != 1) return false;
+// ============================================================================
+// HISTORICAL QUERIES
+// ============================================================================
 
-    return true;
+/**
+ * @brief Run a QUERY from a GUI and stream the results back
+ *
+ * Rows or groups are packed into QUERY_RESULT frames as tightly as
+ * Protocol::MAX_PAYLOAD_SIZE allows. The clients_mutex is taken per frame,
+ * not for the whole result, so live FORWARD_LOG traffic keeps flowing
+ * between batches. The last frame carries "done":true and the totals:
+ * ```json
+ * {"id":7,"done":true,"matched":1200,"scanned":480000,"segments":3,"elapsed_ms":12,"truncated":false}
+ * ```
+ *
+ * @param fd GUI socket
+ * @param ssid The GUI's SSID (see sendToGui())
+ * @param payload QUERY JSON
+ * @return false if the GUI connection failed while sending
+ */
+bool handleQuery(int fd, uint32_t ssid, const std::string &payload) {
+    json done;
+    done["done"] = true;
+
+    Query query;
+    try {
+        query = Query::fromJson(json::parse(payload));
+    } catch (const std::exception &e) {
+        done["error"] = std::string("Bad query: ") + e.what();
+        return sendToGui(fd, ssid, Protocol::QUERY_RESULT, done.dump());
+    }
+    done["id"] = query.id;
+
+    if (!query_engine) {
+        done["error"] = "Server has no record store (start it with --store DIR)";
+        return sendToGui(fd, ssid, Protocol::QUERY_RESULT, done.dump());
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    QueryResult result = query_engine->run(query);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+
+    // Batch as many serialized items as fit: {"id":N,"<key>":[item,item,...]}
+    const char *key = query.group_by == Query::GroupBy::NONE ? "rows" : "groups";
+    std::string prefix = "{\"id\":" + std::to_string(query.id) + ",\"" + key + "\":[";
+    std::string batch = prefix;
+    auto flushBatch = [&]() -> bool {
+        if (batch.size() == prefix.size()) return true;
+        batch += "]}";
+        bool ok = sendToGui(fd, ssid, Protocol::QUERY_RESULT, batch);
+        batch = prefix;
+        return ok;
+    };
+    auto addItem = [&](const json &item) -> bool {
+        std::string text = item.dump();
+        if (batch.size() + text.size() + 3 > Protocol::MAX_PAYLOAD_SIZE && !flushBatch()) return false;
+        if (batch.size() > prefix.size()) batch += ",";
+        batch += text;
+        return true;
+    };
+
+    for (const auto &row: result.rows) {
+        if (!addItem(QueryEngine::rowToJson(row.first, row.second))) return false;
+    }
+    for (const auto &group: result.groups) {
+        if (!addItem(QueryEngine::groupToJson(query, group.first, group.second))) return false;
+    }
+    if (!flushBatch()) return false;
+
+    done["matched"] = result.matched;
+    done["scanned"] = result.scanned;
+    done["segments"] = result.segments;
+    done["elapsed_ms"] = elapsed;
+    done["truncated"] = result.truncated;
+
+    std::cout << "[SERVER] Query " << query.id << ": " << result.matched << " of " << result.scanned
+            << " records matched in " << result.segments << " segment(s), " << elapsed << " ms" << std::endl;
+    return sendToGui(fd, ssid, Protocol::QUERY_RESULT, done.dump());
 }
 
 /**
- * @brief Extract the remote IP address from a connected socket
+ * @brief Answer a QUERY the server has no room for with a "busy" error
  *
- * @param fd Socket file descriptor
- * @return IP address string (e.g., "192.168.1.1"), or empty string on error
+ * @return false if the GUI connection failed while sending
  */
-std::string getClientIP(int fd) {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    if (getpeername(fd, (struct sockaddr *) &addr, &len) == -1) {
-        return "";
+bool refuseQuery(int fd, uint32_t ssid, std::string_view payload) {
+    json done;
+    done["done"] = true;
+    done["error"] = "Server busy: too many queries in progress, try again later";
+    try {
+        done["id"] = json::parse(payload).value("id", 0u);
+    } catch (const json::exception &) {
     }
-    return std::string(inet_ntoa(addr.sin_addr));
+    return sendToGui(fd, ssid, Protocol::QUERY_RESULT, done.dump());
 }
 
 // ============================================================================
@@ -252,203 +627,876 @@ std::string getClientIP(int fd) {
 // ============================================================================
 
 /**
- * @brief Handle a single client connection (runs in its own thread)
+ * @struct RelayedStream
+ * @brief One sniffer stream arriving through a relay server
  *
- * This is the main per-client handler. Each client connection (sniffer or GUI)
- * gets its own thread running this function.
+ * The relay names the stream by its own SSID; this server gives it one of
+ * its own on first sight, so GUIs, the store and our own upstream see a
+ * single SSID namespace however many relays feed in.
+ */
+struct RelayedStream {
+    uint32_t ssid = 0;          ///< Our SSID for the stream
+    SnifferLossStats loss;      ///< Accounting for the stream on this hop
+};
+
+/**
+ * @struct Session
+ * @brief Protocol state of one connection, independent of the I/O model
  *
- * ## Protocol Flow
+ * The thread-per-connection handler keeps its Session on its own stack; the
+ * event-driven backends keep one per fd on the event-loop thread. Either way
+ * every received frame goes through handleFrame().
+ */
+struct Session {
+    int fd = -1;
+    std::string remote_ip;
+    uint32_t ssid = 0;
+    bool registered = false;    ///< CLIENT_HELLO has been answered
+    bool is_sniffer = false;
+    uint32_t caps = 0;          ///< Negotiated in CLIENT_HELLO (Protocol::Capability bits)
+    SnifferLossStats loss;      ///< Sniffers only
+    uint32_t credit_window = 0; ///< Sniffers only: the window granted in SERVER_HELLO
+    uint32_t credits_owed = 0;  ///< Sniffers only: records fanned out but not yet credited
+    FrameReader rx;             ///< Received bytes not yet parsed into frames
+    bool redirected = false;    ///< Sent to another server of the pool; closed on its next frame
+    Shm::Channel *shm = nullptr; ///< Set for shared-memory sniffers: frames go both ways through it
+    std::unordered_map<uint32_t, RelayedStream> relayed; ///< Relays only: keyed by the relay's SSID
+    uint64_t stream_drop = 0;   ///< Relays only: records refused because relayed was full
+};
+
+/**
+ * @brief Pick the SSID of a new stream; the caller holds clients_mutex
  *
- * 1. **CLIENT_HELLO Reception**
- *    - Receive and parse CLIENT_HELLO frame
- *    - Identify client type based on presence of "interface" field:
- *      - Sniffer: Contains "interface" field (e.g., "en0")
- *      - GUI: Contains "type":"gui" field
- *    - Assign unique SSID
- *    - Send SERVER_HELLO response with assigned SSID
- *    - Register client in global clients list
- *
- * 2. **Sniffer Handling**
- *    - Enter read loop waiting for TRAFFIC_LOG frames
- *    - For each TRAFFIC_LOG:
- *      - Wrap log with SSID in FORWARD_LOG message
- *      - Send to ALL connected GUI clients
- *    - Loop until sniffer disconnects
- *
- * 3. **GUI Client Handling**
- *    - Receive SERVER_HELLO acknowledgment
- *    - Sleep in a loop (doesn't send frames)
- *    - Continues receiving FORWARD_LOG messages from sniffers
- *    - Loop until GUI disconnects
+ * A stream gets the stable SSID it asks for unless a live stream already
+ * holds it: a second sniffer with the same identity, or (rarely) two
+ * identities with the same hash. Those streams, and GUIs (wanted ==
+ * SSID_UNASSIGNED), take the next counter SSID instead.
  *
- * @param client_fd Socket file descriptor for this client
- * @param client_ip Remote IP address (for identification)
+ * @param wanted Protocol::stableSsid() of the sniffer, or SSID_UNASSIGNED
+ * @param holder Who is asking, for the log line of a later conflict
+ */
+uint32_t assignSsid(uint32_t wanted, const std::string &holder) {
+    if (Protocol::isStableSsid(wanted)) {
+        auto inserted = stable_ssids.emplace(wanted, holder);
+        if (inserted.second) return wanted;
+        std::cerr << "[SERVER] SSID " << wanted << " for " << holder << " is held by "
+                << inserted.first->second << "; assigning SSID " << next_ssid << std::endl;
+    }
+    return next_ssid++;
+}
+
+/**
+ * @brief Credit window to grant a sniffer that has just negotiated its caps
  *
- * @note This function is called in a detached thread, so cleanup happens
- *       when function returns
- * @note The function is resilient to errors - disconnects gracefully
- * @note Uses clients_mutex to protect concurrent access to clients list
+ * CREDIT_WINDOW suits one JSON record per frame. A batching sniffer gets at
+ * least CREDIT_FRAMES full batches, or it would stall on every other frame,
+ * and any sniffer gets CREDIT_RATE records for each second of round trip so
+ * a distant one keeps sending while its credits are on the way back.
+ */
+uint32_t creditWindow(const Session &session) {
+    uint64_t window = Protocol::CREDIT_WINDOW;
+    if ((session.caps & Protocol::CAP_BINARY) && (session.caps & Protocol::CAP_BATCH)) {
+        uint64_t per_frame = (Protocol::maxPayload(session.caps) - 2) / RecordCodec::WIRE_SIZE;
+        window = std::max<uint64_t>(window, per_frame * Protocol::CREDIT_FRAMES);
+    }
+    if (!session.shm) window += Protocol::CREDIT_RATE * roundTripUs(session.fd) / 1000000;
+    return static_cast<uint32_t>(std::min<uint64_t>(window, Protocol::MAX_CREDIT_WINDOW));
+}
+
+/**
+ * @brief Send a frame to the peer of a session, over its socket or its shared memory
  *
- * ## Example CLIENT_HELLO Payloads
+ * Only for frames addressed to the session itself (SERVER_HELLO, CREDIT).
+ * The shared-memory ring is never waited on: a sniffer that stops reading
+ * its CREDIT frames simply runs out of credits.
+ */
+bool sendToPeer(Session &session, uint8_t type, const std::string &payload) {
+    if (session.shm) return session.shm->send(type, payload.data(), payload.size(), false);
+    return sendFrame(session.fd, session.caps, type, payload);
+}
+
+/**
+ * @brief Handle CLIENT_HELLO: assign an SSID, answer, register the client
  *
- * Sniffer:
- * ```json
- * {"hostname":"MacBook-Pro-3.local","interface":"en0"}
- * ```
+ * Identifies the client type by the presence of the "interface" field:
+ * - Sniffer: `{"hostname":"MacBook-Pro-3.local","interface":"en0"}`
+ * - GUI: `{"hostname":"Qt GUI Client","type":"gui"}`
  *
- * GUI:
+ * SERVER_HELLO response:
  * ```json
- * {"hostname":"Qt GUI Client","type":"gui"}
+ * {"ssid":1,"ip":"127.0.0.1","registered":true,"proto":2,"caps":["seq","credits"]}
  * ```
  *
- * SERVER_HELLO Response:
- * ```json
- * {"ssid":1,"ip":"127.0.0.1","registered":true}
- * ```
+ * A sniffer's SSID is Protocol::stableSsid() of "hostname/interface" (see
+ * assignSsid()), so it survives reconnects and server restarts. In a pool
+ * (--pool), a sniffer this server does not own is answered with
+ * `{"registered":false,"redirect":"HOST:PORT"}` instead and not registered.
+ * GUIs are told the pool's members, so they can build a merged view.
+ *
+ * "caps" is the intersection of what the client offered and SERVER_CAPS; a
+ * client that offered nothing is a revision-1 peer and gets LEGACY_CAPS.
+ * Revision-1 clients ignore the extra fields.
+ *
+ * @return false if the response could not be sent
+ * @throws json::exception if the payload is not valid JSON
+ */
+bool registerClient(Session &session, std::string_view hello) {
+    json payload = json::parse(hello);
+    std::cout << "[SERVER] Parsed payload: " << payload.dump() << std::endl;
+
+    // Sniffers send "interface" field, GUI clients send "type":"gui"
+    session.is_sniffer = payload.contains("interface");
+    if (session.shm && !session.is_sniffer) {
+        // FORWARD_* frames go to GUIs through their sockets only
+        std::cerr << "[SERVER] Only sniffers may connect through shared memory" << std::endl;
+        return false;
+    }
+
+    uint32_t offered = Protocol::LEGACY_CAPS;
+    if (payload.contains("caps")) {
+        offered = Protocol::parseCapabilities(payload["caps"].get<std::vector<std::string> >());
+    }
+    session.caps = Protocol::negotiate(offered, SERVER_CAPS);
+    if (!session.is_sniffer) session.caps &= ~Protocol::CAP_RELAY;
+    bool relay = session.caps & Protocol::CAP_RELAY;
+
+    std::string identity;
+    if (session.is_sniffer) {
+        identity = Protocol::snifferIdentity(payload.value("hostname", ""), payload.value("interface", ""));
+    }
+
+    // Relays carry many sniffers and are accepted by any member; a
+    // shared-memory sniffer is on this host and cannot go elsewhere
+    if (shard_ring && session.is_sniffer && !relay && !session.shm && !shard_ring->owns(identity)) {
+        json response;
+        response["registered"] = false;
+        response["redirect"] = shard_ring->owner(identity);
+        response["proto"] = Protocol::PROTOCOL_REVISION;
+        std::cout << "[SERVER] Sniffer " << identity << " belongs to " << shard_ring->owner(identity)
+                << ", redirecting" << std::endl;
+        session.redirected = true;
+        return sendToPeer(session, Protocol::SERVER_HELLO, response.dump());
+    }
+
+    // Critical section: protect clients list and SSID assignment
+    std::lock_guard<std::mutex> lock(clients_mutex);
+
+    // Register sniffer in IP-to-sniffer map (for grouping by source)
+    if (session.is_sniffer && ip_to_sniffer.find(session.remote_ip) == ip_to_sniffer.end()) {
+        ip_to_sniffer[session.remote_ip] = {next_sniffer_index++, session.remote_ip};
+    }
+
+    // Assign unique SSID for this client connection
+    bool stable = session.is_sniffer && !relay;
+    session.ssid = assignSsid(stable ? Protocol::stableSsid(identity) : Protocol::SSID_UNASSIGNED, identity);
+    fd_to_ssid[session.fd] = session.ssid;
+
+    json response;
+    response["ssid"] = session.ssid;
+    response["ip"] = session.remote_ip;
+    response["registered"] = true;
+    if (session.is_sniffer && (session.caps & Protocol::CAP_CREDITS)) {
+        // Initial flow-control window; replenished by CREDIT frames
+        session.credit_window = creditWindow(session);
+        response["credits"] = session.credit_window;
+    }
+    response["proto"] = Protocol::PROTOCOL_REVISION;
+    response["caps"] = Protocol::capabilityNames(session.caps);
+    if (shard_ring && !session.is_sniffer) {
+        response["pool"] = shard_ring->members();
+        response["shard"] = shard_ring->self();
+    }
+
+    if (!sendToPeer(session, Protocol::SERVER_HELLO, response.dump())) {
+        return false;
+    }
+
+    clients.push_back({session.fd, session.remote_ip, session.ssid, session.is_sniffer, session.caps});
+    session.registered = true;
+
+    // Larger frames from the peer only once it has negotiated them
+    bool large_frames = session.caps & Protocol::CAP_LARGE_FRAMES;
+    session.rx.allowLargeFrames(large_frames);
+    if (session.shm) session.shm->allowLargeFrames(large_frames);
+
+    std::string mode = (session.caps & Protocol::CAP_BINARY) ? "binary" : "json";
+    if (session.caps & Protocol::CAP_BATCH) mode += "+batch";
+    if (session.caps & Protocol::CAP_LARGE_FRAMES) mode += "+large";
+    if (session.caps & Protocol::CAP_COMPRESS) mode += "+lz";
+    if (relay) {
+        std::cout << "Relay registered: IP=" << session.remote_ip << " SSID=" << session.ssid
+                << " mode=" << mode << std::endl;
+    } else if (session.is_sniffer) {
+        std::cout << "Sniffer registered: IP=" << session.remote_ip << " SSID=" << session.ssid
+                << " (" << identity << ") mode=" << mode << std::endl;
+    } else {
+        std::cout << "GUI Client registered: IP=" << session.remote_ip << " SSID=" << session.ssid
+                << " mode=" << mode << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief Return one flow-control credit to a sniffer
+ *
+ * FLOW CONTROL: credits are returned only after a record has been fanned
+ * out, so a slow GUI or a busy server shrinks the sniffer's window instead
+ * of filling socket buffers. Credits go back in batches of half a window to
+ * keep CREDIT frames rare.
+ *
+ * @param records Records just handled (a RECORD_BATCH returns them all at once)
+ */
+void consumeCredit(Session &session, uint32_t records = 1) {
+    if (!(session.caps & Protocol::CAP_CREDITS)) return;
+    session.credits_owed += records;
+    if (session.credits_owed >= session.credit_window / 2) {
+        json grant;
+        grant["credits"] = session.credits_owed;
+        sendToPeer(session, Protocol::CREDIT, grant.dump());
+        session.credits_owed = 0;
+    }
+}
+
+/**
+ * @brief Pass received records on: to the GUIs, the store and the parent server
+ *
+ * LOCK GRANULARITY: forwardToGuis() holds clients_mutex while writing. With
+ * thread-per-connection sendFrame() can block on a slow GUI; with an event
+ * backend it only queues. A failed send is counted as a fan-out drop instead
+ * of being silently ignored.
+ *
+ * The store and the upstream link come after fan-out and only queue, so
+ * neither the disk nor the parent ever sits between a sniffer and the GUIs.
+ */
+void deliverBatch(ForwardBatch &batch, SnifferLossStats &loss) {
+    loss.fanout_drop += forwardToGuis(batch);
+
+    if (record_store) {
+        for (size_t i = 0; i < batch.records.size(); ++i) {
+            // HTTP summaries are live-only: the host they are about is not in the record
+            if (batch.records.flags[i] & WireRecord::FLAG_HTTP_SUMMARY) continue;
+            record_store->append(batch.ssid, RecordStore::fromWire(batch.records.row(i)));
+        }
+    }
+    if (upstream) {
+        upstream->submit(batch.ssid, batch.records);
+    }
+}
+
+/**
+ * @brief Decode count binary records, plain or packed, into out
+ * @return false if the data does not hold exactly count records
+ */
+bool decodeRecords(const char *data, size_t len, size_t count, bool packed, RecordColumns &out) {
+    if (packed) {
+        thread_local std::string scratch;
+        return ColumnCodec::unpackBatch(data, len, count, out, scratch);
+    }
+    if (len != count * RecordCodec::WIRE_SIZE) return false;
+    for (size_t i = 0; i < count; ++i) {
+        out.push_back(RecordCodec::decode(data + i * RecordCodec::WIRE_SIZE));
+    }
+    return true;
+}
+
+/**
+ * @brief Loss accounting for a decoded batch of one stream
+ *
+ * Column-wise: the accounting only touches four of the eleven columns.
+ * DNS transactions and HTTP summaries describe packets that already came
+ * as packet records, so they add nothing to est_packets.
+ */
+void accountRecords(uint32_t ssid, SnifferLossStats &loss, const RecordColumns &columns) {
+    loss.records += columns.size();
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns.flags[i] & (WireRecord::FLAG_DNS | WireRecord::FLAG_HTTP_SUMMARY)) continue;
+        loss.est_packets += static_cast<uint64_t>(columns.packets[i]) * columns.sample_rate[i];
+    }
+    for (uint64_t seq: columns.seq) {
+        uint64_t missing = loss.rx_seq.observe(seq);
+        if (missing > 0) {
+            std::cerr << "[SERVER] SSID=" << ssid << " sequence gap: " << missing
+                    << " record(s) lost before seq " << seq << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Handle one TRAFFIC_LOG: account, fan out to GUIs, persist
  *
  * FORWARD_LOG Format (sent to GUIs):
  * ```json
  * {"ssid":1,"log":{"timestamp":"2025-12-16 21:15:30.123","src":"192.168.1.100","dst":"142.251.41.14","protocol":"TCP",...}}
  * ```
  */
-void handleClient(int client_fd, const std::string &client_ip) {
-    std::cout << "[SERVER] handleClient: trying to read first frame" << std::endl;
-    Frame frame;
-    if (!readFrame(client_fd, frame)) {
-        std::cout << "[SERVER] Failed to read first frame from " << client_ip << std::endl;
-        close(client_fd);
+void handleTrafficLog(Session &session, std::string_view payload) {
+    SnifferLossStats &loss = session.loss;
+
+    // Parse the traffic log JSON from sniffer and every field we read from
+    // it. A single malformed record (bad JSON, or a field of the wrong type
+    // such as "length":"abc") is counted and skipped rather than tearing
+    // down the whole sniffer connection.
+    json log_payload;
+    WireRecord record;
+    std::string kind;
+    uint64_t packets = 1, sample_rate = 1, seq = 0;
+    try {
+        log_payload = json::parse(payload);
+        record = RecordCodec::fromJson(log_payload);
+        kind = log_payload.value("kind", std::string());
+        packets = log_payload.value("packets", uint64_t{1});
+        sample_rate = log_payload.value("sample_rate", uint64_t{1});
+        seq = log_payload.value("seq", uint64_t{0});
+    } catch (const json::exception &) {
+        loss.decode_drop++;
+        consumeCredit(session);
         return;
     }
 
-    std::cout << "[SERVER] Received frame type: " << (int) frame.type << ", payload size: " << frame.payload.size() <<
-            std::endl;
+    // Sampled records stand for sample_rate packets and flow summaries for
+    // "packets"; scale back up to estimate the traffic the sniffer actually saw.
+    // DNS transactions and HTTP summaries are not traffic (see accountRecords()).
+    loss.records++;
+    if (kind != "dns" && kind != "http_summary") {
+        loss.est_packets += packets * sample_rate;
+    }
 
-    if (frame.type == Protocol::CLIENT_HELLO) {
-        try {
-            std::cout << "[SERVER] Parsing CLIENT_HELLO payload..." << std::endl;
-            std::cout.flush();
-            json payload = json::parse(frame.payload);
-            std::cout << "[SERVER] Parsed payload: " << payload.dump() << std::endl;
-            std::cout.flush();
-
-            // ================================================================
-            // STEP 1: Identify client type and assign SSID
-            // ================================================================
-            // Sniffers send "interface" field, GUI clients send "type":"gui"
-            bool is_sniffer = payload.contains("interface");
-
-            uint32_t ssid; {
-                // Critical section: protect clients list and SSID assignment
-                std::lock_guard<std::mutex> lock(clients_mutex);
-
-                // Register sniffer in IP-to-sniffer map (for grouping by source)
-                if (is_sniffer && ip_to_sniffer.find(client_ip) == ip_to_sniffer.end()) {
-                    ip_to_sniffer[client_ip] = {next_sniffer_index++, client_ip};
-                }
+    uint64_t missing = loss.rx_seq.observe(seq);
+    if (missing > 0) {
+        std::cerr << "[SERVER] SSID=" << session.ssid << " sequence gap: " << missing
+                << " record(s) lost before seq " << seq << std::endl;
+    }
 
-                // Assign unique SSID for this client connection
-                ssid = next_ssid++;
-                fd_to_ssid[client_fd] = ssid;
-
-                // ============================================================
-                // STEP 2: Send SERVER_HELLO response
-                // ============================================================
-                json response;
-                response["ssid"] = ssid;
-                response["ip"] = client_ip;
-                response["registered"] = true;
-
-                if (!sendFrame(client_fd, Protocol::SERVER_HELLO, response.dump())) {
-                    close(client_fd);
-                    return;
-                }
+    // Wrap with SSID for GUI clients to know which sniffer sent it. JSON
+    // GUIs get the sniffer's object unchanged; binary GUIs get the record form.
+    json forward;
+    forward["ssid"] = session.ssid;
+    forward["log"] = log_payload;
 
-                // ============================================================
-                // STEP 3: Register client and print confirmation
-                // ============================================================
-                clients.push_back({client_fd, client_ip, ssid, is_sniffer});
+    ForwardBatch batch;
+    batch.ssid = session.ssid;
+    batch.records.push_back(record);
+    batch.bodies.push_back(forward.dump());
 
-                if (is_sniffer) {
-                    std::cout << "Sniffer registered: IP=" << client_ip << " SSID=" << ssid << std::endl;
-                } else {
-                    std::cout << "GUI Client registered: IP=" << client_ip << " SSID=" << ssid << std::endl;
-                }
-            } // Lock released here
-
-            // ================================================================
-            // STEP 4: Handle client-specific communication loop
-            // ================================================================
-            if (is_sniffer) {
-                // SNIFFER HANDLER: Receive logs and broadcast to GUIs
-                while (readFrame(client_fd, frame)) {
-                    if (frame.type == Protocol::TRAFFIC_LOG) {
-                        // Parse the traffic log JSON from sniffer
-                        json log_payload = json::parse(frame.payload);
-
-                        // Wrap with SSID for GUI clients to know which sniffer sent it
-                        json forward;
-                        forward["ssid"] = ssid;
-                        forward["log"] = log_payload;
-
-                        std::string forward_str = forward.dump();
-
-                        // Broadcast to all connected GUI clients
-                        {
-                            // LOCK GRANULARITY: Narrow Critical Section
-                            // ===============================================
-                            // Lock scope: Only protect the clients list iteration
-                            // Unlock scope: BEFORE actual sendFrame() socket writes
-                            //
-                            // Why use narrow locks?
-                            // - Reduces lock contention: other threads waiting for access
-                            // - sendFrame() can block on socket writes (slow I/O)
-                            // - If locked during sendFrame(), all other threads blocked
-                            // - Narrow locks: maximum concurrency
-                            //
-                            // Race condition trade-off:
-                            // - RISK: clients list could change during iteration
-                            //   (new GUI connects, another GUI disconnects)
-                            // - REAL IMPACT: low for this design
-                            //   * New GUIs: won't receive this frame (next frame OK)
-                            //   * Disconnected GUI: sendFrame() error handled gracefully
-                            // - ACCEPTABLE: This is a teaching project
-                            //
-                            // Production Improvement:
-                            // - Snapshot the client list while locked
-                            // - Release lock
-                            // - Send to snapshots
-                            // - Eliminates race condition entirely
-                            //
-                            std::lock_guard<std::mutex> lock(clients_mutex);
-                            for (const auto &c: clients) {
-                                if (!c.is_sniffer) {
-                                    // Send FORWARD_LOG frame to GUI client
-                                    sendFrame(c.fd, Protocol::FORWARD_LOG, forward_str);
-                                }
-                            }
-                        } // Lock released
-                    }
-                }
-            } else {
-                // GUI CLIENT HANDLER: Just keep connection alive
-                // Frames are sent to this client by sniffers' handler above
-                while (true) {
-                    sleep(1);
-                }
+    deliverBatch(batch, loss);
+    consumeCredit(session);
+}
+
+/**
+ * @brief Handle one RECORD_BATCH or RECORD_BATCH_LZ from a binary sniffer
+ *
+ * Same accounting, fan-out and persistence as handleTrafficLog(), but for up
+ * to a frame's worth of records at once and without any JSON unless a JSON
+ * GUI is connected. A batch that does not decode to its declared count is
+ * dropped whole and counted as decode_drop.
+ *
+ * @param packed true for RECORD_BATCH_LZ
+ */
+void handleRecordBatch(Session &session, std::string_view payload, bool packed) {
+    SnifferLossStats &loss = session.loss;
+
+    ForwardBatch batch;
+    batch.ssid = session.ssid;
+
+    size_t count = payload.size() >= 2 ? RecordCodec::get16(payload.data()) : 0;
+    if (payload.size() < 2 || !decodeRecords(payload.data() + 2, payload.size() - 2, count, packed, batch.records)) {
+        // The declared count is still our best guess at what the sniffer spent
+        uint32_t spent = static_cast<uint32_t>(std::max<size_t>(count, 1));
+        loss.decode_drop += spent;
+        consumeCredit(session, spent);
+        return;
+    }
+
+    accountRecords(session.ssid, loss, batch.records);
+    deliverBatch(batch, loss);
+    consumeCredit(session, static_cast<uint32_t>(count));
+}
+
+/**
+ * @brief Our stream for one of a relay's SSIDs, assigning an SSID on first sight
+ *
+ * A stable SSID is kept as it is (sniffer SSIDs are the same at every
+ * tier); a counter SSID is only unique on the relay and is remapped.
+ *
+ * @param records Records the caller holds for the stream, counted in
+ *        stream_drop if it is refused
+ * @return null once the relay carries MAX_RELAYED_STREAMS streams and
+ *         relay_ssid is not one of them
+ */
+RelayedStream *relayedStream(Session &session, uint32_t relay_ssid, size_t records) {
+    auto found = session.relayed.find(relay_ssid);
+    if (found == session.relayed.end() && session.relayed.size() >= MAX_RELAYED_STREAMS) {
+        if (session.stream_drop == 0 && records > 0) {
+            std::cerr << "[SERVER] Relay SSID=" << session.ssid << " carries " << MAX_RELAYED_STREAMS
+                    << " streams; refusing records of stream " << relay_ssid << " and any further one" << std::endl;
+        }
+        session.stream_drop += records;
+        return nullptr;
+    }
+    RelayedStream &stream = found != session.relayed.end() ? found->second : session.relayed[relay_ssid];
+    if (stream.ssid == Protocol::SSID_UNASSIGNED) {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        stream.ssid = assignSsid(relay_ssid, "relay SSID=" + std::to_string(session.ssid));
+        std::cout << "[SERVER] Relay SSID=" << session.ssid << " stream " << relay_ssid
+                << " is SSID " << stream.ssid << std::endl;
+    }
+    return &stream;
+}
+
+/**
+ * @brief Handle one FORWARD_BATCH or FORWARD_BATCH_LZ from a relay server
+ *
+ * The relay's SSID in the header is mapped to one of ours; from there on
+ * the records are handled exactly like a sniffer's. The header's first seq
+ * numbers records on the link itself, so a gap there is logged against the
+ * relay, while each record's own seq still tracks its sniffer's stream.
+ */
+void handleRelayBatch(Session &session, std::string_view payload, bool packed) {
+    if (payload.size() < FORWARD_BATCH_HEADER) {
+        session.loss.decode_drop++;
+        return;
+    }
+    const char *data = payload.data();
+    size_t count = RecordCodec::get16(data + 12);
+    uint64_t first_seq = RecordCodec::get64(data + 4);
+    RelayedStream *stream = relayedStream(session, RecordCodec::get32(data), std::max<size_t>(count, 1));
+    if (!stream) return;
+
+    ForwardBatch batch;
+    batch.ssid = stream->ssid;
+    if (!decodeRecords(data + FORWARD_BATCH_HEADER, payload.size() - FORWARD_BATCH_HEADER, count, packed,
+                       batch.records)) {
+        stream->loss.decode_drop += std::max<size_t>(count, 1);
+        return;
+    }
+
+    uint64_t missing = session.loss.rx_seq.observe(first_seq);
+    if (missing > 0) {
+        std::cerr << "[SERVER] Relay SSID=" << session.ssid << " link gap: " << missing
+                << " record(s) lost before seq " << first_seq << std::endl;
+    }
+    if (count > 0) session.loss.rx_seq.expected = first_seq + count;   // The batch is contiguous
+    session.loss.records += count;
+
+    accountRecords(stream->ssid, stream->loss, batch.records);
+    deliverBatch(batch, stream->loss);
+    consumeCredit(session, static_cast<uint32_t>(count));
+}
+
+/**
+ * @brief This server's counters for one stream, the "server" part of STATS
+ */
+json serverView(uint32_t ssid, const SnifferLossStats &loss) {
+    json view = {
+        {"rx_seq", loss.rx_seq.expected - 1},
+        {"seq_gap", loss.rx_seq.lost},
+        {"decode_drop", loss.decode_drop},
+        {"fanout_drop", loss.fanout_drop},
+        {"records", loss.records},
+        {"est_packets", loss.est_packets}
+    };
+    if (record_store) {
+        // Store-wide: the writer queue is shared by all sniffers
+        view["store_written"] = record_store->written();
+        view["store_drop"] = record_store->dropped();
+    }
+    if (io_backend) {
+        // Server-wide: one event loop serves every connection
+        view["io_backend"] = io_backend->name();
+        view["io_syscalls"] = io_backend->syscalls();
+    }
+    if (upstream) {
+        view["upstream"] = upstream->address();
+        view["upstream_connected"] = upstream->connected();
+        view["upstream_drop"] = upstream->dropped(ssid);
+    }
+    return view;
+}
+
+/**
+ * @brief STATS for GUIs limited to Protocol::MAX_PAYLOAD_SIZE
+ *
+ * Keeps the loss counters every GUI revision shows. The per-hop "relays"
+ * list and the dissector, store and relay counters only newer GUIs list,
+ * and with them STATS outgrow a version-1 frame.
+ */
+json compactStats(const json &stats) {
+    static const char *const SNIFFER_KEYS[] = {
+        "seq", "kernel_recv", "kernel_drop", "ring_drop", "send_drop", "sampled_out", "summarized",
+        "summary_drop", "sample_mode", "sample_rate", "mode", "credits"
+    };
+    static const char *const SERVER_KEYS[] = {
+        "rx_seq", "seq_gap", "decode_drop", "fanout_drop", "records", "est_packets"
+    };
+
+    json compact;
+    compact["ssid"] = stats.value("ssid", 0u);
+    auto pick = [&](const char *section, const char *const *keys, size_t count) {
+        auto it = stats.find(section);
+        if (it == stats.end() || !it->is_object()) return;
+        json &out = compact[section];
+        out = json::object();
+        for (size_t i = 0; i < count; ++i) {
+            auto field = it->find(keys[i]);
+            if (field != it->end()) out[keys[i]] = *field;
+        }
+    };
+    pick("sniffer", SNIFFER_KEYS, std::size(SNIFFER_KEYS));
+    pick("server", SERVER_KEYS, std::size(SERVER_KEYS));
+    return compact;
+}
+
+/**
+ * @brief Send a stream's STATS to the GUIs, and to the parent server if relaying
+ */
+void publishStats(const json &stats) {
+    std::string payload = stats.dump();
+    std::string compact = payload.size() <= Protocol::MAX_PAYLOAD_SIZE ? payload : compactStats(stats).dump();
+    broadcastToGuis(Protocol::STATS, payload, compact);
+    if (upstream) {
+        upstream->submitStats(payload);
+    }
+}
+
+/**
+ * @brief Handle a sniffer's STATS: add the server's view, pass to GUIs
+ */
+void handleSnifferStats(Session &session, std::string_view payload) {
+    SnifferLossStats &loss = session.loss;
+
+    json sniffer_stats;
+    try {
+        sniffer_stats = json::parse(payload);
+    } catch (const json::exception &) {
+        loss.decode_drop++;
+        return;
+    }
+
+    json stats;
+    stats["ssid"] = session.ssid;
+    stats["sniffer"] = sniffer_stats;
+    stats["server"] = serverView(session.ssid, loss);
+
+    std::cout << "[SERVER] SSID=" << session.ssid << " mode="
+            << sniffer_stats.value("mode", "n/a") << " loss: kernel="
+            << sniffer_stats.value("kernel_drop", uint64_t{0})
+            << " ring=" << sniffer_stats.value("ring_drop", uint64_t{0})
+            << " send=" << sniffer_stats.value("send_drop", uint64_t{0})
+            << " gap=" << loss.rx_seq.lost
+            << " decode=" << loss.decode_drop
+            << " fanout=" << loss.fanout_drop << std::endl;
+
+    publishStats(stats);
+}
+
+/**
+ * @brief Handle the STATS a relay built for one of its streams
+ *
+ * The relay's payload has the shape of our own. The sniffer's counters pass
+ * through unchanged, the relay's "server" view is appended to "relays", and
+ * our view becomes "server". A GUI at the top tier thus sees every hop,
+ * listed from the sniffer outwards.
+ */
+void handleRelayStats(Session &session, std::string_view payload) {
+    json relayed;
+    uint32_t relay_ssid;
+    try {
+        relayed = json::parse(payload);
+        relay_ssid = relayed.at("ssid").get<uint32_t>();
+    } catch (const json::exception &) {
+        session.loss.decode_drop++;
+        return;
+    }
+    RelayedStream *stream = relayedStream(session, relay_ssid, 0);
+    if (!stream) return;
+
+    // Hops are only appended to a list; anything else from the relay is dropped
+    json hops = json::array();
+    if (relayed.contains("relays") && relayed["relays"].is_array()) hops = relayed["relays"];
+    hops.push_back(relayed.value("server", json::object()));
+
+    json stats;
+    stats["ssid"] = stream->ssid;
+    stats["sniffer"] = relayed.value("sniffer", json::object());
+    stats["relays"] = hops;
+    stats["server"] = serverView(stream->ssid, stream->loss);
+    publishStats(stats);
+}
+
+/**
+ * @brief Dispatch one received frame
+ *
+ * ## Protocol Flow
+ *
+ * 1. **CLIENT_HELLO** must come first; see registerClient()
+ * 2. **Sniffers** then send TRAFFIC_LOG (JSON) or RECORD_BATCH (binary) and
+ *    STATS frames; records are wrapped with the SSID and sent to ALL
+ *    connected GUI clients, each in the encoding that GUI negotiated
+ * 3. **GUI clients** receive FORWARD_LOG or FORWARD_BATCH frames pushed by the
+ *    sniffers' handlers; their own frames are QUERY requests answered by
+ *    handleQuery()
+ *
+ * @return false if the connection should be closed
+ * @throws json::exception if CLIENT_HELLO is not valid JSON
+ */
+bool handleFrame(Session &session, const FrameView &frame) {
+    if (!session.registered) {
+        std::cout << "[SERVER] Received frame type: " << (int) frame.type << ", payload size: "
+                << frame.payload.size() << std::endl;
+        if (frame.type != Protocol::CLIENT_HELLO || session.redirected) return false;
+        return registerClient(session, frame.payload);
+    }
+
+    if (session.caps & Protocol::CAP_RELAY) {
+        if (frame.type == Protocol::FORWARD_BATCH) {
+            handleRelayBatch(session, frame.payload, false);
+        } else if (frame.type == Protocol::FORWARD_BATCH_LZ && (session.caps & Protocol::CAP_COMPRESS)) {
+            handleRelayBatch(session, frame.payload, true);
+        } else if (frame.type == Protocol::STATS) {
+            handleRelayStats(session, frame.payload);
+        }
+        return true;
+    }
+
+    if (session.is_sniffer) {
+        if (frame.type == Protocol::TRAFFIC_LOG) {
+            handleTrafficLog(session, frame.payload);
+        } else if (frame.type == Protocol::RECORD_BATCH && (session.caps & Protocol::CAP_BINARY)) {
+            handleRecordBatch(session, frame.payload, false);
+        } else if (frame.type == Protocol::RECORD_BATCH_LZ && (session.caps & Protocol::CAP_COMPRESS)) {
+            handleRecordBatch(session, frame.payload, true);
+        } else if (frame.type == Protocol::STATS) {
+            handleSnifferStats(session, frame.payload);
+        }
+        return true;
+    }
+
+    if (frame.type == Protocol::QUERY) {
+        if (io_backend) {
+            // A query can scan for seconds; it must not stall the event loop.
+            // It runs on query_runner and its results go out through the
+            // thread-safe send queue.
+            if (pending_queries.fetch_add(1) >= MAX_PENDING_QUERIES) {
+                pending_queries--;
+                return refuseQuery(session.fd, session.ssid, frame.payload);
             }
-        } catch (const std::exception &e) {
-            std::cerr << "Error handling client: " << e.what() << std::endl;
-            std::cerr << "[SERVER] Exception details: " << typeid(e).name() << std::endl;
+            query_runner->submit([fd = session.fd, ssid = session.ssid, payload = std::string(frame.payload)] {
+                try {
+                    handleQuery(fd, ssid, payload);
+                } catch (const std::exception &e) {
+                    std::cerr << "[SERVER] Query failed: " << e.what() << std::endl;
+                }
+                pending_queries--;
+            });
+            return true;
         }
+        return handleQuery(session.fd, session.ssid, std::string(frame.payload));
     }
+    return true;
+}
 
+/**
+ * @brief Remove a connection from the shared client tables
+ */
+void unregisterClient(const Session &session) {
+    if (session.stream_drop > 0) {
+        std::cerr << "[SERVER] Relay SSID=" << session.ssid << " closed; " << session.stream_drop
+                << " record(s) of streams over " << MAX_RELAYED_STREAMS << " were refused" << std::endl;
+    }
     std::lock_guard<std::mutex> lock(clients_mutex);
     clients.erase(std::remove_if(clients.begin(), clients.end(),
-                                 [client_fd](const Client &c) { return c.fd == client_fd; }), clients.end());
-    fd_to_ssid.erase(client_fd);
+                                 [&session](const Client &c) { return c.fd == session.fd; }), clients.end());
+    fd_to_ssid.erase(session.fd);
+
+    // A stable SSID is only ever held by the stream it was assigned to, so
+    // the sniffer's next connection gets it back
+    if (Protocol::isStableSsid(session.ssid)) stable_ssids.erase(session.ssid);
+    for (const auto &relayed: session.relayed) {
+        if (Protocol::isStableSsid(relayed.second.ssid)) stable_ssids.erase(relayed.second.ssid);
+    }
+}
+
+/**
+ * @brief Handle a single client connection (runs in its own thread)
+ *
+ * Used with `--io threads`. Each client connection (sniffer or GUI) gets its
+ * own thread that blocks in session.rx.readFrame() and passes every frame to
+ * handleFrame(). One read() usually delivers many frames, which are then
+ * handled without touching the socket again. readFrame() failing means the
+ * client went away (or sent garbage), which ends the thread and unregisters it.
+ *
+ * @param client_fd Socket file descriptor for this client
+ * @param client_ip Remote IP address (for identification)
+ *
+ * @note This function is called in a detached thread, so cleanup happens
+ *       when function returns
+ * @note The function is resilient to errors - disconnects gracefully
+ */
+void handleClient(int client_fd, const std::string &client_ip) {
+    Session session;
+    session.fd = client_fd;
+    session.remote_ip = client_ip;
+
+    std::cout << "[SERVER] handleClient: trying to read first frame" << std::endl;
+    FrameView frame;
+    try {
+        while (session.rx.readFrame(client_fd, frame)) {
+            if (!handleFrame(session, frame)) break;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error handling client: " << e.what() << std::endl;
+        std::cerr << "[SERVER] Exception details: " << typeid(e).name() << std::endl;
+    }
+    if (session.rx.buffered() > 0) {
+        std::cerr << "[SERVER] Dropping " << client_ip << ": " << session.rx.error() << std::endl;
+    }
+    if (!session.registered) {
+        std::cout << "[SERVER] Failed to read first frame from " << client_ip << std::endl;
+    }
+
+    unregisterClient(session);
     close(client_fd);
 }
 
+// ============================================================================
+// EVENT-DRIVEN CONNECTIONS (--io epoll / uring)
+// ============================================================================
+
+std::unordered_map<int, Session> sessions; ///< Event-loop thread only
+
+/**
+ * @brief Cut every complete frame out of a connection's received bytes
+ *
+ * Called by the event loop with whatever one read returned, which may hold
+ * many frames or only part of one. The bytes go into session.rx, whose
+ * frames are handled in place; the tail that is not yet a whole frame stays
+ * there for the next call.
+ *
+ * @return false on a protocol violation or if handleFrame() asks to close
+ */
+bool onConnectionData(int fd, const char *data, size_t len) {
+    auto it = sessions.find(fd);
+    if (it == sessions.end()) return false;
+    Session &session = it->second;
+    session.rx.feed(data, len);
+
+    FrameView frame;
+    try {
+        while (true) {
+            FrameReader::Status status = session.rx.next(frame);
+            if (status == FrameReader::Status::NEED_MORE) return true;
+            if (status == FrameReader::Status::BAD_FRAME) {
+                std::cerr << "[SERVER] Dropping " << session.remote_ip << ": " << session.rx.error() << std::endl;
+                return false;
+            }
+            if (!handleFrame(session, frame)) return false;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error handling client: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+/**
+ * @brief Run every connection on the event loop of io_backend (never returns)
+ *
+ * @param server_fd Listening socket file descriptor (already bound and listening)
+ */
+void eventLoop(int server_fd) {
+    IoCallbacks callbacks;
+    callbacks.on_accept = [](int fd, const std::string &ip) {
+        std::cout << "New connection from " << ip << std::endl;
+        setNoDelay(fd);
+        Session &session = sessions[fd];
+        session = Session();
+        session.fd = fd;
+        session.remote_ip = ip;
+    };
+    callbacks.on_data = onConnectionData;
+    callbacks.on_close = [](int fd) {
+        auto it = sessions.find(fd);
+        if (it == sessions.end()) return;
+        if (!it->second.registered) {
+            std::cout << "[SERVER] Failed to read first frame from " << it->second.remote_ip << std::endl;
+        }
+        unregisterClient(it->second);
+        sessions.erase(it);
+    };
+
+    io_backend->run(server_fd, callbacks);
+}
+
+// ============================================================================
+// SHARED-MEMORY SNIFFERS (--shm)
+// ============================================================================
+
+/**
+ * @brief Serve one sniffer that connected through shared memory (own thread)
+ *
+ * Frames are handled in place in the ring and released only afterwards, so
+ * a record is never copied on this side. While frames keep coming the loop
+ * makes no syscalls; when the ring runs dry it parks in waitReadable() until
+ * the sniffer rings the doorbell or hangs up.
+ *
+ * @param control_fd Accepted Unix socket; the channel takes ownership
+ */
+void handleShmClient(int control_fd) {
+    std::unique_ptr<Shm::Channel> channel;
+    try {
+        channel = Shm::Channel::accept(control_fd);
+    } catch (const std::exception &e) {
+        std::cerr << "[SERVER] Rejecting shared-memory sniffer: " << e.what() << std::endl;
+        return;
+    }
+
+    Session session;
+    session.fd = control_fd;
+    session.remote_ip = "local";
+    session.shm = channel.get();
+    std::cout << "New shared-memory connection" << std::endl;
+
+    FrameView frame;
+    try {
+        while (true) {
+            FrameReader::Status status = channel->next(frame);
+            if (status == FrameReader::Status::BAD_FRAME) {
+                std::cerr << "[SERVER] Dropping shared-memory sniffer: " << channel->error() << std::endl;
+                break;
+            }
+            if (status == FrameReader::Status::NEED_MORE) {
+                if (!channel->waitReadable(1000) && channel->closed()) break;
+                continue;
+            }
+            bool keep = handleFrame(session, frame);
+            channel->consume();
+            if (!keep) break;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error handling client: " << e.what() << std::endl;
+    }
+
+    std::cout << "[SERVER] Shared-memory sniffer SSID=" << session.ssid << " closed (doorbells sent: "
+            << channel->doorbells() << ")" << std::endl;
+    unregisterClient(session);
+}
+
+/**
+ * @brief Accept shared-memory sniffers on the --shm socket (runs in its own thread)
+ *
+ * Whatever the --io model, each such sniffer gets a thread: it spends its
+ * time in the ring, not in a socket the event loop could watch.
+ */
+void shmAcceptLoop(int listen_fd) {
+    while (true) {
+        int control_fd = accept(listen_fd, nullptr, nullptr);
+        if (control_fd < 0) {
+            if (errno != EINTR) std::cerr << "Accept failed" << std::endl;
+            continue;
+        }
+        std::thread(handleShmClient, control_fd).detach();
+    }
+}
+
 // ============================================================================
 // MAIN SERVER LOOP
 // ============================================================================
@@ -456,8 +1504,9 @@ void handleClient(int client_fd, const std::string &client_ip) {
 /**
  * @brief Main server accept loop - listens for incoming connections
  *
- * Runs in the main thread, continuously accepting new client connections
- * and spawning a new thread for each one via handleClient().
+ * Used with `--io threads`. Runs in the main thread, continuously accepting
+ * new client connections and spawning a new thread for each one via
+ * handleClient().
  *
  * For each new connection:
  * 1. Accept the socket connection
@@ -487,6 +1536,7 @@ void acceptLoop(int server_fd) {
 
         std::string client_ip = std::string(inet_ntoa(client_addr.sin_addr));
         std::cout << "New connection from " << client_ip << std::endl;
+        setNoDelay(client_fd);
 
         // Spawn a new thread for this client (detached so we don't track it)
         //
@@ -505,14 +1555,9 @@ void acceptLoop(int server_fd) {
         // - Context switching overhead increases with many threads
         // - Max realistic connections: ~1000-5000 with this model
         //
-        // Production Alternative: Thread Pool + Work Queue
-        // - Pool of N worker threads (e.g., 32 threads)
-        // - Each new connection queued
-        // - Workers process from queue
-        // - Scalable to 100K+ connections
-        // - Trade-off: more complex code, event-based design (epoll/kqueue)
-        //
-        // For a teaching project handling <100 sniffers: this simple model is fine.
+        // Event-driven alternative: --io epoll / --io uring (the default on
+        // Linux) run every connection from one loop thread instead; see
+        // eventLoop() and IoBackend.h. This model remains for portability.
         std::thread(handleClient, client_fd, client_ip).detach();
     }
 }
@@ -526,12 +1571,15 @@ void acceptLoop(int server_fd) {
  *
  * ## Initialization Steps
  *
- * 1. Parse command line arguments (port number required)
+ * 1. Parse command line arguments (port number required, store options optional)
  * 2. Create TCP listening socket
  * 3. Set SO_REUSEADDR to allow quick port reuse on restart
  * 4. Bind socket to address 0.0.0.0:<port> (all interfaces)
  * 5. Listen for incoming connections with backlog of 10
- * 6. Enter acceptLoop() which runs until server is killed
+ * 6. With --shm, start shmAcceptLoop() on a Unix socket at that path
+ *    With --upstream, start the UpstreamLink to the parent server
+ *    With --pool, build the ShardRing that decides which sniffers stay here
+ * 7. Enter eventLoop() (or acceptLoop() for --io threads), which runs until the server is killed
  *
  * ## Shutdown
  *
@@ -541,7 +1589,7 @@ void acceptLoop(int server_fd) {
  * - Connection cleanup is OS-managed (doesn't need explicit cleanup)
  *
  * @param argc Argument count
- * @param argv Argument vector - expects [program_path, port_number]
+ * @param argv Argument vector - expects [program_path, port_number, options...]
  * @return 0 on success, 1 on initialization error
  *
  * @usage ./SnifferServer 9090
@@ -555,13 +1603,100 @@ void acceptLoop(int server_fd) {
  * ```
  */
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <port>" << std::endl;
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <port> [--io auto|threads|epoll|uring] [--shm PATH]"
+                << " [--upstream HOST:PORT] [--upstream-aggregate MS] [--pool HOST:PORT,... --self HOST:PORT]"
+                << " [--store DIR] [--retain-hours H] [--retain-mb M] [--segment-mb M] [--segment-sec S]" << std::endl;
         return 1;
     }
 
     int port = std::atoi(argv[1]);
 
+    // Optional persistent store and I/O model
+    StoreConfig store_config;
+    IoBackend::Kind io_kind = IoBackend::Kind::AUTO;
+    std::string shm_path;
+    std::string upstream_address;
+    uint32_t upstream_aggregate_ms = 0;
+    std::string pool;
+    std::string self;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--io") {
+            try {
+                io_kind = IoBackend::parseKind(value);
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+        } else if (arg == "--shm") {
+            shm_path = value;
+        } else if (arg == "--upstream") {
+            upstream_address = value;
+        } else if (arg == "--upstream-aggregate") {
+            upstream_aggregate_ms = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--pool") {
+            pool = value;
+        } else if (arg == "--self") {
+            self = value;
+        } else if (arg == "--store") {
+            store_config.root = value;
+        } else if (arg == "--retain-hours") {
+            store_config.retain_seconds = std::strtoull(value.c_str(), nullptr, 10) * 3600;
+        } else if (arg == "--retain-mb") {
+            store_config.retain_bytes = std::strtoull(value.c_str(), nullptr, 10) << 20;
+        } else if (arg == "--segment-mb") {
+            store_config.segment_max_bytes = std::max<uint64_t>(1, std::strtoull(value.c_str(), nullptr, 10)) << 20;
+        } else if (arg == "--segment-sec") {
+            store_config.segment_max_seconds = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (!pool.empty()) {
+        try {
+            shard_ring.reset(new ShardRing(ShardRing::parsePool(pool), self));
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Shard " << self << " of a pool of " << shard_ring->members().size() << std::endl;
+    }
+
+    if (!store_config.root.empty()) {
+        try {
+            record_store.reset(new RecordStore(store_config));
+            query_pool.reset(new ThreadPool(std::max(2u, std::min(8u, std::thread::hardware_concurrency()))));
+            query_engine.reset(new QueryEngine(*record_store, *query_pool));
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // A GUI that disconnects mid-write must not kill the server: ignore
+    // SIGPIPE so write() returns EPIPE and the failure is counted as a
+    // fan-out drop instead.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!upstream_address.empty()) {
+        try {
+            UpstreamConfig upstream_config = UpstreamConfig::parseAddress(upstream_address);
+            upstream_config.aggregate_ms = upstream_aggregate_ms;
+            upstream.reset(new UpstreamLink(upstream_config));
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     // ====================================================================
     // STEP 1: Create socket
     // ====================================================================
@@ -616,8 +1751,33 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    std::cout << "Server listening on port " << port << std::endl;
-    acceptLoop(server_fd);
+    try {
+        io_backend = IoBackend::create(io_kind);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (io_backend) {
+        query_runner.reset(new ThreadPool(QUERY_RUNNERS));
+    }
+
+    std::cout << "Server listening on port " << port << " ("
+            << (io_backend ? io_backend->name() : "thread per connection") << ")" << std::endl;
+
+    if (!shm_path.empty()) {
+        try {
+            std::thread(shmAcceptLoop, Shm::Channel::listen(shm_path)).detach();
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Shared-memory sniffers accepted on " << shm_path << std::endl;
+    }
+    if (io_backend) {
+        eventLoop(server_fd);
+    } else {
+        acceptLoop(server_fd);
+    }
 
     return 0;
 }
@@ -0,0 +1,192 @@
+/**
+ * @file BatchParser.cpp
+ * @brief Implementation of the batch header reader
+ */
+
+#include "BatchParser.h"
+
+#include <netinet/in.h>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BATCH_PARSER_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr uint16_t ETHERTYPE_IPV4 = 0x0800;
+constexpr uint8_t IPV4_NO_OPTIONS = 0x45;       // Version 4, IHL 5
+
+/// Bytes of a frame the vector engine reads: up to the end of the ports
+constexpr uint32_t GATHER_END = 38;
+
+inline uint16_t get16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+#ifdef BATCH_PARSER_AVX2
+
+bool hasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+/// The 32-bit word at byte field of each readable frame, 0 for the others
+__attribute__((target("avx2")))
+inline __m256i gatherWord(const int* base, __m256i offset, __m256i readable, int field) {
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base,
+                                       _mm256_add_epi32(offset, _mm256_set1_epi32(field)), readable, 1);
+}
+
+/**
+ * @brief Frames [begin, begin + 8) with AVX2
+ *
+ * @return false, having written nothing, if the frames are too far apart
+ *         for 32-bit gather offsets
+ */
+__attribute__((target("avx2")))
+bool parseGroupAvx2(const unsigned char* const* frames, const uint32_t* lengths, size_t begin,
+                    PacketColumns& out) {
+    // Gathers address base + 32-bit offset; the group's first frame is the
+    // base. An offset o fits when (o + 2^30) >> 31 is 0, i.e. |o| < 1 GB.
+    const __m256i base = _mm256_set1_epi64x(reinterpret_cast<intptr_t>(frames[begin]));
+    const __m256i bias = _mm256_set1_epi64x(1LL << 30);
+    const __m256i low = _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(frames + begin)), base);
+    const __m256i high = _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(frames + begin + 4)), base);
+    const __m256i far = _mm256_srli_epi64(_mm256_or_si256(_mm256_add_epi64(low, bias), _mm256_add_epi64(high, bias)), 31);
+    if (!_mm256_testz_si256(far, far)) return false;
+    const __m256i low_dwords = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    const __m256i offset = _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(low, low_dwords),
+                                                     _mm256_permutevar8x32_epi32(high, low_dwords), 0x20);
+    const __m256i length = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lengths + begin));
+    const __m256i zero = _mm256_setzero_si256();
+
+    // Frames too short for the loads below are masked off: not read at all,
+    // and their words are zero, which fails every test
+    const __m256i readable = _mm256_cmpgt_epi32(length, _mm256_set1_epi32(GATHER_END - 1));
+    const int* at = reinterpret_cast<const int*>(frames[begin]);
+    const __m256i type_word = gatherWord(at, offset, readable, 12);    // EtherType, version/IHL, TOS
+    const __m256i frag_word = gatherWord(at, offset, readable, 20);    // Flags/fragment offset, TTL, protocol
+    const __m256i src = gatherWord(at, offset, readable, 26);
+    const __m256i dst = gatherWord(at, offset, readable, 30);
+    const __m256i ports = gatherWord(at, offset, readable, 34);
+
+    // Words are little-endian: 0x0800 and 0x45 read as 0x??450008. DF may
+    // be set, MF and the fragment offset may not.
+    const __m256i ipv4 = _mm256_cmpeq_epi32(_mm256_and_si256(type_word, _mm256_set1_epi32(0x00FFFFFF)),
+                                            _mm256_set1_epi32(IPV4_NO_OPTIONS << 16 | 0x0008));
+    const __m256i whole = _mm256_cmpeq_epi32(_mm256_and_si256(frag_word, _mm256_set1_epi32(0xFF3F)), zero);
+    const __m256i protocol = _mm256_srli_epi32(frag_word, 24);
+    const __m256i tcp = _mm256_and_si256(
+        _mm256_cmpeq_epi32(protocol, _mm256_set1_epi32(IPPROTO_TCP)),
+        _mm256_cmpgt_epi32(length, _mm256_set1_epi32(BatchParser::MIN_TCP_FRAME - 1)));
+    const __m256i udp = _mm256_and_si256(
+        _mm256_cmpeq_epi32(protocol, _mm256_set1_epi32(IPPROTO_UDP)),
+        _mm256_cmpgt_epi32(length, _mm256_set1_epi32(BatchParser::MIN_UDP_FRAME - 1)));
+    const __m256i simple = _mm256_and_si256(_mm256_and_si256(ipv4, whole), _mm256_or_si256(tcp, udp));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&out.src_ip[begin]), src);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&out.dst_ip[begin]), dst);
+
+    // Within each 128-bit half: the four source ports byte-swapped into the
+    // low 8 bytes, the destination ports into the high 8. Swapping the
+    // middle quadwords then puts all eight of each side together.
+    const __m256i split_ports = _mm256_setr_epi8(
+        1, 0, 5, 4, 9, 8, 13, 12, 3, 2, 7, 6, 11, 10, 15, 14,
+        1, 0, 5, 4, 9, 8, 13, 12, 3, 2, 7, 6, 11, 10, 15, 14);
+    const __m256i port_columns = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(ports, split_ports), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out.src_port[begin]), _mm256_castsi256_si128(port_columns));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out.dst_port[begin]), _mm256_extracti128_si256(port_columns, 1));
+
+    // EtherType the same way, from the low two bytes of its word
+    const __m256i split_type = _mm256_setr_epi8(
+        1, 0, 5, 4, 9, 8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1,
+        1, 0, 5, 4, 9, 8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i type_column = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(type_word, split_type), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out.ethertype[begin]), _mm256_castsi256_si128(type_column));
+
+    // One byte per frame: protocol (top byte of its word) in bytes 0-3 of
+    // each half, the simple flag in bytes 4-7; interleaving the halves'
+    // dwords then gives 8 protocol bytes followed by 8 flags
+    const __m256i pick_bytes = _mm256_setr_epi8(
+        3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i pick_flags = _mm256_setr_epi8(
+        -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i bytes = _mm256_or_si256(_mm256_shuffle_epi8(frag_word, pick_bytes),
+                                    _mm256_shuffle_epi8(_mm256_and_si256(simple, _mm256_set1_epi32(1)), pick_flags));
+    bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    const __m128i packed = _mm256_castsi256_si128(bytes);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&out.protocol[begin]), packed);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&out.simple[begin]), _mm_srli_si128(packed, 8));
+
+    // The masked-off frames still have an EtherType if they reach that far
+    unsigned short_frames = ~static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(readable))) & 0xFF;
+    while (short_frames) {
+        size_t i = begin + __builtin_ctz(short_frames);
+        out.ethertype[i] = lengths[i] >= 14 ? get16(frames[i] + 12) : 0;
+        short_frames &= short_frames - 1;
+    }
+    return true;
+}
+
+#endif // BATCH_PARSER_AVX2
+
+} // namespace
+
+void BatchParser::parse(const unsigned char* const* frames, const uint32_t* lengths, size_t count,
+                        PacketColumns& out) {
+    out.resize(count);
+    size_t i = 0;
+#ifdef BATCH_PARSER_AVX2
+    if (hasAvx2()) {
+        for (; i + 8 <= count; i += 8) {
+            if (!parseGroupAvx2(frames, lengths, i, out)) {
+                scalarRange(frames, lengths, i, i + 8, out);
+            }
+        }
+    }
+#endif
+    scalarRange(frames, lengths, i, count, out);
+}
+
+void BatchParser::parseScalar(const unsigned char* const* frames, const uint32_t* lengths, size_t count,
+                              PacketColumns& out) {
+    out.resize(count);
+    scalarRange(frames, lengths, 0, count, out);
+}
+
+const char* BatchParser::engine() {
+#ifdef BATCH_PARSER_AVX2
+    if (hasAvx2()) return "avx2";
+#endif
+    return "scalar";
+}
+
+void BatchParser::scalarRange(const unsigned char* const* frames, const uint32_t* lengths,
+                              size_t begin, size_t end, PacketColumns& out) {
+    for (size_t i = begin; i < end; ++i) {
+        const unsigned char* frame = frames[i];
+        uint32_t length = lengths[i];
+        out.ethertype[i] = length >= 14 ? get16(frame + 12) : 0;
+        out.simple[i] = 0;
+
+        // Same test as the vector engine, one byte at a time
+        if (out.ethertype[i] != ETHERTYPE_IPV4 || length < MIN_UDP_FRAME ||
+            frame[14] != IPV4_NO_OPTIONS || (frame[20] & 0x3F) != 0 || frame[21] != 0) {
+            continue;
+        }
+        uint8_t protocol = frame[23];
+        if (!(protocol == IPPROTO_UDP || (protocol == IPPROTO_TCP && length >= MIN_TCP_FRAME))) {
+            continue;
+        }
+        out.simple[i] = 1;
+        out.protocol[i] = protocol;
+        memcpy(&out.src_ip[i], frame + 26, 4);
+        memcpy(&out.dst_ip[i], frame + 30, 4);
+        out.src_port[i] = get16(frame + 34);
+        out.dst_port[i] = get16(frame + 36);
+    }
+}
@@ -0,0 +1,94 @@
+/**
+ * @file BatchParser.h
+ * @brief Header fields of a whole capture buffer at once, as columns
+ *
+ * Nearly every frame a sniffer sees has the same layout: Ethernet, an IPv4
+ * header without options, then TCP or UDP. For such a frame every field a
+ * record needs sits at a fixed offset, so BatchParser reads them for a
+ * block of frames (one BPF buffer) in one pass and writes them to
+ * PacketColumns, one array per field, with no per-frame call chain and no
+ * layer-by-layer bounds checks.
+ *
+ * ## Engines
+ *
+ * Where the CPU has AVX2 (checked once at run time on x86-64), eight frames
+ * are done at a time: five 32-bit gathers (EtherType with the IPv4 version,
+ * fragment bits with the protocol, the two addresses, the ports), vector
+ * compares for the layout test, and byte shuffles that swap the ports and
+ * EtherType to host order and pack them into their columns. The frames of
+ * a group must lie within 1 GB of each other, as in any capture buffer; a
+ * group that does not, and the frames left over after the last full group,
+ * go through the scalar engine, which is also the only one elsewhere
+ * (arm64 included).
+ *
+ * A frame the test rejects (another EtherType, IPv4 options, fragments,
+ * other protocols, too short a capture) is not looked at further: the
+ * caller hands it to PacketParser, which knows every other case.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @struct PacketColumns
+ * @brief BatchParser's output: header fields of frame i at index i
+ *
+ * Only ethertype is defined for every frame (0 if shorter than an Ethernet
+ * header); the other fields only where simple is 1.
+ */
+struct PacketColumns {
+    std::vector<uint16_t> ethertype;
+    std::vector<uint8_t> simple;        ///< 1: Ethernet, IPv4 without options or fragmentation, TCP or UDP
+    std::vector<uint8_t> protocol;      ///< IPPROTO_TCP or IPPROTO_UDP
+    std::vector<uint32_t> src_ip;       ///< Network byte order
+    std::vector<uint32_t> dst_ip;
+    std::vector<uint16_t> src_port;     ///< Host byte order
+    std::vector<uint16_t> dst_port;
+
+    size_t size() const { return ethertype.size(); }
+
+    void resize(size_t n) {
+        ethertype.resize(n);
+        simple.resize(n);
+        protocol.resize(n);
+        src_ip.resize(n);
+        dst_ip.resize(n);
+        src_port.resize(n);
+        dst_port.resize(n);
+    }
+};
+
+/**
+ * @class BatchParser
+ * @brief Fills PacketColumns for a block of Ethernet frames, see the file comment
+ */
+class BatchParser {
+public:
+    /// Smallest capture of a simple frame: TCP needs its whole header, UDP its 8 bytes
+    static constexpr size_t MIN_TCP_FRAME = 14 + 20 + 20;
+    static constexpr size_t MIN_UDP_FRAME = 14 + 20 + 8;
+
+    /**
+     * @brief Read the header fields of count frames into out (resized to count)
+     *
+     * @param frames First byte of each frame's Ethernet header
+     * @param lengths Captured bytes of each frame
+     */
+    static void parse(const unsigned char* const* frames, const uint32_t* lengths, size_t count,
+                      PacketColumns& out);
+
+    /// parse() without SIMD, whatever the CPU (the reference for the vector engine)
+    static void parseScalar(const unsigned char* const* frames, const uint32_t* lengths, size_t count,
+                            PacketColumns& out);
+
+    /// The engine parse() uses on this machine: "avx2" or "scalar"
+    static const char* engine();
+
+private:
+    /// Frames [begin, end) one by one
+    static void scalarRange(const unsigned char* const* frames, const uint32_t* lengths,
+                            size_t begin, size_t end, PacketColumns& out);
+};
@@ -0,0 +1,91 @@
+/**
+ * @file ConsoleSink.cpp
+ * @brief Implementation of the buffered console output
+ */
+
+#include "ConsoleSink.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+ConsoleSink& ConsoleSink::forThread() {
+    thread_local ConsoleSink sink;
+    return sink;
+}
+
+ConsoleSink::ConsoleSink()
+    : buf_(new char[BUFFER_SIZE]),
+      tty_(isatty(STDOUT_FILENO) == 1),
+      last_flush_(std::chrono::steady_clock::now()) {
+}
+
+ConsoleSink::~ConsoleSink() {
+    flush();
+}
+
+// ============================================================================
+// Formatting
+// ============================================================================
+
+ConsoleSink& ConsoleSink::text(std::string_view s) {
+    if (used_ + s.size() > BUFFER_SIZE) {
+        flush();
+        if (s.size() > BUFFER_SIZE) s = s.substr(0, BUFFER_SIZE);  // Never happens for packet lines
+    }
+    memcpy(buf_.get() + used_, s.data(), s.size());
+    used_ += s.size();
+    return *this;
+}
+
+ConsoleSink& ConsoleSink::text(char c) {
+    if (used_ == BUFFER_SIZE) flush();
+    buf_[used_++] = c;
+    return *this;
+}
+
+ConsoleSink& ConsoleSink::number(uint64_t value) {
+    char digits[20];
+    auto res = std::to_chars(digits, digits + sizeof(digits), value);
+    return text(std::string_view(digits, static_cast<size_t>(res.ptr - digits)));
+}
+
+ConsoleSink& ConsoleSink::color(const char* code) {
+    if (tty_) text(code);
+    return *this;
+}
+
+void ConsoleSink::endLine() {
+    text('\n');
+    if (tty_ || used_ >= FLUSH_THRESHOLD) flush();
+}
+
+// ============================================================================
+// Output
+// ============================================================================
+
+void ConsoleSink::flushIfIdle() {
+    if (used_ > 0 && std::chrono::steady_clock::now() - last_flush_ >= FLUSH_INTERVAL) {
+        flush();
+    }
+}
+
+void ConsoleSink::flush() {
+    last_flush_ = std::chrono::steady_clock::now();
+    size_t done = 0;
+    while (done < used_ && !broken_) {
+        ssize_t n = write(STDOUT_FILENO, buf_.get() + done, used_ - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            // Reader went away (e.g. `| head`): keep capturing, stop printing
+            std::cerr << "[SNIFFER] Console output failed (" << strerror(errno)
+                      << "); discarding further packet lines" << std::endl;
+            broken_ = true;
+        } else {
+            done += static_cast<size_t>(n);
+        }
+    }
+    used_ = 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file ConsoleSink.h
+ * @brief Buffered standard output for the sniffer's console mode
+ *
+ * PacketParser::parseAndPrint() used to write every packet through
+ * std::cout and std::endl, so console mode made at least one write() per
+ * packet and formatted every number through iostream. Piped into a file or
+ * grep, that capped it at a few hundred thousand lines per second.
+ *
+ * ## Buffering
+ *
+ * Lines are appended to a BUFFER_SIZE buffer per thread and written out
+ * with a single write(2) when:
+ * - the buffer holds FLUSH_THRESHOLD bytes
+ * - FLUSH_INTERVAL has passed since the last write (the capture loop calls
+ *   flushIfIdle() after every BPF read, timeouts included, so a quiet
+ *   interface still shows its last packets within a fraction of a second)
+ * - stdout is a terminal: then every line is written as it is completed,
+ *   as someone is watching it
+ *
+ * ## Colours
+ *
+ * The ANSI colour codes are only emitted when stdout is a terminal; piped
+ * output is plain text.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+/**
+ * @class ConsoleSink
+ * @brief Per-thread line buffer in front of stdout
+ *
+ * Not thread-safe by design: every thread gets its own instance from
+ * forThread(), so printing never takes a lock.
+ */
+class ConsoleSink {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 17;
+    /// Written out once this much is buffered (leaves room for one more line)
+    static constexpr size_t FLUSH_THRESHOLD = BUFFER_SIZE - 1024;
+    /// Longest time a completed line waits in the buffer
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{200};
+
+    /// The calling thread's sink (created on first use, flushed at thread exit)
+    static ConsoleSink& forThread();
+
+    ~ConsoleSink();
+
+    ConsoleSink(const ConsoleSink&) = delete;
+    ConsoleSink& operator=(const ConsoleSink&) = delete;
+
+    ConsoleSink& text(std::string_view s);
+    ConsoleSink& text(char c);
+
+    /// Decimal, through std::to_chars
+    ConsoleSink& number(uint64_t value);
+
+    /// ANSI escape sequence, dropped unless stdout is a terminal
+    ConsoleSink& color(const char* code);
+
+    /// Terminate the line and write out whatever is due
+    void endLine();
+
+    /// Write out the buffer if FLUSH_INTERVAL has passed since the last write
+    void flushIfIdle();
+
+    /// Write out the buffer now
+    void flush();
+
+    bool colors() const { return tty_; }
+
+private:
+    ConsoleSink();
+
+    std::unique_ptr<char[]> buf_;      ///< BUFFER_SIZE bytes, on the heap rather than in every thread's TLS
+    size_t used_ = 0;
+    bool tty_ = false;                  ///< stdout is a terminal: colours, line buffering
+    bool broken_ = false;               ///< stdout is gone (EPIPE etc.); output is discarded
+    std::chrono::steady_clock::time_point last_flush_;
+};
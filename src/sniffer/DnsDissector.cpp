@@ -0,0 +1,244 @@
+/**
+ * @file DnsDissector.cpp
+ * @brief Implementation of DNS name handling and query/response matching
+ */
+
+#include "DnsDissector.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+namespace {
+
+/// DNS header (RFC 1035 section 4.1.1), big-endian
+constexpr size_t HEADER_SIZE = 12;
+constexpr uint16_t FLAG_QR = 0x8000;        ///< Response
+constexpr uint16_t OPCODE_MASK = 0x7800;    ///< 0 = standard query
+constexpr uint16_t RCODE_MASK = 0x000F;
+
+/// A label length byte with these bits set is a compression pointer
+constexpr uint8_t POINTER = 0xC0;
+
+inline uint16_t get16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+inline uint8_t lower(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<uint8_t>(c + ('a' - 'A')) : c;
+}
+
+} // namespace
+
+// ============================================================================
+// DnsName
+// ============================================================================
+
+bool DnsName::validate(size_t& end) const {
+    size_t at = offset_;
+    size_t wire_length = 0;
+    bool jumped = false;
+
+    while (true) {
+        if (at >= length_) return false;
+        uint8_t len = message_[at];
+        if ((len & POINTER) == POINTER) {
+            if (at + 1 >= length_) return false;
+            size_t target = static_cast<size_t>(len & ~POINTER) << 8 | message_[at + 1];
+            // Strictly backwards: every jump makes progress, so no loops
+            if (target >= at) return false;
+            if (!jumped) end = at + 2;
+            jumped = true;
+            at = target;
+            continue;
+        }
+        if (len & POINTER) return false;    // 0x40 and 0x80: obsolete label types
+
+        wire_length += len + 1u;
+        if (wire_length > MAX_NAME) return false;
+        if (len == 0) {
+            if (!jumped) end = at + 1;
+            return true;
+        }
+        at += len + 1u;
+    }
+}
+
+template <typename F>
+void DnsName::forEachLabel(F&& f) const {
+    size_t at = offset_;
+    while (message_[at] != 0) {
+        uint8_t len = message_[at];
+        if ((len & POINTER) == POINTER) {
+            at = static_cast<size_t>(len & ~POINTER) << 8 | message_[at + 1];
+            continue;
+        }
+        f(message_ + at + 1, len);
+        at += len + 1u;
+    }
+}
+
+size_t DnsName::text(char* out) const {
+    size_t n = 0;
+    forEachLabel([&](const uint8_t* label, uint8_t len) {
+        if (n > 0) out[n++] = '.';
+        for (uint8_t i = 0; i < len; ++i) {
+            uint8_t c = label[i];
+            out[n++] = c > ' ' && c < 0x7F && c != '.' ? static_cast<char>(c) : '?';
+        }
+    });
+    if (n == 0) out[n++] = '.';
+    out[n] = '\0';
+    return n;
+}
+
+std::string DnsName::str() const {
+    char buf[MAX_TEXT];
+    return std::string(buf, text(buf));
+}
+
+bool DnsName::equals(const DnsName& other) const {
+    uint8_t a[MAX_NAME], b[MAX_NAME];
+    size_t n = flatten(a);
+    if (other.flatten(b) != n) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (lower(a[i]) != lower(b[i])) return false;
+    }
+    return true;
+}
+
+size_t DnsName::flatten(uint8_t* out) const {
+    size_t n = 0;
+    forEachLabel([&](const uint8_t* label, uint8_t len) {
+        out[n++] = len;
+        memcpy(out + n, label, len);
+        n += len;
+    });
+    out[n++] = 0;
+    return n;
+}
+
+// ============================================================================
+// DnsDissector
+// ============================================================================
+
+DnsDissector::DnsDissector(const DnsOptions& options) : options_(options) {
+}
+
+void DnsDissector::datagram(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port, uint16_t dst_port,
+                            const uint8_t* payload, size_t length, uint64_t ts_ns) {
+    if (ts_ns >= last_sweep_ns_ + SWEEP_INTERVAL_NS) {
+        sweep(ts_ns);
+    }
+
+    // Header and the first question; further questions (never seen in
+    // practice) are ignored
+    if (length < HEADER_SIZE) {
+        ++stats_.malformed;
+        return;
+    }
+    uint16_t id = get16(payload);
+    uint16_t flags = get16(payload + 2);
+    if ((flags & OPCODE_MASK) != 0 || get16(payload + 4) == 0) {
+        return;     // Not a standard query (NOTIFY, UPDATE, ...) or no question
+    }
+    DnsName qname(payload, length, HEADER_SIZE);
+    size_t end;
+    if (!qname.validate(end) || end + 4 > length) {
+        ++stats_.malformed;
+        return;
+    }
+    uint16_t qtype = get16(payload + end);
+
+    bool response = flags & FLAG_QR;
+    if (response ? src_port != PORT : dst_port != PORT) {
+        ++stats_.malformed;
+        return;
+    }
+    Key key = response ? Key{dst_ip, src_ip, dst_port, src_port, id}
+                       : Key{src_ip, dst_ip, src_port, dst_port, id};
+
+    if (!response) {
+        auto it = pending_.find(key);
+        if (it != pending_.end()) {
+            ++stats_.retransmits;
+            return;
+        }
+        if (pending_.size() >= options_.max_pending) {
+            ++stats_.refused;
+            return;
+        }
+        Pending& query = pending_[key];
+        query.ts_ns = ts_ns;
+        query.qtype = qtype;
+        query.name_length = static_cast<uint8_t>(qname.flatten(query.name));
+        ++stats_.queries;
+        return;
+    }
+
+    auto it = pending_.find(key);
+    if (it == pending_.end() || it->second.qtype != qtype ||
+        !qname.equals(DnsName(it->second.name, it->second.name_length, 0))) {
+        ++stats_.unmatched;
+        return;
+    }
+    ++stats_.answered;
+    report(key, it->second, true, ts_ns, static_cast<uint8_t>(flags & RCODE_MASK), qname);
+    pending_.erase(it);
+}
+
+void DnsDissector::report(const Key& key, const Pending& query, bool answered, uint64_t ts_ns,
+                          uint8_t rcode, const DnsName& qname) {
+    if (!callback_) return;
+
+    DnsTransaction t;
+    t.client_ip = key.client_ip;
+    t.server_ip = key.server_ip;
+    t.client_port = key.client_port;
+    t.server_port = key.server_port;
+    t.id = key.id;
+    t.qtype = query.qtype;
+    t.query_ts_ns = query.ts_ns;
+    t.answered = answered;
+    t.latency_ns = answered && ts_ns > query.ts_ns ? ts_ns - query.ts_ns : 0;
+    t.rcode = rcode;
+    t.qname = qname;
+    callback_(t);
+}
+
+void DnsDissector::sweep(uint64_t now_ns) {
+    last_sweep_ns_ = now_ns;
+    uint64_t timeout_ns = static_cast<uint64_t>(options_.timeout_sec) * 1000000000ull;
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        auto next = std::next(it);
+        if (it->second.ts_ns + timeout_ns < now_ns) {
+            ++stats_.timeouts;
+            report(it->first, it->second, false, 0, 0, DnsName(it->second.name, it->second.name_length, 0));
+            pending_.erase(it);
+        }
+        it = next;
+    }
+}
+
+const char* DnsDissector::typeName(uint16_t qtype, char (&buf)[12]) {
+    switch (qtype) {
+        case 1: return "A";
+        case 2: return "NS";
+        case 5: return "CNAME";
+        case 6: return "SOA";
+        case 12: return "PTR";
+        case 15: return "MX";
+        case 16: return "TXT";
+        case 28: return "AAAA";
+        case 33: return "SRV";
+        case 35: return "NAPTR";
+        case 43: return "DS";
+        case 48: return "DNSKEY";
+        case 64: return "SVCB";
+        case 65: return "HTTPS";
+        case 255: return "ANY";
+        default:
+            snprintf(buf, sizeof(buf), "TYPE%u", qtype);
+            return buf;
+    }
+}
@@ -0,0 +1,206 @@
+/**
+ * @file DnsDissector.h
+ * @brief DNS query/response matching for latency and response codes
+ *
+ * PacketParser hands every UDP datagram to or from port 53 to a
+ * DnsDissector. Queries wait in a table keyed by the 5-tuple and the DNS
+ * id; the response that matches one (same key, same question) completes a
+ * DnsTransaction with the latency and response code, which goes to the
+ * callback. Queries without a response are reported once timeout_sec has
+ * passed in packet time.
+ *
+ * ## Names
+ *
+ * Names are not decoded while parsing. A DnsName is a view of the message
+ * (offset of the first label); it is validated once, with compression
+ * pointers followed, and only turned into text if a consumer asks for it.
+ * Pointers must point before the label they replace, so a name cannot
+ * loop, and a name longer than MAX_NAME bytes is malformed.
+ *
+ * ## Memory
+ *
+ * The table holds at most max_pending queries; further ones are refused
+ * and counted. A pending query keeps a copy of its question name (at most
+ * MAX_NAME bytes), since the packet it came in is gone by the time a
+ * timeout is reported.
+ *
+ * DNS over TCP and queries on other ports are not tracked. Queries still
+ * pending when capture stops are not reported.
+ *
+ * Not thread-safe: used only by the capture loop.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @struct DnsOptions
+ * @brief Limits of the pending-query table
+ */
+struct DnsOptions {
+    size_t max_pending = 16384;     ///< Queries waiting for a response
+    uint32_t timeout_sec = 5;       ///< Queries are reported unanswered after this long
+};
+
+/**
+ * @class DnsName
+ * @brief A domain name in place in a DNS message
+ */
+class DnsName {
+public:
+    /// Longest name in wire form (RFC 1035 section 2.3.4)
+    static constexpr size_t MAX_NAME = 255;
+
+    /// Longest text() output, terminator included
+    static constexpr size_t MAX_TEXT = MAX_NAME;
+
+    DnsName() = default;
+    DnsName(const uint8_t* message, size_t length, size_t offset)
+        : message_(message), length_(length), offset_(offset) {}
+
+    /**
+     * @brief Check the name and find where it ends in the message
+     *
+     * @param[out] end Offset just past the name (past the first pointer, if any)
+     * @return false if the name is truncated, too long, or has a bad pointer
+     */
+    bool validate(size_t& end) const;
+
+    /**
+     * @brief Dotted text of a validated name, without the final dot ("." for the root)
+     *
+     * Bytes outside printable ASCII and dots inside labels become '?'.
+     *
+     * @param out At least MAX_TEXT bytes
+     * @return Length written, not counting the terminator
+     */
+    size_t text(char* out) const;
+
+    /// text() as a string (allocates)
+    std::string str() const;
+
+    /// Same name, ignoring ASCII case (both validated)
+    bool equals(const DnsName& other) const;
+
+    /**
+     * @brief Uncompressed wire form of a validated name
+     *
+     * @param out At least MAX_NAME bytes
+     * @return Length written; a DnsName over out at offset 0 is the same name
+     */
+    size_t flatten(uint8_t* out) const;
+
+private:
+    /// Calls f(label, length) for each label of a validated name
+    template <typename F>
+    void forEachLabel(F&& f) const;
+
+    const uint8_t* message_ = nullptr;
+    size_t length_ = 0;
+    size_t offset_ = 0;
+};
+
+/**
+ * @struct DnsTransaction
+ * @brief A query and its outcome, as passed to the callback
+ */
+struct DnsTransaction {
+    uint32_t client_ip = 0;         ///< Network byte order
+    uint32_t server_ip = 0;
+    uint16_t client_port = 0;       ///< Host byte order
+    uint16_t server_port = 0;
+    uint16_t id = 0;
+    uint16_t qtype = 0;
+    uint64_t query_ts_ns = 0;
+    bool answered = false;          ///< false: timed out, latency_ns and rcode are 0
+    uint64_t latency_ns = 0;
+    uint8_t rcode = 0;
+    DnsName qname;                  ///< Valid during the callback only
+};
+
+/**
+ * @class DnsDissector
+ * @brief Pending-query table, see the file comment
+ */
+class DnsDissector {
+public:
+    using Callback = std::function<void(const DnsTransaction&)>;
+
+    /// DNS server port; datagrams from or to it are inspected
+    static constexpr uint16_t PORT = 53;
+
+    /// Packet-time interval between timeout sweeps
+    static constexpr uint64_t SWEEP_INTERVAL_NS = 1000000000ull;
+
+    struct Stats {
+        uint64_t queries = 0;           ///< Queries added to the table
+        uint64_t answered = 0;          ///< Transactions completed by a response
+        uint64_t timeouts = 0;          ///< Queries reported unanswered
+        uint64_t retransmits = 0;       ///< Queries repeated while pending (latency counts from the first)
+        uint64_t unmatched = 0;         ///< Responses without a pending query or with another question
+        uint64_t malformed = 0;         ///< Datagrams on port 53 that are not usable DNS
+        uint64_t refused = 0;           ///< Queries not tracked: table full
+    };
+
+    explicit DnsDissector(const DnsOptions& options);
+
+    void setCallback(const Callback& callback) { callback_ = callback; }
+
+    /**
+     * @brief Inspect one UDP datagram from or to PORT
+     *
+     * @param src_ip Network byte order
+     * @param src_port Host byte order
+     * @param payload UDP payload (the DNS message)
+     */
+    void datagram(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port, uint16_t dst_port,
+                  const uint8_t* payload, size_t length, uint64_t ts_ns);
+
+    /// Name of a query type ("A", "AAAA", ...; "TYPE<n>" if unknown), in buf if needed
+    static const char* typeName(uint16_t qtype, char (&buf)[12]);
+
+    const Stats& stats() const { return stats_; }
+    size_t pending() const { return pending_.size(); }
+
+private:
+    struct Key {
+        uint32_t client_ip, server_ip;
+        uint16_t client_port, server_port;
+        uint16_t id;
+        bool operator==(const Key& o) const {
+            return client_ip == o.client_ip && server_ip == o.server_ip && client_port == o.client_port &&
+                   server_port == o.server_port && id == o.id;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = (static_cast<uint64_t>(k.client_ip) << 32 | k.server_ip) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(h ^ (static_cast<uint64_t>(k.client_port) << 32 |
+                                            static_cast<uint64_t>(k.server_port) << 16 | k.id));
+        }
+    };
+
+    /// A query waiting for its response
+    struct Pending {
+        uint64_t ts_ns;
+        uint16_t qtype;
+        uint8_t name_length;
+        uint8_t name[DnsName::MAX_NAME];    ///< Question name, uncompressed
+    };
+    using Table = std::unordered_map<Key, Pending, KeyHash>;
+
+    void report(const Key& key, const Pending& query, bool answered, uint64_t ts_ns, uint8_t rcode,
+                const DnsName& qname);
+    void sweep(uint64_t now_ns);
+
+    DnsOptions options_;
+    Callback callback_;
+    Table pending_;
+    uint64_t last_sweep_ns_ = 0;
+    Stats stats_;
+};
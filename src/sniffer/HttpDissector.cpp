@@ -0,0 +1,544 @@
+/**
+ * @file HttpDissector.cpp
+ * @brief Implementation of the HTTP/1.x dissector and its summary table
+ */
+
+#include "HttpDissector.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+/// Longest Content-Length or chunk size taken seriously (1 PB)
+constexpr uint64_t MAX_BODY = 1ull << 50;
+
+/**
+ * @brief First occurrence of byte in [p, end), or nullptr
+ *
+ * Compares 16 bytes at a time where SSE2 (x86-64) or NEON (arm64) is
+ * available; header lines average some 30 bytes, so most are found in one
+ * or two steps. The tail, and every byte elsewhere, goes through the loop.
+ */
+inline const char* findByte(const char* p, const char* end, char byte) {
+#if defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(byte);
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(byte));
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)), needle);
+        // No movemask on NEON: narrow each byte of the result to a nibble
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != 0) return p + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == byte) return p;
+    }
+    return nullptr;
+}
+
+/// Methods are upper-case tokens (RFC 9110 section 9; extension methods use '-' and '_')
+inline bool isMethodChar(char c) {
+    return (c >= 'A' && c <= 'Z') || c == '-' || c == '_';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+/// Case-insensitive comparison with a lower-case literal
+inline bool equalsLower(const char* text, size_t n, const char* lower) {
+    size_t i = 0;
+    for (; i < n && lower[i] != '\0'; ++i) {
+        if (toLower(text[i]) != lower[i]) return false;
+    }
+    return i == n && lower[i] == '\0';
+}
+
+/// Copy up to max bytes of text into out and terminate it; non-printables become '?'
+inline void copyText(char* out, size_t max, const char* text, size_t n, bool lower) {
+    n = std::min(n, max);
+    for (size_t i = 0; i < n; ++i) {
+        char c = text[i];
+        c = c > ' ' && c < 0x7F ? c : '?';
+        out[i] = lower ? toLower(c) : c;
+    }
+    out[n] = '\0';
+}
+
+/// Leading and trailing spaces and tabs off [begin, end)
+inline void trim(const char*& begin, const char*& end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t')) ++begin;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) --end;
+}
+
+/// "HTTP/1.0" or "HTTP/1.1" (any minor digit)
+inline bool isVersion(const char* text, size_t n) {
+    return n == 8 && memcmp(text, "HTTP/1.", 7) == 0 && isDigit(text[7]);
+}
+
+/**
+ * @brief Path prefix of an origin-form path: query and fragment cut, at most
+ * PATH_SEGMENTS segments and MAX_PATH characters
+ */
+void pathPrefix(char* out, const char* path, const char* end, size_t segments) {
+    size_t n = 0;
+    size_t slashes = 0;
+    for (const char* p = path; p < end && n < HttpTransaction::MAX_PATH; ++p) {
+        char c = *p;
+        if (c == '?' || c == '#') break;
+        if (c == '/' && ++slashes > segments) break;
+        out[n++] = c > ' ' && c < 0x7F ? c : '?';
+    }
+    out[n] = '\0';
+}
+
+/// Decimal Content-Length; false unless all digits
+bool parseLength(const char* p, const char* end, uint64_t& value) {
+    if (p == end) return false;
+    value = 0;
+    for (; p < end; ++p) {
+        if (!isDigit(*p)) return false;
+        value = value * 10 + static_cast<uint64_t>(*p - '0');
+        if (value > MAX_BODY) return false;
+    }
+    return true;
+}
+
+/// Hexadecimal chunk size, up to a chunk extension; false if there is none
+bool parseChunkSize(const char* p, const char* end, uint64_t& value) {
+    value = 0;
+    const char* start = p;
+    for (; p < end; ++p) {
+        char c = toLower(*p);
+        int digit = isDigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        if (digit < 0) break;
+        value = value << 4 | static_cast<uint64_t>(digit);
+        if (value > MAX_BODY) return false;
+    }
+    return p > start && (p == end || *p == ';' || *p == ' ' || *p == '\t');
+}
+
+} // namespace
+
+// ============================================================================
+// Dissector
+// ============================================================================
+
+HttpDissector::HttpDissector(const HttpOptions& options) {
+    for (uint16_t port : options.ports) {
+        ports_.set(port);
+    }
+}
+
+bool HttpDissector::accept(const TcpConnection& conn) {
+    return ports_.test(conn.server_port);
+}
+
+void HttpDissector::onData(TcpConnection& conn, int dir, const uint8_t* data, size_t length, uint64_t ts_ns) {
+    auto* ex = static_cast<Exchange*>(conn.state.get());
+    if (!ex) {
+        // Clients speak first, and with a method name
+        if (dir != 0 || !isMethodChar(static_cast<char>(data[0]))) {
+            ++stats_.rejected;
+            conn.done = true;
+            return;
+        }
+        ex = new Exchange;
+        conn.state.reset(ex);
+    }
+
+    const char* p = reinterpret_cast<const char*>(data);
+    consume(conn, *ex, dir, p, p + length, ts_ns);
+    if (conn.done) {
+        conn.state.reset();
+    }
+}
+
+void HttpDissector::onGap(TcpConnection& conn, int dir, uint32_t length) {
+    if (conn.done) return;
+    auto* ex = static_cast<Exchange*>(conn.state.get());
+    if (ex) {
+        // A hole inside a body of known size loses nothing we look at
+        Direction& d = ex->dir[dir];
+        if ((d.phase == Phase::BODY || d.phase == Phase::CHUNK_DATA) && length <= d.remaining) {
+            d.remaining -= length;
+            if (d.remaining == 0) {
+                d.phase = d.phase == Phase::BODY ? Phase::START_LINE : Phase::CHUNK_END;
+            }
+            return;
+        }
+        if (d.phase == Phase::UNTIL_CLOSE) return;
+        ++stats_.desync;
+    }
+    conn.done = true;
+    conn.state.reset();
+}
+
+void HttpDissector::onClose(TcpConnection& conn) {
+    auto* ex = static_cast<Exchange*>(conn.state.get());
+    if (ex) {
+        stats_.unanswered += ex->count;
+    }
+}
+
+void HttpDissector::Direction::append(const char* text, size_t n) {
+    size_t room = MAX_LINE - line_length;
+    if (n <= room) {
+        memcpy(line + line_length, text, n);
+        line_length = static_cast<uint16_t>(line_length + n);
+        return;
+    }
+
+    // Fill up, then slide the last LINE_TAIL bytes along
+    memcpy(line + line_length, text, room);
+    line_length = MAX_LINE;
+    text += room;
+    n -= room;
+    char* tail = line + MAX_LINE - LINE_TAIL;
+    if (n >= LINE_TAIL) {
+        memcpy(tail, text + n - LINE_TAIL, LINE_TAIL);
+    } else {
+        memmove(tail, tail + n, LINE_TAIL - n);
+        memcpy(tail + LINE_TAIL - n, text, n);
+    }
+}
+
+void HttpDissector::consume(TcpConnection& conn, Exchange& ex, int dir, const char* p, const char* end,
+                            uint64_t ts_ns) {
+    Direction& d = ex.dir[dir];
+    while (p < end && !conn.done) {
+        switch (d.phase) {
+            case Phase::BODY:
+            case Phase::CHUNK_DATA: {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(d.remaining, static_cast<uint64_t>(end - p)));
+                p += n;
+                d.remaining -= n;
+                if (d.remaining == 0) {
+                    d.phase = d.phase == Phase::BODY ? Phase::START_LINE : Phase::CHUNK_END;
+                }
+                break;
+            }
+            case Phase::UNTIL_CLOSE:
+                return;
+            default: {
+                if (d.phase == Phase::START_LINE && d.line_length == 0) {
+                    d.message_ts_ns = ts_ns;
+                }
+                const char* lf = findByte(p, end, '\n');
+                if (!lf) {
+                    d.append(p, static_cast<size_t>(end - p));   // The line goes on in the next segment
+                    return;
+                }
+                const char* line = p;
+                size_t length = static_cast<size_t>(lf - p);
+                if (d.line_length > 0) {
+                    d.append(p, length);
+                    line = d.line;
+                    length = d.line_length;
+                }
+                p = lf + 1;
+                d.line_length = 0;
+                if (length > 0 && line[length - 1] == '\r') --length;
+                onLine(conn, ex, dir, line, length);
+                break;
+            }
+        }
+    }
+}
+
+void HttpDissector::onLine(TcpConnection& conn, Exchange& ex, int dir, const char* line, size_t length) {
+    Direction& d = ex.dir[dir];
+    uint64_t size;
+    switch (d.phase) {
+        case Phase::START_LINE:
+            if (length == 0) return;    // Stray CRLF between messages (RFC 9112 section 2.2)
+            if (dir == 0) {
+                requestLine(conn, ex, line, length);
+            } else {
+                responseLine(conn, ex, line, length);
+            }
+            return;
+        case Phase::HEADERS:
+            if (length > 0) {
+                if (!headerField(ex, dir, line, length)) giveUp(conn, ex);
+            } else if (dir == 0) {
+                endRequestHeaders(conn, ex);
+            } else {
+                endResponseHeaders(conn, ex);
+            }
+            return;
+        case Phase::CHUNK_SIZE:
+            if (!parseChunkSize(line, line + length, size)) {
+                giveUp(conn, ex);
+            } else if (size == 0) {
+                d.phase = Phase::TRAILERS;
+            } else {
+                d.remaining = size;
+                d.phase = Phase::CHUNK_DATA;
+            }
+            return;
+        case Phase::CHUNK_END:
+            if (length != 0) {
+                giveUp(conn, ex);
+            } else {
+                d.phase = Phase::CHUNK_SIZE;
+            }
+            return;
+        case Phase::TRAILERS:
+            if (length == 0) d.phase = Phase::START_LINE;
+            return;
+        default:
+            return;
+    }
+}
+
+void HttpDissector::requestLine(TcpConnection& conn, Exchange& ex, const char* line, size_t length) {
+    const char* end = line + length;
+    const char* method_end = line;
+    while (method_end < end && isMethodChar(*method_end)) ++method_end;
+    size_t method_length = static_cast<size_t>(method_end - line);
+
+    // METHOD SP request-target SP HTTP-version
+    const char* version = end;
+    while (version > method_end && version[-1] != ' ') --version;
+    if (method_length == 0 || method_length > HttpTransaction::MAX_METHOD || method_end == end ||
+        *method_end != ' ' || version - 1 <= method_end || !isVersion(version, static_cast<size_t>(end - version))) {
+        giveUp(conn, ex);
+        return;
+    }
+    const char* target = method_end + 1;
+    const char* target_end = version - 1;
+
+    Request& r = ex.parsing;
+    r.ts_ns = ex.dir[0].message_ts_ns;
+    copyText(r.method, HttpTransaction::MAX_METHOD, line, method_length, false);
+    r.head = method_length == 4 && memcmp(line, "HEAD", 4) == 0;
+    r.connect = method_length == 7 && memcmp(line, "CONNECT", 7) == 0;
+    r.host[0] = '\0';
+    r.path[0] = '\0';
+
+    if (*target == '/') {
+        pathPrefix(r.path, target, target_end, PATH_SEGMENTS);
+    } else if (r.connect) {
+        // authority-form: the target is the host
+        copyText(r.host, HttpTransaction::MAX_HOST, target, static_cast<size_t>(target_end - target), true);
+    } else {
+        // absolute-form (to proxies): the authority takes the place of Host
+        const char* scheme_end = static_cast<const char*>(
+            memchr(target, ':', static_cast<size_t>(target_end - target)));
+        if (scheme_end && target_end - scheme_end >= 3 && scheme_end[1] == '/' && scheme_end[2] == '/') {
+            const char* authority = scheme_end + 3;
+            const char* path = authority;
+            while (path < target_end && *path != '/' && *path != '?' && *path != '#') ++path;
+            copyText(r.host, HttpTransaction::MAX_HOST, authority, static_cast<size_t>(path - authority), true);
+            if (path < target_end && *path == '/') {
+                pathPrefix(r.path, path, target_end, PATH_SEGMENTS);
+            } else {
+                copyText(r.path, HttpTransaction::MAX_PATH, "/", 1, false);
+            }
+        } else {
+            pathPrefix(r.path, target, target_end, PATH_SEGMENTS);    // "*" of OPTIONS
+        }
+    }
+
+    Direction& d = ex.dir[0];
+    d.chunked = false;
+    d.has_length = false;
+    d.phase = Phase::HEADERS;
+    ex.seen_request = true;
+}
+
+void HttpDissector::responseLine(TcpConnection& conn, Exchange& ex, const char* line, size_t length) {
+    // HTTP-version SP 3DIGIT SP [reason-phrase]
+    if (length < 12 || !isVersion(line, 8) || line[8] != ' ' || !isDigit(line[9]) || !isDigit(line[10]) ||
+        !isDigit(line[11]) || (length > 12 && line[12] != ' ') || line[9] < '1' || line[9] > '5') {
+        giveUp(conn, ex);
+        return;
+    }
+    uint16_t status = static_cast<uint16_t>((line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0'));
+
+    Direction& d = ex.dir[1];
+    d.chunked = false;
+    d.has_length = false;
+    d.phase = Phase::HEADERS;
+    ex.status = status;
+    if (status < 200 && status != 101) return;  // Interim: the final response is still to come
+
+    if (ex.count == 0) {
+        giveUp(conn, ex);     // A response to nothing we saw
+        return;
+    }
+    const Request& r = ex.pending[ex.head];
+    ex.head = static_cast<uint8_t>((ex.head + 1) % MAX_PIPELINE);
+    --ex.count;
+    ex.answers_head = r.head;
+    ex.answers_connect = r.connect;
+    ++stats_.transactions;
+
+    if (!callback_) return;
+    HttpTransaction t;
+    t.client_ip = conn.client_ip;
+    t.server_ip = conn.server_ip;
+    t.client_port = conn.client_port;
+    t.server_port = conn.server_port;
+    t.request_ts_ns = r.ts_ns;
+    t.latency_ns = d.message_ts_ns > r.ts_ns ? d.message_ts_ns - r.ts_ns : 0;
+    t.status = status;
+    memcpy(t.method, r.method, sizeof t.method);
+    memcpy(t.host, r.host, sizeof t.host);
+    memcpy(t.path, r.path, sizeof t.path);
+    callback_(t);
+}
+
+bool HttpDissector::headerField(Exchange& ex, int dir, const char* line, size_t length) {
+    const char* colon = static_cast<const char*>(memchr(line, ':', length));
+    if (!colon) return true;    // Obsolete line folding or junk: nothing we need
+    const char* name_end = colon;
+    const char* value = colon + 1;
+    const char* value_end = line + length;
+    trim(value, value_end);
+    size_t name_length = static_cast<size_t>(name_end - line);
+
+    Direction& d = ex.dir[dir];
+    if (equalsLower(line, name_length, "content-length")) {
+        if (!parseLength(value, value_end, d.remaining)) return false;
+        d.has_length = true;
+    } else if (equalsLower(line, name_length, "transfer-encoding")) {
+        // Chunked is always the last coding when present (RFC 9112 section 6.1)
+        size_t n = static_cast<size_t>(value_end - value);
+        d.chunked = n >= 7 && equalsLower(value_end - 7, 7, "chunked");
+    } else if (dir == 0 && ex.parsing.host[0] == '\0' && equalsLower(line, name_length, "host")) {
+        copyText(ex.parsing.host, HttpTransaction::MAX_HOST, value, static_cast<size_t>(value_end - value), true);
+    }
+    return true;
+}
+
+void HttpDissector::endRequestHeaders(TcpConnection& conn, Exchange& ex) {
+    if (ex.count == MAX_PIPELINE) {
+        giveUp(conn, ex);
+        return;
+    }
+    ex.pending[(ex.head + ex.count) % MAX_PIPELINE] = ex.parsing;
+    ++ex.count;
+    ++stats_.requests;
+
+    // A request without Content-Length or chunking has no body
+    Direction& d = ex.dir[0];
+    if (d.chunked) {
+        d.phase = Phase::CHUNK_SIZE;
+    } else if (d.has_length && d.remaining > 0) {
+        d.phase = Phase::BODY;
+    } else {
+        d.phase = Phase::START_LINE;
+    }
+}
+
+void HttpDissector::endResponseHeaders(TcpConnection& conn, Exchange& ex) {
+    Direction& d = ex.dir[1];
+    uint16_t status = ex.status;
+    if (status == 101 || (ex.answers_connect && status >= 200 && status < 300)) {
+        conn.done = true;     // Another protocol, or a tunnel, from here on
+        return;
+    }
+    if (status < 200) {
+        d.phase = Phase::START_LINE;
+    } else if (ex.answers_head || status == 204 || status == 304) {
+        d.phase = Phase::START_LINE;    // No body whatever the headers say
+    } else if (d.chunked) {
+        d.phase = Phase::CHUNK_SIZE;
+    } else if (d.has_length) {
+        d.phase = d.remaining > 0 ? Phase::BODY : Phase::START_LINE;
+    } else {
+        d.phase = Phase::UNTIL_CLOSE;
+    }
+}
+
+void HttpDissector::giveUp(TcpConnection& conn, const Exchange& ex) {
+    if (ex.seen_request) {
+        ++stats_.desync;
+    } else {
+        ++stats_.rejected;
+    }
+    conn.done = true;
+}
+
+// ============================================================================
+// Summary table
+// ============================================================================
+
+HttpSummaryTable::HttpSummaryTable(size_t max_groups) : max_groups_(std::min(max_groups, MAX_GROUPS)) {
+    size_t capacity = 16;
+    while (capacity / 2 < max_groups_) {
+        capacity <<= 1;
+    }
+    slots_.resize(capacity);
+}
+
+void HttpSummaryTable::add(const HttpTransaction& transaction) {
+    // FNV-1a over host and status
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = transaction.host; *c != '\0'; ++c) {
+        hash = (hash ^ static_cast<uint8_t>(*c)) * 1099511628211ull;
+    }
+    hash = (hash ^ transaction.status) * 1099511628211ull;
+
+    uint64_t latency_us = transaction.latency_ns / 1000;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Group& group = slots_[i];
+        if (group.status == 0) {
+            if (used_ >= max_groups_) {
+                ++dropped_;
+                return;
+            }
+            ++used_;
+            group.status = transaction.status;
+            memcpy(group.host, transaction.host, sizeof group.host);
+            group.first_ts_ns = transaction.request_ts_ns;
+            group.last_ts_ns = transaction.request_ts_ns;
+            group.requests = 0;
+            group.latency_us_sum = 0;
+            group.latency_us_max = 0;
+            memset(group.buckets, 0, sizeof group.buckets);
+        } else if (group.status != transaction.status || strcmp(group.host, transaction.host) != 0) {
+            continue;
+        }
+        ++group.requests;
+        group.latency_us_sum += latency_us;
+        group.latency_us_max = std::max(group.latency_us_max, latency_us);
+        ++group.buckets[bucket(latency_us)];
+        group.first_ts_ns = std::min(group.first_ts_ns, transaction.request_ts_ns);
+        group.last_ts_ns = std::max(group.last_ts_ns, transaction.request_ts_ns);
+        return;
+    }
+}
+
+void HttpSummaryTable::clear() {
+    for (Group& group : slots_) {
+        group.status = 0;
+    }
+    used_ = 0;
+}
+
+size_t HttpSummaryTable::bucket(uint64_t latency_us) {
+    uint64_t ms = latency_us / 1000;
+    if (ms == 0) return 0;
+    return std::min<size_t>(64 - static_cast<size_t>(__builtin_clzll(ms)), BUCKETS - 1);
+}
@@ -0,0 +1,252 @@
+/**
+ * @file HttpDissector.h
+ * @brief HTTP/1.x request/response matching and per-host latency histograms
+ *
+ * HttpDissector claims connections to the configured server ports from the
+ * TcpReassembler and follows both directions of the stream: request line
+ * and headers from the client, status line and headers from the server,
+ * bodies skipped by Content-Length or chunked framing. Each response is
+ * paired with the oldest unanswered request (HTTP/1.1 pipelining keeps
+ * them in order) and an HttpTransaction goes to the callback: method,
+ * host, path prefix, status and the time from the first byte of the
+ * request to the first byte of the status line.
+ *
+ * ## Fast path
+ *
+ * A connection whose first client byte cannot start a method, or whose
+ * first line is not "METHOD target HTTP/1.x", is let go at once
+ * (TcpConnection::done). Lines are found with a 16-byte-wide search for
+ * the line feed (SSE2 or NEON, a plain loop elsewhere) and parsed in place
+ * when they lie within one segment; only a line split across segments is
+ * collected, up to MAX_LINE bytes (of a longer line only the start and
+ * the last LINE_TAIL bytes are kept: cookies and the like are of no
+ * interest). Bodies are stepped over without being looked at, and a gap
+ * inside a body of known length costs nothing.
+ *
+ * ## What is kept
+ *
+ * Host is lower-cased and the path cut to its first PATH_SEGMENTS
+ * segments without the query ("/api/v1/users/42?x=1" becomes "/api/v1"),
+ * so values group well. A connection keeps at most MAX_PIPELINE requests
+ * waiting for their responses; beyond that, or on anything it cannot
+ * frame (a gap in the stream, a bad chunk size), it is given up and
+ * counted. 1xx responses other than 101 are skipped; 101 and a successful
+ * CONNECT end the dissection, since what follows is no longer HTTP.
+ *
+ * HttpSummaryTable folds transactions into one latency histogram per
+ * (host, status), which is what the sniffer sends in remote mode.
+ *
+ * Not thread-safe: used only by the capture loop.
+ */
+
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "TcpReassembler.h"
+
+/**
+ * @struct HttpOptions
+ * @brief Which connections are inspected and how transactions are summarized
+ */
+struct HttpOptions {
+    std::vector<uint16_t> ports = {80, 8080};   ///< Server ports; empty turns the dissector off
+    size_t max_groups = 256;                    ///< (host, status) histograms per summary interval
+    uint32_t interval_sec = 10;                 ///< Seconds between summaries (remote mode)
+};
+
+/**
+ * @struct HttpTransaction
+ * @brief One request and its response
+ */
+struct HttpTransaction {
+    static constexpr size_t MAX_METHOD = 15;
+    static constexpr size_t MAX_HOST = 127;
+    static constexpr size_t MAX_PATH = 63;
+
+    uint32_t client_ip = 0;         ///< Network byte order
+    uint32_t server_ip = 0;
+    uint16_t client_port = 0;       ///< Host byte order
+    uint16_t server_port = 0;
+    uint64_t request_ts_ns = 0;     ///< Capture time of the request's first byte
+    uint64_t latency_ns = 0;        ///< From the request to the response's status line
+    uint16_t status = 0;
+    char method[MAX_METHOD + 1];
+    char host[MAX_HOST + 1];        ///< Lower case; empty if the request named none
+    char path[MAX_PATH + 1];        ///< Path prefix, see the file comment
+};
+
+/**
+ * @class HttpDissector
+ * @brief HTTP/1.x parser on top of TcpReassembler, see the file comment
+ */
+class HttpDissector : public TcpStreamHandler {
+public:
+    using Callback = std::function<void(const HttpTransaction&)>;
+
+    /// Bytes of a line that are looked at
+    static constexpr size_t MAX_LINE = 256;
+
+    /// Requests awaiting a response per connection
+    static constexpr size_t MAX_PIPELINE = 4;
+
+    /// Path segments kept
+    static constexpr size_t PATH_SEGMENTS = 2;
+
+    struct Stats {
+        uint64_t requests = 0;          ///< Request headers parsed
+        uint64_t transactions = 0;      ///< Responses matched to a request
+        uint64_t unanswered = 0;        ///< Requests still waiting when their connection ended
+        uint64_t rejected = 0;          ///< Connections whose client does not speak HTTP/1.x
+        uint64_t desync = 0;            ///< Connections given up: bad framing, gap or too deep a pipeline
+    };
+
+    explicit HttpDissector(const HttpOptions& options);
+
+    HttpDissector(const HttpDissector&) = delete;
+    HttpDissector& operator=(const HttpDissector&) = delete;
+
+    void setCallback(Callback callback) { callback_ = std::move(callback); }
+
+    bool accept(const TcpConnection& conn) override;
+    void onData(TcpConnection& conn, int dir, const uint8_t* data, size_t length, uint64_t ts_ns) override;
+    void onGap(TcpConnection& conn, int dir, uint32_t length) override;
+    void onClose(TcpConnection& conn) override;
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    /// Where one direction of the stream is
+    enum class Phase : uint8_t {
+        START_LINE,     ///< Request line or status line
+        HEADERS,
+        BODY,           ///< remaining bytes of Content-Length
+        CHUNK_SIZE,
+        CHUNK_DATA,     ///< remaining bytes of the chunk
+        CHUNK_END,      ///< CRLF after the chunk data
+        TRAILERS,
+        UNTIL_CLOSE     ///< Response body delimited by the end of the connection
+    };
+
+    struct Direction {
+        Phase phase = Phase::START_LINE;
+        bool chunked = false;           ///< Of the message whose headers are being read
+        bool has_length = false;
+        uint16_t line_length = 0;       ///< Bytes collected in line (split lines only)
+        uint64_t remaining = 0;
+        uint64_t message_ts_ns = 0;     ///< First byte of the current start line
+        char line[MAX_LINE];
+
+        /// Add part of a split line; once full, the first bytes and the last LINE_TAIL are kept
+        void append(const char* text, size_t n);
+    };
+
+    /// Bytes kept from the end of an overlong line (the version of a request line)
+    static constexpr size_t LINE_TAIL = 16;
+
+    struct Request {
+        uint64_t ts_ns;
+        bool head;                      ///< HEAD: the response has no body
+        bool connect;                   ///< CONNECT: a 2xx response turns the stream into a tunnel
+        char method[HttpTransaction::MAX_METHOD + 1];
+        char host[HttpTransaction::MAX_HOST + 1];
+        char path[HttpTransaction::MAX_PATH + 1];
+    };
+
+    /// Per-connection state, created on the first client bytes
+    struct Exchange : TcpConnection::State {
+        Direction dir[2];
+        Request parsing;                ///< Request whose headers are being read
+        Request pending[MAX_PIPELINE];  ///< Ring of requests sent, oldest at head
+        uint8_t head = 0;
+        uint8_t count = 0;
+        uint16_t status = 0;            ///< Of the response whose headers are being read
+        bool answers_head = false;      ///< ... and what its request was
+        bool answers_connect = false;
+        bool seen_request = false;      ///< A request line parsed: failures from now on are desync
+    };
+
+    /// Feed one direction's bytes through its Direction
+    void consume(TcpConnection& conn, Exchange& ex, int dir, const char* p, const char* end, uint64_t ts_ns);
+
+    /// One complete line of direction dir, without its line end
+    void onLine(TcpConnection& conn, Exchange& ex, int dir, const char* line, size_t length);
+
+    void requestLine(TcpConnection& conn, Exchange& ex, const char* line, size_t length);
+    void responseLine(TcpConnection& conn, Exchange& ex, const char* line, size_t length);
+
+    /// Content-Length, Transfer-Encoding and Host; false if Content-Length is not a number
+    bool headerField(Exchange& ex, int dir, const char* line, size_t length);
+
+    /// End of a message's headers: pick how its body is framed
+    void endRequestHeaders(TcpConnection& conn, Exchange& ex);
+    void endResponseHeaders(TcpConnection& conn, Exchange& ex);
+
+    /// Stop following a connection that cannot be framed
+    void giveUp(TcpConnection& conn, const Exchange& ex);
+
+    std::bitset<65536> ports_;
+    Callback callback_;
+    Stats stats_;
+};
+
+/**
+ * @class HttpSummaryTable
+ * @brief Latency histograms per (host, status) over one summary interval
+ *
+ * A fixed open-addressed table: adding a transaction allocates nothing,
+ * and a (host, status) beyond max_groups is refused and counted. Bucket 0
+ * holds latencies under 1 ms, bucket i (1..BUCKETS-2) [2^(i-1), 2^i) ms,
+ * and the last one everything from 2^(BUCKETS-2) ms on.
+ */
+class HttpSummaryTable {
+public:
+    static constexpr size_t BUCKETS = 16;
+
+    /// Most groups a table holds; a larger max_groups is cut to this
+    static constexpr size_t MAX_GROUPS = 65536;
+
+    struct Group {
+        uint16_t status = 0;            ///< 0: free slot
+        char host[HttpTransaction::MAX_HOST + 1];
+        uint64_t first_ts_ns;           ///< Earliest request in the interval
+        uint64_t last_ts_ns;            ///< Latest request
+        uint64_t requests;
+        uint64_t latency_us_sum;
+        uint64_t latency_us_max;
+        uint64_t buckets[BUCKETS];
+    };
+
+    explicit HttpSummaryTable(size_t max_groups);
+
+    void add(const HttpTransaction& transaction);
+
+    /// Each group in use, in no particular order
+    template <typename F>
+    void forEach(F&& f) const {
+        for (const Group& group : slots_) {
+            if (group.status != 0) f(group);
+        }
+    }
+
+    /// Empty the table for the next interval
+    void clear();
+
+    bool empty() const { return used_ == 0; }
+    size_t groups() const { return used_; }
+
+    /// Transactions refused because the table was full (cumulative)
+    uint64_t dropped() const { return dropped_; }
+
+    /// Histogram bucket of a latency
+    static size_t bucket(uint64_t latency_us);
+
+private:
+    std::vector<Group> slots_;          ///< Power of two, at least twice max_groups
+    size_t max_groups_;
+    size_t used_ = 0;
+    uint64_t dropped_ = 0;
+};
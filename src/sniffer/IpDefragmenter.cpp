@@ -0,0 +1,178 @@
+/**
+ * @file IpDefragmenter.cpp
+ * @brief Implementation of IPv4 fragment reassembly
+ */
+
+#include "IpDefragmenter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+IpDefragmenter::IpDefragmenter(const FragmentOptions& options)
+    : options_(options), pool_(options.memory_bytes), scratch_(new uint8_t[MAX_DATAGRAM]) {
+}
+
+IpDefragmenter::~IpDefragmenter() {
+    while (!datagrams_.empty()) {
+        discard(datagrams_.begin());
+    }
+}
+
+const uint8_t* IpDefragmenter::add(const uint8_t* ip, size_t caplen, uint64_t ts_ns, size_t& length) {
+    ++stats_.fragments;
+    if (ts_ns >= last_sweep_ns_ + SWEEP_INTERVAL_NS) {
+        sweep(ts_ns);
+    }
+
+    const auto* iph = reinterpret_cast<const struct ip*>(ip);
+    size_t header_length = iph->ip_hl * 4u;
+    size_t total_length = ntohs(iph->ip_len);
+    uint16_t frag = ntohs(iph->ip_off);
+    uint32_t offset = (frag & IP_OFFMASK) * 8u;
+    bool more = frag & IP_MF;
+
+    // The fragment itself: whole, not empty, a multiple of 8 unless last,
+    // and not reaching past the largest datagram
+    if (header_length < sizeof(struct ip) || total_length <= header_length || total_length > caplen ||
+        (more && (total_length - header_length) % 8 != 0) ||
+        header_length + offset + (total_length - header_length) > MAX_DATAGRAM) {
+        ++stats_.invalid;
+        return nullptr;
+    }
+    uint32_t data_length = static_cast<uint32_t>(total_length - header_length);
+    uint32_t end = offset + data_length;
+
+    Key key{iph->ip_src.s_addr, iph->ip_dst.s_addr, iph->ip_id, iph->ip_p};
+    auto it = datagrams_.find(key);
+    if (it == datagrams_.end()) {
+        if (datagrams_.size() >= options_.max_datagrams) {
+            ++stats_.dropped;
+            return nullptr;
+        }
+        it = datagrams_.emplace(key, Datagram()).first;
+        it->second.first_ts_ns = ts_ns;
+    }
+    Datagram& datagram = it->second;
+
+    // Consistent with what is known of the datagram so far
+    bool bad = ++datagram.fragments > MAX_FRAGMENTS;
+    if (!more) {
+        bad |= datagram.total != 0 && datagram.total != end;
+        datagram.total = end;
+    }
+    bad |= datagram.total != 0 && end > datagram.total;
+    if (bad) {
+        ++stats_.invalid;
+        discard(it);
+        return nullptr;
+    }
+
+    if (!insert(datagram, offset, ip + header_length, data_length)) {
+        discard(it);
+        return nullptr;
+    }
+    if (offset == 0) {
+        datagram.header_length = static_cast<uint8_t>(header_length);
+        memcpy(datagram.header, ip, header_length);
+    }
+
+    if (datagram.total == 0 || datagram.received != datagram.total || datagram.header_length == 0) {
+        return nullptr;
+    }
+    // Without overlaps, all bytes received means no gaps either
+    if (datagram.header_length + datagram.total > MAX_DATAGRAM) {
+        ++stats_.invalid;
+        discard(it);
+        return nullptr;
+    }
+    const uint8_t* whole = assemble(datagram, length);
+    ++stats_.reassembled;
+    discard(it);
+    return whole;
+}
+
+bool IpDefragmenter::insert(Datagram& datagram, uint32_t offset, const uint8_t* data, uint32_t length) {
+    uint32_t end = offset + length;
+
+    // Find the place in offset order; any overlap with a neighbour is fatal
+    TcpSegmentBuffer** link = &datagram.pieces;
+    while (*link && (*link)->seq + (*link)->length <= offset) {
+        link = &(*link)->next;
+    }
+    TcpSegmentBuffer* next = *link;
+    if (next && next->seq < end) {
+        ++stats_.overlaps;
+        return false;
+    }
+    if (datagram.total != 0) {
+        // A piece beyond the end that the last fragment has just declared
+        TcpSegmentBuffer* last = next;
+        while (last && last->next) last = last->next;
+        if (last && last->seq + last->length > datagram.total) {
+            ++stats_.invalid;
+            return false;
+        }
+    }
+
+    for (uint32_t at = offset; at < end;) {
+        uint32_t n = std::min<uint32_t>(end - at, TcpReassembler::SEGMENT_SIZE);
+        TcpSegmentBuffer* piece = pool_.acquire();
+        if (!piece) {
+            ++stats_.dropped;
+            return false;
+        }
+        piece->seq = at;
+        piece->begin = 0;
+        piece->length = static_cast<uint16_t>(n);
+        memcpy(piece->data, data + (at - offset), n);
+        piece->next = next;
+        *link = piece;
+        link = &piece->next;
+        at += n;
+    }
+    datagram.received += length;
+    return true;
+}
+
+const uint8_t* IpDefragmenter::assemble(Datagram& datagram, size_t& length) {
+    uint8_t* out = scratch_.get();
+    memcpy(out, datagram.header, datagram.header_length);
+    for (const TcpSegmentBuffer* piece = datagram.pieces; piece; piece = piece->next) {
+        memcpy(out + datagram.header_length + piece->seq, piece->data + piece->begin, piece->length);
+    }
+
+    // Now an unfragmented datagram. The checksum is not recomputed:
+    // nothing downstream verifies it.
+    length = datagram.header_length + datagram.total;
+    auto* iph = reinterpret_cast<struct ip*>(out);
+    iph->ip_len = htons(static_cast<uint16_t>(length));
+    iph->ip_off = 0;
+    return out;
+}
+
+void IpDefragmenter::discard(Table::iterator it) {
+    TcpSegmentBuffer* piece = it->second.pieces;
+    while (piece) {
+        TcpSegmentBuffer* next = piece->next;
+        pool_.release(piece);
+        piece = next;
+    }
+    datagrams_.erase(it);
+}
+
+void IpDefragmenter::sweep(uint64_t now_ns) {
+    last_sweep_ns_ = now_ns;
+    uint64_t timeout_ns = static_cast<uint64_t>(options_.timeout_sec) * 1000000000ull;
+    for (auto it = datagrams_.begin(); it != datagrams_.end();) {
+        auto next = std::next(it);
+        if (it->second.first_ts_ns + timeout_ns < now_ns) {
+            ++stats_.timeouts;
+            discard(it);
+        }
+        it = next;
+    }
+}
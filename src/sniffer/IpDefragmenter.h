@@ -0,0 +1,137 @@
+/**
+ * @file IpDefragmenter.h
+ * @brief Reassembly of fragmented IPv4 datagrams
+ *
+ * Only the first fragment of a datagram carries the transport header, and
+ * only the last one tells how long the datagram is. Parsed one by one, the
+ * first looks like a whole packet and the others like transport headers
+ * that are really payload. PacketParser therefore hands every fragment to
+ * an IpDefragmenter and parses the datagram once it is complete, as if it
+ * had arrived in one piece.
+ *
+ * ## Table
+ *
+ * Datagrams are keyed by (source, destination, identification, protocol).
+ * Fragment data is copied into buffers of the same SegmentPool type the
+ * TCP reassembler uses, kept sorted by offset. A datagram is complete when
+ * its last fragment has arrived and the fragments cover it without gaps.
+ *
+ * ## Hostile input
+ *
+ * Reassembly is a classic target, so anything inconsistent discards the
+ * whole datagram instead of guessing:
+ * - overlapping fragments (teardrop), which also hides overlap tricks
+ *   against a dissector (as RFC 5722 requires for IPv6)
+ * - a datagram over 65535 bytes (ping of death), a non-final fragment whose
+ *   length is not a multiple of 8, two different ends
+ * - more than MAX_FRAGMENTS fragments
+ *
+ * Memory is bounded by the pool (memory_bytes) and the table size
+ * (max_datagrams); incomplete datagrams are dropped after timeout_sec.
+ *
+ * Not thread-safe: used only by the capture loop.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "TcpReassembler.h"
+
+/**
+ * @struct FragmentOptions
+ * @brief Limits of the fragment table
+ */
+struct FragmentOptions {
+    uint64_t memory_bytes = 16ull << 20;    ///< Fragment data of all incomplete datagrams
+    size_t max_datagrams = 4096;            ///< Incomplete datagrams tracked at once
+    uint32_t timeout_sec = 30;              ///< Incomplete datagrams are dropped after this long
+};
+
+/**
+ * @class IpDefragmenter
+ * @brief Table of incomplete IPv4 datagrams, see the file comment
+ */
+class IpDefragmenter {
+public:
+    /// Fragments accepted per datagram (a 9000-byte datagram cut for a 576-byte MTU needs 17)
+    static constexpr uint16_t MAX_FRAGMENTS = 64;
+
+    /// Largest IPv4 datagram, header included
+    static constexpr size_t MAX_DATAGRAM = 65535;
+
+    /// Packet-time interval between timeout sweeps
+    static constexpr uint64_t SWEEP_INTERVAL_NS = 1000000000ull;
+
+    struct Stats {
+        uint64_t fragments = 0;         ///< Fragments seen
+        uint64_t reassembled = 0;       ///< Datagrams completed
+        uint64_t timeouts = 0;          ///< Datagrams dropped incomplete
+        uint64_t overlaps = 0;          ///< Datagrams dropped for overlapping fragments
+        uint64_t invalid = 0;           ///< Fragments or datagrams dropped as malformed
+        uint64_t dropped = 0;           ///< Fragments dropped: table full or pool exhausted
+    };
+
+    explicit IpDefragmenter(const FragmentOptions& options);
+    ~IpDefragmenter();
+
+    IpDefragmenter(const IpDefragmenter&) = delete;
+    IpDefragmenter& operator=(const IpDefragmenter&) = delete;
+
+    /**
+     * @brief Add one fragment
+     *
+     * @param ip IPv4 header of the fragment
+     * @param caplen Bytes captured from ip on
+     * @param ts_ns Capture time
+     * @param[out] length Size of the returned datagram
+     * @return The whole datagram (header with offset and flags cleared and
+     *         the full total length) if this fragment completed it, else
+     *         nullptr. Valid until the next call.
+     */
+    const uint8_t* add(const uint8_t* ip, size_t caplen, uint64_t ts_ns, size_t& length);
+
+    const Stats& stats() const { return stats_; }
+    size_t pending() const { return datagrams_.size(); }
+
+private:
+    struct Key {
+        uint32_t src, dst;
+        uint16_t id;
+        uint8_t protocol;
+        bool operator==(const Key& o) const {
+            return src == o.src && dst == o.dst && id == o.id && protocol == o.protocol;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = (static_cast<uint64_t>(k.src) << 32 | k.dst) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(h ^ (static_cast<uint64_t>(k.id) << 8 | k.protocol));
+        }
+    };
+
+    /// An incomplete datagram
+    struct Datagram {
+        uint64_t first_ts_ns = 0;
+        TcpSegmentBuffer* pieces = nullptr;  ///< Fragment data, seq = offset, sorted, no overlaps
+        uint32_t received = 0;               ///< Payload bytes in pieces
+        uint32_t total = 0;                  ///< Payload length, once the last fragment is in
+        uint16_t fragments = 0;
+        uint8_t header_length = 0;           ///< 0 until the first fragment is in
+        uint8_t header[60];
+    };
+    using Table = std::unordered_map<Key, Datagram, KeyHash>;
+
+    bool insert(Datagram& datagram, uint32_t offset, const uint8_t* data, uint32_t length);
+    const uint8_t* assemble(Datagram& datagram, size_t& length);
+    void discard(Table::iterator it);
+    void sweep(uint64_t now_ns);
+
+    FragmentOptions options_;
+    SegmentPool pool_;
+    Table datagrams_;
+    std::unique_ptr<uint8_t[]> scratch_;     ///< MAX_DATAGRAM bytes: the last datagram returned
+    uint64_t last_sweep_ns_ = 0;
+    Stats stats_;
+};
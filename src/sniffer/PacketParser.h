@@ -18,6 +18,9 @@
  * - TCP (RFC 793) segments with connection information
  * - UDP (RFC 768) datagrams
  * - ICMP (RFC 792) messages for network diagnostics
+ * - Tunnels: IP-in-IP (RFC 2003), GRE (RFC 2784/2890) with ERSPAN types
+ *   I-III, VXLAN (RFC 7348) and GENEVE (RFC 8926), peeled to the packet
+ *   they carry
  * 
  * Output Format:
  * YYYY-MM-DD HH:MM:SS.UUUUUU src_ip:port -> dst_ip:port PROTOCOL len=bytes
@@ -27,11 +30,20 @@
 
 #include <sys/time.h>  // For struct timeval timestamp handling
 #include <cstddef>     // For size_t type definitions
+#include <cstdint>     // For uint64_t nanosecond timestamps
 #include <nlohmann/json.hpp>
 #include <functional>
 
 using json = nlohmann::json;
 
+class TcpReassembler;
+class IpDefragmenter;
+class DnsDissector;
+class TlsDissector;
+struct TlsHello;
+struct PacketColumns;
+struct WireRecord;
+
 /**
  * @class PacketParser
  * @brief Static utility class for network packet parsing and analysis
@@ -59,13 +71,31 @@ public:
     using LogCallback = std::function<void(const json&)>;
 
 private:
-    // ANSI color codes for traffic type visualization
+    // ANSI color codes for traffic type visualization (terminal only, see ConsoleSink::color())
     static constexpr const char* COLOR_TCP = "\033[34m";    // Blue for TCP
     static constexpr const char* COLOR_UDP = "\033[32m";    // Green for UDP
     static constexpr const char* COLOR_ICMP = "\033[33m";   // Yellow for ICMP
     static constexpr const char* COLOR_RESET = "\033[0m";   // Reset to default
 
     static LogCallback log_callback_;
+    static TcpReassembler* tcp_reassembler_;
+    static IpDefragmenter* ip_defragmenter_;
+    static DnsDissector* dns_dissector_;
+    static TlsDissector* tls_dissector_;
+    static unsigned tunnel_depth_;
+
+    /**
+     * @struct Tunnel
+     * @brief The tunnel layer closest to the packet being parsed
+     */
+    struct Tunnel {
+        const char* type = nullptr;     ///< "ipip", "gre", "erspan", "vxlan", "geneve"; nullptr: none
+        bool has_vni = false;           ///< GRE carries a key only if its K bit is set
+        uint32_t vni = 0;               ///< VNI, GRE key or ERSPAN session ID
+        uint32_t src_ip = 0;            ///< Tunnel endpoints, network byte order
+        uint32_t dst_ip = 0;
+        unsigned depth = 0;             ///< Layers peeled so far
+    };
 
 public:
 
@@ -84,6 +114,8 @@ public:
      * @note Performs bounds checking before accessing packet data
      * @note Silently ignores packets that are too small or malformed
      * @note Non-IPv4 packets (ARP, IPv6, etc.) are currently ignored
+     * @note Lines go to the calling thread's ConsoleSink, which buffers
+     *       them unless stdout is a terminal
      *
      * @see parseEthernet(), struct bpf_hdr for timestamp source
      */
@@ -91,8 +123,64 @@ public:
 
     static void parseToJSON(const unsigned char* packet, size_t caplen, const struct timeval& timestamp, const LogCallback& callback);
 
+    /**
+     * @brief parseToJSON()'s record for frame i of a BatchParser block, without JSON
+     *
+     * For frames the batch found simple (Ethernet, IPv4 without options
+     * or fragmentation, TCP or UDP): the record is filled from the
+     * columns, and the TCP reassembler and DNS dissector are fed as
+     * parseToJSON() would. Only the log callback is left out.
+     *
+     * @return false, having done nothing, if the frame is not simple or its
+     *         record may need more than a WireRecord holds (a tunnel or a
+     *         ClientHello); parseToJSON() must take it then
+     */
+    static bool parseToRecord(const unsigned char* packet, size_t caplen, const struct timeval& timestamp,
+                              const PacketColumns& columns, size_t i, WireRecord& record);
+
     static void setLogCallback(const LogCallback& callback);
 
+    /**
+     * @brief Also hand every TCP segment to reassembler (nullptr: stop)
+     *
+     * Both parse paths feed it, before their own output. Not owned.
+     */
+    static void setTcpReassembler(TcpReassembler* reassembler);
+
+    /**
+     * @brief Reassemble IPv4 fragments with defragmenter (nullptr: parse them one by one)
+     *
+     * Both parse paths then see each fragmented datagram once, whole, when
+     * its last fragment arrives, and nothing for the fragments. Not owned.
+     */
+    static void setIpDefragmenter(IpDefragmenter* defragmenter);
+
+    /**
+     * @brief Also hand every UDP datagram from or to port 53 to dissector (nullptr: stop)
+     *
+     * Both parse paths feed it, before their own output. Not owned.
+     */
+    static void setDnsDissector(DnsDissector* dissector);
+
+    /**
+     * @brief Report the ClientHellos dissector completes (nullptr: stop)
+     *
+     * dissector must also be a handler of the TCP reassembler. The packet
+     * whose segment completes a hello carries its server name, ALPN and
+     * version: a line after the packet's own, or fields of its record.
+     * Not owned.
+     */
+    static void setTlsDissector(TlsDissector* dissector);
+
+    /**
+     * @brief Peel up to depth tunnel layers off each packet (0: parse the outer packet)
+     *
+     * Both parse paths then report the innermost IPv4 packet, with the
+     * type, VNI and endpoints of the tunnel that carried it: a line per
+     * layer before the packet's own, or fields of its record.
+     */
+    static void setTunnelDepth(unsigned depth);
+
 private:
     /**
      * @brief Parses Ethernet (Layer 2) frame headers
@@ -136,12 +224,14 @@ private:
      * @param offset Byte offset to start of IPv4 header
      * @param caplen Total captured packet length
      * @param timestamp Packet capture timestamp
+     * @param tunnel What carried the packet, for packets taken out of a tunnel
      * 
      * @note Calculates header length from ip_hl field (words to bytes)
      * @note Validates header length and packet bounds
      * @see struct ip, IPPROTO_TCP, IPPROTO_UDP constants
      */
-    static void parseIPv4(const unsigned char* packet, size_t offset, size_t caplen, const struct timeval& timestamp);
+    static void parseIPv4(const unsigned char* packet, size_t offset, size_t caplen, const struct timeval& timestamp,
+                          const Tunnel& tunnel);
     
     /**
      * @brief Parses TCP (Layer 4) segment headers
@@ -230,6 +320,66 @@ private:
     static void parseICMP(const unsigned char* packet, size_t offset, size_t caplen,
                          const char* src_ip, const char* dst_ip, const struct timeval& timestamp);
     
+    /**
+     * @brief JSON record of the IPv4 packet at offset (the part of parseToJSON() after Ethernet)
+     *
+     * @param frame_length Reported as "length": the captured frame, or for a
+     *        reassembled datagram its size plus an Ethernet header
+     * @param tunnel What carried the packet, for packets taken out of a tunnel
+     */
+    static void ipv4ToJSON(const unsigned char* packet, size_t offset, size_t caplen, size_t frame_length,
+                           const struct timeval& timestamp, const LogCallback& callback,
+                           const Tunnel& tunnel);
+
+    /**
+     * @brief Find the IPv4 packet carried by the tunnel packet at ip_offset
+     *
+     * Looks at IP-in-IP, GRE (IPv4, transparent Ethernet bridging, ERSPAN
+     * types I-III) and UDP to the VXLAN and GENEVE ports; an inner
+     * Ethernet frame may have up to two VLAN tags. Nothing is copied.
+     *
+     * @param end End of the outer packet: its total length, or less if
+     *        the capture was cut short
+     * @param tunnel Filled in with the layer found
+     * @return Offset of the inner IPv4 header, 0 if the packet is not a
+     *         tunnel this parser knows or what it carries is not IPv4
+     *         (tunnel is then left in no particular state)
+     */
+    static size_t decapsulate(const unsigned char* packet, size_t ip_offset, size_t end, Tunnel& tunnel);
+
+    /// Console line for a tunnel layer: "time src -> dst VXLAN vni=42"
+    static void printTunnel(const Tunnel& tunnel, const struct timeval& timestamp);
+
+    /**
+     * @brief Hand the fragment at ip_offset to ip_defragmenter_
+     *
+     * @return The whole datagram (IPv4 header first, length bytes) if this
+     *         fragment completed it, else nullptr
+     */
+    static const unsigned char* defragment(const unsigned char* packet, size_t ip_offset, size_t caplen,
+                                           const struct timeval& timestamp, size_t& length);
+
+    /**
+     * @brief Pass the TCP segment of the IPv4 packet at ip_offset to tcp_reassembler_
+     *
+     * Skips fragments and segments truncated by the capture. The payload
+     * is passed by pointer into the capture buffer.
+     */
+    static void reassembleTCP(const unsigned char* packet, size_t ip_offset, size_t caplen,
+                              const struct timeval& timestamp);
+
+    /**
+     * @brief Pass the DNS message in the UDP datagram at ip_offset to dns_dissector_
+     *
+     * Only datagrams from or to DnsDissector::PORT. The message is passed by
+     * pointer into the capture buffer.
+     */
+    static void inspectDNS(const unsigned char* packet, size_t ip_offset, size_t caplen,
+                           const struct timeval& timestamp);
+
+    /// Console line for a ClientHello: "time client:port -> server:port TLS 1.3 sni=... alpn=..."
+    static void printTLS(const TlsHello& hello);
+
     /**
      * @brief Formats kernel timestamps into human-readable strings
      * 
@@ -242,11 +392,15 @@ private:
      * 
      * @param timestamp Kernel timestamp from BPF packet header
      * @param buffer Output buffer for formatted timestamp string
-     * @param bufsize Size of output buffer (should be at least 32 bytes)
+     * @param bufsize Size of output buffer (at least RecordCodec::TIMESTAMP_TEXT_SIZE)
      * 
-     * @note Uses localtime() for timezone conversion
+     * @note Thread-safe and allocation-free: the date/time prefix is cached
+     *       per second and thread (RecordCodec::formatTimestamp())
      * @note Microsecond precision preserved from kernel timestamp
      * @see strftime(3), struct timeval, struct bpf_hdr
      */
     static void formatTimestamp(const struct timeval& timestamp, char* buffer, size_t bufsize);
+
+    /// Kernel timestamp as nanoseconds since the epoch (the records' "ts_ns")
+    static uint64_t timestampNs(const struct timeval& timestamp);
 };
\ No newline at end of file
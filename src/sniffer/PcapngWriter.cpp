@@ -0,0 +1,364 @@
+/**
+ * @file PcapngWriter.cpp
+ * @brief Implementation of the rotating, non-blocking pcapng sink
+ */
+
+#include "PcapngWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// pcapng block types and option codes
+constexpr uint32_t BLOCK_SHB = 0x0A0D0D0A;
+constexpr uint32_t BLOCK_IDB = 0x00000001;
+constexpr uint32_t BLOCK_EPB = 0x00000006;
+constexpr uint32_t BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+constexpr uint16_t OPT_ENDOFOPT = 0;
+constexpr uint16_t OPT_SHB_USERAPPL = 4;
+constexpr uint16_t OPT_IF_NAME = 2;
+
+/// EPB fixed part: type, length, interface, ts high, ts low, caplen, origlen
+constexpr size_t EPB_HEADER = 7 * sizeof(uint32_t);
+
+constexpr uint32_t pad4(uint32_t n) { return (n + 3u) & ~3u; }
+
+uint64_t nowSeconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+/// Serialize one pcapng option (code, length, value padded to 4)
+void appendOption(std::vector<unsigned char>& out, uint16_t code, const std::string& value) {
+    uint16_t len = static_cast<uint16_t>(value.size());
+    const unsigned char* c = reinterpret_cast<const unsigned char*>(&code);
+    const unsigned char* l = reinterpret_cast<const unsigned char*>(&len);
+    out.insert(out.end(), c, c + 2);
+    out.insert(out.end(), l, l + 2);
+    out.insert(out.end(), value.begin(), value.end());
+    out.resize(out.size() + (pad4(len) - len), 0);
+}
+
+} // namespace
+
+// ============================================================================
+// CONSTRUCTION / SHUTDOWN
+// ============================================================================
+
+PcapngWriter::PcapngWriter(const PcapngOptions& options, const std::vector<Interface>& interfaces)
+    : options_(options), interfaces_(interfaces) {
+    if (options_.prefix.empty()) {
+        throw std::runtime_error("pcapng: no output prefix given");
+    }
+
+    // Ring size: power of two so positions wrap with a mask
+    size_t ring_size = 1 << 16;
+    while (ring_size < options_.ring_bytes) ring_size <<= 1;
+    ring_ = static_cast<unsigned char*>(std::malloc(ring_size));
+    ring_mask_ = ring_size - 1;
+
+    void* aligned = nullptr;
+    if (!ring_ || posix_memalign(&aligned, IO_ALIGN, WRITE_BUFFER_BYTES) != 0) {
+        std::free(ring_);
+        throw std::runtime_error("pcapng: cannot allocate buffers");
+    }
+    buffer_ = static_cast<unsigned char*>(aligned);
+
+    openFile();   // Fail fast on a bad path, before capture starts
+    if (fd_ < 0) {
+        std::free(ring_);
+        std::free(buffer_);
+        throw std::runtime_error("pcapng: cannot create " + file_path_ + ": " + strerror(errno));
+    }
+
+    std::cout << "[PCAPNG] Writing to " << file_path_ << (direct_ ? " (direct I/O)" : "")
+              << ", ring " << (ring_size >> 20) << " MB" << std::endl;
+
+    writer_ = std::thread(&PcapngWriter::writerLoop, this);
+}
+
+PcapngWriter::~PcapngWriter() {
+    close();
+    std::free(ring_);
+    std::free(buffer_);
+}
+
+void PcapngWriter::close() {
+    if (!writer_.joinable()) return;
+    stopping_.store(true, std::memory_order_release);
+    writer_.join();
+    std::cout << "[PCAPNG] Closed: " << written() << " packets written, "
+              << dropped() << " dropped" << std::endl;
+}
+
+// ============================================================================
+// PRODUCER (capture thread)
+// ============================================================================
+
+bool PcapngWriter::write(uint32_t interface_id, const unsigned char* data, uint32_t caplen,
+                         uint32_t origlen, const struct timeval& ts) {
+    if (options_.snaplen > 0 && caplen > options_.snaplen) {
+        caplen = options_.snaplen;
+    }
+
+    const uint32_t padded = pad4(caplen);
+    const uint32_t total = static_cast<uint32_t>(EPB_HEADER) + padded + sizeof(uint32_t);
+
+    // Only the consumer moves tail_, so free space can only grow under us
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    if ((ring_mask_ + 1) - (head - tail) < total) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // The block is encoded in its final on-disk form, so the writer thread
+    // only ever copies bytes
+    uint64_t usec = static_cast<uint64_t>(ts.tv_sec) * 1000000ull + static_cast<uint64_t>(ts.tv_usec);
+    uint32_t header[7] = {
+        BLOCK_EPB, total, interface_id,
+        static_cast<uint32_t>(usec >> 32), static_cast<uint32_t>(usec & 0xFFFFFFFFu),
+        caplen, origlen
+    };
+    static const unsigned char zeros[4] = {0, 0, 0, 0};
+
+    uint64_t pos = head;
+    ringCopyIn(pos, header, sizeof(header));
+    pos += sizeof(header);
+    ringCopyIn(pos, data, caplen);
+    pos += caplen;
+    ringCopyIn(pos, zeros, padded - caplen);
+    pos += padded - caplen;
+    ringCopyIn(pos, &total, sizeof(total));
+
+    head_.store(head + total, std::memory_order_release);
+    return true;
+}
+
+void PcapngWriter::ringCopyIn(uint64_t pos, const void* src, size_t len) {
+    size_t offset = static_cast<size_t>(pos & ring_mask_);
+    size_t first = std::min(len, ring_mask_ + 1 - offset);
+    memcpy(ring_ + offset, src, first);
+    memcpy(ring_, static_cast<const unsigned char*>(src) + first, len - first);
+}
+
+void PcapngWriter::ringCopyOut(uint64_t pos, void* dst, size_t len) const {
+    size_t offset = static_cast<size_t>(pos & ring_mask_);
+    size_t first = std::min(len, ring_mask_ + 1 - offset);
+    memcpy(dst, ring_ + offset, first);
+    memcpy(static_cast<unsigned char*>(dst) + first, ring_, len - first);
+}
+
+// ============================================================================
+// CONSUMER (writer thread)
+// ============================================================================
+
+void PcapngWriter::writerLoop() {
+    uint64_t last_sync = nowSeconds();
+
+    while (true) {
+        const uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (head == tail) {
+            if (stopping_.load(std::memory_order_acquire)) {
+                // The producer is done; one last look for anything it published
+                if (head_.load(std::memory_order_acquire) == tail) break;
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        while (tail < head) {
+            uint32_t block[2];
+            ringCopyOut(tail, block, sizeof(block));
+            const uint32_t total = block[1];
+
+            if (failed_) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                if (options_.rotate_bytes > 0 && file_bytes_ + total > options_.rotate_bytes) {
+                    closeFile();
+                    openFile();
+                }
+                appendFromRing(tail, total);
+                written_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            tail += total;
+            // Free the space per block so a long drain doesn't starve the producer
+            tail_.store(tail, std::memory_order_release);
+        }
+
+        uint64_t now = nowSeconds();
+        if (!failed_ && options_.rotate_seconds > 0 && now - file_opened_ >= options_.rotate_seconds) {
+            closeFile();
+            openFile();
+        }
+        if (now != last_sync) {
+            sync();
+            last_sync = now;
+        }
+    }
+
+    closeFile();
+}
+
+void PcapngWriter::openFile() {
+    file_opened_ = nowSeconds();
+    time_t opened = static_cast<time_t>(file_opened_);
+    struct tm tm_info;
+    localtime_r(&opened, &tm_info);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_info);
+    char index[16];
+    snprintf(index, sizeof(index), "%05u", file_index_++);
+    file_path_ = options_.prefix + "_" + index + "_" + stamp + ".pcapng";
+
+    direct_ = false;
+#ifdef O_DIRECT
+    fd_ = open(file_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    direct_ = fd_ >= 0;
+    if (fd_ < 0 && errno == EINVAL) {
+        // tmpfs and some network filesystems refuse O_DIRECT
+        fd_ = open(file_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+#else
+    fd_ = open(file_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd_ < 0) {
+        if (writer_.joinable()) {
+            std::cerr << "[PCAPNG] Cannot create " << file_path_ << ": " << strerror(errno)
+                      << "; dropping packets from now on" << std::endl;
+            failed_ = true;
+        }
+        return;
+    }
+#ifdef F_NOCACHE
+    direct_ = fcntl(fd_, F_NOCACHE, 1) == 0;
+#endif
+
+    buffer_used_ = 0;
+    file_offset_ = 0;
+    file_bytes_ = 0;
+
+    writeSectionHeader();
+    for (const auto& iface : interfaces_) {
+        writeInterfaceBlock(iface);
+    }
+}
+
+void PcapngWriter::closeFile() {
+    if (fd_ < 0) return;
+
+    sync();
+    // sync() wrote whole aligned pages; cut the zero padding off again
+    if (ftruncate(fd_, static_cast<off_t>(file_offset_ + buffer_used_)) != 0) {
+        std::cerr << "[PCAPNG] Cannot truncate " << file_path_ << ": " << strerror(errno) << std::endl;
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void PcapngWriter::append(const void* data, size_t len) {
+    const unsigned char* src = static_cast<const unsigned char*>(data);
+    file_bytes_ += len;
+    while (len > 0) {
+        size_t n = std::min(len, WRITE_BUFFER_BYTES - buffer_used_);
+        memcpy(buffer_ + buffer_used_, src, n);
+        buffer_used_ += n;
+        src += n;
+        len -= n;
+        if (buffer_used_ == WRITE_BUFFER_BYTES) {
+            writeBuffer(WRITE_BUFFER_BYTES);
+            file_offset_ += WRITE_BUFFER_BYTES;
+            buffer_used_ = 0;
+        }
+    }
+}
+
+void PcapngWriter::appendFromRing(uint64_t pos, size_t len) {
+    size_t offset = static_cast<size_t>(pos & ring_mask_);
+    size_t first = std::min(len, ring_mask_ + 1 - offset);
+    append(ring_ + offset, first);
+    if (first < len) {
+        append(ring_, len - first);
+    }
+}
+
+bool PcapngWriter::writeBuffer(size_t len) {
+    if (fd_ < 0 || failed_) return false;
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd_, buffer_ + done, len - done, static_cast<off_t>(file_offset_ + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "[PCAPNG] Write to " << file_path_ << " failed: " << strerror(errno)
+                      << "; dropping packets from now on" << std::endl;
+            failed_ = true;
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void PcapngWriter::sync() {
+    if (buffer_used_ == 0) return;
+
+    // Write the partial buffer rounded up to a whole page, without consuming
+    // it: the next sync or full write rewrites the same aligned region
+    size_t rounded = (buffer_used_ + IO_ALIGN - 1) & ~(IO_ALIGN - 1);
+    memset(buffer_ + buffer_used_, 0, rounded - buffer_used_);
+    writeBuffer(rounded);
+}
+
+void PcapngWriter::writeSectionHeader() {
+    std::vector<unsigned char> options;
+    appendOption(options, OPT_SHB_USERAPPL, "NetworkSniffer");
+    appendOption(options, OPT_ENDOFOPT, "");
+
+    // type, length, byte-order magic, version 1.0, section length (-1 = unknown)
+    uint32_t total = static_cast<uint32_t>(4 + 4 + 4 + 2 + 2 + 8 + options.size() + 4);
+    uint16_t major = 1, minor = 0;
+    int64_t section_length = -1;
+
+    append(&BLOCK_SHB, 4);
+    append(&total, 4);
+    append(&BYTE_ORDER_MAGIC, 4);
+    append(&major, 2);
+    append(&minor, 2);
+    append(&section_length, 8);
+    append(options.data(), options.size());
+    append(&total, 4);
+}
+
+void PcapngWriter::writeInterfaceBlock(const Interface& iface) {
+    std::vector<unsigned char> options;
+    appendOption(options, OPT_IF_NAME, iface.name);
+    appendOption(options, OPT_ENDOFOPT, "");
+
+    // type, length, linktype, reserved, snaplen; timestamps default to microseconds
+    uint32_t total = static_cast<uint32_t>(4 + 4 + 2 + 2 + 4 + options.size() + 4);
+    uint16_t linktype = iface.linktype;
+    uint16_t reserved = 0;
+    uint32_t snaplen = options_.snaplen;   // 0 = no limit
+
+    append(&BLOCK_IDB, 4);
+    append(&total, 4);
+    append(&linktype, 2);
+    append(&reserved, 2);
+    append(&snaplen, 4);
+    append(options.data(), options.size());
+    append(&total, 4);
+}
@@ -0,0 +1,165 @@
+/**
+ * @file PcapngWriter.h
+ * @brief Rotating pcapng sink for full packet payloads
+ *
+ * The capture loop only turns packets into header summaries. For forensics
+ * the raw bytes matter, so PcapngWriter records every captured frame to
+ * pcapng files that Wireshark/tshark open directly.
+ *
+ * ## Threading
+ *
+ * The capture loop must never wait on disk. write() encodes the packet as a
+ * finished Enhanced Packet Block straight into a single-producer /
+ * single-consumer ring and returns. If the ring is full the packet is dropped
+ * and counted; the capture loop never blocks. A dedicated writer thread
+ * drains the ring into 1 MB, 4 KB-aligned buffers and issues one large
+ * write per buffer.
+ *
+ * ## Direct I/O
+ *
+ * Files are opened with O_DIRECT (Linux) or F_NOCACHE (macOS) when the
+ * filesystem allows it, so a sustained capture does not evict the rest of
+ * the page cache. Buffers, write sizes and file offsets are all 4 KB
+ * aligned for that reason. A partly filled buffer is written rounded up to
+ * 4 KB (once a second, so a quiet link still reaches disk), and the file is
+ * truncated to its real length when it is closed.
+ *
+ * ## File Layout
+ *
+ * ```
+ * <prefix>_<NNNNN>_<YYYYmmdd-HHMMSS>.pcapng
+ *   Section Header Block
+ *   Interface Description Block   (one per capture interface)
+ *   Enhanced Packet Block ...     (timestamps in microseconds)
+ * ```
+ *
+ * Files rotate by size and/or age. Every file is self-contained: it starts
+ * with its own SHB and IDBs.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <sys/time.h>
+
+/**
+ * @struct PcapngOptions
+ * @brief Output location, truncation and rotation limits
+ */
+struct PcapngOptions {
+    std::string prefix;                      ///< Path prefix; empty disables pcapng output
+    uint32_t snaplen = 0;                    ///< Bytes kept per packet, 0 = whole packet
+    uint64_t rotate_bytes = 1ull << 30;      ///< Start a new file after this size, 0 = never
+    uint32_t rotate_seconds = 0;             ///< Start a new file after this age, 0 = never
+    size_t ring_bytes = 64u << 20;           ///< Capture-to-writer ring (rounded up to a power of two)
+};
+
+/**
+ * @class PcapngWriter
+ * @brief Non-blocking pcapng recorder with its own writer thread
+ *
+ * write() must only be called from one thread (the capture loop).
+ */
+class PcapngWriter {
+public:
+    /// pcapng LINKTYPE_ETHERNET
+    static constexpr uint16_t LINKTYPE_ETHERNET = 1;
+
+    /// Size of each aligned output buffer
+    static constexpr size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+    /// Alignment required for direct I/O
+    static constexpr size_t IO_ALIGN = 4096;
+
+    /// A capture interface, described by an IDB in every file
+    struct Interface {
+        std::string name;
+        uint16_t linktype = LINKTYPE_ETHERNET;
+    };
+
+    /**
+     * @brief Create the first file and start the writer thread
+     *
+     * @param options Output prefix, snaplen and rotation limits
+     * @param interfaces Interfaces in id order (write() takes the index)
+     * @throws std::runtime_error if the first file cannot be created
+     */
+    PcapngWriter(const PcapngOptions& options, const std::vector<Interface>& interfaces);
+
+    /// Same as close()
+    ~PcapngWriter();
+
+    PcapngWriter(const PcapngWriter&) = delete;
+    PcapngWriter& operator=(const PcapngWriter&) = delete;
+
+    /**
+     * @brief Queue one packet (never blocks)
+     *
+     * @param interface_id Index into the constructor's interface list
+     * @param data Link-layer frame
+     * @param caplen Bytes captured (truncated further to snaplen)
+     * @param origlen Original length on the wire
+     * @param ts Capture timestamp
+     * @return false if the ring was full and the packet was dropped
+     */
+    bool write(uint32_t interface_id, const unsigned char* data, uint32_t caplen,
+               uint32_t origlen, const struct timeval& ts);
+
+    /**
+     * @brief Drain the ring, finish the current file and stop the thread
+     *
+     * Safe to call more than once. No write() may run concurrently.
+     */
+    void close();
+
+    /// Packets dropped because the ring was full or the disk failed
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /// Packets written to disk
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+
+private:
+    // ---- Ring (producer: capture thread, consumer: writer thread) ----
+    void ringCopyIn(uint64_t pos, const void* src, size_t len);
+    void ringCopyOut(uint64_t pos, void* dst, size_t len) const;
+
+    // ---- Writer thread ----
+    void writerLoop();
+    void openFile();
+    void closeFile();
+    void append(const void* data, size_t len);
+    void appendFromRing(uint64_t pos, size_t len);
+    bool writeBuffer(size_t len);
+    void sync();
+    void writeSectionHeader();
+    void writeInterfaceBlock(const Interface& iface);
+
+    PcapngOptions options_;
+    std::vector<Interface> interfaces_;
+
+    unsigned char* ring_ = nullptr;
+    size_t ring_mask_ = 0;
+    alignas(64) std::atomic<uint64_t> head_{0};   ///< Next byte the producer writes
+    alignas(64) std::atomic<uint64_t> tail_{0};   ///< Next byte the consumer reads
+
+    // Writer-thread state
+    int fd_ = -1;
+    bool direct_ = false;             ///< fd_ was opened with O_DIRECT
+    unsigned char* buffer_ = nullptr; ///< IO_ALIGN-aligned output buffer
+    size_t buffer_used_ = 0;
+    uint64_t file_offset_ = 0;        ///< File offset of buffer_[0] (always aligned)
+    uint64_t file_bytes_ = 0;         ///< Logical size of the current file
+    uint64_t file_opened_ = 0;        ///< Seconds since epoch
+    uint32_t file_index_ = 0;
+    std::string file_path_;
+    bool failed_ = false;             ///< Disk error; everything after is dropped
+
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> written_{0};
+    std::thread writer_;
+};
@@ -0,0 +1,131 @@
+/**
+ * @file Sampler.cpp
+ * @brief Implementation of deterministic, probabilistic and flow-hash sampling
+ */
+
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+
+Sampler::Sampler(Mode mode, uint32_t rate, uint64_t budget_bytes_per_sec)
+    : mode_(mode),
+      base_rate_(std::max<uint32_t>(1, rate)),
+      rate_(base_rate_),
+      budget_(budget_bytes_per_sec),
+      rng_state_(static_cast<uint64_t>(
+          std::chrono::steady_clock::now().time_since_epoch().count()) | 1),
+      window_start_(std::chrono::steady_clock::now()) {
+}
+
+bool Sampler::accept(const unsigned char* packet, size_t caplen, uint32_t min_rate) {
+    uint32_t rate = std::max(rate_, min_rate);
+    last_rate_ = rate;
+
+    if (rate <= 1) return true;
+
+    switch (mode_) {
+        case Mode::PROBABILISTIC:
+            return nextRandom() % rate == 0;
+
+        case Mode::FLOW_HASH:
+            return flowHash(packet, caplen) % rate == 0;
+
+        case Mode::NONE:            // A floor was forced on an unsampled sniffer
+        case Mode::DETERMINISTIC:
+        default:
+            return ++counter_ % rate == 0;
+    }
+}
+
+bool Sampler::adapt() {
+    if (budget_ == 0) return false;
+
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - window_start_).count();
+    if (elapsed < 1000) return false;
+
+    // Normalize to bytes/sec so a late call doesn't look like a burst
+    uint64_t sent_per_sec = window_bytes_ * 1000 / static_cast<uint64_t>(elapsed);
+    window_bytes_ = 0;
+    window_start_ = now;
+
+    uint32_t old_rate = rate_;
+    if (sent_per_sec > budget_ && rate_ < MAX_RATE) {
+        rate_ = std::min<uint32_t>(rate_ * 2, MAX_RATE);
+    } else if (sent_per_sec * 10 < budget_ * 4 && rate_ > base_rate_) {
+        rate_ = std::max(rate_ / 2, base_rate_);
+    }
+
+    if (rate_ != old_rate) {
+        std::cout << "[SAMPLER] " << sent_per_sec << " B/s vs budget " << budget_
+                  << " B/s: rate 1/" << old_rate << " -> 1/" << rate_ << std::endl;
+        return true;
+    }
+    return false;
+}
+
+uint32_t Sampler::flowHash(const unsigned char* packet, size_t caplen) {
+    // Ethernet (14) + minimum IPv4 header (20)
+    if (caplen < 14) return 0;
+    uint16_t ethertype = static_cast<uint16_t>((packet[12] << 8) | packet[13]);
+    if (ethertype != 0x0800 || caplen < 34) {
+        return ethertype * 2654435761u;
+    }
+
+    const unsigned char* ip = packet + 14;
+    size_t ihl = (ip[0] & 0x0F) * 4u;
+    uint8_t proto = ip[9];
+
+    uint32_t src, dst;
+    memcpy(&src, ip + 12, 4);
+    memcpy(&dst, ip + 16, 4);
+
+    // Ports only for unfragmented TCP/UDP: later fragments carry no L4
+    // header, and all fragments of a datagram must get the same decision
+    uint16_t frag = static_cast<uint16_t>((ip[6] << 8) | ip[7]);
+    uint32_t sport = 0, dport = 0;
+    if ((proto == 6 || proto == 17) && (frag & 0x3FFF) == 0 && caplen >= 14 + ihl + 4) {
+        sport = static_cast<uint32_t>((ip[ihl] << 8) | ip[ihl + 1]);
+        dport = static_cast<uint32_t>((ip[ihl + 2] << 8) | ip[ihl + 3]);
+    }
+
+    // Order the two endpoints so A->B and B->A hash identically
+    uint64_t a = (static_cast<uint64_t>(src) << 16) | sport;
+    uint64_t b = (static_cast<uint64_t>(dst) << 16) | dport;
+    if (a > b) std::swap(a, b);
+
+    // splitmix64 finalizer
+    uint64_t h = a * 0x9E3779B97F4A7C15ull ^ b ^ (static_cast<uint64_t>(proto) << 56);
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27; h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return static_cast<uint32_t>(h);
+}
+
+uint64_t Sampler::nextRandom() {
+    rng_state_ ^= rng_state_ >> 12;
+    rng_state_ ^= rng_state_ << 25;
+    rng_state_ ^= rng_state_ >> 27;
+    return rng_state_ * 0x2545F4914F6CDD1Dull;
+}
+
+Sampler::Mode Sampler::parseMode(const std::string& name) {
+    if (name == "none") return Mode::NONE;
+    if (name == "det") return Mode::DETERMINISTIC;
+    if (name == "prob") return Mode::PROBABILISTIC;
+    if (name == "flow") return Mode::FLOW_HASH;
+    throw std::invalid_argument("Unknown sampling mode: " + name + " (expected none, det, prob or flow)");
+}
+
+const char* Sampler::modeName(Mode mode) {
+    switch (mode) {
+        case Mode::DETERMINISTIC: return "det";
+        case Mode::PROBABILISTIC: return "prob";
+        case Mode::FLOW_HASH: return "flow";
+        case Mode::NONE:
+        default: return "none";
+    }
+}
@@ -0,0 +1,124 @@
+/**
+ * @file Sampler.h
+ * @brief Packet sampling policies for high-rate capture
+ *
+ * On fast links the sniffer cannot afford to parse, serialize and ship every
+ * packet. The Sampler decides, per raw packet and before any parsing, whether
+ * the packet is kept. Three policies are supported:
+ *
+ * - DETERMINISTIC: exactly 1 in N packets (a counter)
+ * - PROBABILISTIC: each packet kept with probability 1/N (xorshift PRNG)
+ * - FLOW_HASH: a packet is kept if its flow hashes into the kept 1/N of the
+ *   hash space, so a sampled flow is seen in full and both directions of a
+ *   connection share the same decision
+ *
+ * The rate can adapt automatically to keep upstream bandwidth under a budget:
+ * once per second the bytes actually sent are compared against the budget and
+ * the rate is doubled or halved. Rates move in powers of two so that, with
+ * FLOW_HASH, the flows kept at rate 2N are a subset of those kept at rate N.
+ *
+ * Every kept record carries the rate it was sampled at ("sample_rate"), so
+ * the server and GUI can scale counts back up.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <chrono>
+
+/**
+ * @class Sampler
+ * @brief Per-packet keep/skip decision with optional bandwidth-driven rate
+ *
+ * Not thread-safe: owned and used by the capture loop only.
+ */
+class Sampler {
+public:
+    /// Sampling policy
+    enum class Mode { NONE, DETERMINISTIC, PROBABILISTIC, FLOW_HASH };
+
+    /// Largest rate the adaptive controller will reach (1 in 65536)
+    static constexpr uint32_t MAX_RATE = 65536;
+
+    /**
+     * @brief Construct a sampler
+     * @param mode Sampling policy (NONE keeps everything unless a floor rate is forced)
+     * @param rate Base rate N (keep 1 in N); also the lowest rate adaptation goes back to
+     * @param budget_bytes_per_sec Upstream budget for adaptation, 0 disables it
+     */
+    explicit Sampler(Mode mode = Mode::NONE, uint32_t rate = 1, uint64_t budget_bytes_per_sec = 0);
+
+    /**
+     * @brief Decide whether to keep a raw link-layer packet
+     *
+     * @param packet Raw Ethernet frame
+     * @param caplen Captured length
+     * @param min_rate Floor imposed by the caller (e.g. flow-control
+     *                 degradation); the effective rate is max(rate(), min_rate)
+     * @return true if the packet should be parsed and delivered
+     *
+     * @note Updates lastRate() with the effective rate used for this packet
+     */
+    bool accept(const unsigned char* packet, size_t caplen, uint32_t min_rate = 1);
+
+    /**
+     * @brief Account for bytes sent upstream (input to rate adaptation)
+     * @param bytes Frame size written to the server
+     */
+    void recordSent(size_t bytes) { window_bytes_ += bytes; }
+
+    /**
+     * @brief Re-evaluate the rate against the budget, at most once per second
+     *
+     * - Sent more than the budget: double the rate
+     * - Sent less than 40% of the budget: halve the rate (not below the base
+     *   rate), since halving doubles the traffic and must still fit
+     *
+     * @return true if the rate changed
+     */
+    bool adapt();
+
+    /// Current adaptive rate (before any caller-imposed floor)
+    uint32_t rate() const { return rate_; }
+
+    /// Effective rate used by the most recent accept() call
+    uint32_t lastRate() const { return last_rate_; }
+
+    /// Sampling policy in use
+    Mode mode() const { return mode_; }
+
+    /**
+     * @brief Parse a command-line mode name
+     * @param name "none", "det", "prob" or "flow"
+     * @throws std::invalid_argument for unknown names
+     */
+    static Mode parseMode(const std::string& name);
+
+    /// Human-readable mode name (inverse of parseMode)
+    static const char* modeName(Mode mode);
+
+private:
+    /**
+     * @brief Symmetric hash of the IPv4 5-tuple in a raw Ethernet frame
+     *
+     * Source and destination are combined order-independently so both
+     * directions of a connection hash the same. Non-IPv4 frames hash on
+     * their EtherType only.
+     */
+    static uint32_t flowHash(const unsigned char* packet, size_t caplen);
+
+    /// xorshift64* - fast, adequate for sampling decisions
+    uint64_t nextRandom();
+
+    Mode mode_;
+    uint32_t base_rate_;
+    uint32_t rate_;
+    uint32_t last_rate_ = 1;
+    uint64_t budget_;
+    uint64_t counter_ = 0;
+    uint64_t rng_state_;
+    uint64_t window_bytes_ = 0;
+    std::chrono::steady_clock::time_point window_start_;
+};
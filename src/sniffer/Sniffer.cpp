@@ -1,5 +1,6 @@
 #include "Sniffer.h"
 #include "PacketParser.h"
+#include "ConsoleSink.h"
 #include "../Protocol.h"
 
 #include <sys/types.h>
@@ -10,14 +11,44 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <cerrno>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
+namespace {
+
+/// Latency as "12.345 ms" on a console line
+void printMillis(ConsoleSink& out, uint64_t latency_us) {
+    char frac[4] = {static_cast<char>('0' + latency_us / 100 % 10),
+                    static_cast<char>('0' + latency_us / 10 % 10),
+                    static_cast<char>('0' + latency_us % 10), '\0'};
+    out.number(latency_us / 1000).text('.').text(frac).text(" ms");
+}
+
+/// Disable Nagle: frames are written whole, so holding back a short one only
+/// adds latency until the server's delayed ACK
+void setNoDelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/// Whether a record carries text a binary record has no room for
+bool needsJson(const json& log) {
+    return log.contains("tls_version") || log.value("kind", "") == "http_summary";
+}
+
+} // namespace
+
 /**
  * @brief Constructor: Initialize BPF device and configure for specified interface
  * 
@@ -36,6 +67,10 @@ using json = nlohmann::json;
  *              - "lo0": Loopback interface (for testing)
  *              The string is copied internally, so the caller's buffer can be
  *              freed after construction.
+ * @param server_ip Server address for distributed mode (empty = console mode)
+ * @param server_port Server port for distributed mode
+ * @param options Sampling policy, upstream bandwidth budget and, with
+ *                options.shm_path, a shared-memory server on this host
  * 
  * @throws std::runtime_error If no BPF devices are available (all in use)
  * @throws std::runtime_error If interface binding fails (invalid interface name)
@@ -47,29 +82,110 @@ using json = nlohmann::json;
  * 
  * @see openBpfDevice(), configureInterface()
  */
-Sniffer::Sniffer(const std::string& iface, const std::string& server_ip, int server_port)
-    : iface_(iface), server_ip_(server_ip), server_port_(server_port) {
+Sniffer::Sniffer(const std::string& iface, const std::string& server_ip, int server_port,
+                 const CaptureOptions& options)
+    : iface_(iface), server_ip_(server_ip), server_port_(server_port),
+      target_ip_(server_ip), target_port_(server_port), shm_path_(options.shm_path),
+      replay_rate_(options.spill.replay_rate),
+      sampler_(options.sample_mode, options.sample_rate, options.upstream_budget) {
     fd_ = openBpfDevice();
     configureInterface();
 
-    if (!server_ip_.empty() && server_port_ > 0) {
+    if (!options.pcap.prefix.empty()) {
+        pcap_.reset(new PcapngWriter(options.pcap, {{iface_, PcapngWriter::LINKTYPE_ETHERNET}}));
+    }
+
+    PacketParser::setTunnelDepth(options.tunnel_depth);
+
+    if (options.fragments.memory_bytes > 0) {
+        defrag_.reset(new IpDefragmenter(options.fragments));
+        PacketParser::setIpDefragmenter(defrag_.get());
+    }
+
+    // Application-layer dissectors register with tcp_ here. Without any,
+    // the parser never hands it a segment.
+    tcp_.reset(new TcpReassembler(options.tcp));
+    if (!options.tls.ports.empty()) {
+        tls_.reset(new TlsDissector(options.tls));
+        tcp_->addHandler(tls_.get());
+        PacketParser::setTlsDissector(tls_.get());
+    }
+    if (!options.http.ports.empty()) {
+        http_.reset(new HttpDissector(options.http));
+        http_->setCallback([this](const HttpTransaction& transaction) {
+            this->reportHttp(transaction);
+        });
+        tcp_->addHandler(http_.get());
+        http_summaries_.reset(new HttpSummaryTable(options.http.max_groups));
+        http_interval_sec_ = options.http.interval_sec;
+        last_http_summary_ = time(nullptr);
+    }
+    if (tcp_->hasHandlers()) {
+        PacketParser::setTcpReassembler(tcp_.get());
+    }
+
+    if (options.binary_records) {
+        offered_caps_ |= Protocol::CAP_BINARY | Protocol::CAP_BATCH | Protocol::CAP_LARGE_FRAMES;
+        if (options.compress_records) offered_caps_ |= Protocol::CAP_COMPRESS;
+    }
+
+    if (!options.shm_path.empty()) {
+        connectShm(options.shm_path);
+    } else if (!server_ip_.empty() && server_port_ > 0) {
         connectToServer();
-        sendClientHello();
-        receiveServerHello();
+    }
+
+    if (server_fd_ != -1) {
+        remote_ = true;
+
+        // A server of a pool sends us on to the one that owns us
+        int redirects = 0;
+        if (!sendClientHello()) {
+            throw std::runtime_error("Failed to send CLIENT_HELLO");
+        }
+        while (!receiveServerHello()) {
+            if (++redirects > MAX_REDIRECTS) {
+                throw std::runtime_error("Too many redirects between servers");
+            }
+            close(server_fd_);
+            server_rx_ = FrameReader();
+            connectToServer();
+            if (!sendClientHello()) {
+                throw std::runtime_error("Failed to send CLIENT_HELLO");
+            }
+        }
+        link_ = LinkState::UP;
+
+        // Only the first connection must succeed; later outages are
+        // bridged by the spill buffer
+        spill_.reset(new SpillBuffer(options.spill));
 
         PacketParser::setLogCallback([this](const json& log) {
-            this->sendTrafficLog(log);
+            this->deliverRecord(log);
+        });
+    }
+
+    // Set up last: the callback prints or sends depending on remote_
+    if (options.dns.max_pending > 0) {
+        dns_.reset(new DnsDissector(options.dns));
+        dns_->setCallback([this](const DnsTransaction& transaction) {
+            this->reportDns(transaction);
         });
+        PacketParser::setDnsDissector(dns_.get());
     }
 }
 
 Sniffer::~Sniffer() {
+    stop();
+    PacketParser::setTcpReassembler(nullptr);
+    PacketParser::setIpDefragmenter(nullptr);
+    PacketParser::setDnsDissector(nullptr);
+    PacketParser::setTlsDissector(nullptr);
+    PacketParser::setTunnelDepth(0);
     if (fd_ != -1) {
         close(fd_);
     }
-    if (server_fd_ != -1) {
-        close(server_fd_);
-    }
+    closeLink();
 }
 
 int Sniffer::openBpfDevice() {
@@ -162,6 +278,22 @@ void Sniffer::configureInterface() {
     }
 
     buffer_.resize(bufsize);
+
+    // STEP 4: Read timeout
+    // ===============================================
+    // BIOCSRTIMEOUT: return from read() after this long even without packets
+    //
+    // Without it read() blocks for as long as the interface is quiet, and so
+    // does everything the loop does between reads: reconnecting to the
+    // server, replaying spilled records, STATS, flushing console output.
+    // 100ms keeps those going on an idle link at no cost on a busy one.
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = READ_TIMEOUT_MS * 1000;
+    if (ioctl(fd_, BIOCSRTIMEOUT, &timeout) == -1) {
+        throw std::runtime_error("Failed to set read timeout");
+    }
+
     std::cout << "Attached to " << iface_ << " (bpf buf " << bufsize << " bytes)" << std::endl;
 }
 
@@ -169,6 +301,23 @@ void Sniffer::run() {
     doReadLoop();
 }
 
+void Sniffer::stop() {
+    if (tcp_) {
+        tcp_->closeAll();   // Dissectors see the end of every open connection
+    }
+    if (!remote_) {
+        // The capture thread's sink: stop() runs on it once run() has returned
+        ConsoleSink::forThread().flush();
+    }
+    if (pcap_) {
+        pcap_->close();
+    }
+    if (spill_ && !spill_->empty()) {
+        std::cerr << "[SNIFFER] Discarding " << spill_->pending() << " spilled records" << std::endl;
+    }
+    spill_.reset();
+}
+
 void Sniffer::doReadLoop() {
     // PACKET CAPTURE MAIN LOOP
     // =================================================================
@@ -179,7 +328,7 @@ void Sniffer::doReadLoop() {
     // 3. Memory alignment: struct packing and word boundaries
     // 4. Bounds checking: prevent reading past buffer end
 
-    while (true) {
+    while (!stop_requested_) {
         // STEP 1: Read raw packet buffer from BPF device
         // ===============================================
         // read() returns the number of bytes available in the BPF buffer
@@ -200,17 +349,42 @@ void Sniffer::doReadLoop() {
         // This single read() may contain 10-1000 packets depending on traffic
 
         ssize_t bytes_read = read(fd_, buffer_.data(), buffer_.size());
+
+        // Pick up any credits the server granted since the last buffer,
+        // before deciding how this buffer's records are delivered. Runs on
+        // timeouts too, so an idle sniffer still reconnects and replays.
+        if (remote_) {
+            if (link_ == LinkState::UP) {
+                pollServerFrames();
+            }
+            maintainUpstream();
+            if (http_) {
+                flushHttpSummaries();   // On a quiet interface too
+            }
+        } else {
+            // Console mode: lines printed from the previous buffer have
+            // waited long enough
+            ConsoleSink::forThread().flushIfIdle();
+        }
+
         if (bytes_read <= 0) {
-            continue;  // No data or error; retry
+            continue;  // Timeout, no data or error; retry
         }
 
-        // STEP 2: Parse multiple packets from single buffer
+        // STEP 2: Find every packet in the buffer
         // ===============================================
-        // Now iterate through all packets in this buffer
-        // Each iteration processes one bpf_hdr + packet pair
+        // Walk the bpf_hdr + packet pairs once and note where each packet
+        // is, so the header fields of all of them can be read in one pass
+
+        if (remote_) {
+            sampler_.adapt();
+        }
 
         unsigned char* ptr = buffer_.data();          // Current position in buffer
         unsigned char* end = ptr + bytes_read;        // End of valid data
+        packet_headers_.clear();
+        packet_frames_.clear();
+        packet_lengths_.clear();
 
         while (ptr < end) {
             // Cast to BPF header (interprets raw bytes as struct)
@@ -219,6 +393,7 @@ void Sniffer::doReadLoop() {
             // BOUNDS CHECK 1: Is there a complete header?
             if (ptr + bh->bh_hdrlen > end) {
                 // Partial header at end of buffer; discard and exit
+                loss_.ring_drop++;
                 break;
             }
 
@@ -228,31 +403,24 @@ void Sniffer::doReadLoop() {
             // BOUNDS CHECK 2: Is the complete packet in buffer?
             if (packet + bh->bh_caplen > end) {
                 // Partial packet at end of buffer; discard and exit
+                loss_.ring_drop++;
                 break;
             }
 
             // ZERO-COPY PACKET ACCESS
             // =======================
             // Notice: we're NOT copying the packet data
-            // We pass a pointer directly into the kernel buffer
+            // We keep a pointer directly into the kernel buffer
             // This is extremely efficient: zero allocation, zero memcpy
             //
             // The packet pointer remains valid ONLY until the next read()
             // call, after which the buffer will be overwritten
             // PacketParser must not cache these pointers across loop iterations
+            packet_headers_.push_back(bh);
+            packet_frames_.push_back(packet);
+            packet_lengths_.push_back(bh->bh_caplen);
 
-            struct timeval tv;
-            tv.tv_sec = bh->bh_tstamp.tv_sec;
-            tv.tv_usec = bh->bh_tstamp.tv_usec;
-
-            // Process this packet (parse and either send to server or print)
-            if (server_fd_ != -1) {
-                PacketParser::parseToJSON(packet, bh->bh_caplen, tv, nullptr);
-            } else {
-                PacketParser::parseAndPrint(packet, bh->bh_caplen, tv);
-            }
-
-            // STEP 3: Move pointer to next packet
+            // Move pointer to next packet
             // ====================================
             // BPF_WORDALIGN: Round up to machine word boundary (typically 4 bytes)
             //
@@ -276,6 +444,66 @@ void Sniffer::doReadLoop() {
 
             ptr += BPF_WORDALIGN(bh->bh_hdrlen + bh->bh_caplen);
         }
+
+        // STEP 3: Header fields of the whole buffer at once
+        // ===============================================
+        // Binary records of plain TCP/UDP packets are built straight from
+        // these columns; JSON peers and everything else take the full parser
+
+        bool batch = remote_ && (caps_ & Protocol::CAP_BINARY);
+        if (batch) {
+            BatchParser::parse(packet_frames_.data(), packet_lengths_.data(), packet_frames_.size(),
+                               packet_columns_);
+        }
+
+        // STEP 4: Deliver each packet
+        // ===============================================
+
+        for (size_t i = 0; i < packet_frames_.size(); ++i) {
+            const struct bpf_hdr* bh = packet_headers_[i];
+            const unsigned char* packet = packet_frames_[i];
+
+            struct timeval tv;
+            tv.tv_sec = bh->bh_tstamp.tv_sec;
+            tv.tv_usec = bh->bh_tstamp.tv_usec;
+
+            // RECORDING: every packet goes to pcapng, sampled or not. This only
+            // copies into the writer's ring; a full ring drops, never blocks.
+            if (pcap_) {
+                pcap_->write(0, packet, bh->bh_caplen, bh->bh_datalen, tv);
+            }
+
+            // SAMPLING: decide on the raw bytes, before paying for parsing
+            // and serialization. Flow control may force a higher rate.
+            if (flow_control_) {
+                updateDeliveryMode();
+            }
+            if (!sampler_.accept(packet, bh->bh_caplen, sampleFloor())) {
+                loss_.sampled_out++;
+                continue;
+            }
+
+            // Process this packet (parse and either send to server or print;
+            // while the server is away deliverRecord() spills it)
+            if (remote_) {
+                WireRecord record;
+                if (batch && !(flow_control_ && mode_ == DeliveryMode::SUMMARY) &&
+                    PacketParser::parseToRecord(packet, bh->bh_caplen, tv, packet_columns_, i, record)) {
+                    deliverWireRecord(record);
+                } else {
+                    PacketParser::parseToJSON(packet, bh->bh_caplen, tv, nullptr);
+                }
+            } else {
+                PacketParser::parseAndPrint(packet, bh->bh_caplen, tv);
+            }
+        }
+
+        if (link_ == LinkState::UP) {
+            flushRecordBatch();
+        }
+        if (link_ == LinkState::UP) {   // The flush may have lost the connection
+            reportLossStats();
+        }
     }
 }
 
@@ -287,163 +515,918 @@ void Sniffer::connectToServer() {
 
     struct sockaddr_in server_addr;
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port_);
-    if (inet_pton(AF_INET, server_ip_.c_str(), &server_addr.sin_addr) <= 0) {
+    server_addr.sin_port = htons(target_port_);
+    if (inet_pton(AF_INET, target_ip_.c_str(), &server_addr.sin_addr) <= 0) {
         throw std::runtime_error("Invalid server IP address");
     }
 
     if (connect(server_fd_, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         throw std::runtime_error("Failed to connect to server");
     }
+    setNoDelay(server_fd_);
+
+    std::cout << "Connected to server at " << target_ip_ << ":" << target_port_ << std::endl;
+}
 
-    std::cout << "Connected to server at " << server_ip_ << ":" << server_port_ << std::endl;
+void Sniffer::connectShm(const std::string& path) {
+    shm_ = Shm::Channel::connect(path);
+    server_fd_ = shm_->fd();
+    std::cout << "Connected to server through shared memory at " << path << std::endl;
 }
 
-void Sniffer::sendClientHello() {
+bool Sniffer::sendClientHello() {
     json hello;
     char hostname[256];
     gethostname(hostname, sizeof(hostname));
     hello["hostname"] = hostname;
-    hello["interface"] = iFface_;
+    hello["interface"] = iface_;
+    hello["proto"] = Protocol::PROTOCOL_REVISION;
+    hello["caps"] = Protocol::capabilityNames(offered_caps_);
 
     if (!sendFrame(Protocol::CLIENT_HELLO, hello.dump())) {
-        throw std::runtime_error("Failed to send CLIENT_HELLO");
+        return false;
     }
     std::cout << "Sent CLIENT_HELLO" << std::endl;
+    return true;
 }
 
-void Sniffer::receiveServerHello() {
-    uint8_t type;
-    std::string payload;
-
-    if (!readFrame(server_fd_, type, payload) || type != Protocol::SERVER_HELLO) {
+bool Sniffer::receiveServerHello() {
+    // Frames the server sends right behind SERVER_HELLO stay buffered in
+    // server_rx_ for pollServerFrames()
+    FrameView frame;
+    bool received = shm_ ? shm_->readFrame(frame, 5000) : server_rx_.readFrame(server_fd_, frame);
+    if (!received || frame.type != Protocol::SERVER_HELLO) {
         throw std::runtime_error("Failed to receive SERVER_HELLO");
     }
 
+    bool accepted = applyServerHello(frame.payload);
+    if (shm_) shm_->consume();
+    return accepted;
+}
+
+bool Sniffer::applyServerHello(std::string_view payload) {
     try {
         json response = json::parse(payload);
+
+        if (response.contains("redirect")) {
+            std::string owner = response["redirect"];
+            size_t colon = owner.rfind(':');
+            if (colon == std::string::npos) {
+                throw std::runtime_error("bad redirect \"" + owner + "\"");
+            }
+            // Only for this attempt: the next one starts at the configured server
+            target_ip_ = owner.substr(0, colon);
+            target_port_ = std::stoi(owner.substr(colon + 1));
+            std::cout << "Redirected to " << owner << std::endl;
+            return false;
+        }
+
         ssid_ = response["ssid"];
         std::cout << "Received SSID: " << ssid_ << std::endl;
+
+        // Servers that support flow control grant an initial window;
+        // older servers don't, and we send every record as before
+        if (response.contains("credits")) {
+            flow_control_ = true;
+            credit_window_ = response["credits"].get<int64_t>();
+            credits_ = credit_window_;
+            std::cout << "Flow control enabled, window=" << credit_window_ << std::endl;
+        }
+
+        // Revision-1 servers send no "caps": stay on JSON records
+        if (response.contains("caps")) {
+            caps_ = Protocol::negotiate(
+                Protocol::parseCapabilities(response["caps"].get<std::vector<std::string> >()), offered_caps_);
+        }
+        server_rx_.allowLargeFrames(caps_ & Protocol::CAP_LARGE_FRAMES);
+        if (shm_) shm_->allowLargeFrames(caps_ & Protocol::CAP_LARGE_FRAMES);
+        if (caps_ & Protocol::CAP_BINARY) {
+            if (caps_ & Protocol::CAP_BATCH) {
+                batch_capacity_ = (Protocol::maxPayload(caps_) - 2) / RecordCodec::WIRE_SIZE;
+            }
+            std::cout << "Sending binary records, up to " << batch_capacity_ << " per frame"
+                      << ((caps_ & Protocol::CAP_COMPRESS) ? ", packed" : "") << std::endl;
+        } else {
+            std::cout << "Sending JSON records" << std::endl;
+        }
     } catch (const std::exception& e) {
         throw std::runtime_error("Failed to parse SERVER_HELLO: " + std::string(e.what()));
     }
+    return true;
 }
 
 bool Sniffer::sendFrame(uint8_t type, const std::string& payload) {
-    if (payload.length() > 1024) return false;
+    if (payload.length() > Protocol::maxPayload(caps_)) return false;
 
     uint8_t header[4];
-    header[0] = Protocol::VERSION;
+    header[0] = Protocol::frameVersion(payload.length());
     header[1] = type;
     header[2] = (payload.length() >> 8) & 0xFF;
     header[3] = payload.length() & 0xFF;
 
-    if (write(server_fd_, header, 4) != 4) return false;
-    if (write(server_fd_, payload.data(), payload.length()) != (ssize_t)payload.length()) return false;
-    if (write(server_fd_, &Protocol::TERM_BYTE, 1) != 1) return false;
+    if (server_fd_ == -1) return false;
+
+    // Shared memory: one copy into the ring, no syscall unless the server sleeps
+    if (shm_) return shm_->send(type, payload.data(), payload.length(), true);
+
+    // Header, payload and terminator in one writev(): separate writes would
+    // be separate segments now that Nagle is off (see setNoDelay())
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char*>(payload.data());
+    iov[1].iov_len = payload.length();
+    iov[2].iov_base = const_cast<uint8_t*>(&Protocol::TERM_BYTE);
+    iov[2].iov_len = 1;
 
+    struct iovec* next = iov;
+    int count = 3;
+    while (count > 0) {
+        ssize_t n = writev(server_fd_, next, count);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        // Skip the buffers (and the part of one) that went out
+        while (count > 0 && static_cast<size_t>(n) >= next->iov_len) {
+            n -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + n;
+            next->iov_len -= n;
+        }
+    }
     return true;
 }
 
-bool Sniffer::readExact(int fd, void* buf, size_t len) {
-    // TCP SHORT READ HANDLING
-    // =================================================================
-    // This function solves a fundamental TCP/IP problem:
-    // read() may return FEWER bytes than requested, even if more are available
-    //
-    // Problem Scenario:
-    // ==================
-    // You want to read 100 bytes.
-    // read(fd, buf, 100) returns 45.
-    // You must call read() again to get the remaining 55 bytes.
-    // But naively, you'd process only 45 bytes, losing the rest!
-    //
-    // Why does TCP do this?
-    // TCP is a byte stream protocol. The kernel fills read() from:
-    // 1. Data already arrived from network
-    // 2. Data waiting in socket buffer
-    // 3. Available kernel buffer space
-    // The kernel may have received packet 1 (45 bytes) but not packet 2 yet.
-    // It returns what's available rather than blocking forever.
-    //
-    // Real example from networking:
-    // - You ask for 1024 bytes (a frame: header + payload)
-    // - Network delivers first 64 bytes
-    // - read() returns 64, not 1024
-    // - Your frame parser would fail: "incomplete frame!"
-    // - Without readExact(), frame parsing is broken
-    //
-    // Solution: readExact() loop
-    // ==========================
-    // Keep reading until we have exactly len bytes OR an error occurs
-    //
-    // Details:
-    // - total: bytes accumulated so far
-    // - buf + total: offset into buffer where to place next read
-    // - len - total: how many more bytes we still need
-    // - Loop while total < len (haven't reached goal)
-    // - If read() returns 0 or -1: error/EOF, return false
-    // - Otherwise: accumulate in total, continue loop
-    //
-    // Example execution:
-    // Want to read: 100 bytes
-    // Iteration 1: read() returns 45  -> total=45, continue
-    // Iteration 2: read() returns 30  -> total=75, continue
-    // Iteration 3: read() returns 25  -> total=100, exit loop
-    // return true (success)
-    //
-    // This pattern is ESSENTIAL for:
-    // - Binary protocol parsing (our case)
-    // - HTTP parsing (wait for exact headers)
-    // - SSL/TLS handshakes
-    // - Any fixed-size-header protocol
-    //
-    // Alternative approaches NOT used:
-    // - MSG_WAITALL flag: not portable (Unix-specific)
-    // - Socket timeout: adds complexity
-    // - Non-blocking I/O with select/epoll: much more complex
+void Sniffer::sendTrafficLog(const json& log) {
+    if (link_ != LinkState::UP) {
+        spillRecord(RecordCodec::fromJson(log));
+        return;
+    }
 
-    size_t total = 0;
-    while (total < len) {
-        ssize_t n = read(fd, (char*)buf + total, len - total);
-        if (n <= 0) return false;  // Error or EOF
-        total += n;
+    if (caps_ & Protocol::CAP_BINARY) {
+        if (!needsJson(log)) {
+            queueBinaryRecord(log);
+            return;
+        }
+        // Binary records have no room for server or host names: this one
+        // goes as JSON, after the batch before it so the sequence stays in order
+        flushRecordBatch();
+        if (link_ != LinkState::UP) {
+            spillRecord(RecordCodec::fromJson(log));
+            return;
+        }
+    }
+
+    json traffic_log = log;
+    traffic_log["ssid"] = ssid_;
+    traffic_log["seq"] = ++tx_seq_;
+
+    // JSON peers (revision 1) read the text forms; records only carry ts_ns
+    // and the raw addresses
+    if (!traffic_log.contains("timestamp")) {
+        traffic_log["timestamp"] = RecordCodec::formatTimestamp(traffic_log.value("ts_ns", uint64_t{0}));
+    }
+    if (traffic_log.contains("src_ip")) {
+        traffic_log["src"] = RecordCodec::ipText(traffic_log["src_ip"].get<uint32_t>());
+        traffic_log["dst"] = RecordCodec::ipText(traffic_log.value("dst_ip", 0u));
+        traffic_log.erase("src_ip");
+        traffic_log.erase("dst_ip");
+    }
+    if (traffic_log.contains("tunnel_src_ip")) {
+        traffic_log["tunnel_src"] = RecordCodec::ipText(traffic_log["tunnel_src_ip"].get<uint32_t>());
+        traffic_log["tunnel_dst"] = RecordCodec::ipText(traffic_log.value("tunnel_dst_ip", 0u));
+        traffic_log.erase("tunnel_src_ip");
+        traffic_log.erase("tunnel_dst_ip");
+    }
+
+    std::string payload = traffic_log.dump();
+
+    // Header + payload + terminator, as counted against the upstream budget
+    sampler_.recordSent(payload.size() + 5);
+
+    if (!sendFrame(Protocol::TRAFFIC_LOG, payload)) {
+        // The connection is gone: keep the record for the next one
+        spillRecord(RecordCodec::fromJson(log));
+        linkDown("traffic log not sent");
     }
-    return true;  // Got exactly len bytes
 }
 
-bool Sniffer::readFrame(int fd, uint8_t& type, std::string& payload) {
-    uint8_t header[4];
-    if (!readExact(fd, header, 4)) return false;
+void Sniffer::queueBinaryRecord(const json& log) {
+    queueWireRecord(RecordCodec::fromJson(log));
+}
 
-    if (header[0] != Protocol::VERSION) return false;
+void Sniffer::queueWireRecord(WireRecord record) {
+    record.seq = ++tx_seq_;
+    record_batch_.push_back(record);
 
-    type = header[1];
-    uint16_t length = (header[2] << 8) | header[3];
+    if (record_batch_.size() >= batch_capacity_) {
+        flushRecordBatch();
+    }
+}
 
-    if (length > 1024) return false;
+void Sniffer::flushRecordBatch() {
+    if (record_batch_.empty()) return;
 
-    std::vector<char> payload_buf(length);
-    if (!readExact(fd, payload_buf.data(), length)) return false;
-    payload = std::string(payload_buf.begin(), payload_buf.end());
+    size_t count = record_batch_.size();
+    size_t raw_size = count * RecordCodec::WIRE_SIZE;
+    uint8_t type = Protocol::RECORD_BATCH;
 
-    uint8_t term;
-    if (!readExact(fd, &term, 1) || term != Protocol::TERM_BYTE) return false;
+    batch_payload_.assign(2, '\0');
+    RecordCodec::put16(&batch_payload_[0], static_cast<uint16_t>(count));
+    if (caps_ & Protocol::CAP_COMPRESS) {
+        ColumnCodec::packBatch(record_batch_, 0, count, batch_payload_, pack_scratch_);
+        type = Protocol::RECORD_BATCH_LZ;
+    }
+    if (type == Protocol::RECORD_BATCH || batch_payload_.size() >= 2 + raw_size) {
+        // Not packed, or packing did not pay off (tiny or very diverse batch)
+        type = Protocol::RECORD_BATCH;
+        batch_payload_.resize(2 + raw_size);
+        for (size_t i = 0; i < count; ++i) {
+            RecordCodec::encode(record_batch_.row(i), &batch_payload_[2 + i * RecordCodec::WIRE_SIZE]);
+        }
+    }
 
-    return true;
+    batch_raw_bytes_ += raw_size;
+    batch_sent_bytes_ += batch_payload_.size();
+    sampler_.recordSent(batch_payload_.size() + 5);
+
+    if (!sendFrame(type, batch_payload_)) {
+        // linkDown() moves the batch to the spill buffer
+        linkDown("record batch not sent");
+        return;
+    }
+    record_batch_.clear();
 }
 
-void Sniffer::sendTrafficLog(const json& log) {
-    if (server_fd_ == -1) return;
+void Sniffer::reportLossStats() {
+    time_t now = time(nullptr);
+    if (now - last_stats_report_ < STATS_INTERVAL_SEC) return;
+    last_stats_report_ = now;
 
-    json traffic_log = log;
-    traffic_log["ssid"] = ssid_;
+    // BIOCGSTATS: cumulative counters since the device was opened
+    // bs_recv = packets seen by the filter, bs_drop = dropped for lack of buffer space
+    struct bpf_stat bs;
+    if (ioctl(fd_, BIOCGSTATS, &bs) == 0) {
+        loss_.kernel_recv = bs.bs_recv;
+        loss_.kernel_drop = bs.bs_drop;
+    }
+    if (spill_) {
+        loss_.send_drop = spill_->dropped();
+    }
 
-    std::string payload = traffic_log.dump();
-    std::cout << "[SNIFFER] Sending log to server: " << payload.substr(0, 100) << "..." << std::endl;
+    json stats;
+    stats["seq"] = tx_seq_;
+    stats["kernel_recv"] = loss_.kernel_recv;
+    stats["kernel_drop"] = loss_.kernel_drop;
+    stats["ring_drop"] = loss_.ring_drop;
+    stats["send_drop"] = loss_.send_drop;
+    stats["sampled_out"] = loss_.sampled_out;
+    stats["summarized"] = loss_.summarized;
+    stats["summary_drop"] = loss_.summary_drop;
+    if (batch_raw_bytes_ > 0) {
+        stats["batch_raw_bytes"] = batch_raw_bytes_;
+        stats["batch_sent_bytes"] = batch_sent_bytes_;
+    }
+    if (pcap_) {
+        stats["pcap_written"] = pcap_->written();
+        stats["pcap_drop"] = pcap_->dropped();
+    }
+    if (shm_) {
+        stats["shm_doorbells"] = shm_->doorbells();
+    }
+    if (spill_) {
+        stats["spill_pending"] = spill_->pending();
+        stats["spilled"] = spill_->spilled();
+        stats["replayed"] = replayed_;
+        stats["reconnects"] = reconnects_;
+    }
+    if (tcp_->hasHandlers()) {
+        const TcpReassembler::Stats& tcp = tcp_->stats();
+        stats["tcp_connections"] = tcp_->connections();
+        stats["tcp_buffered"] = tcp_->bufferedBytes();
+        stats["tcp_out_of_order"] = tcp.out_of_order;
+        stats["tcp_retransmitted"] = tcp.retransmitted_bytes;
+        stats["tcp_gaps"] = tcp.gaps;
+        stats["tcp_gap_bytes"] = tcp.gap_bytes;
+        stats["tcp_memory_drop"] = tcp.memory_drop;
+        stats["tcp_refused"] = tcp.connections_refused;
+    }
+    if (defrag_) {
+        const IpDefragmenter::Stats& frag = defrag_->stats();
+        stats["frag_pending"] = defrag_->pending();
+        stats["frag_reassembled"] = frag.reassembled;
+        stats["frag_timeouts"] = frag.timeouts;
+        stats["frag_overlaps"] = frag.overlaps;
+        stats["frag_invalid"] = frag.invalid;
+        stats["frag_drop"] = frag.dropped;
+    }
+    if (dns_) {
+        const DnsDissector::Stats& dns = dns_->stats();
+        stats["dns_pending"] = dns_->pending();
+        stats["dns_answered"] = dns.answered;
+        stats["dns_timeouts"] = dns.timeouts;
+        stats["dns_unmatched"] = dns.unmatched;
+        stats["dns_malformed"] = dns.malformed;
+        stats["dns_refused"] = dns.refused;
+    }
+    if (tls_) {
+        const TlsDissector::Stats& tls = tls_->stats();
+        stats["tls_hellos"] = tls.hellos;
+        stats["tls_split"] = tls.split;
+        stats["tls_rejected"] = tls.rejected;
+        stats["tls_malformed"] = tls.malformed;
+        stats["tls_incomplete"] = tls.incomplete;
+        stats["tls_memory_drop"] = tls.memory_drop;
+    }
+    if (http_) {
+        const HttpDissector::Stats& http = http_->stats();
+        stats["http_transactions"] = http.transactions;
+        stats["http_unanswered"] = http.unanswered;
+        stats["http_rejected"] = http.rejected;
+        stats["http_desync"] = http.desync;
+        stats["http_group_drop"] = http_summaries_->dropped();
+    }
+    stats["sample_mode"] = Sampler::modeName(sampler_.mode());
+    stats["sample_rate"] = std::max(sampler_.rate(), sampleFloor());
+    if (flow_control_) {
+        static const char* const mode_names[] = {"full", "sampled", "summary"};
+        stats["mode"] = mode_names[static_cast<int>(mode_)];
+        stats["credits"] = credits_;
+    }
 
-    if (!sendFrame(Protocol::TRAFFIC_LOG, payload)) {
-        std::cerr << "[SNIFFER] Failed to send traffic log" << std::endl;
+    // Peers without large frames take 1 KB: with every dissector on, long
+    // runs outgrow that, so the loss counters the server checks go alone
+    std::string payload = stats.dump();
+    if (payload.size() > Protocol::maxPayload(caps_)) {
+        for (const char* prefix : {"tcp_", "frag_", "dns_", "tls_", "http_"}) {
+            for (auto it = stats.begin(); it != stats.end();) {
+                it = it.key().compare(0, strlen(prefix), prefix) == 0 ? stats.erase(it) : std::next(it);
+            }
+        }
+        payload = stats.dump();
+    }
+
+    // A lost STATS frame is superseded by the next one, but a failed send
+    // means the connection is gone
+    if (!sendFrame(Protocol::STATS, payload)) {
+        linkDown("STATS not sent");
+    }
+}
+
+void Sniffer::deliverRecord(const json& log) {
+    // The packet got here through the Sampler; tag it with the rate it was
+    // kept at so the server and GUI can scale counts back up
+    uint32_t rate = sampler_.lastRate();
+
+    if (flow_control_ && mode_ == DeliveryMode::SUMMARY) {
+        summarizeRecord(log);
+        return;
+    }
+
+    if (rate > 1) {
+        json sampled = log;
+        sampled["sample_rate"] = rate;
+        sendTrafficLog(sampled);
+    } else {
+        sendTrafficLog(log);
+    }
+
+    if (flow_control_) {
+        credits_--;
+    }
+}
+
+void Sniffer::deliverWireRecord(WireRecord record) {
+    record.sample_rate = sampler_.lastRate();
+    if (link_ != LinkState::UP) {
+        spillRecord(record);
+    } else {
+        queueWireRecord(record);
+    }
+
+    if (flow_control_) {
+        credits_--;
+    }
+}
+
+uint32_t Sniffer::sampleFloor() const {
+    return (flow_control_ && mode_ == DeliveryMode::SAMPLED) ? DEGRADED_SAMPLE_RATE : 1;
+}
+
+void Sniffer::updateDeliveryMode() {
+    DeliveryMode next;
+    if (credits_ <= 0) {
+        next = DeliveryMode::SUMMARY;
+    } else if (credits_ < credit_window_ / 4 ||
+               (mode_ != DeliveryMode::FULL && credits_ < credit_window_ / 2)) {
+        next = DeliveryMode::SAMPLED;
+    } else {
+        next = DeliveryMode::FULL;
+    }
+
+    if (next == mode_) return;
+
+    switch (next) {
+        case DeliveryMode::FULL:
+            std::cout << "[SNIFFER] Upstream recovered: sending every record" << std::endl;
+            break;
+        case DeliveryMode::SAMPLED:
+            std::cout << "[SNIFFER] Upstream congested: sampling at least 1 in " << DEGRADED_SAMPLE_RATE
+                      << " packets (credits=" << credits_ << ")" << std::endl;
+            break;
+        case DeliveryMode::SUMMARY:
+            std::cout << "[SNIFFER] Upstream saturated: switching to flow summaries" << std::endl;
+            break;
+    }
+    mode_ = next;
+}
+
+void Sniffer::pollServerFrames() {
+    FrameView frame;
+    if (shm_) {
+        // Frames are handled where they lie in the ring, then released
+        FrameReader::Status status;
+        while ((status = shm_->next(frame)) == FrameReader::Status::FRAME) {
+            handleServerFrame(frame);
+            shm_->consume();
+        }
+        if (status == FrameReader::Status::BAD_FRAME) {
+            linkDown("bad frame: " + shm_->error());
+            return;
+        }
+
+        // The rings do not notice a dead server; its end of the socket does
+        struct pollfd pfd;
+        pfd.fd = server_fd_;
+        pfd.events = 0;
+        if (shm_->closed() || (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR)))) {
+            linkDown("server closed the channel");
+            return;
+        }
+    } else {
+        struct pollfd pfd;
+        pfd.fd = server_fd_;
+        pfd.events = POLLIN;
+
+        // Zero timeout: only consume bytes that have already arrived. One read
+        // takes everything that is there; a partial frame stays in server_rx_.
+        while (true) {
+            FrameReader::Status status = server_rx_.next(frame);
+            if (status == FrameReader::Status::BAD_FRAME) {
+                linkDown("bad frame: " + server_rx_.error());
+                return;
+            }
+            if (status == FrameReader::Status::NEED_MORE) {
+                if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                    break;
+                }
+                // Readable but nothing to read: the server closed or reset
+                if (server_rx_.fill(server_fd_) <= 0) {
+                    linkDown("server closed the connection");
+                    return;
+                }
+                continue;
+            }
+            handleServerFrame(frame);
+        }
+    }
+
+    if (!flow_summaries_.empty() && credits_ > 0) {
+        flushFlowSummaries();
+    }
+}
+
+void Sniffer::handleServerFrame(const FrameView& frame) {
+    if (frame.type == Protocol::CREDIT) {
+        try {
+            credits_ += json::parse(frame.payload).value("credits", int64_t{0});
+        } catch (const json::exception& e) {
+            std::cerr << "[SNIFFER] Bad CREDIT frame: " << e.what() << std::endl;
+        }
+    }
+}
+
+void Sniffer::reportDns(const DnsTransaction& transaction) {
+    char type_buf[12];
+    const char* qtype = DnsDissector::typeName(transaction.qtype, type_buf);
+    uint64_t latency_us = transaction.latency_ns / 1000;
+
+    if (!remote_) {
+        char time_str[RecordCodec::TIMESTAMP_TEXT_SIZE];
+        char client[RecordCodec::IPV4_TEXT_SIZE];
+        char server[RecordCodec::IPV4_TEXT_SIZE];
+        char qname[DnsName::MAX_TEXT];
+        RecordCodec::formatTimestamp(transaction.query_ts_ns, time_str);
+        RecordCodec::formatIpv4(transaction.client_ip, client);
+        RecordCodec::formatIpv4(transaction.server_ip, server);
+        transaction.qname.text(qname);
+
+        // timestamp client:port -> server:port DNS type name rcode latency
+        ConsoleSink& out = ConsoleSink::forThread();
+        out.text(time_str).text(' ').text(client).text(':').number(transaction.client_port)
+           .text(" -> ").text(server).text(':').number(transaction.server_port)
+           .text(" DNS ").text(qtype).text(' ').text(qname).text(' ');
+        if (transaction.answered) {
+            out.text(RecordCodec::dnsRcodeName(transaction.rcode)).text(' ');
+            printMillis(out, latency_us);
+        } else {
+            out.text("no response");
+        }
+        out.endLine();
+        return;
+    }
+
+    json log;
+    log["kind"] = "dns";
+    log["ts_ns"] = transaction.query_ts_ns;
+    log["src_ip"] = transaction.client_ip;
+    log["dst_ip"] = transaction.server_ip;
+    log["src_port"] = transaction.client_port;
+    log["dst_port"] = transaction.server_port;
+    log["protocol"] = "UDP";
+    log["qname"] = transaction.qname.str();
+    log["qtype"] = qtype;
+    if (transaction.answered) {
+        log["latency_us"] = std::min<uint64_t>(latency_us, WireRecord::DNS_NO_RESPONSE - 1);
+        log["rcode"] = RecordCodec::dnsRcodeName(transaction.rcode);
+    } else {
+        log["timeout"] = true;
+    }
+
+    sendTrafficLog(log);
+    if (flow_control_) {
+        credits_--;
+    }
+}
+
+void Sniffer::reportHttp(const HttpTransaction& transaction) {
+    if (remote_) {
+        http_summaries_->add(transaction);
+        return;
+    }
+
+    char time_str[RecordCodec::TIMESTAMP_TEXT_SIZE];
+    char client[RecordCodec::IPV4_TEXT_SIZE];
+    char server[RecordCodec::IPV4_TEXT_SIZE];
+    RecordCodec::formatTimestamp(transaction.request_ts_ns, time_str);
+    RecordCodec::formatIpv4(transaction.client_ip, client);
+    RecordCodec::formatIpv4(transaction.server_ip, server);
+
+    // timestamp client:port -> server:port HTTP method host path status latency
+    ConsoleSink& out = ConsoleSink::forThread();
+    out.text(time_str).text(' ').text(client).text(':').number(transaction.client_port)
+       .text(" -> ").text(server).text(':').number(transaction.server_port)
+       .text(" HTTP ").text(transaction.method).text(' ')
+       .text(transaction.host[0] != '\0' ? transaction.host : "-").text(' ')
+       .text(transaction.path[0] != '\0' ? transaction.path : "-").text(' ')
+       .number(transaction.status).text(' ');
+    printMillis(out, transaction.latency_ns / 1000);
+    out.endLine();
+}
+
+void Sniffer::flushHttpSummaries() {
+    time_t now = time(nullptr);
+    if (now - last_http_summary_ < static_cast<time_t>(http_interval_sec_)) return;
+    last_http_summary_ = now;
+
+    http_summaries_->forEach([this](const HttpSummaryTable::Group& group) {
+        // Trailing empty buckets are left out
+        size_t used = HttpSummaryTable::BUCKETS;
+        while (used > 0 && group.buckets[used - 1] == 0) --used;
+
+        json summary;
+        summary["kind"] = "http_summary";
+        summary["ts_ns"] = group.first_ts_ns;
+        summary["last_ts_ns"] = group.last_ts_ns;
+        summary["host"] = group.host;
+        summary["status"] = group.status;
+        summary["requests"] = group.requests;
+        summary["latency_us"] = group.latency_us_sum / group.requests;
+        summary["max_us"] = group.latency_us_max;
+        summary["buckets"] = std::vector<uint64_t>(group.buckets, group.buckets + used);
+
+        sendTrafficLog(summary);
+        if (flow_control_) {
+            credits_--;
+        }
+    });
+    http_summaries_->clear();
+}
+
+void Sniffer::summarizeRecord(const json& log) {
+    // Key on the 5-tuple, addresses as the parser's raw numbers; ports are
+    // absent for ICMP/OTHER. Overlays reuse inner addresses, so the VNI of
+    // a tunneled packet is part of the key.
+    std::string key = log.value("protocol", "") + "|" +
+                      std::to_string(log.value("src_ip", 0u)) + ":" + std::to_string(log.value("src_port", 0)) + "|" +
+                      std::to_string(log.value("dst_ip", 0u)) + ":" + std::to_string(log.value("dst_port", 0));
+    if (log.contains("vni")) {
+        key += "|" + std::to_string(log["vni"].get<uint32_t>());
+    }
+
+    auto it = flow_summaries_.find(key);
+    if (it == flow_summaries_.end()) {
+        if (flow_summaries_.size() >= MAX_FLOW_SUMMARIES) {
+            loss_.summary_drop++;
+            return;
+        }
+        it = flow_summaries_.emplace(key, FlowSummary()).first;
+        it->second.first = log;
+    } else if (log.contains("tls_version")) {
+        // The ClientHello came after the flow's first record: keep what it named
+        for (const char* field : {"tls_version", "sni", "alpn"}) {
+            if (log.contains(field)) it->second.first[field] = log[field];
+        }
+    }
+
+    // Scale by the sampling rate so summaries are already estimates of
+    // the true packet and byte counts
+    uint32_t rate = sampler_.lastRate();
+    it->second.packets += rate;
+    it->second.bytes += log.value("length", uint64_t{0}) * rate;
+    it->second.last_ts_ns = log.value("ts_ns", uint64_t{0});
+    loss_.summarized++;
+}
+
+void Sniffer::flushFlowSummaries() {
+    // Leave at least half of the credits for live records
+    int64_t budget = std::max<int64_t>(1, credits_ / 2);
+
+    auto it = flow_summaries_.begin();
+    while (it != flow_summaries_.end() && budget > 0) {
+        const FlowSummary& flow = it->second;
+
+        json summary = flow.first;
+        summary["kind"] = "flow_summary";
+        summary["packets"] = flow.packets;
+        summary["bytes"] = flow.bytes;
+        summary["length"] = flow.bytes;
+        summary["last_ts_ns"] = flow.last_ts_ns;
+
+        sendTrafficLog(summary);
+        credits_--;
+        budget--;
+        it = flow_summaries_.erase(it);
+    }
+}
+
+// ============================================================================
+// Reconnect and spill
+// ============================================================================
+
+void Sniffer::maintainUpstream() {
+    switch (link_) {
+        case LinkState::UP:
+            replaySpill();
+            break;
+        case LinkState::DOWN:
+            if (Clock::now() >= next_attempt_) {
+                // A new attempt asks the configured server again: the one a
+                // redirect named may be the one that went away
+                redirects_ = 0;
+                target_ip_ = server_ip_;
+                target_port_ = server_port_;
+                beginReconnect();
+            }
+            break;
+        case LinkState::CONNECTING:
+            checkConnect();
+            break;
+        case LinkState::HANDSHAKE:
+            checkHandshake();
+            break;
+    }
+}
+
+void Sniffer::beginReconnect() {
+    link_deadline_ = Clock::now() + CONNECT_TIMEOUT;
+
+    if (!shm_path_.empty()) {
+        // A local Unix socket: connecting does not block
+        try {
+            shm_ = Shm::Channel::connect(shm_path_);
+        } catch (const std::exception& e) {
+            linkDown(e.what());
+            return;
+        }
+        server_fd_ = shm_->fd();
+        if (!sendClientHello()) {
+            linkDown("CLIENT_HELLO not sent");
+            return;
+        }
+        link_ = LinkState::HANDSHAKE;
+        return;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(target_port_);
+    if (inet_pton(AF_INET, target_ip_.c_str(), &server_addr.sin_addr) <= 0) {
+        linkDown("invalid server address " + target_ip_);
+        return;
+    }
+
+    server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd_ < 0) {
+        linkDown(std::string("socket: ") + strerror(errno));
+        return;
+    }
+    setNoDelay(server_fd_);
+
+    // Non-blocking only while connecting; sendFrame() expects a blocking socket
+    fcntl(server_fd_, F_SETFL, fcntl(server_fd_, F_GETFL) | O_NONBLOCK);
+    if (connect(server_fd_, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+        linkDown(std::string("connect: ") + strerror(errno));
+        return;
+    }
+    link_ = LinkState::CONNECTING;
+}
+
+void Sniffer::checkConnect() {
+    struct pollfd pfd;
+    pfd.fd = server_fd_;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, 0) <= 0) {
+        if (Clock::now() >= link_deadline_) linkDown("connect timed out");
+        return;
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(server_fd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        linkDown(std::string("connect: ") + strerror(error ? error : errno));
+        return;
+    }
+
+    fcntl(server_fd_, F_SETFL, fcntl(server_fd_, F_GETFL) & ~O_NONBLOCK);
+    if (!sendClientHello()) {
+        linkDown("CLIENT_HELLO not sent");
+        return;
+    }
+    link_ = LinkState::HANDSHAKE;
+}
+
+void Sniffer::checkHandshake() {
+    FrameView frame;
+    FrameReader::Status status;
+
+    if (shm_) {
+        status = shm_->next(frame);
+        if (status == FrameReader::Status::NEED_MORE && shm_->closed()) {
+            linkDown("server closed the channel");
+            return;
+        }
+    } else {
+        status = server_rx_.next(frame);
+        if (status == FrameReader::Status::NEED_MORE) {
+            struct pollfd pfd;
+            pfd.fd = server_fd_;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                if (server_rx_.fill(server_fd_) <= 0) {
+                    linkDown("server closed the connection");
+                    return;
+                }
+                status = server_rx_.next(frame);
+            }
+        }
+    }
+
+    if (status == FrameReader::Status::NEED_MORE) {
+        if (Clock::now() >= link_deadline_) linkDown("no SERVER_HELLO");
+        return;
+    }
+    if (status == FrameReader::Status::BAD_FRAME || frame.type != Protocol::SERVER_HELLO) {
+        linkDown("no SERVER_HELLO");
+        return;
+    }
+
+    bool accepted;
+    try {
+        accepted = applyServerHello(frame.payload);
+    } catch (const std::exception& e) {
+        linkDown(e.what());
+        return;
+    }
+    if (shm_) shm_->consume();
+
+    if (accepted) {
+        linkUp();
+        return;
+    }
+
+    // The pool changed while we were away: go straight to the new owner
+    closeLink();
+    if (++redirects_ > MAX_REDIRECTS) {
+        linkDown("too many redirects between servers");
+        return;
+    }
+    beginReconnect();
+}
+
+void Sniffer::linkUp() {
+    link_ = LinkState::UP;
+    backoff_ = INITIAL_BACKOFF;
+    reconnects_++;
+
+    // A new session on the server: its sequence check starts over
+    tx_seq_ = 0;
+    last_stats_report_ = 0;
+    replay_tokens_ = 0;
+    replay_clock_ = Clock::now();
+
+    std::cout << "[SNIFFER] Reconnected to server (SSID " << ssid_ << "); "
+              << spill_->pending() << " spilled records to replay" << std::endl;
+}
+
+void Sniffer::linkDown(const std::string& why) {
+    if (link_ == LinkState::UP) {
+        std::cerr << "[SNIFFER] Lost connection to server (" << why << "); spilling records locally" << std::endl;
+    } else {
+        std::cerr << "[SNIFFER] Reconnect failed (" << why << ")" << std::endl;
+    }
+
+    // Records numbered for the old session are renumbered on replay
+    for (size_t i = 0; i < record_batch_.size(); ++i) {
+        spillRecord(record_batch_.row(i));
+    }
+    record_batch_.clear();
+    closeLink();
+
+    // Start from what a fresh CLIENT_HELLO negotiates; pending flow
+    // summaries wait for the new session's credits
+    caps_ = Protocol::LEGACY_CAPS;
+    batch_capacity_ = 1;
+    flow_control_ = false;
+    credit_window_ = 0;
+    credits_ = 0;
+    mode_ = DeliveryMode::FULL;
+
+    link_ = LinkState::DOWN;
+    next_attempt_ = Clock::now() + backoff_;
+    std::cerr << "[SNIFFER] Retrying in " << backoff_.count() / 1000.0 << "s" << std::endl;
+    backoff_ = std::min(backoff_ * 2, MAX_BACKOFF);
+}
+
+void Sniffer::closeLink() {
+    if (shm_) {
+        shm_.reset();           // The channel closes its own socket
+    } else if (server_fd_ != -1) {
+        close(server_fd_);
+    }
+    server_fd_ = -1;
+    server_rx_ = FrameReader();
+}
+
+void Sniffer::spillRecord(WireRecord record) {
+    record.seq = 0;
+    if (!spill_->push(record) && spill_->dropped() == 1) {
+        std::cerr << "[SNIFFER] Spill buffer full; dropping records (counted as send_drop in STATS)" << std::endl;
+    }
+}
+
+void Sniffer::replaySpill() {
+    if (spill_->empty()) return;
+
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - replay_clock_).count();
+    replay_clock_ = now;
+
+    // Refill, allowing a burst of at most a tenth of a second's worth
+    double burst = std::max(1.0, replay_rate_ / 10.0);
+    replay_tokens_ = std::min(burst, replay_tokens_ + elapsed * replay_rate_);
+
+    // Only spend credits above half the window: live records keep enough
+    // to stay in FULL mode until the server returns the replayed ones
+    int64_t budget = static_cast<int64_t>(replay_tokens_);
+    if (flow_control_) {
+        if (mode_ != DeliveryMode::FULL) return;
+        budget = std::min(budget, credits_ - credit_window_ / 2);
+    }
+    if (budget <= 0) return;
+
+    replay_batch_.clear();
+    size_t count = spill_->pop(replay_batch_, static_cast<size_t>(budget));
+    for (size_t i = 0; i < count; ++i) {
+        WireRecord record = replay_batch_.row(i);
+        record.flags |= WireRecord::FLAG_REPLAYED;
+        if (link_ == LinkState::UP && (caps_ & Protocol::CAP_BINARY)) {
+            queueWireRecord(record);
+        } else {
+            sendTrafficLog(RecordCodec::toJson(record));    // Spills again if the link dropped
+        }
+    }
+
+    replay_tokens_ -= count;
+    replayed_ += count;
+    if (flow_control_) {
+        credits_ -= count;
+    }
+    if (link_ == LinkState::UP) {
+        flushRecordBatch();
     }
 }
 
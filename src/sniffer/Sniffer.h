@@ -13,12 +13,91 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <csignal>
 #include <nlohmann/json.hpp>
 #include "../Protocol.h"
+#include "../FrameReader.h"
+#include "../RecordCodec.h"
+#include "../ColumnCodec.h"
+#include "../ShmTransport.h"
+#include "Sampler.h"
+#include "PcapngWriter.h"
+#include "SpillBuffer.h"
+#include "TcpReassembler.h"
+#include "IpDefragmenter.h"
+#include "DnsDissector.h"
+#include "TlsDissector.h"
+#include "HttpDissector.h"
+#include "BatchParser.h"
 
 using json = nlohmann::json;
 
+struct bpf_hdr;
+
+/**
+ * @struct CaptureOptions
+ * @brief Optional capture settings beyond interface and server address
+ */
+struct CaptureOptions {
+    /// Sampling policy applied to raw packets before parsing
+    Sampler::Mode sample_mode = Sampler::Mode::NONE;
+
+    /// Base sampling rate N (keep 1 in N)
+    uint32_t sample_rate = 1;
+
+    /// Upstream bandwidth budget in bytes/sec; the sampling rate adapts to
+    /// stay under it. 0 disables adaptation.
+    uint64_t upstream_budget = 0;
+
+    /// Full-payload pcapng recording (disabled while pcap.prefix is empty).
+    /// Every captured packet is recorded, independent of sampling.
+    PcapngOptions pcap;
+
+    /// Offer binary, batched records in CLIENT_HELLO. The server still
+    /// decides; old servers answer without "caps" and get JSON either way.
+    bool binary_records = true;
+
+    /// Also offer packed batches ("lz"): about 5x fewer bytes than plain
+    /// binary records for some CPU. Only used together with binary_records.
+    bool compress_records = true;
+
+    /// Reach a server on this host through shared memory: path of its
+    /// --shm socket. Takes the place of server_ip/server_port.
+    std::string shm_path;
+
+    /// Backlog kept while the server is unreachable, and how fast it is
+    /// replayed once the sniffer has reconnected
+    SpillOptions spill;
+
+    /// Memory and overlap policy of TCP stream reassembly (for the
+    /// application-layer dissectors)
+    ReassemblyOptions tcp;
+
+    /// Limits of IPv4 fragment reassembly; memory_bytes 0 turns it off
+    /// (fragments are then parsed one by one)
+    FragmentOptions fragments;
+
+    /// Limits of DNS query/response matching; max_pending 0 turns it off
+    DnsOptions dns;
+
+    /// Server ports whose ClientHellos are read for SNI and ALPN (no
+    /// ports: off) and the memory for hellos spanning segments
+    TlsOptions tls;
+
+    /// Server ports whose HTTP/1.x exchanges are timed (no ports: off)
+    /// and how they are summarized for the server
+    HttpOptions http;
+
+    /// Tunnel layers (VXLAN, GENEVE, GRE/ERSPAN, IP-in-IP) taken off a
+    /// packet to reach the one it carries; 0 reports the outer packet
+    unsigned tunnel_depth = 4;
+};
+
 /**
  * @class Sniffer
  * @brief Network packet capture class using Berkeley Packet Filter (BPF)
@@ -62,7 +141,8 @@ public:
      * @note Requires root privileges to access BPF devices
      * @see openBpfDevice(), configureInterface()
      */
-    explicit Sniffer(const std::string& iface, const std::string& server_ip = "", int server_port = 0);
+    explicit Sniffer(const std::string& iface, const std::string& server_ip = "", int server_port = 0,
+                     const CaptureOptions& options = CaptureOptions());
 
     /**
      * @brief Destructor - automatically cleans up BPF device resources
@@ -78,16 +158,36 @@ public:
      * @brief Starts the main packet capture loop
      * 
      * Begins continuous packet capture from the configured network interface.
-     * This function runs indefinitely until interrupted by a signal or an
-     * error occurs. Each captured packet is passed to the PacketParser for
-     * analysis and display.
+     * This function runs until requestStop() is called or an error occurs.
+     * Each captured packet is passed to the PacketParser for analysis and
+     * display.
      * 
      * @throws std::runtime_error if packet reading fails
-     * @note This function blocks until interrupted (typically by Ctrl+C)
+     * @note This function blocks until stopped (typically by Ctrl+C)
      * @see doReadLoop(), PacketParser::parseAndPrint()
      */
     void run();
 
+    /**
+     * @brief Make run() return after the buffer it is working on
+     *
+     * Only sets a flag, so it may be called from a signal handler. run()
+     * sees it within READ_TIMEOUT_MS even on a quiet interface.
+     */
+    void requestStop() { stop_requested_ = 1; }
+
+    /**
+     * @brief Finish the pcapng recording, if any, and drop the spill buffer
+     *
+     * Drains the pcapng ring and closes the current file so it ends on a
+     * complete block. Records still waiting in the spill buffer are lost
+     * and its file is removed. Called on shutdown, on the thread that ran
+     * run() once it has returned (see requestStop()), and again by the
+     * destructor; later calls do nothing. Joins threads and writes output,
+     * so never from a signal handler.
+     */
+    void stop();
+
 private:
     /**
      * @brief Discovers and opens an available BPF device
@@ -155,6 +255,9 @@ private:
      * to bind the BPF device to the specific interface.
      */
     std::string iface_;
+
+    /// Set by requestStop(), possibly from a signal handler
+    volatile sig_atomic_t stop_requested_ = 0;
     
     /**
      * @brief Packet capture buffer
@@ -166,16 +269,339 @@ private:
      */
     std::vector<unsigned char> buffer_;
 
-    std::string server_ip_;
+    /// Packets of the current buffer, in order, and their header fields
+    /// (BatchParser, binary records only)
+    std::vector<const struct bpf_hdr*> packet_headers_;
+    std::vector<const unsigned char*> packet_frames_;
+    std::vector<uint32_t> packet_lengths_;
+    PacketColumns packet_columns_;
+
+    std::string server_ip_;     ///< Configured server; every new attempt starts here
     int server_port_;
-    int server_fd_ = -1;
+    std::string target_ip_;     ///< Server of the current attempt: the configured one or a redirect's
+    int target_port_;
+    std::string shm_path_;      ///< --shm socket, empty over TCP
+    int server_fd_ = -1;        ///< Server socket (the channel's socket with shared memory)
+    FrameReader server_rx_;     ///< Frames from the server (SERVER_HELLO, CREDIT)
+    std::unique_ptr<Shm::Channel> shm_; ///< Shared-memory channel (--shm), null over TCP
     uint32_t ssid_ = 0;
 
+    /**
+     * @enum LinkState
+     * @brief Where the connection to the server stands (distributed mode)
+     *
+     * - UP: SERVER_HELLO received; records are sent
+     * - DOWN: waiting for the next reconnect attempt
+     * - CONNECTING: non-blocking connect() in progress
+     * - HANDSHAKE: CLIENT_HELLO sent, waiting for SERVER_HELLO
+     *
+     * Every state but UP sends records to the SpillBuffer. The capture loop
+     * advances the state in maintainUpstream() and never waits on it.
+     */
+    enum class LinkState { UP, DOWN, CONNECTING, HANDSHAKE };
+
+    using Clock = std::chrono::steady_clock;
+
+    bool remote_ = false;               ///< A server was configured (distributed mode)
+    LinkState link_ = LinkState::DOWN;
+    Clock::time_point next_attempt_;    ///< DOWN: when to try again
+    Clock::time_point link_deadline_;   ///< CONNECTING/HANDSHAKE: when to give up
+    std::chrono::milliseconds backoff_ = INITIAL_BACKOFF;
+    int redirects_ = 0;                 ///< Redirects followed by the current attempt
+    uint64_t reconnects_ = 0;
+
+    std::unique_ptr<SpillBuffer> spill_; ///< Records captured while not UP
+    uint32_t replay_rate_ = 0;          ///< Records/s replayed from spill_
+    double replay_tokens_ = 0;          ///< Replay token bucket
+    Clock::time_point replay_clock_;    ///< Last refill of replay_tokens_
+    RecordColumns replay_batch_;        ///< Records being replayed
+    uint64_t replayed_ = 0;
+
+    /// First reconnect delay; doubled after every failed attempt
+    static constexpr std::chrono::milliseconds INITIAL_BACKOFF{1000};
+
+    /// Longest delay between reconnect attempts
+    static constexpr std::chrono::milliseconds MAX_BACKOFF{30000};
+
+    /// Time a reconnect attempt gets for connect() and SERVER_HELLO
+    static constexpr std::chrono::milliseconds CONNECT_TIMEOUT{5000};
+
+    /**
+     * @struct LossCounters
+     * @brief Where captured packets were lost on the sniffer side
+     *
+     * Reported to the server in STATS frames so operators can see which
+     * stage is dropping data under overload:
+     * - kernel_recv/kernel_drop: BIOCGSTATS totals (packets the kernel saw
+     *   vs. packets it discarded because our BPF buffer was full)
+     * - ring_drop: truncated records discarded while walking a BPF buffer
+     * - send_drop: records lost on the way to the server (the spill buffer
+     *   was full while the server was unreachable)
+     */
+    struct LossCounters {
+        uint64_t kernel_recv = 0;
+        uint64_t kernel_drop = 0;
+        uint64_t ring_drop = 0;
+        uint64_t send_drop = 0;
+        uint64_t sampled_out = 0;    ///< Packets skipped by the Sampler
+        uint64_t summarized = 0;     ///< Records folded into flow summaries
+        uint64_t summary_drop = 0;   ///< Records lost because the summary table was full
+    };
+
+    LossCounters loss_;
+    uint64_t tx_seq_ = 0;               ///< Last TRAFFIC_LOG sequence number sent
+    uint32_t offered_caps_ = Protocol::LEGACY_CAPS; ///< Capabilities sent in CLIENT_HELLO
+    uint32_t caps_ = Protocol::LEGACY_CAPS;         ///< Capabilities agreed in SERVER_HELLO
+    RecordColumns record_batch_;        ///< Records waiting for the next RECORD_BATCH (binary mode)
+    size_t batch_capacity_ = 1;         ///< Records per RECORD_BATCH frame
+    std::string batch_payload_;         ///< Frame payload being built by flushRecordBatch()
+    std::string pack_scratch_;          ///< Scratch buffer for ColumnCodec::packBatch()
+    uint64_t batch_raw_bytes_ = 0;      ///< Batched records as plain binary (count x 42)
+    uint64_t batch_sent_bytes_ = 0;     ///< Payload bytes those batches actually took
+    time_t last_stats_report_ = 0;      ///< When the last STATS frame was sent
+
+    /// Seconds between STATS reports to the server
+    static constexpr int STATS_INTERVAL_SEC = 2;
+
+    /**
+     * @enum DeliveryMode
+     * @brief How records are delivered upstream given the remaining credits
+     *
+     * - FULL: every record is sent (credits >= half the window)
+     * - SAMPLED: the Sampler rate is forced to at least DEGRADED_SAMPLE_RATE (credits low)
+     * - SUMMARY: no credits left; records are aggregated per flow and the
+     *   summaries are sent once the server grants more credits
+     *
+     * Switching back to FULL requires half a window of credits, so the mode
+     * does not flap around the low watermark.
+     */
+    enum class DeliveryMode { FULL, SAMPLED, SUMMARY };
+
+    /**
+     * @struct FlowSummary
+     * @brief Aggregate of the records seen for one 5-tuple while in SUMMARY mode
+     */
+    struct FlowSummary {
+        json first;                   ///< First record of the flow (addresses, ports, protocol)
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        uint64_t last_ts_ns = 0;      ///< Capture time of the latest record
+    };
+
+    bool flow_control_ = false;         ///< Server granted credits in SERVER_HELLO
+    int64_t credit_window_ = 0;         ///< Initial window from SERVER_HELLO
+    int64_t credits_ = 0;               ///< Records we may still send
+    DeliveryMode mode_ = DeliveryMode::FULL;
+    Sampler sampler_;                   ///< Per-packet sampling decision (see CaptureOptions)
+    std::unique_ptr<PcapngWriter> pcap_; ///< Full-payload recorder, null unless --pcap
+    std::unique_ptr<TlsDissector> tls_;  ///< Null if off; declared before tcp_, which holds its state
+    std::unique_ptr<HttpDissector> http_; ///< Null if off; likewise before tcp_
+    std::unique_ptr<TcpReassembler> tcp_; ///< In the packet path only while a dissector uses it
+    std::unique_ptr<IpDefragmenter> defrag_; ///< Null if fragment reassembly is off
+    std::unique_ptr<DnsDissector> dns_;  ///< Null if DNS matching is off
+    std::unordered_map<std::string, FlowSummary> flow_summaries_;
+    std::unique_ptr<HttpSummaryTable> http_summaries_; ///< Transactions since the last flushHttpSummaries()
+    uint32_t http_interval_sec_ = 0;    ///< HttpOptions::interval_sec
+    time_t last_http_summary_ = 0;      ///< When HTTP summaries were last sent
+
+    /// Minimum sampling rate forced while credits are running low
+    static constexpr uint32_t DEGRADED_SAMPLE_RATE = 8;
+
+    /// BIOCSRTIMEOUT: longest read() on a quiet interface
+    static constexpr int READ_TIMEOUT_MS = 100;
+
+    /// Redirects followed in a row before giving up (a pool needs at most one)
+    static constexpr int MAX_REDIRECTS = 3;
+
+    /// Upper bound on flows tracked while in SUMMARY mode
+    static constexpr size_t MAX_FLOW_SUMMARIES = 4096;
+
     void connectToServer();
-    void sendClientHello();
-    void receiveServerHello();
+
+    /**
+     * @brief Reach the server through shared memory instead of TCP
+     *
+     * Creates the rings and hands them to the server at path; afterwards
+     * sendFrame(), receiveServerHello() and pollServerFrames() use them
+     * and server_fd_ is the channel's doorbell socket.
+     */
+    void connectShm(const std::string& path);
+
+    /// @return false if the frame could not be sent
+    bool sendClientHello();
+
+    /**
+     * @brief Wait for SERVER_HELLO and apply it (first connection only)
+     * @return false if the server redirected us; target_ip_ and target_port_
+     *         then name the server to connect to instead
+     * @throws std::runtime_error if no valid SERVER_HELLO arrives
+     */
+    bool receiveServerHello();
+
+    /**
+     * @brief Apply the SSID, credits and capabilities of a SERVER_HELLO
+     * @return false on a redirect (see receiveServerHello())
+     * @throws std::runtime_error if the payload is malformed
+     */
+    bool applyServerHello(std::string_view payload);
+
+    // ========================================================================
+    // Reconnect and spill
+    // ========================================================================
+
+    /**
+     * @brief Advance the connection state machine; replay while UP
+     *
+     * Called on every pass of the capture loop, including the empty reads
+     * BIOCSRTIMEOUT produces while the interface is idle. Only makes
+     * non-blocking calls.
+     */
+    void maintainUpstream();
+
+    /// Start a reconnect attempt (DOWN -> CONNECTING, or HANDSHAKE over shm)
+    void beginReconnect();
+
+    /// CONNECTING: check whether connect() finished and send CLIENT_HELLO
+    void checkConnect();
+
+    /// HANDSHAKE: pick up SERVER_HELLO if it arrived
+    void checkHandshake();
+
+    /**
+     * @brief The connection failed or was lost: spill and schedule a retry
+     *
+     * Unsent records of the current batch go to the SpillBuffer, the
+     * negotiated state is reset to what a new CLIENT_HELLO starts from, and
+     * the next attempt is scheduled after the current backoff.
+     *
+     * @param why Reason for the log message
+     */
+    void linkDown(const std::string& why);
+
+    /// SERVER_HELLO accepted on a reconnect: start a new session
+    void linkUp();
+
+    /// Close the socket or shared-memory channel
+    void closeLink();
+
+    /// Keep one record for replay (spill_drop counts what does not fit)
+    void spillRecord(WireRecord record);
+
+    /**
+     * @brief Resend spilled records, at most replay_rate_ per second
+     *
+     * Only in FULL delivery mode and only with the credits above half the
+     * window, so the backlog never pushes live records into sampling or
+     * summaries. Replayed records carry FLAG_REPLAYED and new sequence
+     * numbers.
+     */
+    void replaySpill();
     bool sendFrame(uint8_t type, const std::string& payload);
-    bool readExact(int fd, void* buf, size_t len);
-    bool readFrame(int fd, uint8_t& type, std::string& payload);
     void sendTrafficLog(const json& log);
+
+    /**
+     * @brief Append one record to the pending RECORD_BATCH (binary mode)
+     *
+     * The batch is sent when it is full and at the end of every BPF buffer,
+     * so batching never holds a record for longer than one read().
+     */
+    void queueBinaryRecord(const json& log);
+
+    /// Number one record and append it to the pending RECORD_BATCH
+    void queueWireRecord(WireRecord record);
+
+    /**
+     * @brief Send the pending records, if any
+     *
+     * As RECORD_BATCH_LZ when "lz" was agreed and packing makes the batch
+     * smaller, otherwise as RECORD_BATCH.
+     */
+    void flushRecordBatch();
+
+    /**
+     * @brief Minimum sampling rate the current DeliveryMode imposes
+     * @return DEGRADED_SAMPLE_RATE while in SAMPLED mode, otherwise 1
+     */
+    uint32_t sampleFloor() const;
+
+    /**
+     * @brief Route one parsed record according to the current DeliveryMode
+     *
+     * This is the PacketParser log callback in distributed mode. It never
+     * blocks: when credits are exhausted the record is summarized instead
+     * of being written to the socket. Records kept by the Sampler at a rate
+     * above 1 are tagged with "sample_rate".
+     *
+     * @param log JSON record produced by PacketParser::parseToJSON()
+     */
+    void deliverRecord(const json& log);
+
+    /**
+     * @brief deliverRecord() for a record PacketParser::parseToRecord() built
+     *
+     * Binary records only, and not in SUMMARY mode: the caller takes the
+     * JSON path for those.
+     */
+    void deliverWireRecord(WireRecord record);
+
+    /**
+     * @brief Drain pending CREDIT frames from the server without blocking
+     *
+     * Called once per BPF buffer. Uses poll() with a zero timeout so the
+     * capture loop never waits on the server. A closed or corrupt
+     * connection takes the link down.
+     */
+    void pollServerFrames();
+
+    /// Act on one frame from the server (CREDIT; others are ignored)
+    void handleServerFrame(const FrameView& frame);
+
+    /**
+     * @brief Re-evaluate the DeliveryMode from the remaining credits
+     *
+     * Prints a message on every transition so operators can see when the
+     * upstream is saturated.
+     */
+    void updateDeliveryMode();
+
+    /**
+     * @brief DnsDissector callback: one line (console) or one "kind":"dns" record
+     *
+     * Records bypass sampling and summarizing: there is one per query, and
+     * a sampled latency would be of little use.
+     */
+    void reportDns(const DnsTransaction& transaction);
+
+    /**
+     * @brief HttpDissector callback: one line (console) or into http_summaries_
+     *
+     * Remote mode sends no per-request records; flushHttpSummaries() ships
+     * the latency histograms instead.
+     */
+    void reportHttp(const HttpTransaction& transaction);
+
+    /**
+     * @brief Send one "kind":"http_summary" record per (host, status) if the
+     * summary interval has elapsed, and start the next interval
+     *
+     * Called after every read(), timeouts included. Like DNS records, summaries bypass
+     * sampling and SUMMARY mode. Transactions of an interval that has not
+     * ended when capture stops are not sent.
+     */
+    void flushHttpSummaries();
+
+    /// Fold a record into its flow summary (SUMMARY mode)
+    void summarizeRecord(const json& log);
+
+    /// Send pending flow summaries, using at most half of the available credits
+    void flushFlowSummaries();
+
+    /**
+     * @brief Send a STATS frame if STATS_INTERVAL_SEC has elapsed
+     *
+     * Refreshes kernel counters via BIOCGSTATS and reports all LossCounters
+     * together with the current sequence number, so the server can compare
+     * what we sent against what it received.
+     */
+    void reportLossStats();
 };
\ No newline at end of file
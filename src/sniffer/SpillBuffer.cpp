@@ -0,0 +1,168 @@
+/**
+ * @file SpillBuffer.cpp
+ * @brief Implementation of the memory-then-disk record backlog
+ */
+
+#include "SpillBuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+/// Whole records per disk read
+constexpr size_t READ_CHUNK = SpillBuffer::WRITE_CHUNK / RecordCodec::WIRE_SIZE * RecordCodec::WIRE_SIZE;
+
+} // namespace
+
+SpillBuffer::SpillBuffer(const SpillOptions& options) : options_(options) {
+    if (!options_.path.empty()) {
+        fd_ = open(options_.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd_ == -1) {
+            throw std::runtime_error("spill: cannot create " + options_.path + ": " + strerror(errno));
+        }
+        write_buf_.reserve(WRITE_CHUNK + RecordCodec::WIRE_SIZE);
+    }
+}
+
+SpillBuffer::~SpillBuffer() {
+    if (fd_ != -1) {
+        close(fd_);
+        unlink(options_.path.c_str());
+    }
+}
+
+// ============================================================================
+// Push
+// ============================================================================
+
+bool SpillBuffer::push(const WireRecord& record) {
+    // Memory only while nothing is waiting on disk, so pop() can always
+    // drain memory first without reordering
+    if (disk_records_ == 0 && mem_.size() < options_.memory_records) {
+        mem_.push_back(record);
+        ++spilled_;
+        return true;
+    }
+    if (pushToDisk(record)) {
+        ++spilled_;
+        ++spilled_to_disk_;
+        return true;
+    }
+    ++dropped_;
+    return false;
+}
+
+bool SpillBuffer::pushToDisk(const WireRecord& record) {
+    if (fd_ == -1) return false;
+    if (write_off_ + write_buf_.size() + RecordCodec::WIRE_SIZE > options_.disk_bytes) return false;
+
+    size_t at = write_buf_.size();
+    write_buf_.resize(at + RecordCodec::WIRE_SIZE);
+    RecordCodec::encode(record, &write_buf_[at]);
+    ++disk_records_;
+
+    // A failed write counts the whole tier as dropped, this record included
+    if (write_buf_.size() >= WRITE_CHUNK) flushWrites();
+    return true;
+}
+
+void SpillBuffer::flushWrites() {
+    size_t done = 0;
+    while (done < write_buf_.size()) {
+        ssize_t n = pwrite(fd_, write_buf_.data() + done, write_buf_.size() - done,
+                           static_cast<off_t>(write_off_ + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            diskFailed("write");
+            return;
+        }
+        done += static_cast<size_t>(n);
+    }
+    write_off_ += write_buf_.size();
+    write_buf_.clear();
+}
+
+// ============================================================================
+// Pop
+// ============================================================================
+
+size_t SpillBuffer::pop(RecordColumns& out, size_t max) {
+    size_t taken = 0;
+
+    while (taken < max && !mem_.empty()) {
+        out.push_back(mem_.front());
+        mem_.pop_front();
+        ++taken;
+    }
+
+    while (taken < max && disk_records_ > 0) {
+        if (read_pos_ == read_buf_.size() && !fillReadBuffer()) break;
+        size_t n = std::min(max - taken, (read_buf_.size() - read_pos_) / RecordCodec::WIRE_SIZE);
+        for (size_t i = 0; i < n; ++i) {
+            out.push_back(RecordCodec::decode(&read_buf_[read_pos_]));
+            read_pos_ += RecordCodec::WIRE_SIZE;
+        }
+        disk_records_ -= n;
+        taken += n;
+    }
+    return taken;
+}
+
+bool SpillBuffer::fillReadBuffer() {
+    read_buf_.clear();
+    read_pos_ = 0;
+
+    if (read_off_ < write_off_) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(READ_CHUNK, write_off_ - read_off_));
+        read_buf_.resize(want);
+        size_t done = 0;
+        while (done < want) {
+            ssize_t n = pread(fd_, &read_buf_[done], want - done, static_cast<off_t>(read_off_ + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                read_buf_.clear();
+                diskFailed("read");
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        read_off_ += want;
+        // Read to the end: start over at offset 0 so the file does not grow
+        // across outages. write_buf_ is written there on its next flush.
+        if (read_off_ == write_off_) truncateFile();
+        return true;
+    }
+
+    // Everything on disk has been read; the rest never left write_buf_
+    read_buf_.swap(write_buf_);
+    truncateFile();
+    return !read_buf_.empty();
+}
+
+void SpillBuffer::truncateFile() {
+    if (ftruncate(fd_, 0) != 0) {
+        std::cerr << "[SNIFFER] Cannot truncate spill file " << options_.path << ": "
+                  << strerror(errno) << std::endl;
+    }
+    read_off_ = 0;
+    write_off_ = 0;
+}
+
+void SpillBuffer::diskFailed(const char* what) {
+    std::cerr << "[SNIFFER] Spill file " << what << " failed (" << strerror(errno) << "); "
+              << disk_records_ << " spilled records lost, continuing in memory only" << std::endl;
+    dropped_ += disk_records_;
+    disk_records_ = 0;
+    write_buf_.clear();
+    read_buf_.clear();
+    read_pos_ = 0;
+    close(fd_);
+    unlink(options_.path.c_str());
+    fd_ = -1;
+}
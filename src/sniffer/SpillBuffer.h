@@ -0,0 +1,120 @@
+/**
+ * @file SpillBuffer.h
+ * @brief Bounded local backlog for records captured while the server is away
+ *
+ * Without a server connection the sniffer used to count every record as a
+ * send failure. While the connection is down it now pushes them here
+ * instead, and replays them once it is back (see Sniffer::replaySpill()).
+ *
+ * ## Tiers
+ *
+ * Records go to a bounded queue in memory first. Once that is full they
+ * are appended to a spill file (if one was configured), up to a size
+ * limit. Past that, new records are dropped and counted. Records always
+ * leave in the order they arrived:
+ * - while anything is on disk, new records go to disk too, behind it
+ * - pop() drains memory first (it holds only records older than the disk)
+ * - the file is truncated to zero whenever it has been read to the end
+ *
+ * ## I/O
+ *
+ * The capture loop calls push() and pop() directly. Disk traffic is batched
+ * into WRITE_CHUNK-sized write() and pread() calls on the page cache, so an
+ * outage at 100k records/s costs about four writes per second. The file
+ * never outlives the process: it is truncated on open and removed on
+ * destruction, so a restart does not replay a previous run's backlog.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include "../ColumnCodec.h"
+
+/**
+ * @struct SpillOptions
+ * @brief Where and how much to buffer while disconnected
+ */
+struct SpillOptions {
+    size_t memory_records = 1 << 18;    ///< Memory tier (~11 MB at 42 bytes/record)
+    std::string path;                   ///< Spill file; empty = memory tier only
+    uint64_t disk_bytes = 1ull << 30;   ///< Spill file limit
+    uint32_t replay_rate = 20000;       ///< Records/s replayed after a reconnect
+};
+
+/**
+ * @class SpillBuffer
+ * @brief FIFO of WireRecords, in memory first and then on disk
+ *
+ * Not thread-safe: used only by the capture loop.
+ */
+class SpillBuffer {
+public:
+    /// Bytes per write() and pread() on the spill file
+    static constexpr size_t WRITE_CHUNK = 1 << 20;
+
+    /**
+     * @brief Allocate the memory tier and create (or truncate) the spill file
+     * @throws std::runtime_error if the spill file cannot be opened
+     */
+    explicit SpillBuffer(const SpillOptions& options);
+
+    /// Closes and removes the spill file
+    ~SpillBuffer();
+
+    SpillBuffer(const SpillBuffer&) = delete;
+    SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+    /**
+     * @brief Append one record (never blocks on anything but the page cache)
+     * @return false if both tiers are full and the record was dropped
+     */
+    bool push(const WireRecord& record);
+
+    /**
+     * @brief Move up to max of the oldest records into out
+     * @return Records appended to out
+     */
+    size_t pop(RecordColumns& out, size_t max);
+
+    /// Records waiting to be replayed
+    uint64_t pending() const { return mem_.size() + disk_records_; }
+
+    bool empty() const { return pending() == 0; }
+
+    /// Records ever accepted by push()
+    uint64_t spilled() const { return spilled_; }
+
+    /// Records refused by push() or lost to a disk error
+    uint64_t dropped() const { return dropped_; }
+
+    /// Records that went through the spill file
+    uint64_t spilledToDisk() const { return spilled_to_disk_; }
+
+private:
+    bool pushToDisk(const WireRecord& record);
+    void flushWrites();
+    bool fillReadBuffer();
+    void truncateFile();
+    void diskFailed(const char* what);
+
+    SpillOptions options_;
+
+    // Memory tier: grows in deque blocks up to memory_records, so a
+    // sniffer that never loses its server never pays for it
+    std::deque<WireRecord> mem_;
+
+    // Disk tier: [read_off_, write_off_) in the file, then write_buf_
+    int fd_ = -1;
+    std::string write_buf_;             ///< Encoded records not yet written
+    std::string read_buf_;              ///< Encoded records read but not yet popped
+    size_t read_pos_ = 0;
+    uint64_t write_off_ = 0;
+    uint64_t read_off_ = 0;
+    uint64_t disk_records_ = 0;         ///< In the file, write_buf_ or read_buf_
+
+    uint64_t spilled_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t spilled_to_disk_ = 0;
+};
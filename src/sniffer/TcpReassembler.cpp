@@ -0,0 +1,392 @@
+/**
+ * @file TcpReassembler.cpp
+ * @brief Implementation of TCP stream reassembly
+ */
+
+#include "TcpReassembler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <netinet/tcp.h>
+
+static_assert(sizeof(TcpSegmentBuffer) == 2048, "segment buffers should fill exactly 2 KB");
+
+namespace {
+
+/// a comes before b in sequence space (RFC 1982 serial number arithmetic)
+inline bool before(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+} // namespace
+
+// ============================================================================
+// SegmentPool
+// ============================================================================
+
+SegmentPool::SegmentPool(uint64_t memory_bytes)
+    : capacity_(static_cast<size_t>(memory_bytes / sizeof(TcpSegmentBuffer))) {
+}
+
+TcpSegmentBuffer* SegmentPool::acquire() {
+    if (!free_) {
+        if (allocated_ >= capacity_) return nullptr;
+        size_t n = std::min(BLOCK_BUFFERS, capacity_ - allocated_);
+        blocks_.emplace_back(new TcpSegmentBuffer[n]);
+        TcpSegmentBuffer* block = blocks_.back().get();
+        for (size_t i = 0; i < n; ++i) {
+            block[i].next = free_;
+            free_ = &block[i];
+        }
+        allocated_ += n;
+    }
+    TcpSegmentBuffer* buffer = free_;
+    free_ = buffer->next;
+    ++in_use_;
+    return buffer;
+}
+
+void SegmentPool::release(TcpSegmentBuffer* buffer) {
+    buffer->next = free_;
+    free_ = buffer;
+    --in_use_;
+}
+
+// ============================================================================
+// Connections
+// ============================================================================
+
+TcpReassembler::TcpReassembler(const ReassemblyOptions& options)
+    : options_(options), pool_(options.memory_bytes) {
+}
+
+TcpReassembler::~TcpReassembler() {
+    closeAll();
+}
+
+TcpReassembler::Key TcpReassembler::keyOf(const TcpSegment& seg) {
+    bool src_low = seg.src_ip < seg.dst_ip || (seg.src_ip == seg.dst_ip && seg.src_port < seg.dst_port);
+    if (src_low) return {seg.src_ip, seg.dst_ip, seg.src_port, seg.dst_port};
+    return {seg.dst_ip, seg.src_ip, seg.dst_port, seg.src_port};
+}
+
+void TcpReassembler::segment(const TcpSegment& seg) {
+    if (seg.ts_ns >= last_sweep_ns_ + SWEEP_INTERVAL_NS) {
+        sweep(seg.ts_ns);
+    }
+
+    Key key = keyOf(seg);
+    auto it = connections_.find(key);
+    if (it == connections_.end()) {
+        if (seg.flags & TH_RST) return;
+        if (!open(key, seg)) return;
+        it = connections_.find(key);
+    }
+
+    TcpConnection& conn = it->second;
+    ++stats_.segments;
+    conn.last_ts_ns = seg.ts_ns;
+
+    if (seg.flags & TH_RST) {
+        close(it);
+        return;
+    }
+
+    int dir = (seg.src_ip == conn.client_ip && seg.src_port == conn.client_port) ? 0 : 1;
+    TcpHalfStream& half = conn.half[dir];
+
+    // Data starts after the SYN, which takes one sequence number. Without a
+    // SYN (capture started mid-connection) the first segment seen is the start.
+    uint32_t seq = seg.seq;
+    if (seg.flags & TH_SYN) ++seq;
+    if (!half.started) {
+        half.started = true;
+        half.next_seq = seq;
+    }
+
+    if (seg.length > 0 && !conn.done) {
+        addData(conn, dir, seq, seg.payload, seg.length);
+    }
+
+    if ((seg.flags & TH_FIN) && !half.fin_seen) {
+        half.fin_seen = true;
+        half.fin_seq = seq + seg.length;
+    }
+    if (half.fin_seen && (conn.done || half.next_seq == half.fin_seq)) {
+        half.closed = true;
+    }
+    if (conn.half[0].closed && conn.half[1].closed) {
+        close(it);
+    }
+}
+
+TcpConnection* TcpReassembler::open(const Key& key, const TcpSegment& seg) {
+    if (connections_.size() >= options_.max_connections) {
+        ++stats_.connections_refused;
+        return nullptr;
+    }
+
+    // The SYN+ACK comes from the server; any other first segment is taken
+    // to be the client's
+    bool from_server = (seg.flags & TH_SYN) && (seg.flags & TH_ACK);
+    TcpConnection conn;
+    conn.client_ip = from_server ? seg.dst_ip : seg.src_ip;
+    conn.server_ip = from_server ? seg.src_ip : seg.dst_ip;
+    conn.client_port = from_server ? seg.dst_port : seg.src_port;
+    conn.server_port = from_server ? seg.src_port : seg.dst_port;
+    conn.first_ts_ns = seg.ts_ns;
+
+    for (TcpStreamHandler* handler : handlers_) {
+        if (handler->accept(conn)) {
+            conn.handler = handler;
+            break;
+        }
+    }
+    if (!conn.handler) return nullptr;
+
+    ++stats_.connections;
+    return &connections_.emplace(key, std::move(conn)).first->second;
+}
+
+void TcpReassembler::close(Table::iterator it) {
+    TcpConnection& conn = it->second;
+
+    // Whatever waited behind a hole is all there will be
+    for (int dir = 0; dir < 2; ++dir) {
+        while (conn.half[dir].pending && !conn.done) {
+            skipHole(conn, dir);
+        }
+        release(conn.half[dir]);
+    }
+    conn.handler->onClose(conn);
+    connections_.erase(it);
+}
+
+void TcpReassembler::closeAll() {
+    while (!connections_.empty()) {
+        close(connections_.begin());
+    }
+}
+
+void TcpReassembler::sweep(uint64_t now_ns) {
+    last_sweep_ns_ = now_ns;
+    uint64_t idle_ns = static_cast<uint64_t>(options_.idle_timeout_sec) * 1000000000ull;
+    for (auto it = connections_.begin(); it != connections_.end();) {
+        auto next = std::next(it);
+        if (it->second.last_ts_ns + idle_ns < now_ns) {
+            ++stats_.timeouts;
+            close(it);
+        }
+        it = next;
+    }
+}
+
+// ============================================================================
+// Ordering
+// ============================================================================
+
+void TcpReassembler::addData(TcpConnection& conn, int dir, uint32_t seq, const uint8_t* data, uint32_t length) {
+    TcpHalfStream& half = conn.half[dir];
+
+    for (;;) {
+        // Bytes before next_seq were delivered already: retransmitted
+        if (before(seq, half.next_seq)) {
+            uint32_t old = half.next_seq - seq;
+            if (old >= length) {
+                stats_.retransmitted_bytes += length;
+                return;
+            }
+            stats_.retransmitted_bytes += old;
+            seq += old;
+            data += old;
+            length -= old;
+        }
+
+        if (seq == half.next_seq) {
+            // In order: straight from the capture buffer. Under FIRST,
+            // buffered data wins where it overlaps, so stop where it starts.
+            uint32_t now = length;
+            if (half.pending && options_.overlap == ReassemblyOptions::Overlap::FIRST) {
+                now = std::min(length, half.pending->seq - seq);
+            }
+            deliver(conn, dir, data, now, conn.last_ts_ns);
+            half.next_seq += now;
+            drain(conn, dir);
+            if (now == length || conn.done) return;
+            seq += now;
+            data += now;
+            length -= now;
+            continue;       // The rest is trimmed against what drain() delivered
+        }
+
+        // Ahead of a hole: buffer it, unless this direction is out of room
+        bool room = !half.pending || half.pending_bytes + length <= options_.flow_bytes;
+        if (room && insert(half, seq, data, length)) {
+            ++stats_.out_of_order;
+            return;
+        }
+        if (!half.pending) {
+            ++stats_.memory_drop;
+            return;
+        }
+        // Stop waiting for the oldest hole, then try again
+        skipHole(conn, dir);
+        if (conn.done) return;
+    }
+}
+
+bool TcpReassembler::insert(TcpHalfStream& half, uint32_t seq, const uint8_t* data, uint32_t length) {
+    uint32_t end = seq + length;
+    bool overlapped = false;
+    if (options_.overlap == ReassemblyOptions::Overlap::LAST) {
+        overlapped = trimOverlap(half, seq, end);
+    }
+
+    // Fill the gaps between buffered segments that fall in [seq, end)
+    TcpSegmentBuffer** link = &half.pending;
+    uint32_t cur = seq;
+    while (before(cur, end)) {
+        TcpSegmentBuffer* next = *link;
+        if (next && !before(cur, next->seq)) {
+            uint32_t next_end = next->seq + next->length;
+            if (before(cur, next_end)) {
+                overlapped = true;
+                cur = before(end, next_end) ? end : next_end;
+            }
+            link = &next->next;
+            continue;
+        }
+
+        uint32_t gap_end = (next && before(next->seq, end)) ? next->seq : end;
+        uint32_t n = std::min<uint32_t>(gap_end - cur, SEGMENT_SIZE);
+        TcpSegmentBuffer* buffer = pool_.acquire();
+        if (!buffer) {
+            if (overlapped) ++stats_.overlaps;
+            return false;
+        }
+        buffer->seq = cur;
+        buffer->begin = 0;
+        buffer->length = static_cast<uint16_t>(n);
+        memcpy(buffer->data, data + (cur - seq), n);
+        buffer->next = next;
+        *link = buffer;
+        link = &buffer->next;
+        half.pending_bytes += n;
+        cur += n;
+    }
+
+    if (overlapped) ++stats_.overlaps;
+    return true;
+}
+
+bool TcpReassembler::trimOverlap(TcpHalfStream& half, uint32_t seq, uint32_t end) {
+    bool overlapped = false;
+    TcpSegmentBuffer** link = &half.pending;
+    while (*link && before((*link)->seq, end)) {
+        TcpSegmentBuffer* buffer = *link;
+        uint32_t buffer_end = buffer->seq + buffer->length;
+        if (!before(seq, buffer_end)) {
+            link = &buffer->next;
+            continue;
+        }
+        overlapped = true;
+
+        if (!before(buffer->seq, seq) && !before(end, buffer_end)) {
+            // Entirely replaced
+            *link = buffer->next;
+            half.pending_bytes -= buffer->length;
+            pool_.release(buffer);
+            continue;
+        }
+
+        if (before(buffer->seq, seq) && before(end, buffer_end)) {
+            // The new data falls inside: keep both ends (the tail is lost
+            // if the pool is exhausted)
+            uint32_t head = seq - buffer->seq;
+            uint32_t tail = buffer_end - end;
+            TcpSegmentBuffer* rest = pool_.acquire();
+            if (rest) {
+                rest->seq = end;
+                rest->begin = 0;
+                rest->length = static_cast<uint16_t>(tail);
+                memcpy(rest->data, buffer->data + buffer->begin + (end - buffer->seq), tail);
+                rest->next = buffer->next;
+                buffer->next = rest;
+                half.pending_bytes -= buffer->length - head - tail;
+            } else {
+                half.pending_bytes -= buffer->length - head;
+            }
+            buffer->length = static_cast<uint16_t>(head);
+            break;
+        }
+
+        if (before(buffer->seq, seq)) {
+            // Overlaps the start of the new data: keep its head
+            half.pending_bytes -= buffer_end - seq;
+            buffer->length = static_cast<uint16_t>(seq - buffer->seq);
+            link = &buffer->next;
+            continue;
+        }
+
+        // Overlaps the end of the new data: keep its tail
+        uint32_t cut = end - buffer->seq;
+        buffer->begin = static_cast<uint16_t>(buffer->begin + cut);
+        buffer->length = static_cast<uint16_t>(buffer->length - cut);
+        buffer->seq = end;
+        half.pending_bytes -= cut;
+        break;
+    }
+    return overlapped;
+}
+
+void TcpReassembler::drain(TcpConnection& conn, int dir) {
+    TcpHalfStream& half = conn.half[dir];
+    while (half.pending && !before(half.next_seq, half.pending->seq)) {
+        TcpSegmentBuffer* buffer = half.pending;
+        half.pending = buffer->next;
+        half.pending_bytes -= buffer->length;
+
+        uint32_t buffer_end = buffer->seq + buffer->length;
+        if (before(half.next_seq, buffer_end)) {
+            uint32_t skip = half.next_seq - buffer->seq;
+            half.next_seq = buffer_end;
+            deliver(conn, dir, buffer->data + buffer->begin + skip, buffer->length - skip, conn.last_ts_ns);
+        }
+        pool_.release(buffer);
+    }
+}
+
+void TcpReassembler::skipHole(TcpConnection& conn, int dir) {
+    TcpHalfStream& half = conn.half[dir];
+    uint32_t missing = half.pending->seq - half.next_seq;
+    ++stats_.gaps;
+    stats_.gap_bytes += missing;
+    half.next_seq = half.pending->seq;
+    conn.handler->onGap(conn, dir, missing);
+    if (!conn.done) {
+        drain(conn, dir);
+    } else {
+        release(half);
+    }
+}
+
+void TcpReassembler::deliver(TcpConnection& conn, int dir, const uint8_t* data, uint32_t length, uint64_t ts_ns) {
+    if (conn.done || length == 0) return;
+    stats_.delivered_bytes += length;
+    conn.handler->onData(conn, dir, data, length, ts_ns);
+    if (conn.done) {
+        // The handler has what it wanted; stop buffering for it
+        release(conn.half[0]);
+        release(conn.half[1]);
+    }
+}
+
+void TcpReassembler::release(TcpHalfStream& half) {
+    while (half.pending) {
+        TcpSegmentBuffer* buffer = half.pending;
+        half.pending = buffer->next;
+        pool_.release(buffer);
+    }
+    half.pending_bytes = 0;
+}
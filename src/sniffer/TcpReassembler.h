@@ -0,0 +1,264 @@
+/**
+ * @file TcpReassembler.h
+ * @brief Ordered TCP byte streams for application-layer dissectors
+ *
+ * PacketParser looks at one segment at a time. Dissectors for protocols on
+ * top of TCP (TLS, HTTP) need the bytes of each direction in order, once,
+ * across segment boundaries. TcpReassembler turns the segments the parser
+ * hands it into that, per connection, and passes the result to the
+ * TcpStreamHandler that claimed the connection.
+ *
+ * ## Connections
+ *
+ * A connection is created by its first segment, if a handler accept()s it;
+ * connections no handler wants cost one hash lookup per segment and nothing
+ * else. The sender of the SYN (or, when the capture starts mid-connection,
+ * of the first segment seen) is the client, direction 0. A connection ends
+ * when both FINs have been delivered, on RST, or after idle_timeout_sec
+ * without segments; any data still waiting behind a hole is delivered then,
+ * after a gap.
+ *
+ * ## Segments
+ *
+ * - In-order data is handed to the handler straight from the capture
+ *   buffer, without a copy. This is by far the common case.
+ * - Data ahead of a hole is copied into pooled SEGMENT_SIZE buffers, kept
+ *   sorted by sequence number, and delivered once the hole is filled.
+ * - Data already delivered (retransmissions) is trimmed and counted.
+ * - Where out-of-order data overlaps data already buffered, the overlap
+ *   policy decides which copy is kept (operating systems disagree, so an
+ *   evasion-aware setup can pick the receiver's behaviour).
+ *
+ * ## Memory
+ *
+ * All buffered data lives in one SegmentPool, which allocates blocks of
+ * buffers on demand up to memory_bytes and recycles them through a free
+ * list: no allocation per segment. When one direction holds flow_bytes, or
+ * the pool is exhausted, that direction stops waiting: the hole is reported
+ * to the handler as a gap and the data behind it is delivered. The number
+ * of connections is capped at max_connections; further ones are refused
+ * and counted, like the flow summary table does.
+ *
+ * Not thread-safe: used only by the capture loop.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @struct ReassemblyOptions
+ * @brief Limits and policy of the TCP reassembler
+ */
+struct ReassemblyOptions {
+    /// Which copy of overlapping out-of-order data is kept
+    enum class Overlap { FIRST, LAST };
+
+    uint64_t memory_bytes = 64ull << 20;    ///< Out-of-order data, all connections together
+    uint32_t flow_bytes = 1 << 20;          ///< Out-of-order data per direction of a connection
+    size_t max_connections = 1 << 16;       ///< Tracked connections
+    uint32_t idle_timeout_sec = 120;        ///< Connections without segments for this long are closed
+    Overlap overlap = Overlap::FIRST;
+};
+
+/**
+ * @struct TcpSegment
+ * @brief One TCP segment as the parser found it
+ */
+struct TcpSegment {
+    uint32_t src_ip = 0;            ///< Network byte order
+    uint32_t dst_ip = 0;
+    uint16_t src_port = 0;          ///< Host byte order
+    uint16_t dst_port = 0;
+    uint32_t seq = 0;               ///< Host byte order
+    uint8_t flags = 0;              ///< TH_SYN, TH_FIN, TH_RST, ...
+    const uint8_t* payload = nullptr;
+    uint32_t length = 0;            ///< Payload bytes (IP length minus headers)
+    uint64_t ts_ns = 0;
+};
+
+/**
+ * @struct TcpSegmentBuffer
+ * @brief Pooled copy of (part of) an out-of-order segment
+ */
+struct TcpSegmentBuffer {
+    TcpSegmentBuffer* next;         ///< Next buffered segment, or next free buffer
+    uint32_t seq;                   ///< Sequence number of data[begin]
+    uint16_t begin;
+    uint16_t length;
+    uint8_t data[2048 - 16];
+};
+
+/**
+ * @struct TcpHalfStream
+ * @brief One direction of a connection
+ */
+struct TcpHalfStream {
+    bool started = false;           ///< next_seq is known
+    bool fin_seen = false;
+    bool closed = false;            ///< Everything up to the FIN was delivered
+    uint32_t next_seq = 0;          ///< Next byte to deliver
+    uint32_t fin_seq = 0;           ///< Sequence number of the FIN
+    TcpSegmentBuffer* pending = nullptr;  ///< Data ahead of next_seq, sorted, no overlaps
+    uint32_t pending_bytes = 0;
+};
+
+class TcpStreamHandler;
+
+/**
+ * @struct TcpConnection
+ * @brief A connection being reassembled, as its handler sees it
+ */
+struct TcpConnection {
+    /// Per-connection state of the handler; it may put anything here
+    struct State {
+        virtual ~State() = default;
+    };
+
+    uint32_t client_ip = 0;         ///< Network byte order
+    uint32_t server_ip = 0;
+    uint16_t client_port = 0;
+    uint16_t server_port = 0;
+    TcpHalfStream half[2];          ///< [0] client to server, [1] server to client
+    uint64_t first_ts_ns = 0;
+    uint64_t last_ts_ns = 0;
+    TcpStreamHandler* handler = nullptr;
+    std::unique_ptr<State> state;
+    bool done = false;              ///< Set by the handler: deliver nothing more
+};
+
+/**
+ * @class TcpStreamHandler
+ * @brief Consumer of reassembled streams (a dissector)
+ */
+class TcpStreamHandler {
+public:
+    virtual ~TcpStreamHandler() = default;
+
+    /// Claim a new connection; called once, on its first segment
+    virtual bool accept(const TcpConnection& conn) = 0;
+
+    /// Next in-order bytes of direction dir (0 = client to server)
+    virtual void onData(TcpConnection& conn, int dir, const uint8_t* data, size_t length,
+                        uint64_t ts_ns) = 0;
+
+    /// length bytes of direction dir were never seen and are skipped
+    virtual void onGap(TcpConnection& /*conn*/, int /*dir*/, uint32_t /*length*/) {}
+
+    /// The connection ended (FINs, RST, timeout or shutdown)
+    virtual void onClose(TcpConnection& /*conn*/) {}
+};
+
+/**
+ * @class SegmentPool
+ * @brief Free list of TcpSegmentBuffers, grown in blocks up to a limit
+ */
+class SegmentPool {
+public:
+    static constexpr size_t BLOCK_BUFFERS = 256;  ///< Buffers per allocation (512 KB)
+
+    explicit SegmentPool(uint64_t memory_bytes);
+
+    /// A free buffer, or nullptr if memory_bytes are in use
+    TcpSegmentBuffer* acquire();
+    void release(TcpSegmentBuffer* buffer);
+
+    size_t inUse() const { return in_use_; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    std::vector<std::unique_ptr<TcpSegmentBuffer[]> > blocks_;
+    TcpSegmentBuffer* free_ = nullptr;
+    size_t allocated_ = 0;
+    size_t in_use_ = 0;
+    size_t capacity_;
+};
+
+/**
+ * @class TcpReassembler
+ * @brief Connection table and in-order delivery, see the file comment
+ */
+class TcpReassembler {
+public:
+    /// Payload bytes per pooled buffer
+    static constexpr size_t SEGMENT_SIZE = sizeof(TcpSegmentBuffer::data);
+
+    /// Packet-time interval between idle connection sweeps
+    static constexpr uint64_t SWEEP_INTERVAL_NS = 1000000000ull;
+
+    struct Stats {
+        uint64_t segments = 0;              ///< Segments of tracked connections
+        uint64_t connections = 0;           ///< Connections claimed by a handler
+        uint64_t connections_refused = 0;   ///< New-connection segments not tracked: table full
+        uint64_t out_of_order = 0;          ///< Segments that arrived ahead of a hole
+        uint64_t retransmitted_bytes = 0;   ///< Bytes already delivered, trimmed
+        uint64_t overlaps = 0;              ///< Out-of-order segments overlapping buffered data
+        uint64_t gaps = 0;                  ///< Holes given up on
+        uint64_t gap_bytes = 0;
+        uint64_t memory_drop = 0;           ///< Segments dropped with the pool exhausted
+        uint64_t delivered_bytes = 0;
+        uint64_t timeouts = 0;              ///< Connections closed as idle
+    };
+
+    explicit TcpReassembler(const ReassemblyOptions& options);
+
+    /// Closes every connection (handlers get their onClose())
+    ~TcpReassembler();
+
+    TcpReassembler(const TcpReassembler&) = delete;
+    TcpReassembler& operator=(const TcpReassembler&) = delete;
+
+    /// Offer new connections to handler (after the handlers added before it)
+    void addHandler(TcpStreamHandler* handler) { handlers_.push_back(handler); }
+    bool hasHandlers() const { return !handlers_.empty(); }
+
+    /// Feed one segment, in capture order
+    void segment(const TcpSegment& seg);
+
+    /// Deliver what is buffered and close every connection
+    void closeAll();
+
+    const Stats& stats() const { return stats_; }
+    size_t connections() const { return connections_.size(); }
+    uint64_t bufferedBytes() const { return pool_.inUse() * SEGMENT_SIZE; }
+
+private:
+    /// Both endpoints, lower (address, port) first, so both directions find it
+    struct Key {
+        uint32_t ip_lo, ip_hi;
+        uint16_t port_lo, port_hi;
+        bool operator==(const Key& o) const {
+            return ip_lo == o.ip_lo && ip_hi == o.ip_hi && port_lo == o.port_lo && port_hi == o.port_hi;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = (static_cast<uint64_t>(k.ip_lo) << 32 | k.ip_hi) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(h ^ (static_cast<uint64_t>(k.port_lo) << 16 | k.port_hi));
+        }
+    };
+    using Table = std::unordered_map<Key, TcpConnection, KeyHash>;
+
+    static Key keyOf(const TcpSegment& seg);
+
+    TcpConnection* open(const Key& key, const TcpSegment& seg);
+    void addData(TcpConnection& conn, int dir, uint32_t seq, const uint8_t* data, uint32_t length);
+    bool insert(TcpHalfStream& half, uint32_t seq, const uint8_t* data, uint32_t length);
+    bool trimOverlap(TcpHalfStream& half, uint32_t seq, uint32_t end);
+    void drain(TcpConnection& conn, int dir);
+    void skipHole(TcpConnection& conn, int dir);
+    void deliver(TcpConnection& conn, int dir, const uint8_t* data, uint32_t length, uint64_t ts_ns);
+    void release(TcpHalfStream& half);
+    void close(Table::iterator it);
+    void sweep(uint64_t now_ns);
+
+    ReassemblyOptions options_;
+    std::vector<TcpStreamHandler*> handlers_;
+    SegmentPool pool_;
+    Table connections_;
+    uint64_t last_sweep_ns_ = 0;
+    Stats stats_;
+};
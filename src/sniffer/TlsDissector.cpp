@@ -0,0 +1,325 @@
+/**
+ * @file TlsDissector.cpp
+ * @brief Implementation of the ClientHello reader
+ */
+
+#include "TlsDissector.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint8_t CONTENT_HANDSHAKE = 0x16;
+constexpr uint8_t HANDSHAKE_CLIENT_HELLO = 1;
+constexpr size_t RECORD_HEADER = 5;
+
+/// Extensions of interest (RFC 6066, RFC 7301, RFC 8446)
+constexpr uint16_t EXT_SERVER_NAME = 0;
+constexpr uint16_t EXT_ALPN = 16;
+constexpr uint16_t EXT_SUPPORTED_VERSIONS = 43;
+
+constexpr uint8_t NAME_TYPE_HOST = 0;
+
+inline uint16_t get16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+/**
+ * @brief Whether the first bytes of a stream can start a ClientHello record
+ *
+ * Checks the content type, the major version and the handshake type, as
+ * far as length reaches (at least one byte).
+ */
+inline bool startsLikeHello(const uint8_t* p, size_t length) {
+    return p[0] == CONTENT_HANDSHAKE && (length < 2 || p[1] == 3) &&
+           (length < 6 || p[5] == HANDSHAKE_CLIENT_HELLO);
+}
+
+/// Bytes of the record starting at p (header included), 0 if its header is incomplete
+inline size_t recordLength(const uint8_t* p, size_t length) {
+    return length < RECORD_HEADER ? 0 : RECORD_HEADER + get16(p + 3);
+}
+
+/// Bounded reader over a length-prefixed structure; every read checks the end
+struct Reader {
+    const uint8_t* at;
+    const uint8_t* end;
+
+    bool empty() const { return at == end; }
+    size_t left() const { return static_cast<size_t>(end - at); }
+
+    bool skip(size_t n) {
+        if (left() < n) return false;
+        at += n;
+        return true;
+    }
+    bool u8(uint8_t& v) {
+        if (left() < 1) return false;
+        v = *at++;
+        return true;
+    }
+    bool u16(uint16_t& v) {
+        if (left() < 2) return false;
+        v = get16(at);
+        at += 2;
+        return true;
+    }
+    bool u24(uint32_t& v) {
+        if (left() < 3) return false;
+        v = static_cast<uint32_t>(at[0]) << 16 | get16(at + 1);
+        at += 3;
+        return true;
+    }
+    /// The next n bytes as a reader of their own
+    bool sub(size_t n, Reader& out) {
+        if (left() < n) return false;
+        out = Reader{at, at + n};
+        at += n;
+        return true;
+    }
+};
+
+/// Append n bytes of text to out, which the caller made room for, and terminate it
+inline void appendText(char* out, uint8_t& length, const uint8_t* text, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t c = text[i];
+        out[length++] = c > ' ' && c < 0x7F ? static_cast<char>(c) : '?';
+    }
+    out[length] = '\0';
+}
+
+bool readServerName(Reader ext, TlsHello& hello) {
+    uint16_t list_length;
+    Reader list;
+    if (!ext.u16(list_length) || !ext.sub(list_length, list)) return false;
+    while (!list.empty()) {
+        uint8_t type;
+        uint16_t length;
+        Reader name;
+        if (!list.u8(type) || !list.u16(length) || !list.sub(length, name)) return false;
+        // One host_name at most (RFC 6066 section 3); other name types are unused
+        if (type == NAME_TYPE_HOST && hello.sni_length == 0) {
+            appendText(hello.sni, hello.sni_length, name.at,
+                       std::min<size_t>(length, TlsHello::MAX_SNI));
+        }
+    }
+    return true;
+}
+
+bool readAlpn(Reader ext, TlsHello& hello) {
+    uint16_t list_length;
+    Reader list;
+    if (!ext.u16(list_length) || !ext.sub(list_length, list)) return false;
+    while (!list.empty()) {
+        uint8_t length;
+        Reader protocol;
+        if (!list.u8(length) || length == 0 || !list.sub(length, protocol)) return false;
+        size_t separator = hello.alpn_length > 0 ? 1 : 0;
+        if (hello.alpn_length + separator + length > TlsHello::MAX_ALPN) continue;
+        if (separator) {
+            hello.alpn[hello.alpn_length++] = ',';
+        }
+        appendText(hello.alpn, hello.alpn_length, protocol.at, length);
+    }
+    return true;
+}
+
+bool readSupportedVersions(Reader ext, TlsHello& hello) {
+    uint8_t list_length;
+    Reader list;
+    if (!ext.u8(list_length) || list_length % 2 != 0 || !ext.sub(list_length, list)) return false;
+    uint16_t best = 0;
+    uint16_t version;
+    while (list.u16(version)) {
+        // GREASE values (RFC 8701) look like 0x?A?A and mean nothing
+        if ((version & 0x0F0F) == 0x0A0A) continue;
+        best = std::max(best, version);
+    }
+    if (best != 0) hello.version = best;
+    return true;
+}
+
+} // namespace
+
+TlsDissector::TlsDissector(const TlsOptions& options)
+    : max_buffers_(options.memory_bytes / sizeof(HelloBuffer)) {
+    for (uint16_t port : options.ports) {
+        ports_.set(port);
+    }
+}
+
+bool TlsDissector::accept(const TcpConnection& conn) {
+    return ports_.test(conn.server_port);
+}
+
+void TlsDissector::onData(TcpConnection& conn, int dir, const uint8_t* data, size_t length, uint64_t ts_ns) {
+    if (dir != 0) return;   // The server's side says nothing we want
+
+    auto* partial = static_cast<Partial*>(conn.state.get());
+    if (!partial) {
+        // First client bytes: anything but a ClientHello is let go at once
+        if (!startsLikeHello(data, length)) {
+            ++stats_.rejected;
+            conn.done = true;
+            return;
+        }
+        size_t record = recordLength(data, length);
+        if (record != 0 && length >= record) {
+            finish(conn, data, record, ts_ns);    // Whole in this segment: parse in place
+            return;
+        }
+        HelloBuffer* buffer = acquire();
+        if (!buffer) {
+            ++stats_.memory_drop;
+            conn.done = true;
+            return;
+        }
+        partial = new Partial(this, buffer);
+        conn.state.reset(partial);
+    }
+
+    HelloBuffer* buffer = partial->buffer;
+    size_t n = std::min(length, HELLO_BUFFER - buffer->length);
+    memcpy(buffer->data + buffer->length, data, n);
+    buffer->length += static_cast<uint32_t>(n);
+
+    // The bytes checked on the first segment may only have arrived now
+    if (!startsLikeHello(buffer->data, buffer->length)) {
+        ++stats_.rejected;
+        conn.done = true;
+        conn.state.reset();
+        return;
+    }
+    size_t record = recordLength(buffer->data, buffer->length);
+    if (record > HELLO_BUFFER) {
+        ++stats_.malformed;     // Longer than any TLS record may be
+        conn.done = true;
+        conn.state.reset();
+        return;
+    }
+    if (record != 0 && buffer->length >= record) {
+        finish(conn, buffer->data, record, ts_ns);
+    }
+}
+
+void TlsDissector::onGap(TcpConnection& conn, int dir, uint32_t /*length*/) {
+    if (dir != 0 || conn.done) return;
+
+    // Whatever follows the hole is not the start of the client's stream
+    ++stats_.incomplete;
+    conn.done = true;
+    conn.state.reset();
+}
+
+void TlsDissector::onClose(TcpConnection& conn) {
+    if (conn.state) {
+        ++stats_.incomplete;
+    }
+}
+
+void TlsDissector::finish(TcpConnection& conn, const uint8_t* record, size_t length, uint64_t ts_ns) {
+    conn.done = true;   // Nothing after the hello is of interest
+
+    if (parseClientHello(record, length, hello_)) {
+        ++stats_.hellos;
+        if (conn.state) ++stats_.split;
+        hello_.client_ip = conn.client_ip;
+        hello_.server_ip = conn.server_ip;
+        hello_.client_port = conn.client_port;
+        hello_.server_port = conn.server_port;
+        hello_.ts_ns = ts_ns;
+        has_hello_ = true;
+    } else {
+        ++stats_.malformed;
+    }
+
+    // Only now: record may point into the buffer
+    conn.state.reset();
+}
+
+bool TlsDissector::parseClientHello(const uint8_t* record, size_t length, TlsHello& hello) {
+    Reader in{record, record + length};
+    uint8_t content_type, handshake_type, n8;
+    uint16_t record_version, record_length, n16;
+    uint32_t handshake_length;
+    Reader fragment, body;
+
+    // Record header, then one handshake message that must fit in the record
+    if (!in.u8(content_type) || content_type != CONTENT_HANDSHAKE || !in.u16(record_version) ||
+        !in.u16(record_length) || !in.sub(record_length, fragment)) {
+        return false;
+    }
+    if (!fragment.u8(handshake_type) || handshake_type != HANDSHAKE_CLIENT_HELLO ||
+        !fragment.u24(handshake_length) || !fragment.sub(handshake_length, body)) {
+        return false;
+    }
+
+    // legacy_version, random, session_id, cipher_suites, compression_methods
+    uint16_t legacy_version;
+    if (!body.u16(legacy_version) || !body.skip(32) ||
+        !body.u8(n8) || n8 > 32 || !body.skip(n8) ||
+        !body.u16(n16) || n16 % 2 != 0 || !body.skip(n16) ||
+        !body.u8(n8) || !body.skip(n8)) {
+        return false;
+    }
+    hello.version = legacy_version;
+    hello.sni_length = 0;
+    hello.sni[0] = '\0';
+    hello.alpn_length = 0;
+    hello.alpn[0] = '\0';
+
+    if (body.empty()) return true;      // No extensions at all (SSL 3.0 era clients)
+
+    Reader extensions;
+    if (!body.u16(n16) || !body.sub(n16, extensions)) return false;
+    while (!extensions.empty()) {
+        uint16_t type;
+        Reader ext;
+        if (!extensions.u16(type) || !extensions.u16(n16) || !extensions.sub(n16, ext)) return false;
+        switch (type) {
+            case EXT_SERVER_NAME:
+                if (!readServerName(ext, hello)) return false;
+                break;
+            case EXT_ALPN:
+                if (!readAlpn(ext, hello)) return false;
+                break;
+            case EXT_SUPPORTED_VERSIONS:
+                if (!readSupportedVersions(ext, hello)) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+const char* TlsDissector::versionName(uint16_t version) {
+    switch (version) {
+        case 0x0300: return "SSL3";
+        case 0x0301: return "1.0";
+        case 0x0302: return "1.1";
+        case 0x0303: return "1.2";
+        case 0x0304: return "1.3";
+        default: return "?";
+    }
+}
+
+TlsDissector::HelloBuffer* TlsDissector::acquire() {
+    HelloBuffer* buffer = free_;
+    if (buffer) {
+        free_ = buffer->next;
+    } else if (buffers_.size() < max_buffers_) {
+        buffers_.emplace_back(new HelloBuffer);
+        buffer = buffers_.back().get();
+    } else {
+        return nullptr;
+    }
+    buffer->length = 0;
+    return buffer;
+}
+
+void TlsDissector::release(HelloBuffer* buffer) {
+    buffer->next = free_;
+    free_ = buffer;
+}
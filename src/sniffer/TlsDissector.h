@@ -0,0 +1,160 @@
+/**
+ * @file TlsDissector.h
+ * @brief Server name (SNI) and ALPN from TLS ClientHellos
+ *
+ * The ClientHello is the last plaintext a TLS connection sends that names
+ * what it is for: the server name and the application protocols the client
+ * offers. TlsDissector claims connections to the configured server ports
+ * from the TcpReassembler, reads the first flight of the client, and stops
+ * (TcpConnection::done) as soon as the hello is parsed or clearly absent.
+ * PacketParser then attaches the result to the record of the packet that
+ * completed the hello.
+ *
+ * ## Fast path
+ *
+ * Most connections cost a few byte comparisons: the first client bytes
+ * must be a handshake record (0x16, version 3.x) holding a ClientHello
+ * (type 1), or the connection is rejected on the spot. A hello that fits
+ * in its first segment - almost all of them - is parsed in place, straight
+ * from the capture buffer. Parsing is a bounded scan of length-prefixed
+ * fields into fixed buffers: nothing is allocated and no field can make it
+ * read past the record.
+ *
+ * ## Split hellos
+ *
+ * A hello spread over several segments (large key shares do that) is
+ * collected into one of a pool of HELLO_BUFFER-sized buffers, grown up to
+ * memory_bytes; when none is free the hello is dropped and counted. A gap
+ * in the client's stream before the hello is complete abandons it.
+ *
+ * Only the first record is read: a ClientHello split over several TLS
+ * records (legal, never seen from common clients) is counted as
+ * malformed.
+ *
+ * Not thread-safe: used only by the capture loop.
+ */
+
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "TcpReassembler.h"
+
+/**
+ * @struct TlsOptions
+ * @brief Which connections are inspected and the memory for split hellos
+ */
+struct TlsOptions {
+    std::vector<uint16_t> ports = {443};    ///< Server ports; empty turns the dissector off
+    uint64_t memory_bytes = 4ull << 20;     ///< Hellos spanning segments, all connections together
+};
+
+/**
+ * @struct TlsHello
+ * @brief What a ClientHello says about its connection
+ */
+struct TlsHello {
+    /// Longest host name kept (DNS names are at most 253 characters)
+    static constexpr size_t MAX_SNI = 255;
+
+    /// Longest ALPN list kept, protocols separated by commas
+    static constexpr size_t MAX_ALPN = 127;
+
+    uint32_t client_ip = 0;         ///< Network byte order
+    uint32_t server_ip = 0;
+    uint16_t client_port = 0;       ///< Host byte order
+    uint16_t server_port = 0;
+    uint64_t ts_ns = 0;             ///< Capture time of the segment completing the hello
+    uint16_t version = 0;           ///< Highest version offered, e.g. 0x0304 for TLS 1.3
+    uint8_t sni_length = 0;         ///< 0: no server_name extension
+    uint8_t alpn_length = 0;        ///< 0: no ALPN extension
+    char sni[MAX_SNI + 1];          ///< Printable ASCII, others replaced by '?'
+    char alpn[MAX_ALPN + 1];        ///< e.g. "h2,http/1.1"; protocols that do not fit are left out
+};
+
+/**
+ * @class TlsDissector
+ * @brief ClientHello reader on top of TcpReassembler, see the file comment
+ */
+class TlsDissector : public TcpStreamHandler {
+public:
+    /// Largest TLS record: header and 2^14 bytes of plaintext
+    static constexpr size_t HELLO_BUFFER = 5 + 16384;
+
+    struct Stats {
+        uint64_t hellos = 0;            ///< ClientHellos parsed
+        uint64_t split = 0;             ///< ... of which spanned segments
+        uint64_t rejected = 0;          ///< Connections whose first client bytes are not a ClientHello
+        uint64_t malformed = 0;         ///< Hellos that do not parse
+        uint64_t incomplete = 0;        ///< Hellos abandoned at a gap or when the connection ended
+        uint64_t memory_drop = 0;       ///< Split hellos dropped: no buffer free
+    };
+
+    /// Connections holding a split hello must be closed before this is destroyed
+    explicit TlsDissector(const TlsOptions& options);
+
+    TlsDissector(const TlsDissector&) = delete;
+    TlsDissector& operator=(const TlsDissector&) = delete;
+
+    bool accept(const TcpConnection& conn) override;
+    void onData(TcpConnection& conn, int dir, const uint8_t* data, size_t length, uint64_t ts_ns) override;
+    void onGap(TcpConnection& conn, int dir, uint32_t length) override;
+    void onClose(TcpConnection& conn) override;
+
+    /// Whether connections to this server port are read
+    bool watchesPort(uint16_t port) const { return ports_.test(port); }
+
+    /// The hello completed since the last clearHello(), or nullptr
+    const TlsHello* hello() const { return has_hello_ ? &hello_ : nullptr; }
+
+    /// Forget the last hello; the parser calls this before each segment
+    void clearHello() { has_hello_ = false; }
+
+    /**
+     * @brief Parse one TLS record holding a ClientHello
+     *
+     * @param record From the record header on
+     * @param length Bytes of the record (header included)
+     * @param[out] hello version, sni and alpn; the rest is left alone
+     * @return false if it is not a well-formed ClientHello
+     */
+    static bool parseClientHello(const uint8_t* record, size_t length, TlsHello& hello);
+
+    /// "1.3", "1.2", ... for a version number ("?" if unknown)
+    static const char* versionName(uint16_t version);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    /// A hello being collected from several segments
+    struct HelloBuffer {
+        HelloBuffer* next;              ///< Next free buffer
+        uint32_t length;
+        uint8_t data[HELLO_BUFFER];
+    };
+
+    /// Connection state while a hello is split; returns its buffer on destruction
+    struct Partial : TcpConnection::State {
+        Partial(TlsDissector* owner, HelloBuffer* buffer) : owner(owner), buffer(buffer) {}
+        ~Partial() override { owner->release(buffer); }
+        TlsDissector* owner;
+        HelloBuffer* buffer;
+    };
+
+    HelloBuffer* acquire();
+    void release(HelloBuffer* buffer);
+
+    /// Parse a whole record and, if it is a ClientHello, make it hello()
+    void finish(TcpConnection& conn, const uint8_t* record, size_t length, uint64_t ts_ns);
+
+    std::bitset<65536> ports_;
+    std::vector<std::unique_ptr<HelloBuffer> > buffers_;
+    HelloBuffer* free_ = nullptr;
+    size_t max_buffers_;
+    TlsHello hello_;
+    bool has_hello_ = false;
+    Stats stats_;
+};